@@ -24,6 +24,7 @@
 
 #define TNFSD_PORT	16384	/* UDP port to listen on */
 #define MAXMSGSZ	532	/* maximum size of a TNFS message */
+#define TNFS_MAX_TCPMSG	65535	/* largest message a TCP client may negotiate at MOUNT */
 #define MAX_FD_PER_CONN	16	/* maximum open file descriptors per client */
 #define MAX_DHND_PER_CONN 8	/* max open directories per client */
 #define MAX_SESSIONS        4096   /* maximum number of opened sessions */
@@ -41,6 +42,39 @@
 #define TIMEOUT_MSB	0x03	/* Timeout MSB (1 sec) */
 #define MAX_FILENAME_LEN 256	/* longest filename supported */
 #define MAX_IOSZ	512	/* maximum size of an IO operation */
+#define DIRARENA_MINBLOCK 4096	/* first arena block of a directory listing */
+#define DIRARENA_MAXBLOCK 65536	/* arena blocks double in size up to this */
+#define DIRCACHE_MAX 64	/* directory listings kept after their handles close */
+#define DIRCACHE_MAXBYTES (16 * 1024 * 1024)	/* and the most memory they may use */
+#define DIRCACHE_TTL 2	/* seconds an unwatched listing may be reused for */
+#define DIRPAGES_MAX 4	/* views of a shared listing kept as encoded READDIRX pages */
+#define RESOLVE_CACHE 64	/* directories kept open to resolve client paths beneath */
+#define STATCACHE_MAX 4096	/* stat() results kept, including files that don't exist */
+#define STATCACHE_TTL 2	/* seconds a stat() result may be reused for */
+#define DEVCACHE_MAX 16	/* mount points whose size and free space are kept */
+#define DEVCACHE_TTL 2	/* seconds they're kept for */
+#define HASHCACHE_MAX 1024	/* files whose content checksum is kept */
+#define HASH_INLINE (256 * 1024)	/* bytes checksummed before HASH replies, larger files are a job */
+#define JOBS_MAX 16	/* copies and other background jobs running or not yet polled */
+#define JOB_KEEP 300	/* seconds a finished job's outcome waits to be polled */
+#define JOB_COPY_CHUNK (1024 * 1024)	/* bytes copied between progress reports */
+#define TREE_DEPTH_MAX 64	/* directories deep a tree is removed or copied */
+#define WATCH_MAX 256	/* WATCH requests held at once */
+#define WATCH_WAIT 30	/* seconds one is held unless the client says otherwise */
+#define WINDOW_MAX 16	/* requests a UDP client may have outstanding after WINDOW */
+#define OVERLAY_BLOCK 512	/* bytes a client overlay holds a written block of */
+#define ZIPCACHE_MAX 8	/* ZIP archives whose central directory is kept */
+#define ZSEEK_SPAN (128 * 1024)	/* output between checkpoints in a compressed file */
+#define ZSEEK_CHUNKS 4	/* stretches between checkpoints kept decompressed per open file */
+#define OFFLOAD_QUEUE 64	/* requests a session puts aside until its slow one is done */
+#define OFFLOAD_THREADS 4	/* threads slow requests run on */
+#define TASKPOOL_THREADS 8	/* worker threads, for stat()ing directories in parallel */
+#define DIRLOAD_CHUNK 32	/* directory entries stat()ed by a worker at a time */
+#define NOTIFY_WATCHES 8192	/* directories watched at once, least recently used dropped first */
+#define SEARCH_BUCKETS 65536	/* trigram hash buckets of the search index */
+#define SEARCH_REFRESH 300	/* rebuild the search index this often without inotify, 0 never */
+#define SEARCH_REBUILD_WAIT 10	/* seconds at least between starting builds of it */
+#define SEARCH_WATCH_STEP 1024	/* directories of a new one watched per pass of the main loop */
 #define STATS_INTERVAL 60   /* how often the server stats should be logged. 0 to disable stats logging. */
 
 #endif
@@ -26,6 +26,7 @@ TNFS daemon datagram handler
 
 #include <sys/types.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
@@ -52,24 +53,58 @@ TNFS daemon datagram handler
 #include "errortable.h"
 #include "directory.h"
 #include "tnfs_file.h"
+#include "device.h"
+#include "notify.h"
+#include "dirindex.h"
+#include "search.h"
+#include "job.h"
+#include "tree.h"
+#include "watch.h"
+#include "window.h"
+#include "offload.h"
+
+/* While a COMPOUND runs its parts, tnfs_send() leaves each one's reply
+   here instead of sending it */
+typedef struct _compound_part
+{
+	unsigned char *buf;		/* where the part's reply goes */
+	int room;				/* the most it may be */
+	int len;				/* its size, -1 if it didn't fit */
+	uint8_t status;
+} compound_part;
+
+#define COMPOUND_NOREPLY -2	/* part.len until the part replies */
+#define COMPOUND_FIXED_MAX 22	/* the longest reply of a fixed size, STAT's */
+#define COMPOUND_READDIRX_MIN 4	/* a READDIRX reply without any entries */
+
+static THREADLOCAL compound_part *compound = NULL;
 
 int sockfd;		 /* UDP global socket file descriptor */
 int tcplistenfd; /* TCP listening socket file descriptor */
 
+void _tcp_decode(TcpConnection *tcp_conn);
+void _tcp_close(TcpConnection *tcp_conn);
+
 tnfs_cmdfunc dircmd[NUM_DIRCMDS] =
 	{&tnfs_opendir, &tnfs_readdir, &tnfs_closedir,
 	 &tnfs_mkdir, &tnfs_rmdir, &tnfs_telldir, &tnfs_seekdir,
-	 &tnfs_opendirx, &tnfs_readdirx};
+	 &tnfs_opendirx, &tnfs_readdirx, &tnfs_search,
+	 &tnfs_rmtree, &tnfs_copytree, &tnfs_watch};
 
 tnfs_cmdfunc filecmd[NUM_FILECMDS] =
 	{&tnfs_open_deprecated, &tnfs_read, &tnfs_write, &tnfs_close,
 	 &tnfs_stat, &tnfs_lseek, &tnfs_unlink, &tnfs_chmod, &tnfs_rename,
-	 &tnfs_open};
+	 &tnfs_open, &tnfs_hash, &tnfs_copy, &tnfs_jobstatus};
+
+tnfs_cmdfunc devcmd[NUM_DEVCMDS] =
+	{&tnfs_size, &tnfs_free};
 
 const char *sesscmd_names[NUM_SESSCMDS] =
 	{
 		"TNFS_MOUNT",
-		"TNFS_UMOUNT"};
+		"TNFS_UMOUNT",
+		"TNFS_COMPOUND",
+		"TNFS_WINDOW"};
 
 const char *dircmd_names[NUM_DIRCMDS] =
 	{"TNFS_OPENDIR",
@@ -80,7 +115,11 @@ const char *dircmd_names[NUM_DIRCMDS] =
 	 "TNFS_TELLDIR",
 	 "TNFS_SEEKDIR",
 	 "TNFS_OPENDIRX",
-	 "TNFS_READDIRX"};
+	 "TNFS_READDIRX",
+	 "TNFS_SEARCH",
+	 "TNFS_RMTREE",
+	 "TNFS_COPYTREE",
+	 "TNFS_WATCH"};
 
 const char *filecmd_names[NUM_FILECMDS] =
 	{
@@ -93,7 +132,15 @@ const char *filecmd_names[NUM_FILECMDS] =
 		"TNFS_UNLINK",
 		"TNFS_CHMOD",
 		"TNFS_RENAME",
-		"TNFS_OPEN"};
+		"TNFS_OPEN",
+		"TNFS_HASH",
+		"TNFS_COPY",
+		"TNFS_JOBSTATUS"};
+
+const char *devcmd_names[NUM_DEVCMDS] =
+	{
+		"TNFS_SIZE",
+		"TNFS_FREE"};
 
 const char *get_cmd_name(uint8_t cmd)
 {
@@ -117,6 +164,11 @@ const char *get_cmd_name(uint8_t cmd)
 		if(index < NUM_SESSCMDS)
 			return sesscmd_names[index];
 	}
+	else if(class == CLASS_DEVICE)
+	{
+		if(index < NUM_DEVCMDS)
+			return devcmd_names[index];
+	}
 
 	return "UNKNOWN_CMD";
 }
@@ -181,11 +233,20 @@ void tnfs_mainloop()
 	struct timeval select_timeout;
 	time_t last_stats_report = 0;
 	time_t now = 0;
+	bool searchmore = false;
 
 	memset(&tcpsocks, 0, sizeof(tcpsocks));
 
 	while (1)
 	{
+		/* what arrived over TCP while its session was busy, and
+		 * connections closed meanwhile */
+		for (i = 0; i < MAX_TCP_CONN; i++)
+		{
+			if (tcpsocks[i].cli_fd)
+				_tcp_decode(&tcpsocks[i]);
+		}
+
 		FD_ZERO(&fdset);
 
 		/* add UDP socket and TCP listen socket to fdset */
@@ -194,14 +255,23 @@ void tnfs_mainloop()
 
 		for (i = 0; i < MAX_TCP_CONN; i++)
 		{
-			if (tcpsocks[i].cli_fd)
+			if (tcpsocks[i].cli_fd && !tcpsocks[i].closed)
 			{
 				FD_SET(tcpsocks[i].cli_fd, &fdset);
 			}
 		}
 
+		/* changes to watched directories */
+		if (notify_fd() >= 0)
+			FD_SET(notify_fd(), &fdset);
+
+		/* requests done off the main loop */
+		if (offload_fd() >= 0)
+			FD_SET(offload_fd(), &fdset);
+
 		FD_COPY(&fdset, &errfdset);
-		select_timeout.tv_sec = 1;
+		select_timeout.tv_sec = searchmore || job_pending() ? 0 : 1;
+		select_timeout.tv_usec = 0;
 
 		readyfds = select(FD_SETSIZE, &fdset, NULL, &errfdset, &select_timeout);
 		if (readyfds == SOCKET_ERROR) {
@@ -209,9 +279,17 @@ void tnfs_mainloop()
 			break;
 		}
 
-		if (readyfds == 0) {
-			// Just a normal timeout, reloop
-			continue;
+		/* A normal timeout leaves the sets empty, so just fall
+		 * through to the periodic tasks */
+
+		if (notify_fd() >= 0 && FD_ISSET(notify_fd(), &fdset))
+		{
+			notify_dispatch();
+		}
+
+		if (offload_fd() >= 0 && FD_ISSET(offload_fd(), &fdset))
+		{
+			offload_finish();
 		}
 
 		/* UDP message? */
@@ -238,6 +316,14 @@ void tnfs_mainloop()
 			}
 		}
 
+#ifdef ENABLE_DIRINDEX
+		dirindex_check();
+#endif
+		watch_check();
+		notify_trim();
+		searchmore = search_update();
+		job_poll();
+
 		time(&now);
 		if (STATS_INTERVAL > 0 && now - last_stats_report > STATS_INTERVAL)
 		{
@@ -323,12 +409,106 @@ void tnfs_handle_udpmsg()
 	*(rxbuf + rxbytes) = 0;
 }
 
+/* How many of the bytes received so far make up the next message, 0 if
+ * more are needed. TCP has no framing and most requests don't carry their
+ * length, so whatever one recv() returned is taken as a message, as it
+ * always has been. A WRITE does say how long it is, and once its session
+ * has negotiated a larger message size it will often arrive in several
+ * segments. Only then is the rest waited for, and a WRITE claiming more
+ * than was negotiated is taken as it came */
+int _tcp_msglen(TcpConnection *tcp_conn)
+{
+	unsigned char *buf = tcp_conn->rxbuf;
+	int len = tcp_conn->rxlen;
+	Session *sess;
+	int msglen, sindex;
+
+	if (len < TNFS_HEADERSZ)
+		return 0;
+	if (buf[3] != TNFS_WRITEBLOCK)
+		return len;
+	sess = tnfs_findsession_sid(tnfs16uint(buf), &sindex);
+	if (sess == NULL || sess->cli_fd != tcp_conn->cli_fd ||
+		sess->maxmsgsz <= MAXMSGSZ)
+		return len;
+	if (len < TNFS_HEADERSZ + 3)
+		return 0;
+
+	msglen = TNFS_HEADERSZ + 3 + tnfs16uint(buf + TNFS_HEADERSZ + 1);
+	if (msglen > sess->maxmsgsz)
+		return len;
+	return msglen;
+}
+
+/* Run the messages received in full, leaving the rest for later. While
+ * a session's request is off the main loop its messages are put aside,
+ * as long as there's room, and the rest wait here. A connection the
+ * client has closed goes once its sessions are done with it */
+void _tcp_decode(TcpConnection *tcp_conn)
+{
+	Session *sess;
+	int msglen, sindex, paused = 0;
+
+	while (tcp_conn->rxlen > 0 &&
+		   (msglen = _tcp_msglen(tcp_conn)) > 0 &&
+		   msglen <= tcp_conn->rxlen)
+	{
+		sess = tnfs_findsession_sid(tnfs16uint(tcp_conn->rxbuf), &sindex);
+		if (sess != NULL && offload_full(sess))
+		{
+			paused = 1;
+			break;
+		}
+		tnfs_decode(&tcp_conn->cliaddr, tcp_conn->cli_fd, msglen, tcp_conn->rxbuf);
+		tcp_conn->rxlen -= msglen;
+		memmove(tcp_conn->rxbuf, tcp_conn->rxbuf + msglen, tcp_conn->rxlen);
+	}
+
+	if (tcp_conn->closed && !paused && !offload_pending(tcp_conn->cli_fd))
+		_tcp_close(tcp_conn);
+}
+
+void _tcp_close(TcpConnection *tcp_conn)
+{
+	MSGLOG(tcp_conn->cliaddr.sin_addr.s_addr, "Client disconnected, closing socket.");
+	tnfs_reset_cli_fd_in_sessions(tcp_conn->cli_fd);
+
+#ifdef WIN32
+	closesocket(tcp_conn->cli_fd);
+#else
+	close(tcp_conn->cli_fd);
+#endif
+
+	tcp_conn->cli_fd = 0;
+	tcp_conn->closed = 0;
+	free(tcp_conn->rxbuf);
+	tcp_conn->rxbuf = NULL;
+	tcp_conn->rxlen = tcp_conn->rxsize = 0;
+}
+
 void tnfs_handle_tcpmsg(TcpConnection *tcp_conn)
 {
-	unsigned char buf[MAXMSGSZ];
-	int sz;
+	unsigned char *buf;
+	int sz, want;
+
+	/* room for the rest of a WRITE that's only partly here, and more
+	   after what's still waiting to run */
+	want = tcp_conn->rxlen ? _tcp_msglen(tcp_conn) : 0;
+	if (want < tcp_conn->rxlen + MAXMSGSZ)
+		want = tcp_conn->rxlen + MAXMSGSZ;
+	if (want > tcp_conn->rxsize)
+	{
+		if ((buf = realloc(tcp_conn->rxbuf, want)) == NULL)
+		{
+			MSGLOG(tcp_conn->cliaddr.sin_addr.s_addr, "Out of memory for TCP message");
+			return;
+		}
+		tcp_conn->rxbuf = buf;
+		tcp_conn->rxsize = want;
+	}
 
-	sz = recv(tcp_conn->cli_fd, (char *)buf, sizeof(buf), 0);
+	sz = recv(tcp_conn->cli_fd, (char *)tcp_conn->rxbuf + tcp_conn->rxlen,
+			  tcp_conn->rxsize - tcp_conn->rxlen, 0);
 
 #ifdef WIN32
 	if (sz == SOCKET_ERROR) {
@@ -340,20 +520,11 @@ void tnfs_handle_tcpmsg(TcpConnection *tcp_conn)
 	}
 #endif
 
-	if (sz <= 0) {
-		MSGLOG(tcp_conn->cliaddr.sin_addr.s_addr, "Client disconnected, closing socket.");
-		tnfs_reset_cli_fd_in_sessions(tcp_conn->cli_fd);
-
-#ifdef WIN32
-		closesocket(tcp_conn->cli_fd);
-#else
-		close(tcp_conn->cli_fd);
-#endif
-
-		tcp_conn->cli_fd = 0;
-		return;
-	}
-	tnfs_decode(&tcp_conn->cliaddr, tcp_conn->cli_fd, sz, buf);
+	if (sz <= 0)
+		tcp_conn->closed = 1;
+	else
+		tcp_conn->rxlen += sz;
+	_tcp_decode(tcp_conn);
 }
 
 void tnfs_decode(struct sockaddr_in *cliaddr, int cli_fd, int rxbytes, unsigned char *rxbuf)
@@ -362,7 +533,6 @@ void tnfs_decode(struct sockaddr_in *cliaddr, int cli_fd, int rxbytes, unsigned
 	Session *sess;
 	int sindex;
 	int datasz = rxbytes - TNFS_HEADERSZ;
-	int cmdclass, cmdidx;
 	unsigned char *databuf = rxbuf + TNFS_HEADERSZ;
 
 	memset(&hdr, 0, sizeof(hdr));
@@ -396,6 +566,12 @@ void tnfs_decode(struct sockaddr_in *cliaddr, int cli_fd, int rxbytes, unsigned
 			TNFSMSGLOG(&hdr, "Session and IP do not match");
 			return;
 		}
+		/* one of its requests is still running off the main loop */
+		if (sess->offload != NULL)
+		{
+			offload_hold(sess, cliaddr, cli_fd, rxbuf, rxbytes);
+			return;
+		}
 		if (sess->cli_fd != 0 && sess->cli_fd != cli_fd)
 		{
 			TNFSMSGLOG(&hdr, "Session is assigned to another TCP connection");
@@ -411,6 +587,17 @@ void tnfs_decode(struct sockaddr_in *cliaddr, int cli_fd, int rxbytes, unsigned
 		return;
 	}
 
+	/* a session with a window keeps its own order */
+	if (sess->window != NULL)
+	{
+		window_decode(sess, sindex, &hdr, cliaddr, databuf, datasz);
+		return;
+	}
+
+	/* a WATCH still being held is answered when it's due */
+	if (watch_held(sess, &hdr))
+		return;
+
 	/* client is asking for a resend */
 	if (hdr.seqno == sess->lastseqno)
 	{
@@ -418,37 +605,206 @@ void tnfs_decode(struct sockaddr_in *cliaddr, int cli_fd, int rxbytes, unsigned
 		return;
 	}
 
-	/* find the command class and pass it off to the right
-	 * function */
-	cmdclass = hdr.cmd & 0xF0;
-	cmdidx = hdr.cmd & 0x0F;
-	switch (cmdclass)
+	if (offload_wanted(&hdr, sess))
+		offload_run(&hdr, sess, sindex, databuf, datasz);
+	else
+		tnfs_dispatch(&hdr, sess, sindex, databuf, datasz);
+}
+
+/* Pass a request off to the function for its command */
+void tnfs_dispatch(Header *hdr, Session *sess, int sindex,
+	unsigned char *databuf, int datasz)
+{
+	switch (hdr->cmd & 0xF0)
 	{
 	case CLASS_SESSION:
-		switch (cmdidx)
+		switch (hdr->cmd & 0x0F)
 		{
 		case TNFS_UMOUNT:
-			tnfs_umount(&hdr, sess, sindex);
+			tnfs_umount(hdr, sess, sindex);
+			break;
+		case TNFS_COMPOUND:
+			tnfs_compound(hdr, sess, databuf, datasz);
+			break;
+		case TNFS_WINDOW:
+			tnfs_window(hdr, sess, databuf, datasz);
 			break;
 		default:
-			tnfs_badcommand(&hdr, sess);
+			tnfs_badcommand(hdr, sess);
 		}
 		break;
+	default:
+		tnfs_command(hdr, sess, databuf, datasz);
+	}
+}
+
+/* Run a directory, file or device command */
+void tnfs_command(Header *hdr, Session *sess, unsigned char *databuf, int datasz)
+{
+	int cmdidx = hdr->cmd & 0x0F;
+
+	switch (hdr->cmd & 0xF0)
+	{
 	case CLASS_DIRECTORY:
 		if (cmdidx < NUM_DIRCMDS)
-			(*dircmd[cmdidx])(&hdr, sess, databuf, datasz);
+			(*dircmd[cmdidx])(hdr, sess, databuf, datasz);
 		else
-			tnfs_badcommand(&hdr, sess);
+			tnfs_badcommand(hdr, sess);
 		break;
 	case CLASS_FILE:
 		if (cmdidx < NUM_FILECMDS)
-			(*filecmd[cmdidx])(&hdr, sess, databuf, datasz);
+			(*filecmd[cmdidx])(hdr, sess, databuf, datasz);
+		else
+			tnfs_badcommand(hdr, sess);
+		break;
+	case CLASS_DEVICE:
+		if (cmdidx < NUM_DEVCMDS)
+			(*devcmd[cmdidx])(hdr, sess, databuf, datasz);
 		else
-			tnfs_badcommand(&hdr, sess);
+			tnfs_badcommand(hdr, sess);
 		break;
 	default:
-		tnfs_badcommand(&hdr, sess);
+		tnfs_badcommand(hdr, sess);
+	}
+}
+
+/* The least room a part of a COMPOUND needs for its reply. READ and
+   READDIRX return as much as fits, and the commands that reply with
+   nothing but a status can always run */
+int _compound_minroom(uint8_t cmd)
+{
+	switch (cmd)
+	{
+	case TNFS_CLOSEFILE:
+	case TNFS_CLOSEDIR:
+	case TNFS_UNLINKFILE:
+	case TNFS_CHMODFILE:
+	case TNFS_RENAMEFILE:
+	case TNFS_MKDIR:
+	case TNFS_RMDIR:
+	case TNFS_SEEKDIR:
+		return 0;
+	case TNFS_READBLOCK:
+		return 3;
+	case TNFS_READDIRX:
+		return COMPOUND_READDIRX_MIN;
+	case TNFS_READDIR:
+		return MAX_FILENAME_LEN + 1;
+	default:
+		return COMPOUND_FIXED_MAX;
+	}
+}
+
+/* Whether a command's reply starts with a handle later parts can use */
+int _compound_opens(uint8_t cmd)
+{
+	return cmd == TNFS_OPENFILE || cmd == TNFS_OPENFILE_OLD ||
+		   cmd == TNFS_OPENDIR || cmd == TNFS_OPENDIRX || cmd == TNFS_SEARCH ||
+		   cmd == TNFS_COPYFILE || cmd == TNFS_RMTREE || cmd == TNFS_COPYTREE;
+}
+
+/* Run several directory, file and device commands in order and send
+   all their replies back as one */
+void tnfs_compound(Header *hdr, Session *sess, unsigned char *databuf, int datasz)
+{
+	unsigned char *reply;
+	compound_part part;
+	Header subhdr;
+	unsigned char *args;
+	uint8_t cmd, flags;
+	int i, count, argsz, pos, room, failed = 0, handle = -1;
+	int used = 1;
+	int limit = sess->maxmsgsz - TNFS_HEADERSZ - 1;
+	int maxmsgsz = sess->maxmsgsz;
+	int maxiosz = sess->maxiosz;
+
+	/* check the whole request before running any of it */
+	count = datasz > 0 ? databuf[0] : -1;
+	for (i = 0, pos = 1; i < count && pos + 4 <= datasz; i++)
+	{
+		/* nor can a WATCH wait for a change in the middle of one */
+		if ((databuf[pos] & 0xF0) == CLASS_SESSION || databuf[pos] == TNFS_WATCH)
+			break;
+		pos += 4 + tnfs16uint(databuf + pos + 2);
+	}
+	if (count < 1 || i < count || pos != datasz)
+	{
+		hdr->status = TNFS_EINVAL;
+		tnfs_send(sess, hdr, NULL, 0);
+		return;
+	}
+
+	reply = tnfs_replybuf(sess, hdr);
+	reply[0] = 0;
+	for (i = 0, pos = 1; i < count; i++)
+	{
+		cmd = databuf[pos];
+		flags = databuf[pos + 1];
+		argsz = tnfs16uint(databuf + pos + 2);
+		args = databuf + pos + 4;
+		pos += 4 + argsz;
+
+		/* after a failure, only the parts that clean up run */
+		if (failed && !(flags & TNFS_COMPOUND_ALWAYS))
+			continue;
+
+		/* what's left once every later part has room for its status */
+		room = limit - used - 4 * (count - i);
+		if (room < 0)
+			break;
+
+		part.buf = reply + used + 4;
+		part.room = room;
+		part.len = 0;
+		if ((flags & TNFS_COMPOUND_CHAIN) && (handle < 0 || argsz < 1))
+			part.status = TNFS_EBADF;
+		else if (room < _compound_minroom(cmd))
+			part.status = TNFS_ENOBUFS;
+		else
+		{
+			if (flags & TNFS_COMPOUND_CHAIN)
+				args[0] = (unsigned char)handle;
+			subhdr = *hdr;
+			subhdr.cmd = cmd;
+			subhdr.status = 0;
+
+			/* so READ and READDIRX only return what fits */
+			sess->maxmsgsz = TNFS_HEADERSZ + 1 + room;
+			if (sess->maxiosz > room - 2)
+				sess->maxiosz = room - 2;
+			part.len = COMPOUND_NOREPLY;
+			compound = &part;
+			tnfs_command(&subhdr, sess, args, argsz);
+			compound = NULL;
+			sess->maxmsgsz = maxmsgsz;
+			sess->maxiosz = maxiosz;
+
+			if (part.len == COMPOUND_NOREPLY)
+			{
+				part.status = TNFS_ENOSYS;
+				part.len = 0;
+			}
+			else if (part.len < 0)
+			{
+				part.status = TNFS_ENOBUFS;
+				part.len = 0;
+			}
+		}
+
+		reply[used] = (unsigned char)i;
+		reply[used + 1] = part.status;
+		uint16tnfs(reply + used + 2, (uint16_t)part.len);
+		used += 4 + part.len;
+		reply[0]++;
+
+		if (part.status != TNFS_SUCCESS)
+			failed = 1;
+		else if (_compound_opens(cmd) && part.len > 0)
+			handle = part.buf[0];
 	}
+
+	hdr->status = TNFS_SUCCESS;
+	tnfs_send(sess, hdr, reply, used);
 }
 
 void tnfs_invalidsession(Header *hdr)
@@ -465,19 +821,42 @@ void tnfs_badcommand(Header *hdr, Session *sess)
 	tnfs_send(sess, hdr, NULL, 0);
 }
 
+unsigned char *tnfs_replybuf(Session *sess, Header *hdr)
+{
+	if (compound != NULL)
+		return compound->buf;
+	if (sess->window != NULL)
+		return window_reply(sess, hdr->seqno) + TNFS_HEADERSZ + 1;
+	return sess->lastmsg + TNFS_HEADERSZ + 1;
+}
+
 void tnfs_send(Session *sess, Header *hdr, unsigned char *msg, int msgsz)
 {
 	struct sockaddr_in cliaddr;
 	ssize_t txbytes;
 	unsigned char txbuf_nosess[5];
-	unsigned char *txbuf = sess ? sess->lastmsg : txbuf_nosess;
+	unsigned char *txbuf = txbuf_nosess;
+
+	/* part of a COMPOUND, sent with the rest */
+	if (compound != NULL && sess != NULL)
+	{
+		compound->status = hdr->status;
+		compound->len = msgsz <= compound->room ? msgsz : -1;
+		if (msg && compound->len > 0 && msg != compound->buf)
+			memcpy(compound->buf, msg, msgsz);
+		return;
+	}
 
 	// TNFS_HEADERSZ + statuscode + msg
-	if (TNFS_HEADERSZ + 1 + msgsz > MAXMSGSZ)
+	if (TNFS_HEADERSZ + 1 + msgsz > (sess ? sess->maxmsgsz : MAXMSGSZ))
 	{
 		die("tnfs_send: Message too big");
 	}
 
+	/* kept to be sent again if the client asks */
+	if (sess)
+		txbuf = sess->window ? window_reply(sess, hdr->seqno) : sess->lastmsg;
+
 	cliaddr.sin_family = AF_INET;
 	cliaddr.sin_addr.s_addr = hdr->ipaddr;
 	cliaddr.sin_port = htons(hdr->port);
@@ -486,10 +865,15 @@ void tnfs_send(Session *sess, Header *hdr, unsigned char *msg, int msgsz)
 	*(txbuf + 2) = hdr->seqno;
 	*(txbuf + 3) = hdr->cmd;
 	*(txbuf + 4) = hdr->status;
-	if (msg)
+	/* unless it was put together there in the first place */
+	if (msg && msg != txbuf + 5)
 		memcpy(txbuf + 5, msg, msgsz);
 
-	if (sess)
+	if (sess && sess->window)
+	{
+		window_replied(sess, hdr->seqno, TNFS_HEADERSZ + 1 + msgsz);
+	}
+	else if (sess)
 	{
 		sess->lastmsgsz = TNFS_HEADERSZ + 1 + msgsz; /* header + status code + payload */
 		sess->lastseqno = hdr->seqno;
@@ -512,18 +896,33 @@ void tnfs_send(Session *sess, Header *hdr, unsigned char *msg, int msgsz)
 }
 
 void tnfs_resend(Session *sess, struct sockaddr_in *cliaddr, int cli_fd)
+{
+	/* the reply went out over a TCP connection that has since gone */
+	if (sess->lastmsgsz > sess->maxmsgsz)
+	{
+		MSGLOG(cliaddr->sin_addr.s_addr,
+			   "Last reply is too big to resend");
+		return;
+	}
+
+	tnfs_retransmit(cliaddr, cli_fd, sess->lastmsg, sess->lastmsgsz);
+}
+
+void tnfs_retransmit(struct sockaddr_in *cliaddr, int cli_fd,
+	unsigned char *msg, int msgsz)
 {
 	int txbytes;
+
 	if (cli_fd == 0)
 	{
-		txbytes = sendto(sockfd, WIN32_CHAR_P sess->lastmsg, sess->lastmsgsz, 0,
+		txbytes = sendto(sockfd, WIN32_CHAR_P msg, msgsz, 0,
 						(struct sockaddr *)cliaddr, sizeof(struct sockaddr_in));
 	}
 	else
 	{
-		txbytes = send(cli_fd, WIN32_CHAR_P sess->lastmsg, sess->lastmsgsz, 0); 
+		txbytes = send(cli_fd, WIN32_CHAR_P msg, msgsz, 0); 
 	}
-	if (txbytes < sess->lastmsgsz)
+	if (txbytes < msgsz)
 	{
 		MSGLOG(cliaddr->sin_addr.s_addr,
 			   "Retransmit was truncated");
@@ -57,8 +57,19 @@ void tcp_accept(TcpConnection *tcp_conn_list);
 void tnfs_handle_tcpmsg(TcpConnection *tcp_conn);
 void tnfs_decode(struct sockaddr_in *cliaddr, int cli_fd,
 	int rxbytes, unsigned char *rxbuf);
+void tnfs_dispatch(Header *hdr, Session *sess, int sindex,
+	unsigned char *databuf, int datasz);
+void tnfs_command(Header *hdr, Session *sess, unsigned char *databuf, int datasz);
+void tnfs_compound(Header *hdr, Session *sess, unsigned char *databuf, int datasz);
 void tnfs_invalidsession(Header *hdr);
 void tnfs_badcommand(Header *hdr, Session *sess);
+/* Where the reply to hdr can be put together, sess->maxmsgsz less the
+ * header and status. Passed to tnfs_send, it's sent and kept for resending
+ * from there without being copied. Only for a reply that's sent at once,
+ * as it overwrites the last one */
+unsigned char *tnfs_replybuf(Session *sess, Header *hdr);
 void tnfs_send(Session *sess, Header *hdr, unsigned char *msg, int msgsz);
 void tnfs_resend(Session *sess, struct sockaddr_in *cliaddr, int cli_fd);
+void tnfs_retransmit(struct sockaddr_in *cliaddr, int cli_fd,
+	unsigned char *msg, int msgsz);
 #endif
@@ -0,0 +1,151 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon device functions
+ *
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/statvfs.h>
+#endif
+
+#include "config.h"
+#include "tnfs.h"
+#include "device.h"
+#include "directory.h"
+#include "datagram.h"
+#include "errortable.h"
+#include "endian.h"
+#include "bsdcompat.h"
+
+/* Clients poll free space, often many at once, so each mount point's
+   figures are kept for a few seconds */
+typedef struct _devcache_entry
+{
+	char path[MAX_FILEPATH];	/* empty if unused */
+	uint32_t sizekb;
+	uint32_t freekb;
+	time_t loaded;
+} devcache_entry;
+
+static devcache_entry devcache[DEVCACHE_MAX];
+
+uint32_t _device_kb(uint64_t bytes)
+{
+	bytes /= 1024;
+	return bytes > UINT32_MAX ? UINT32_MAX : (uint32_t)bytes;
+}
+
+/* Finds the size and free space of the filesystem holding path.
+   Returns 0, or -1 with errno set */
+int _device_query(const char *path, uint32_t *sizekb, uint32_t *freekb)
+{
+#ifdef WIN32
+	ULARGE_INTEGER avail, total;
+
+	if (!GetDiskFreeSpaceExA(path, &avail, &total, NULL))
+	{
+		errno = EIO;
+		return -1;
+	}
+	*sizekb = _device_kb(total.QuadPart);
+	*freekb = _device_kb(avail.QuadPart);
+#else
+	struct statvfs vfs;
+
+	if (statvfs(path, &vfs) < 0)
+		return -1;
+	/* what's free to anyone, not just root */
+	*sizekb = _device_kb((uint64_t)vfs.f_blocks * vfs.f_frsize);
+	*freekb = _device_kb((uint64_t)vfs.f_bavail * vfs.f_frsize);
+#endif
+	return 0;
+}
+
+/* The cached figures for a session's mount point, queried again when
+   they've gone stale. Returns NULL with errno set on failure */
+devcache_entry *_device_lookup(Session *s)
+{
+	char path[MAX_FILEPATH];
+	devcache_entry *e, *oldest = &devcache[0];
+	time_t now = time(NULL);
+	int i;
+
+	get_root(s, path, sizeof(path));
+	for (i = 0; i < DEVCACHE_MAX; i++)
+	{
+		e = &devcache[i];
+		if (strcmp(e->path, path) == 0)
+		{
+			if (now - e->loaded < DEVCACHE_TTL && now >= e->loaded)
+				return e;
+			oldest = e;
+			break;
+		}
+		if (e->loaded < oldest->loaded)
+			oldest = e;
+	}
+
+	e = oldest;
+	if (_device_query(path, &e->sizekb, &e->freekb) < 0)
+	{
+		e->path[0] = 0;
+		e->loaded = 0;
+		return NULL;
+	}
+	strlcpy(e->path, path, sizeof(e->path));
+	e->loaded = now;
+	return e;
+}
+
+void _device_reply(Header *hdr, Session *s, int wantfree)
+{
+	unsigned char reply[4];
+	devcache_entry *e;
+
+	if ((e = _device_lookup(s)) == NULL)
+	{
+		hdr->status = tnfs_error(errno);
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+	uint32tnfs(reply, wantfree ? e->freekb : e->sizekb);
+	hdr->status = TNFS_SUCCESS;
+	tnfs_send(s, hdr, reply, sizeof(reply));
+}
+
+void tnfs_size(Header *hdr, Session *s, unsigned char *databuf, int datasz)
+{
+	_device_reply(hdr, s, 0);
+}
+
+void tnfs_free(Header *hdr, Session *s, unsigned char *databuf, int datasz)
+{
+	_device_reply(hdr, s, 1);
+}
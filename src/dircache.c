@@ -0,0 +1,336 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * Directory listing cache
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "dircache.h"
+#include "directory.h"
+#include "notify.h"
+#include "log.h"
+
+#if defined(WIN32)
+#define ST_MTIME_NSEC(st) 0
+#elif defined(__APPLE__)
+#define ST_MTIME_NSEC(st) ((st)->st_mtimespec.tv_nsec)
+#else
+#define ST_MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+#endif
+
+/* under dirlist_lock() */
+dir_listing *cachehead = NULL;
+dir_listing *cachetail = NULL;
+int cachecount = 0;
+dir_listing *loadhead = NULL;	/* stamped and still being read */
+
+/* Compare paths ignoring trailing slashes, as "/tnfs/" and "/tnfs"
+ * may both name the root */
+bool _dircache_samepath(const char *a, const char *b)
+{
+	size_t la = strlen(a), lb = strlen(b);
+	while (la > 1 && a[la - 1] == '/')
+		la--;
+	while (lb > 1 && b[lb - 1] == '/')
+		lb--;
+	return la == lb && strncmp(a, b, la) == 0;
+}
+
+/* Take a listing out of the cache, keeping the cache's reference */
+void _dircache_detach(dir_listing *listing)
+{
+	if (listing->prev)
+		listing->prev->next = listing->next;
+	else
+		cachehead = listing->next;
+	if (listing->next)
+		listing->next->prev = listing->prev;
+	else
+		cachetail = listing->prev;
+	listing->prev = listing->next = NULL;
+	listing->state = DIRCACHE_STALE;
+	cachecount--;
+}
+
+/* Take a listing out of the cache, dropping the cache's reference */
+void _dircache_remove(dir_listing *listing)
+{
+	_dircache_detach(listing);
+	dirlist_unref(listing);
+}
+
+/* Move a cached listing to the front */
+void _dircache_touch(dir_listing *listing)
+{
+	if (listing == cachehead)
+		return;
+	listing->prev->next = listing->next;
+	if (listing->next)
+		listing->next->prev = listing->prev;
+	else
+		cachetail = listing->prev;
+	listing->prev = NULL;
+	listing->next = cachehead;
+	cachehead->prev = listing;
+	cachehead = listing;
+}
+
+/* Something changed in a directory: forget what we have of it */
+void _dircache_changed(const char *dirpath, const char *name, void *ctx)
+{
+	dir_listing *listing, *next;
+
+	dirlist_lock();
+	/* one being read on another thread may have missed it */
+	for (listing = loadhead; listing != NULL; listing = listing->next)
+	{
+		if (dirpath == NULL || _dircache_samepath(listing->path, dirpath))
+			listing->state = DIRCACHE_STALE;
+	}
+	for (listing = cachehead; listing != NULL; listing = next)
+	{
+		next = listing->next;
+		if (dirpath == NULL || _dircache_samepath(listing->path, dirpath))
+		{
+#ifdef DEBUG
+			fprintf(stderr, "dircache: dropping '%s'\n", listing->path);
+#endif
+			_dircache_remove(listing);
+		}
+	}
+	dirlist_unlock();
+}
+
+/* Whether an unwatched listing still matches the directory. Called
+   without the lock, as it goes to the disk */
+bool _dircache_fresh(dir_listing *listing)
+{
+	struct stat st;
+
+	/* without notification a file can change in place unnoticed,
+	 * so only trust the directory's mtime for a short while */
+	return time(NULL) - listing->loaded <= DIRCACHE_TTL &&
+		   stat(listing->path, &st) == 0 &&
+		   st.st_mtime == listing->mtime_sec && ST_MTIME_NSEC(&st) == listing->mtime_nsec;
+}
+
+dir_listing *dircache_lookup(const char *path)
+{
+	dir_listing *listing;
+	bool fresh;
+
+	dirlist_lock();
+	for (listing = cachehead; listing != NULL; listing = listing->next)
+	{
+		if (_dircache_samepath(listing->path, path))
+			break;
+	}
+	if (listing == NULL || listing->state == DIRCACHE_STALE)
+	{
+		if (listing != NULL)
+			_dircache_remove(listing);
+		dirlist_unlock();
+		return NULL;
+	}
+	listing->refs++;
+	if (listing->state == DIRCACHE_WATCHED)
+	{
+		_dircache_touch(listing);
+		dirlist_unlock();
+		return listing;
+	}
+	dirlist_unlock();
+
+	fresh = _dircache_fresh(listing);
+
+	/* another thread may have dropped it meanwhile */
+	dirlist_lock();
+	if (listing->state != DIRCACHE_STALE)
+	{
+		if (fresh)
+			_dircache_touch(listing);
+		else
+			_dircache_remove(listing);
+	}
+	if (!fresh)
+	{
+		dirlist_unref(listing);
+		listing = NULL;
+	}
+	dirlist_unlock();
+	return listing;
+}
+
+bool dircache_watched(const char *path)
+{
+	dir_listing *listing;
+	bool watched = false;
+
+	dirlist_lock();
+	for (listing = cachehead; listing != NULL; listing = listing->next)
+	{
+		if (_dircache_samepath(listing->path, path))
+		{
+			watched = listing->state == DIRCACHE_WATCHED;
+			break;
+		}
+	}
+	dirlist_unlock();
+	return watched;
+}
+
+void dircache_stamp(dir_listing *listing)
+{
+	struct stat st;
+	uint8_t state;
+
+	/* from here on a change marks it stale */
+	dirlist_lock();
+	listing->prev = NULL;
+	listing->next = loadhead;
+	if (loadhead)
+		loadhead->prev = listing;
+	loadhead = listing;
+	dirlist_unlock();
+
+	/* watch before the directory is read so no change can slip between */
+	if (notify_watch(listing->path, _dircache_changed, NULL) == 0)
+		state = DIRCACHE_WATCHED;
+	else
+		state = DIRCACHE_UNWATCHED;
+
+	if (stat(listing->path, &st) == 0)
+	{
+		listing->mtime_sec = st.st_mtime;
+		listing->mtime_nsec = ST_MTIME_NSEC(&st);
+	}
+	else
+	{
+		state = DIRCACHE_STALE;
+	}
+
+	dirlist_lock();
+	if (listing->state != DIRCACHE_STALE)
+		listing->state = state;
+	dirlist_unlock();
+}
+
+/* Take a listing that has been read, or failed to be, off the list of
+   those being read. Called with the lock held */
+void _dircache_loaded(dir_listing *listing)
+{
+	if (listing->prev)
+		listing->prev->next = listing->next;
+	else
+		loadhead = listing->next;
+	if (listing->next)
+		listing->next->prev = listing->prev;
+	listing->prev = listing->next = NULL;
+}
+
+void dircache_abandon(dir_listing *listing)
+{
+	dirlist_lock();
+	_dircache_loaded(listing);
+	dirlist_unlock();
+}
+
+/* Memory held by a listing, including any sort orders and READDIRX
+   pages made so far */
+size_t _dircache_size(const dir_listing *listing)
+{
+	size_t bytes = listing->arena.bytes + listing->size * sizeof(directory_entry) + listing->pagebytes;
+	int i;
+
+	for (i = 0; i < DIRLIST_ORDERS; i++)
+	{
+		if (listing->orders[i])
+			bytes += listing->count * sizeof(uint32_t);
+	}
+	return bytes;
+}
+
+void dircache_insert(dir_listing *listing)
+{
+	dir_listing *l, *evicted = NULL;
+	size_t bytes = 0;
+
+	dirlist_lock();
+	_dircache_loaded(listing);
+	if (listing->state == DIRCACHE_STALE || DIRCACHE_MAX == 0)
+	{
+		dirlist_unlock();
+		return;
+	}
+
+	/* replace any older listing of the same directory */
+	for (l = cachehead; l != NULL; l = l->next)
+	{
+		if (_dircache_samepath(l->path, listing->path))
+		{
+			_dircache_remove(l);
+			break;
+		}
+	}
+
+	listing->refs++;
+	listing->prev = NULL;
+	listing->next = cachehead;
+	if (cachehead)
+		cachehead->prev = listing;
+	else
+		cachetail = listing;
+	cachehead = listing;
+	cachecount++;
+
+	for (l = cachehead; l != NULL; l = l->next)
+		bytes += _dircache_size(l);
+
+	/* evict the least recently used, still open ones live on in their handles */
+	while (cachetail != NULL && (cachecount > DIRCACHE_MAX || bytes > DIRCACHE_MAXBYTES))
+	{
+		l = cachetail;
+		bytes -= _dircache_size(l);
+		_dircache_detach(l);
+		l->next = evicted;
+		evicted = l;
+	}
+	dirlist_unlock();
+
+	/* not with the lock held, which the callback takes */
+	while ((l = evicted) != NULL)
+	{
+		evicted = l->next;
+		l->next = NULL;
+		notify_unwatch(l->path, _dircache_changed, NULL);
+		dirlist_release(l);
+	}
+}
@@ -0,0 +1,58 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * Directory listing cache
+ *
+ * Listings loaded by OPENDIRX are kept after their handles close so
+ * the next client opening the same directory, with whatever options,
+ * can be given a view of them instead of reading the disk again.
+ *
+ * */
+
+#ifndef _TNFS_DIRCACHE_H
+#define _TNFS_DIRCACHE_H
+
+#include "tnfs.h"
+
+#define DIRCACHE_UNWATCHED 0	/* reuse only while its mtime matches and within DIRCACHE_TTL */
+#define DIRCACHE_WATCHED 1	/* reuse until a change is notified */
+#define DIRCACHE_STALE 2	/* never reuse */
+
+/* Returns a fresh cached listing of the directory at path with a
+ * reference for the caller, or NULL if it needs to be read. A miss
+ * starts watching the directory, so read it after calling this. */
+dir_listing *dircache_lookup(const char *path);
+
+/* Whether a listing of path is cached and watched for changes, so that
+ * dircache_lookup() would return it without touching the disk */
+bool dircache_watched(const char *path);
+
+/* Record the directory's mtime in a new listing, before it's read */
+void dircache_stamp(dir_listing *listing);
+
+/* Keep a listing that has been read for later lookups, unless it
+ * changed meanwhile. One that couldn't be read is abandoned instead */
+void dircache_insert(dir_listing *listing);
+void dircache_abandon(dir_listing *listing);
+
+#endif
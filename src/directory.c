@@ -34,6 +34,10 @@
 #include <unistd.h>
 #include <stdbool.h>
 
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#endif
+
 #include "tnfs.h"
 #include "log.h"
 #include "config.h"
@@ -43,8 +47,17 @@
 #include "errortable.h"
 #include "bsdcompat.h"
 #include "endian.h"
+#include "statcache.h"
 #include "log.h"
 #include "fileinfo.h"
+#include "pattern.h"
+#include "dirindex.h"
+#include "search.h"
+#include "dircache.h"
+#include "taskpool.h"
+#include "resolve.h"
+#include "vfs.h"
+#include "hashcache.h"
 
 #ifdef TNFS_DIR_EXT
 #include <stdint.h>
@@ -61,17 +74,11 @@ struct tnfs_opendir_ext {
 	int do_uppercase;           // ;u "UPPER CASE" names; default: as-is
 	int do_lowercase;           // ;l "lower case" names; default: as-is
 	int do_camelcase;           // ;c "Camel Case" names; default: as-is
-	char *wildcard;
+	tnfs_pattern *wildcard;
 };
 static int alphacase_sort(const struct dirent **a, const struct dirent **b) {
 	return strcasecmp((*a)->d_name, (*b)->d_name);
 }
-static int wildcard( const char *pattern, const char *str ) {
-	if( *pattern=='\0' ) return !*str;
-	if( *pattern=='*' )  return wildcard(pattern+1, str) || (*str && wildcard(pattern, str+1));
-	if( *pattern=='?' )  return *str && (*str != '.') && wildcard(pattern+1, str+1);
-	return ((*str|32) == (*pattern|32)) && wildcard(pattern+1, str+1);
-}
 static double rng(uint64_t *seed) { // returns [0,1)
 	uint64_t z = (*seed += UINT64_C(0x9e3779b97f4a7c15));
 	z = (z ^ (z >> 30)) *  UINT64_C(0xbf58476d1ce4e5b9);
@@ -105,12 +112,13 @@ static unsigned next_prime(unsigned seed) {
 }
 #endif
 
-directory_entry_list dirlist_concat(directory_entry_list list1, directory_entry_list list2);
 
 char root[MAX_ROOT]; /* root for all operations */
 char realroot[MAX_ROOT]; /* full path of the tnfs root dir */
 char dirbuf[MAX_FILEPATH];
 
+int _load_directory(dir_handle *dirh, uint8_t diropts, uint8_t sortopts, uint16_t maxresults, const tnfs_pattern *pattern);
+
 int tnfs_setroot(char *rootdir)
 {
 	if (strlen(rootdir) > MAX_ROOT)
@@ -119,31 +127,25 @@ int tnfs_setroot(char *rootdir)
 #ifdef WIN32
 	GetFullPathNameA(rootdir, MAX_ROOT, realroot, NULL);
 #else
-	realpath(rootdir, realroot);
+	if (realpath(rootdir, realroot) == NULL)
+		return -1;
 #endif
 
 	strlcpy(root, rootdir, MAX_ROOT);
-	return 0;
+	return resolve_init(realroot);
 }
 
 /* validates a path points to an actual directory */
 int validate_dir(Session *s, const char *path)
 {
-	char fullpath[MAX_TNFSPATH];
 	struct stat dirstat;
-	get_root(s, fullpath, MAX_TNFSPATH);
-
-	/* relative paths are always illegal in tnfs messages */
-	if (strstr(fullpath, "../") != NULL)
-		return -1;
 
-	normalize_path(fullpath, fullpath, MAX_TNFSPATH);
 #ifdef DEBUG
-	fprintf(stderr, "validate_dir: Path='%s'\n", fullpath);
+	fprintf(stderr, "validate_dir: Path='%s/%s'\n", s->root ? s->root : "", path);
 #endif
 
-	/* check we have an actual directory */
-	if (stat(fullpath, &dirstat) == 0)
+	/* check we have an actual directory, inside the tnfs root */
+	if (resolve_stat(s, path, &dirstat) == 0)
 	{
 		if (S_ISDIR(dirstat.st_mode))
 		{
@@ -188,7 +190,7 @@ int validate_path(Session *s, const char *path)
 	fprintf(stderr, "validate path: %s::%s == ", valpath, realroot);
 #endif
 
-	if (strstr(valpath, realroot) != NULL)
+	if (resolve_inside(valpath))
 	{
 #ifdef DEBUG
 	fprintf(stderr, "PASSED\n");
@@ -280,10 +282,42 @@ void normalize_path(char *newbuf, char *oldbuf, int bufsz)
 #endif
 }
 
+/* Open a handle's directory beneath the session root, or the session
+   root itself if the path leads outside the tnfs root. dirh->path is
+   the directory opened. Returns -1 with errno set on failure */
+int _resolve_dirhandle(Session *s, dir_handle *dirh, const char *path)
+{
+	char rootpath[MAX_TNFSPATH];
+
+	if ((dirh->handle = resolve_opendir(s, path)) == NULL && errno == EXDEV)
+	{
+		get_root(s, rootpath, sizeof(rootpath));
+		normalize_path(dirh->path, rootpath, MAX_TNFSPATH);
+		dirh->handle = resolve_opendir(s, "");
+	}
+	/* not a directory on disk, but maybe inside an archive */
+	else if (dirh->handle == NULL && (errno == ENOTDIR || errno == ENOENT))
+	{
+		dirh->vdir = vfs_opendir(s, path);
+	}
+	return dirh->handle || dirh->vdir ? 0 : -1;
+}
+
+/* Close whatever a directory handle has open and release the rest */
+void dirhandle_close(dir_handle *dirh)
+{
+	if (dirh->vdir)
+		vfs_closedir(dirh->vdir);
+	else if (dirh->handle)
+		closedir(dirh->handle);
+	dirh->vdir = NULL;
+	dirh->handle = NULL;
+	dirhandle_free(dirh);
+}
+
 /* Open a directory */
 void tnfs_opendir(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 {
-	DIR *dptr;
 	char path[MAX_TNFSPATH];
 	unsigned char reply[2];
 	int i;
@@ -306,7 +340,7 @@ void tnfs_opendir(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 	/* find the first available slot in the session */
 	for (i = 0; i < MAX_DHND_PER_CONN; i++)
 	{
-		if (s->dhandles[i].handle == NULL)
+		if (!DIRHANDLE_OPEN(&s->dhandles[i]))
 		{
 #ifdef TNFS_DIR_EXT
 			/* extract options from databuf if present at eos; truncates databuf */
@@ -314,11 +348,17 @@ void tnfs_opendir(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 			if(options) *options++ = '\0';
 
 			/* extract wildcard mask from path; extra work needed if /enclosed/ in a path; truncates databuf */
-			char *mask = 0;
+			tnfs_pattern *mask = 0;
 			if(strchr((const char *)databuf,'*') || strchr((const char*)databuf,'?')) {
-				mask = strrchr((const char*)databuf,'/');
-				if(mask) *mask = '\0', mask = strdup(mask+1);
-				else mask = strdup((const char *)databuf), databuf[0] = 0;
+				char *slash = strrchr((const char*)databuf,'/');
+				if(slash) *slash = '\0', mask = pattern_compile(slash+1, PATTERN_QMARK_NODOT);
+				else mask = pattern_compile((const char *)databuf, PATTERN_QMARK_NODOT), databuf[0] = 0;
+				/* a mask that can't be compiled mustn't list everything */
+				if(!mask) {
+					hdr->status = TNFS_ENOMEM;
+					tnfs_send(s, hdr, NULL, 0);
+					return;
+				}
 			}
 
 			/* build & normalize path */
@@ -359,13 +399,13 @@ void tnfs_opendir(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 					 root, s->root, databuf);
 			normalize_path(s->dhandles[i].path, path, MAX_TNFSPATH);
 
-			/* set path to root if requested path is outside tnfs root */
-			if (!validate_path(s, s->dhandles[i].path))
-				strcpy(s->dhandles[i].path, root);
-
-			if ((dptr = opendir(s->dhandles[i].path)) != NULL)
+			/* open the session root if requested path is outside tnfs root;
+			   a virtual directory is listed all at once for READDIR to step through */
+			if (_resolve_dirhandle(s, &(s->dhandles[i]), (char *)databuf) == 0 &&
+				(s->dhandles[i].vdir == NULL ||
+				 (errno = _load_directory(&(s->dhandles[i]), TNFS_DIROPT_NO_FOLDERSFIRST | TNFS_DIROPT_NO_SKIPHIDDEN |
+										  TNFS_DIROPT_NO_SKIPSPECIAL, TNFS_DIRSORT_NONE, 0, NULL)) == 0))
 			{
-				s->dhandles[i].handle = dptr;
 #endif
 				/* send OK response */
 				hdr->status = TNFS_SUCCESS;
@@ -393,10 +433,11 @@ void tnfs_readdir(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 {
 	struct dirent *entry;
 	char reply[MAX_FILENAME_LEN];
+	const char *name = NULL;
 
 	if (datasz != 1 ||
 		*databuf > MAX_DHND_PER_CONN ||
-		s->dhandles[*databuf].handle == NULL)
+		!DIRHANDLE_OPEN(&s->dhandles[*databuf]))
 	{
 		hdr->status = TNFS_EBADF;
 		tnfs_send(s, hdr, NULL, 0);
@@ -413,7 +454,7 @@ void tnfs_readdir(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 		handle->at = (handle->at + handle->inc) % handle->total;
 		/* repeat if options and conditions do not match */
 		if(handle->do_exclude_sysnames) if(entry->d_name[0] == '.') goto repeat;
-		if(handle->wildcard) if(!wildcard(handle->wildcard, entry->d_name)) goto repeat;
+		if(handle->wildcard) if(!pattern_match(handle->wildcard, entry->d_name)) goto repeat;
 		/* stat here for 'd' and 'f' flags. bypass if needed */
 		if( handle->do_exclude_dirs ) if(entry->d_type == DT_DIR) goto repeat;
 		if( handle->do_exclude_files ) if(entry->d_type != DT_DIR) goto repeat;
@@ -422,12 +463,22 @@ void tnfs_readdir(Header *hdr, Session *s, unsigned char *databuf, int datasz)
                 /**/ if( handle->do_lowercase ) while(*p) *p++ = tolower(*p); //= *s | 32;
 	        else if( handle->do_uppercase ) while(*p) *p++ = toupper(*p); //= *s & ~32;
 	        else if( handle->do_camelcase ) while(*p) *p++ = (p == entry->d_name || p[-1] <= 32 ? toupper(*p) : tolower(*p));
+		name = entry->d_name;
 #else
-	entry = readdir(s->dhandles[*databuf].handle);
-	if (entry)
+	dir_handle *dirh = &s->dhandles[*databuf];
+	if (dirh->vdir != NULL)
+	{
+		if (dirh->position < dirh->entry_count)
+			name = dirh->listing->entries[dirh->view[dirh->position++]].entrypath;
+	}
+	else if ((entry = readdir(dirh->handle)) != NULL)
+	{
+		name = entry->d_name;
+	}
+	if (name)
 	{
 #endif
-		strlcpy(reply, entry->d_name, MAX_FILENAME_LEN);
+		strlcpy(reply, name, MAX_FILENAME_LEN);
 		hdr->status = TNFS_SUCCESS;
 		tnfs_send(s, hdr, (unsigned char *)reply, strlen(reply) + 1);
 	}
@@ -443,7 +494,7 @@ void tnfs_closedir(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 {
 	if (datasz != 1 ||
 		*databuf > MAX_DHND_PER_CONN ||
-		s->dhandles[*databuf].handle == NULL)
+		!DIRHANDLE_OPEN(&s->dhandles[*databuf]))
 	{
 		hdr->status = TNFS_EBADF;
 		tnfs_send(s, hdr, NULL, 0);
@@ -458,17 +509,13 @@ void tnfs_closedir(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 		free(handle->namelist[i]);
 	}
 	if(handle->namelist) free(handle->namelist);
-	if(handle->wildcard) free(handle->wildcard);
+	if(handle->wildcard) pattern_free(handle->wildcard);
 	free(handle);
-#else
-	closedir(s->dhandles[*databuf].handle);
+	s->dhandles[*databuf].handle = NULL;
 #endif
 
-	s->dhandles[*databuf].handle = NULL;
+	dirhandle_close(&s->dhandles[*databuf]);
 	s->dhandles[*databuf].path[0] = '\0';
-	dirlist_free(s->dhandles[*databuf].entry_list);
-	s->dhandles[*databuf].current_entry = s->dhandles[*databuf].entry_list = NULL;
-	s->dhandles[*databuf].entry_count = 0;
 
 	hdr->status = TNFS_SUCCESS;
 	tnfs_send(s, hdr, NULL, 0);
@@ -485,12 +532,9 @@ void tnfs_mkdir(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 	}
 	else
 	{
-#ifdef WIN32
-		if (mkdir(dirbuf) == 0)
-#else
-		if (mkdir(dirbuf, 0755) == 0)
-#endif
+		if (resolve_mkdir(s, (char *)buf, 0755) == 0)
 		{
+			statcache_drop(dirbuf, 0);
 			hdr->status = TNFS_SUCCESS;
 			tnfs_send(s, hdr, NULL, 0);
 		}
@@ -513,8 +557,9 @@ void tnfs_rmdir(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 	}
 	else
 	{
-		if (rmdir(dirbuf) == 0)
+		if (resolve_rmdir(s, (char *)buf) == 0)
 		{
+			statcache_drop(dirbuf, 1);
 			hdr->status = TNFS_SUCCESS;
 			tnfs_send(s, hdr, NULL, 0);
 		}
@@ -534,7 +579,7 @@ void tnfs_seekdir(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 	// followed by 4 bytes for the new position
 	if (datasz != 5 ||
 		*databuf > MAX_DHND_PER_CONN ||
-		s->dhandles[*databuf].handle == NULL)
+		!DIRHANDLE_OPEN(&s->dhandles[*databuf]))
 	{
 		hdr->status = TNFS_EBADF;
 		tnfs_send(s, hdr, NULL, 0);
@@ -547,13 +592,15 @@ void tnfs_seekdir(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 #endif
 
 	// We handle this differently depending on whether we've pre-loaded the directory or not
-	if (s->dhandles[*databuf].entry_list == NULL)
+	if (s->dhandles[*databuf].listing == NULL)
 	{
 		seekdir(s->dhandles[*databuf].handle, (long)pos);
 	}
 	else
 	{
-		s->dhandles[*databuf].current_entry = dirlist_get_node_at_index(s->dhandles[*databuf].entry_list, pos);
+		if (pos > s->dhandles[*databuf].entry_count)
+			pos = s->dhandles[*databuf].entry_count;
+		s->dhandles[*databuf].position = pos;
 	}
 #ifdef USAGELOG
 	if (pos == 0) {
@@ -576,7 +623,7 @@ void tnfs_telldir(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 	// databuf holds our directory handle: check it
 	if (datasz != 1 ||
 		*databuf > MAX_DHND_PER_CONN ||
-		s->dhandles[*databuf].handle == NULL)
+		!DIRHANDLE_OPEN(&s->dhandles[*databuf]))
 	{
 		hdr->status = TNFS_EBADF;
 		tnfs_send(s, hdr, NULL, 0);
@@ -584,13 +631,13 @@ void tnfs_telldir(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 	}
 
 	// We handle this differently depending on whether we've pre-loaded the directory or not
-	if (s->dhandles[*databuf].entry_list == NULL)
+	if (s->dhandles[*databuf].listing == NULL)
 	{
 		pos = telldir(s->dhandles[*databuf].handle);
 	}
 	else
 	{
-		pos = dirlist_get_index_for_node(s->dhandles[*databuf].entry_list, s->dhandles[*databuf].current_entry);
+		pos = s->dhandles[*databuf].position;
 	}
 
 #ifdef DEBUG
@@ -603,6 +650,216 @@ void tnfs_telldir(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 	tnfs_send(s, hdr, (unsigned char *)&pos, sizeof(pos));
 }
 
+/* The number of bytes required by the response 'header'
+ response_count (1) + dir_status (1) + dirpos (2) = 4 bytes
+*/
+#define READDIRX_HEADER_SIZE 4
+
+/* The number of bytes each entry takes not including the
+ length of the actual file/directory name
+ flags (1) + size (4) + mtime (4) + ctime(4) + NULL (1) = 14 bytes
+ */
+#define READDIRX_ENTRY_SIZE 14
+
+/* Encode a READDIRX reply holding the entries of a view from position
+   on, no more than req_count of them (0 for as many as fit) in at most
+   reply_max bytes. Returns the size of the reply and sets *next to the
+   position after the last entry in it */
+int _readdirx_encode(const dir_listing *listing, const uint32_t *view, uint32_t entry_count,
+					 uint32_t position, uint8_t req_count, int reply_max,
+					 uint8_t *reply, uint32_t *next)
+{
+	// set the reply count to 0
+	reply[0] = 0;
+	// set the status to 0
+	reply[1] = 0;
+
+	directory_entry *pThisEntry;
+	uint8_t *pEntryInReply;
+	// Start by pointing to just after the reply 'header' in the buffer
+	pEntryInReply = reply + READDIRX_HEADER_SIZE;
+
+	uint8_t count_sent = 0;
+	int total_size = READDIRX_HEADER_SIZE;
+
+	while (position < entry_count)
+	{
+		// Quit if we've reached the requested count, or what the count byte can say
+		if ((req_count != 0 && count_sent >= req_count) || count_sent == UINT8_MAX)
+			break;
+
+		pThisEntry = &listing->entries[view[position]];
+		int namelen = strlen(pThisEntry->entrypath);
+
+		// Quit if this entry won't fit in what's left of the reply buffer
+		if ((total_size + READDIRX_ENTRY_SIZE + namelen) > reply_max)
+			break;
+
+		// If this is the first entry, copy the directory position into the reply
+		if (count_sent == 0)
+			uint16tnfs(reply + 2, position);
+
+		// Copy the entry data into the appropriate spots in the reply buffer
+		pEntryInReply[0] = pThisEntry->flags;
+		uint32tnfs(pEntryInReply + 1, pThisEntry->size);
+		uint32tnfs(pEntryInReply + 5, pThisEntry->mtime);
+		uint32tnfs(pEntryInReply + 9, pThisEntry->ctime);
+		memcpy(pEntryInReply + 13, pThisEntry->entrypath, namelen + 1);
+
+		// Update our count and save it in the reply
+		count_sent++;
+		reply[0] = count_sent;
+
+		// Keep track of how much of the buffer we've used
+		total_size += READDIRX_ENTRY_SIZE + namelen;
+		// Move our pointer within the reply to the end of the current entry
+		pEntryInReply = reply + total_size;
+
+		// Point to the next directory entry
+		position++;
+	}
+
+	// If we've reached the end of the directory, set the TNFS_DIRSTATUS_EOF flag
+	if (position >= entry_count)
+		reply[1] |= TNFS_DIRSTATUS_EOF;
+
+	*next = position;
+	return total_size;
+}
+
+size_t _dirpages_bytes(const dir_pages *pages)
+{
+	return sizeof(dir_pages) + pages->entry_count * sizeof(uint32_t) +
+		   pages->pagecap * 2 * sizeof(uint32_t) + pages->datasize;
+}
+
+void _dirpages_free(dir_pages *pages)
+{
+	free(pages->view);
+	free(pages->starts);
+	free(pages->offsets);
+	free(pages->data);
+	free(pages);
+}
+
+/* Find the listing's pages for the handle's view and page geometry, or
+   start them. Only a listing that other handles can share is worth it,
+   and only for a few views of it. Returns NULL if pages aren't kept */
+dir_pages *_dirpages_find(dir_handle *dh, uint8_t req_count, int reply_max)
+{
+	dir_listing *listing = dh->listing;
+	dir_pages *pages;
+	int views = 0;
+
+	if (dh->pages && dh->pages->req_count == req_count && dh->pages->reply_max == reply_max)
+		return dh->pages;
+	dh->pages = NULL;
+
+	dirlist_lock();
+	if (listing->refs < 2)
+	{
+		dirlist_unlock();
+		return NULL;
+	}
+
+	for (pages = listing->pages; pages != NULL; pages = pages->next, views++)
+	{
+		if (pages->req_count == req_count && pages->reply_max == reply_max &&
+			pages->entry_count == dh->entry_count &&
+			memcmp(pages->view, dh->view, dh->entry_count * sizeof(uint32_t)) == 0)
+		{
+			dirlist_unlock();
+			dh->pages = pages;
+			return pages;
+		}
+	}
+	if (views >= DIRPAGES_MAX || (pages = calloc(1, sizeof(dir_pages))) == NULL)
+	{
+		dirlist_unlock();
+		return NULL;
+	}
+	pages->view = malloc((dh->entry_count + 1) * sizeof(uint32_t));
+	pages->pagecap = 16;
+	pages->starts = malloc(pages->pagecap * sizeof(uint32_t));
+	pages->offsets = malloc(pages->pagecap * sizeof(uint32_t));
+	if (pages->view == NULL || pages->starts == NULL || pages->offsets == NULL)
+	{
+		dirlist_unlock();
+		_dirpages_free(pages);
+		return NULL;
+	}
+	memcpy(pages->view, dh->view, dh->entry_count * sizeof(uint32_t));
+	pages->entry_count = dh->entry_count;
+	pages->req_count = req_count;
+	pages->reply_max = reply_max;
+	pages->starts[0] = 0;
+	pages->offsets[0] = 0;
+
+	pages->next = listing->pages;
+	listing->pages = pages;
+	listing->pagebytes += _dirpages_bytes(pages);
+	dirlist_unlock();
+	dh->pages = pages;
+	return pages;
+}
+
+/* Returns the page that starts at a position of the view, encoding it
+   if it's the next one due, or -1 if the position isn't at a page */
+int _dirpages_page(dir_listing *listing, dir_pages *pages, uint32_t position)
+{
+	uint32_t lo = 0, hi = pages->npages, mid;
+	size_t before, need;
+	void *p;
+
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (pages->starts[mid] < position)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (pages->starts[lo] != position)
+		return -1;
+	if (lo < pages->npages)
+		return lo;
+	if (position >= pages->entry_count)
+		return -1;
+
+	/* make room for the next page */
+	before = _dirpages_bytes(pages);
+	if (pages->npages + 2 > pages->pagecap)
+	{
+		if ((p = realloc(pages->starts, pages->pagecap * 2 * sizeof(uint32_t))) == NULL)
+			return -1;
+		pages->starts = p;
+		if ((p = realloc(pages->offsets, pages->pagecap * 2 * sizeof(uint32_t))) == NULL)
+			return -1;
+		pages->offsets = p;
+		pages->pagecap *= 2;
+	}
+	need = pages->offsets[lo] + pages->reply_max;
+	if (need > pages->datasize)
+	{
+		if (need < pages->datasize * 2)
+			need = pages->datasize * 2;
+		if ((p = realloc(pages->data, need)) == NULL)
+			return -1;
+		pages->data = p;
+		pages->datasize = need;
+	}
+	dirlist_lock();
+	listing->pagebytes += _dirpages_bytes(pages) - before;
+	dirlist_unlock();
+
+	pages->offsets[lo + 1] = pages->offsets[lo] +
+		_readdirx_encode(listing, pages->view, pages->entry_count, position,
+						 pages->req_count, pages->reply_max,
+						 pages->data + pages->offsets[lo], &pages->starts[lo + 1]);
+	pages->npages++;
+	return lo;
+}
+
 /* Read a directory entry and provide extended results */
 void tnfs_readdirx(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 {
@@ -623,7 +880,7 @@ void tnfs_readdirx(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 	// databuf holds our directory handle followed by number of entries requested
 	if (datasz != 2 ||
 		(sid = databuf[0]) > MAX_DHND_PER_CONN ||
-		s->dhandles[sid].handle == NULL)
+		!DIRHANDLE_OPEN(&s->dhandles[sid]))
 	{
 		hdr->status = TNFS_EBADF;
 		tnfs_send(s, hdr, NULL, 0);
@@ -645,322 +902,438 @@ void tnfs_readdirx(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 #endif
 
 	// Return EOF if we're already at the end of the list
-	if (dh->current_entry == NULL)
+	if (dh->listing == NULL || dh->position >= dh->entry_count)
 	{
 #ifdef DEBUG
 		TNFSMSGLOG(hdr, "readdirx no more entries - returning EOF");
 #endif
 		hdr->status = TNFS_EOF;
 		tnfs_send(s, hdr, NULL, 0);
+		return;
 	}
 
 #ifdef DEBUG
 	TNFSMSGLOG(hdr, "readdirx request for %hu entries", req_count);
 #endif
 
-/* The number of bytes required by the response 'header'
- response_count (1) + dir_status (1) + dirpos (2) = 4 bytes
-*/
-#define READDIRX_HEADER_SIZE 4
-
-/* The number of bytes each entry takes not including the
- length of the actual file/directory name
- flags (1) + size (4) + mtime (4) + ctime(4) + NULL (1) = 14 bytes
- */
-#define READDIRX_ENTRY_SIZE 14
-
-	// our reply must hold up to TNFS_MAX_PAYLOAD bytes
-	uint8_t reply[TNFS_MAX_PAYLOAD];
-	// set the reply count to 0
-	reply[0] = 0;
-	// set the status to 0
-	reply[1] = 0;
+	// our reply may hold up to the session's largest payload, which is
+	// TNFS_MAX_PAYLOAD bytes unless more was negotiated over TCP
+	int reply_max = s->maxmsgsz - TNFS_HEADERSZ - 1;
+	uint8_t *reply;
+	int total_size;
 
-	directory_entry *pThisEntry, *pEntryInReply;
-	// Start by pointing to just after the reply 'header' in the buffer
-	pEntryInReply = (directory_entry *)(reply + READDIRX_HEADER_SIZE);
+	// Serve the page already made for this view if there is one
+	dir_pages *pages = _dirpages_find(dh, req_count, reply_max);
+	int page = pages ? _dirpages_page(dh->listing, pages, dh->position) : -1;
 
-	uint8_t count_sent = 0;
-	int total_size = READDIRX_HEADER_SIZE;
-
-	while (dh->current_entry != NULL)
+	if (page >= 0)
 	{
-		// Quit if we've reached the requested count
-		if (req_count != 0 && count_sent >= req_count)
-			break;
-
-		pThisEntry = &dh->current_entry->entry;
-		int namelen = strlen(pThisEntry->entrypath);
-
-		// Quit if this entry won't fit in what's left of the reply buffer
-		if ((total_size + READDIRX_ENTRY_SIZE + namelen) > sizeof(reply))
-			break;
-
-		// If this is the first entry, copy the directory position into the reply
-		if (count_sent == 0)
-			uint16tnfs(reply + 2, dirlist_get_index_for_node(dh->entry_list, dh->current_entry));
-
-		// Copy the entry data into the appropriate spots in the reply buffer
-		strcpy(pEntryInReply->entrypath, pThisEntry->entrypath);
-
-		pEntryInReply->flags = pThisEntry->flags;
-		uint32tnfs((unsigned char *)&pEntryInReply->size, pThisEntry->size);
-		uint32tnfs((unsigned char *)&pEntryInReply->mtime, pThisEntry->mtime);
-		uint32tnfs((unsigned char *)&pEntryInReply->ctime, pThisEntry->ctime);
-
-		// Update our count and save it in the reply
-		count_sent++;
-		reply[0] = count_sent;
-
-		// Keep track of how much of the buffer we've used
-		total_size += READDIRX_ENTRY_SIZE + namelen;
-		// Move our pointer within the reply to the end of the current entry
-		pEntryInReply = (directory_entry *)(reply + total_size);
-
-		// Point to the next directory entry
-		dh->current_entry = dh->current_entry->next;
+		reply = pages->data + pages->offsets[page];
+		total_size = pages->offsets[page + 1] - pages->offsets[page];
+		dh->position = pages->starts[page + 1];
+	}
+	else
+	{
+		// encoded straight into the reply
+		reply = tnfs_replybuf(s, hdr);
+		total_size = _readdirx_encode(dh->listing, dh->view, dh->entry_count, dh->position,
+									  req_count, reply_max, reply, &dh->position);
 	}
-
-	// If we've reached the end of the directory, set the TNFS_DIRSTATUS_EOF flag
-	if(dh->current_entry == NULL)
-		reply[1] |= TNFS_DIRSTATUS_EOF;
 
 	// Respond with whatever we've collected
 	hdr->status = TNFS_SUCCESS;
 #ifdef DEBUG
-	TNFSMSGLOG(hdr, "readdirx responding with %hu entries, status_flags=0x%x", reply[0], reply[1]);
+	TNFSMSGLOG(hdr, "readdirx responding with %hu entries, status_flags=0x%x%s", reply[0], reply[1],
+			   page >= 0 ? " (cached page)" : "");
 #endif
 	tnfs_send(s, hdr, reply, total_size);
 }
 
-// Returns false if pattern doesn't match, otherwise true
-bool _pattern_match(const char *src, const char *pattern)
+/* Returns true if an entry passes the listing options */
+bool _dirlist_keep(const directory_entry *entry, uint8_t diropts, const tnfs_pattern *pattern)
 {
-	if (src == NULL || pattern == NULL)
+	/* If it's not a directory and we have a pattern that this doesn't match, skip it
+		Ignore the directory qualification if TNFS_DIROPT_DIR_PATTERN is set */
+	if ((diropts & TNFS_DIROPT_DIR_PATTERN) || !(entry->flags & FILEINFOFLAG_DIRECTORY))
+	{
+		if (pattern != NULL && pattern_match(pattern, entry->entrypath) == false)
+			return false;
+	}
+
+	// Skip this if it's hidden (assuming TNFS_DIROPT_NO_SKIPHIDDEN isn't set)
+	if (!(diropts & TNFS_DIROPT_NO_SKIPHIDDEN) && (entry->flags & FILEINFOFLAG_HIDDEN))
 		return false;
 
-	int m = strlen(pattern);
-	int n = strlen(src);
+	// Skip this if it's special (assuming TNFS_DIROPT_NO_SKIPSPECIAL isn't set)
+	if (!(diropts & TNFS_DIROPT_NO_SKIPSPECIAL) && (entry->flags & FILEINFOFLAG_SPECIAL))
+		return false;
 
-#ifdef DEBUG
-	fprintf(stderr, "Pattern match: \"%s\", \"%s\" = ", src, pattern);
-#endif
-	// Empty pattern can only match with empty string
-	if (m == 0)
-		return (n == 0);
+	return true;
+}
 
-	// Lookup table for storing results of subproblems
-	bool lookup[n + 1][m + 1];
+/* A checksum of everything READDIRX returns for a handle's view, which
+   a client can hand back to OPENDIRX to learn nothing has changed.
+   Never 0, so a client without one can send that */
+uint32_t _dirlist_token(const dir_handle *dirh)
+{
+	const directory_entry *e;
+	unsigned char fields[READDIRX_ENTRY_SIZE - 1];
+	uint32_t i, crc = 0;
 
-	// Initailze lookup table to false
-	memset(lookup, false, sizeof(lookup));
+	for (i = 0; i < dirh->entry_count; i++)
+	{
+		e = &dirh->listing->entries[dirh->view[i]];
+		fields[0] = e->flags;
+		uint32tnfs(fields + 1, e->size);
+		uint32tnfs(fields + 5, e->mtime);
+		uint32tnfs(fields + 9, e->ctime);
+		crc = crc32c(crc, fields, sizeof(fields));
+		crc = crc32c(crc, e->entrypath, strlen(e->entrypath) + 1);
+	}
+	return crc ? crc : 1;
+}
 
-	// Empty pattern can match with empty string
-	lookup[0][0] = true;
+/* Build the handle's view of its listing: the entries that pass the
+   options, directories first unless TNFS_DIROPT_NO_FOLDERSFIRST is set,
+   in the order asked for. Nothing is sorted here, the view is read off
+   the listing's permutation for the sort key, backwards for descending.
+   With TNFS_DIROPT_TOKEN the view's token is worked out too. Returns
+   errno on failure, otherwise zero */
+int _dirlist_view(dir_handle *dirh, uint8_t diropts, uint8_t sortopts, uint16_t maxresults, const tnfs_pattern *pattern)
+{
+	dir_listing *listing = dirh->listing;
+	const uint32_t *order = NULL;
+	uint8_t *keep;
+	uint32_t i, n, kept = 0;
+	int pass;
+
+	if ((keep = malloc(listing->count + 1)) == NULL ||
+		(dirh->view = malloc((listing->count + 1) * sizeof(uint32_t))) == NULL)
+	{
+		free(keep);
+		return ENOMEM;
+	}
 
-	// Only '*' can match with empty string
-	for (int j = 1; j <= m; j++)
-		if (pattern[j - 1] == '*')
-			lookup[0][j] = lookup[0][j - 1];
+	// A max applies to the entries in the order they were read, as if the
+	// directory had been read no further
+	for (i = 0; i < listing->count; i++)
+	{
+		keep[i] = (!maxresults || kept < maxresults) &&
+				  _dirlist_keep(&listing->entries[i], diropts, pattern);
+		kept += keep[i];
+	}
+
+	if (!(sortopts & TNFS_DIRSORT_NONE))
+		order = dirlist_order(listing, sortopts);
+	bool reverse = order != NULL && (sortopts & TNFS_DIRSORT_DESCENDING);
+	bool foldersfirst = !(diropts & TNFS_DIROPT_NO_FOLDERSFIRST);
 
-	// Fill the table in bottom-up fashion
-	for (int i = 1; i <= n; i++)
+	// With folders first, the first pass takes the directories and the
+	// second everything else
+	for (pass = foldersfirst ? 0 : 2; pass < (foldersfirst ? 2 : 3); pass++)
 	{
-		for (int j = 1; j <= m; j++)
+		for (n = 0; n < listing->count; n++)
 		{
-			// Two cases if we see a '*':
-			// a) We ignore '*' character and move to next character in the pattern,
-			//     i.e., '*' indicates an empty sequence.
-			// b) '*' character matches with i-th character in input
-			if (pattern[j - 1] == '*')
-			{
-				lookup[i][j] = lookup[i][j - 1] || lookup[i - 1][j];
-
-			// Current characters are considered matching in two cases:
-			// (a) current character of pattern is '?'
-			// (b) characters actually match (case insensitive)
-			} else if (pattern[j - 1] == '?' ||
-				 (src[i - 1] == pattern[j - 1]) ||
-				 (tolower(src[i - 1]) == tolower(pattern[j - 1])))
-			{
-				lookup[i][j] = lookup[i - 1][j - 1];
-			}
-			// If characters don't match
-			else
-				lookup[i][j] = false;
+			i = order ? order[reverse ? listing->count - 1 - n : n] : n;
+			if (!keep[i])
+				continue;
+			bool isdir = (listing->entries[i].flags & FILEINFOFLAG_DIRECTORY) != 0;
+			if ((pass == 0 && !isdir) || (pass == 1 && isdir))
+				continue;
+			dirh->view[dirh->entry_count++] = i;
 		}
 	}
-	bool result = lookup[n][m];
 
-#ifdef DEBUG
-	fprintf(stderr, "%s\n", result ? "TRUE" : "FALSE");
-#endif
-	return result;
+	free(keep);
+	dirh->position = 0;
+	if (diropts & TNFS_DIROPT_TOKEN)
+		dirh->token = _dirlist_token(dirh);
+	return 0;
 }
 
-/* Returns errno on failure, otherwise zero */
-int _load_directory(dir_handle *dirh, uint8_t diropts, uint8_t sortopts, uint16_t maxresults, const char *pattern)
+void dirhandle_free(dir_handle *dirh)
 {
-	struct dirent *entry;
+	dirlist_release(dirh->listing);
+	free(dirh->view);
+	dirh->listing = NULL;
+	dirh->view = NULL;
+	dirh->entry_count = 0;
+	dirh->position = 0;
+	dirh->pages = NULL;
+}
+
+typedef struct _statbatch
+{
+	dir_listing *listing;
+	uint8_t *ok;		/* whether each entry's details were found */
+	int cached;			/* whether to go through the stat() cache */
+} statbatch;
+
+/* Fills in the details of a range of listing entries; runs on the
+   worker threads */
+void _load_stat(void *ctx, uint32_t begin, uint32_t end)
+{
+	statbatch *batch = (statbatch *)ctx;
 	char statpath[MAX_TNFSPATH];
 	char temp_statpath[MAX_TNFSPATH*2];
+	directory_entry *e;
+	fileinfo_t finf;
+#ifndef WIN32
+	struct stat st;
+#endif
+	uint32_t i;
 
-	// Free any existing entries
-	dirlist_free(dirh->entry_list);
-	dirh->entry_count = 0;
+	for (i = begin; i < end; i++)
+	{
+		e = &batch->listing->entries[i];
+		snprintf(temp_statpath, sizeof(temp_statpath), "%s%c%s", batch->listing->path, FILEINFO_PATHSEPARATOR, e->entrypath);
+		strncpy(statpath, temp_statpath, sizeof(statpath));
+#ifdef WIN32
+		batch->ok[i] = get_fileinfo(statpath, &finf) == 0;
+#else
+		if (batch->cached)
+			batch->ok[i] = statcache_stat(statpath, &st) == 0;
+		else
+			batch->ok[i] = stat(statpath, &st) == 0;
+		if (batch->ok[i])
+			fileinfo_fromstat(statpath, &st, &finf);
+#endif
+		if (batch->ok[i])
+		{
+			e->flags = finf.flags;
+			e->size = finf.size;
+			e->mtime = finf.m_time;
+			e->ctime = finf.c_time;
+			vfs_listentry(batch->listing->path, e);
+		}
+	}
+}
 
-	if ((dirh->handle = opendir(dirh->path)) == NULL)
-		return errno;
+/* Fill in the details of every entry in a listing, dropping any that
+   can't be stat()ed. Returns errno on failure, otherwise zero */
+int _load_details(dir_listing *listing)
+{
+	if (listing->count == 0)
+		return 0;
 
-	// A list to hold all subdirectory names
-	directory_entry_list list_dirs = NULL;
-	// A list to hold all normal file names
-	directory_entry_list list_files = NULL;
-	uint16_t entrycount = 0;
+	// Over a network each stat() is a round trip, so they're shared out
+	// across the worker threads rather than made one after another
+	// Entries that haven't changed since the directory was last read
+	// come from the stat() cache, which must be watching first
+	statbatch batch;
+	batch.listing = listing;
+	batch.cached = statcache_watch(listing->path) == 0;
+	if ((batch.ok = malloc(listing->count)) == NULL)
+		return ENOMEM;
+	taskpool_parallel(_load_stat, &batch, listing->count, DIRLOAD_CHUNK);
+
+	// Drop any entries that couldn't be stat()ed, keeping the read order
+	uint32_t i, kept = 0;
+	for (i = 0; i < listing->count; i++)
+	{
+		if (batch.ok[i])
+			listing->entries[kept++] = listing->entries[i];
+	}
+	listing->count = kept;
+	free(batch.ok);
 
-	// Read every entry
-	while ((entry = readdir(dirh->handle)) != NULL)
+	return 0;
+}
+
+/* Read the entries of an open directory into a listing: from the
+   directory index when it's current, otherwise by reading and stat()ing
+   every entry. Returns errno on failure, otherwise zero */
+int _load_listing(dir_listing *listing, DIR *dh)
+{
+	struct dirent *entry;
+#ifdef ENABLE_DIRINDEX
+	directory_entry *e;
+	int verify;
+#endif
+
+#ifdef ENABLE_DIRINDEX
+	/* Use the prebuilt index if it still matches what's on disk,
+	   saving reading the directory, and once it's being watched a
+	   stat() for every entry too */
+	const dirindex_dir *indexed = dirindex_lookup(listing->path, dirfd(dh), &verify);
+	if (indexed != NULL)
 	{
-		// Try to stat the file before we can decide on other things
-		fileinfo_t finf;
-		snprintf(temp_statpath, sizeof(temp_statpath), "%s%c%s", dirh->path, FILEINFO_PATHSEPARATOR, entry->d_name);
-		strncpy(statpath, temp_statpath, sizeof(statpath));
-		if (get_fileinfo(statpath, &finf) == 0)
+		const dirindex_entry *ie = dirindex_entries(indexed);
+		uint32_t n;
+
+		for (n = 0; n < indexed->count; n++)
 		{
-			/* If it's not a directory and we have a pattern that this doesn't match, skip it
-				Ignore the directory qualification if TNFS_DIROPT_DIR_PATTERN is set */
-			if ((diropts & TNFS_DIROPT_DIR_PATTERN) || !(finf.flags & FILEINFOFLAG_DIRECTORY))
+			if ((e = dirlist_add(listing, dirindex_string(ie[n].name))) == NULL)
 			{
-				if (pattern != NULL && _pattern_match(entry->d_name, pattern) == false)
-					continue;
+				dirindex_release();
+				return ENOMEM;
 			}
-
-			// Skip this if it's hidden (assuming TNFS_DIROPT_NO_SKIPHIDDEN isn't set)
-			if (!(diropts & TNFS_DIROPT_NO_SKIPHIDDEN) && (finf.flags & FILEINFOFLAG_HIDDEN))
+			if (verify)
 				continue;
+			e->flags = ie[n].flags;
+			e->size = ie[n].size;
+			e->mtime = ie[n].mtime;
+			e->ctime = ie[n].ctime;
+			vfs_listentry(listing->path, e);
+		}
+		dirindex_release();
+		return verify ? _load_details(listing) : 0;
+	}
+#endif
 
-			// Skip this if it's special (assuming TNFS_DIROPT_NO_SKIPSPECIAL isn't set)
-			if (!(diropts & TNFS_DIROPT_NO_SKIPSPECIAL) && (finf.flags & FILEINFOFLAG_SPECIAL))
-				continue;
+	// Read every name first, then fill in the details of all of them
+	while ((entry = readdir(dh)) != NULL)
+	{
+		if (dirlist_add(listing, entry->d_name) == NULL)
+			return ENOMEM;
+	}
+	return _load_details(listing);
+}
+
+/* Reads the directory open on the handle. Returns errno on failure,
+   otherwise zero */
+int _load_directory(dir_handle *dirh, uint8_t diropts, uint8_t sortopts, uint16_t maxresults, const tnfs_pattern *pattern)
+{
+	int result;
+
+	// Let go of any previous listing
+	dirhandle_free(dirh);
 
-			// Create a new directory_entry_node to add to our list
-			directory_entry_list_node *node = calloc(1, sizeof(directory_entry_list_node));
+	// A listing another handle loaded recently is as good as reading it again
+	if ((dirh->listing = dircache_lookup(dirh->path)) != NULL)
+	{
+		result = 0;
+	}
+	else if ((dirh->listing = dirlist_new(dirh->path)) == NULL)
+	{
+		result = ENOMEM;
+	}
+	else if (dirh->vdir != NULL)
+	{
+		// Archives keep an index of their own
+		result = vfs_loaddir(dirh->vdir, dirh->listing);
+	}
+	else
+	{
+		dircache_stamp(dirh->listing);
+		if ((result = _load_listing(dirh->listing, dirh->handle)) == 0)
+			dircache_insert(dirh->listing);
+		else
+			dircache_abandon(dirh->listing);
+	}
 
-			// Copy the name into the node
-			strlcpy(node->entry.entrypath, entry->d_name, MAX_FILENAME_LEN);
+	if (result == 0)
+		result = _dirlist_view(dirh, diropts, sortopts, maxresults, pattern);
 
-			directory_entry_list *list_dest_p = &list_files;
+	if (result != 0)
+		dirhandle_close(dirh);
+	return result;
+}
 
-			if (finf.flags & FILEINFOFLAG_DIRECTORY)
-			{
-				node->entry.flags = finf.flags;
-				/* If the TNFS_DIROPT_NO_FOLDERSFIRST 0x01  flag hasn't been set, put this node
-				   in a separate list for directories so they're sorted separately */
-				if (!(diropts & TNFS_DIROPT_NO_FOLDERSFIRST))
-					list_dest_p = &list_dirs;
-			}
-			node->entry.size = finf.size;
-			node->entry.mtime = finf.m_time;
-			node->entry.ctime = finf.c_time;
+/* Parse the arguments shared by OPENDIRX and SEARCH.
+   Returns -1 if the request is malformed */
+int _opendirx_args(Header *hdr, unsigned char *databuf, int datasz,
+				   uint8_t *diropts, uint8_t *sortopts, uint16_t *maxresults,
+				   uint32_t *token, char **pPattern, char **pDirpath)
+{
+	int i;
+	int start = 4;
 
-			dirlist_push(list_dest_p, node);
-			entrycount++;
+	// With TNFS_DIROPT_TOKEN the client's token comes before the pattern
+	if (datasz > 0 && (databuf[0] & TNFS_DIROPT_TOKEN))
+		start = 8;
 
-			// If we were given a max, break if we've reached it
-			if (maxresults > 0 && entrycount >= maxresults)
-				break;
+	// We should have a minimum of 7 bytes in the request (11 with a token)
+	// And the buffer should be null-terminated
+	if ((datasz < start + 3) || (*(databuf + datasz - 1) != 0))
+	{
 #ifdef DEBUG
-			//fprintf(stderr, "_load_directory added \"%s\" %u\n", node->entry.entrypath, node->entry.size);
+		TNFSMSGLOG(hdr, "Invalid argument count or missing NULL terminator");
 #endif
-		}
+		return -1;
 	}
 
-	// Sort the two lists (assuming TNFS_DIRSORT_NONE isn't set)
-	if (!(sortopts & TNFS_DIRSORT_NONE))
+	*diropts = databuf[0];
+	*sortopts = databuf[1];
+	*maxresults = tnfs16uint(databuf + 2);
+	*token = start == 8 ? tnfs32uint(databuf + 4) : 0;
+	*pPattern = (char *)(databuf + start);
+
+	// If there's no NULL between the glob pattern and the directory name,
+	// just assume there's no glob pattern rather than return an error
+	i = strlen(*pPattern);
+	if (i + start + 1 == datasz)
 	{
-		if (list_dirs != NULL)
-			dirlist_sort(&list_dirs, sortopts);
-		if (list_files != NULL)
-			dirlist_sort(&list_files, sortopts);
+		*pDirpath = *pPattern;
+		*pPattern = NULL;
 	}
-
-	// Combine the two lists into one
-	dirh->entry_list = dirlist_concat(list_dirs, list_files);
-	dirh->entry_count = entrycount;
-
-#ifdef DEBUG
-/*
-	fprintf(stderr, "RETURNING LIST:\n");
-	directory_entry_list _dl = dirh->entry_list;
-	while (_dl)
+	else
 	{
-		fprintf(stderr, "\t%s\n", _dl->entry.entrypath);
-		_dl = _dl->next;
+		*pDirpath = *pPattern + i + 1;
 	}
-*/
+	if (i == 0)
+		*pPattern = NULL;
+
+#ifdef DEBUG
+	TNFSMSGLOG(hdr, "%s: diropt=0x%02x, sortopt=0x%02x, max=0x%04hx, pat=\"%s\", path=\"%s\"",
+			hdr->cmd == TNFS_SEARCH ? "search" : "opendirx",
+			*diropts, *sortopts, *maxresults, *pPattern ? *pPattern : "", *pDirpath);
 #endif
+	return 0;
+}
 
-	dirh->current_entry = dirh->entry_list;
+/* Reply to OPENDIRX or SEARCH with the handle and how many entries it
+   lists, and with TNFS_DIROPT_TOKEN the listing's token. A listing that
+   matches the token the client already has isn't kept open */
+void _opendirx_reply(Header *hdr, Session *s, int i, uint8_t diropts, uint32_t token)
+{
+	dir_handle *dirh = &s->dhandles[i];
+	unsigned char reply[7];
+	int replysz = 3;
 
-	return 0;
+	reply[0] = (unsigned char)i;
+	uint16tnfs(reply + 1, dirh->entry_count);
+	if (diropts & TNFS_DIROPT_TOKEN)
+	{
+		uint32tnfs(reply + 3, dirh->token);
+		replysz = 7;
+		if (dirh->token == token)
+		{
+			reply[0] = TNFS_DIRHANDLE_UNCHANGED;
+			dirhandle_close(dirh);
+		}
+	}
+	hdr->status = TNFS_SUCCESS;
+	tnfs_send(s, hdr, reply, replysz);
 }
 
 /* Open a directory with additional options */
 void tnfs_opendirx(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 {
 	char path[MAX_TNFSPATH];
-	unsigned char reply[3];
 
 	uint8_t diropts;
 	uint8_t sortopts;
 	uint16_t maxresults;
+	uint32_t token;
 	uint8_t result;
 	char *pPattern;
 	char *pDirpath;
+	tnfs_pattern *pattern;
 
 	int i;
 
-	// We should have a minimum of 7 bytes in the request
-	// And the buffer should be null-terminated
-	if ((datasz < 7) || (*(databuf + datasz - 1) != 0))
+	if (_opendirx_args(hdr, databuf, datasz, &diropts, &sortopts, &maxresults, &token, &pPattern, &pDirpath) < 0)
 	{
-#ifdef DEBUG
-		TNFSMSGLOG(hdr, "Invalid argument count or missing NULL terminator");
-#endif
 		hdr->status = TNFS_EINVAL;
 		tnfs_send(s, hdr, NULL, 0);
 		return;
 	}
 
-	diropts = databuf[0];
-	sortopts = databuf[1];
-	maxresults = tnfs16uint(databuf + 2);
-	pPattern = (char *)(databuf + 4);
-
-	// If there's no NULL between the glob pattern and the directory name,
-	// just assume there's no glob pattern rather than return an error
-	i = strlen(pPattern);
-	if (i + 5 == datasz)
-	{
-		pDirpath = pPattern;
-		pPattern = NULL;
-	}
-	else
-	{
-		pDirpath = pPattern + i + 1;
-	}
-	if (i == 0)
-		pPattern = NULL;
-
-#ifdef DEBUG
-	TNFSMSGLOG(hdr, "opendirx: diropt=0x%02x, sortopt=0x%02x, max=0x%04hx, pat=\"%s\", path=\"%s\"",
-			diropts, sortopts, maxresults, pPattern ? pPattern : "", pDirpath);
-#endif
-
 	/* find the first available slot in the session */
 	for (i = 0; i < MAX_DHND_PER_CONN; i++)
 	{
-		if (s->dhandles[i].handle == NULL)
+		if (!DIRHANDLE_OPEN(&s->dhandles[i]))
 		{
 			snprintf(path, sizeof(path), "%s/%s/%s",
 					 root, s->root, pDirpath);
@@ -968,21 +1341,32 @@ void tnfs_opendirx(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 			// Remove any doubled-up path separators
 			normalize_path(s->dhandles[i].path, path, MAX_TNFSPATH);
 
-			/* set path to root if requested path is outside tnfs root */
-			if (!validate_path(s, s->dhandles[i].path))
-				strcpy(s->dhandles[i].path, root);
-
-			result = _load_directory(&(s->dhandles[i]), diropts, sortopts, maxresults, pPattern);
+			/* open the session root if requested path is outside tnfs root */
+			if (_resolve_dirhandle(s, &(s->dhandles[i]), pDirpath) != 0)
+			{
+				result = errno;
+			}
+			else
+			{
+				// Compile the pattern once rather than re-parsing it for every entry;
+				// one that can't be compiled mustn't list everything
+				pattern = pPattern ? pattern_compile(pPattern, 0) : NULL;
+				if (pPattern && pattern == NULL)
+				{
+					dirhandle_close(&(s->dhandles[i]));
+					result = ENOMEM;
+				}
+				else
+					result = _load_directory(&(s->dhandles[i]), diropts, sortopts, maxresults, pattern);
+				pattern_free(pattern);
+			}
 			if (result == 0)
 			{
 				/* send OK response */
-				hdr->status = TNFS_SUCCESS;
 				#ifdef DEBUG
 				TNFSMSGLOG(hdr, "opendirx response: handle=%hu, count=%hu", i, s->dhandles[i].entry_count);
 				#endif
-				reply[0] = (unsigned char) i;
-				uint16tnfs(reply + 1, s->dhandles[i].entry_count);
-				tnfs_send(s, hdr, reply, 3);
+				_opendirx_reply(hdr, s, i, diropts, token);
 			}
 			else
 			{
@@ -1000,157 +1384,537 @@ void tnfs_opendirx(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 	tnfs_send(s, hdr, NULL, 0);
 }
 
-// Attaches list2 to the end of list1 and returns the head of the result
-// Return will be list2 if list1 is NULL
-directory_entry_list dirlist_concat(directory_entry_list list1, directory_entry_list list2)
+int tnfs_opendirx_cached(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 {
-	if (list1 == NULL)
-		return list2;
-
-	// Get to the end of the first list
-	directory_entry_list_node *pEnd = list1;
-	while (pEnd->next != NULL)
-		pEnd = pEnd->next;
+	char path[MAX_TNFSPATH];
+	char dirpath[MAX_TNFSPATH];
+	uint8_t diropts;
+	uint8_t sortopts;
+	uint16_t maxresults;
+	uint32_t token;
+	char *pPattern;
+	char *pDirpath;
 
-	pEnd->next = list2;
-	return list1;
+	/* a malformed one is refused at once */
+	if (_opendirx_args(hdr, databuf, datasz, &diropts, &sortopts, &maxresults, &token, &pPattern, &pDirpath) < 0)
+		return 1;
+	snprintf(path, sizeof(path), "%s/%s/%s", root, s->root, pDirpath);
+	normalize_path(dirpath, path, MAX_TNFSPATH);
+	return dircache_watched(dirpath);
 }
 
-void dirlist_push(directory_entry_list *dlist, directory_entry_list_node *node)
+typedef struct _search_results
 {
-	if (dlist == NULL || node == NULL)
-		return;
-
-	// This entry becomes the head, any current head becomes the second node
-	node->next = *dlist;
-	*dlist = node;
-}
+	dir_listing *listing;
+	uint8_t diropts;
+	uint16_t maxresults;
+} search_results;
 
-/* Returns poitner to node at index given or NULL if no such index */
-directory_entry_list_node *dirlist_get_node_at_index(directory_entry_list dlist, uint32_t index)
+/* Adds one search match to the listing, returns false once it's full */
+bool _search_collect(const char *relpath, void *ctx)
 {
-	uint32_t i = 0;
-	while (dlist && i++ < index)
-		dlist = dlist->next;
+	search_results *r = (search_results *)ctx;
+	char statpath[MAX_FILEPATH];
+	directory_entry *e;
+	fileinfo_t finf;
+	const char *p;
+
+	// Matches inside hidden directories are hidden too
+	if (!(r->diropts & TNFS_DIROPT_NO_SKIPHIDDEN))
+	{
+		for (p = relpath; p != NULL; p = strchr(p, '/'))
+		{
+			if (*p == '/')
+				p++;
+			if (*p == '.')
+				return true;
+		}
+	}
 
-	return dlist;
-}
+	snprintf(statpath, sizeof(statpath), "%s%c%s", r->listing->path, FILEINFO_PATHSEPARATOR, relpath);
+	if (get_fileinfo(statpath, &finf) != 0)
+		return true;
 
-/* Returns poitner to node at index given or NULL if no such index */
-uint32_t dirlist_get_index_for_node(directory_entry_list dlist, directory_entry_list_node *node)
-{
-	uint32_t i = 0;
-	while (dlist)
+	if ((e = dirlist_add(r->listing, relpath)) == NULL)
+		return false;
+	e->flags = finf.flags;
+	e->size = finf.size;
+	e->mtime = finf.m_time;
+	e->ctime = finf.c_time;
+	vfs_listentry(r->listing->path, e);
+
+	// Only count what the view will show
+	if (!_dirlist_keep(e, r->diropts, NULL))
 	{
-		if (dlist == node)
-			break;
-		dlist = dlist->next;
-		i++;
+		r->listing->count--;
+		return true;
 	}
 
-	return i;
+	// The count in the reply is 16 bits, so that's the limit without a max
+	return r->listing->count < (r->maxresults > 0 ? r->maxresults : UINT16_MAX);
 }
 
-/* Free the linked list of directory entries */
-void dirlist_free(directory_entry_list dlist)
+/* Returns errno on failure, otherwise zero */
+int _search_directory(dir_handle *dirh, uint8_t diropts, uint8_t sortopts, uint16_t maxresults, const tnfs_pattern *pattern)
 {
-	while (dlist)
+	search_results r;
+	int result;
+
+	// Let go of any previous listing. The directory stays open to hold
+	// the handle, as for OPENDIRX
+	dirhandle_free(dirh);
+
+	// Results are particular to the search, so they're never cached
+	if ((dirh->listing = dirlist_new(dirh->path)) == NULL)
+	{
+		result = ENOMEM;
+	}
+	else
 	{
-		directory_entry_list_node *next = dlist->next;
-		free(dlist);
-		dlist = next;
+		r.listing = dirh->listing;
+		r.diropts = diropts;
+		r.maxresults = maxresults;
+
+		result = search_find(dirh->path, pattern, (diropts & TNFS_DIROPT_DIR_PATTERN) != 0, _search_collect, &r);
+		if (result == 0)
+			result = _dirlist_view(dirh, diropts, sortopts, 0, NULL);
 	}
+
+	if (result != 0)
+		dirhandle_close(dirh);
+	return result;
 }
 
-directory_entry_list _mergesort_merge(directory_entry_list list_left, directory_entry_list list_right, uint8_t sortopts)
+/* Search a directory and everything below it for matching names.
+   Takes the same arguments as OPENDIRX; the handle it returns lists
+   the matches by their paths relative to the directory searched */
+void tnfs_search(Header *hdr, Session *s, unsigned char *databuf, int datasz)
 {
-	if (list_left == NULL)
-		return list_right;
-	if (list_right == NULL)
-		return list_left;
+	char path[MAX_TNFSPATH];
 
-	directory_entry_list result;
+	uint8_t diropts;
+	uint8_t sortopts;
+	uint16_t maxresults;
+	uint32_t token;
+	uint8_t result;
+	char *pPattern;
+	char *pDirpath;
+	tnfs_pattern *pattern;
 
-	int r;
-	// Sort by size
-	if (sortopts & TNFS_DIRSORT_SIZE)
+	int i;
+
+	if (_opendirx_args(hdr, databuf, datasz, &diropts, &sortopts, &maxresults, &token, &pPattern, &pDirpath) < 0)
 	{
-		r = list_left->entry.size - list_right->entry.size;
+		hdr->status = TNFS_EINVAL;
+		tnfs_send(s, hdr, NULL, 0);
+		return;
 	}
-	// Sort by modified timestamp
-	else if (sortopts & TNFS_DIRSORT_MODIFIED)
+
+	/* find the first available slot in the session */
+	for (i = 0; i < MAX_DHND_PER_CONN; i++)
 	{
-		r = list_left->entry.mtime - list_right->entry.mtime;
+		if (!DIRHANDLE_OPEN(&s->dhandles[i]))
+		{
+			snprintf(path, sizeof(path), "%s/%s/%s",
+					 root, s->root, pDirpath);
+
+			// Remove any doubled-up path separators
+			normalize_path(s->dhandles[i].path, path, MAX_TNFSPATH);
+
+			/* open the session root if requested path is outside tnfs root */
+			if (_resolve_dirhandle(s, &(s->dhandles[i]), pDirpath) != 0)
+			{
+				result = errno;
+			}
+			else
+			{
+				// Without a pattern, everything matches
+				pattern = pattern_compile(pPattern ? pPattern : "*", 0);
+				if (pattern == NULL)
+				{
+					dirhandle_close(&(s->dhandles[i]));
+					result = ENOMEM;
+				}
+				else
+					result = _search_directory(&(s->dhandles[i]), diropts, sortopts, maxresults, pattern);
+				pattern_free(pattern);
+			}
+			if (result == 0)
+			{
+				#ifdef DEBUG
+				TNFSMSGLOG(hdr, "search response: handle=%hu, count=%hu", i, s->dhandles[i].entry_count);
+				#endif
+				_opendirx_reply(hdr, s, i, diropts, token);
+			}
+			else
+			{
+				hdr->status = tnfs_error(result);
+				tnfs_send(s, hdr, NULL, 0);
+			}
+			return;
+		}
 	}
-	// Sort by name
-	else
+
+	/* no free handles left */
+	hdr->status = TNFS_EMFILE;
+	tnfs_send(s, hdr, NULL, 0);
+}
+
+/* Totals across every listing currently held, for the stats report */
+size_t dirlist_total_bytes = 0;
+uint32_t dirlist_total_entries = 0;
+
+#ifdef ENABLE_THREADS
+static pthread_mutex_t listlock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void dirlist_lock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_lock(&listlock);
+#endif
+}
+
+void dirlist_unlock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_unlock(&listlock);
+#endif
+}
+
+/* Listings are read on the worker threads too */
+void _dirlist_count(long bytes, int entries)
+{
+	dirlist_lock();
+	dirlist_total_bytes += bytes;
+	dirlist_total_entries += entries;
+	dirlist_unlock();
+}
+
+/* Bump-allocates size bytes with the given alignment from the arena,
+   chaining on a new block when the current one is full */
+void *_dirlist_arena_alloc(dir_arena *arena, size_t size, size_t align)
+{
+	dir_arena_block *block = arena->blocks;
+	size_t hdrsz = (sizeof(dir_arena_block) + 7) & ~(size_t)7;
+	size_t offset;
+
+	if (block != NULL)
 	{
-		// Decide whether to use case-sensitive or insensitive sorting
-		if (sortopts & TNFS_DIRSORT_CASE)
-			r = strcmp(list_left->entry.entrypath, list_right->entry.entrypath);
-		else
-			r = strcasecmp(list_left->entry.entrypath, list_right->entry.entrypath);
+		offset = (block->used + align - 1) & ~(align - 1);
+		if (offset + size <= block->size)
+		{
+			block->used = offset + size;
+			return (unsigned char *)block + offset;
+		}
 	}
 
-	// Reverse the result if we're sorting descending
-	if (sortopts & TNFS_DIRSORT_DESCENDING)
-		r *= -1;
+	// Each block is twice the size of the last, within limits
+	size_t blocksz = block ? block->size * 2 : DIRARENA_MINBLOCK;
+	if (blocksz > DIRARENA_MAXBLOCK)
+		blocksz = DIRARENA_MAXBLOCK;
+	if (blocksz < hdrsz + size)
+		blocksz = hdrsz + size;
 
-	if (r < 0)
+	if ((block = malloc(blocksz)) == NULL)
 	{
-		result = list_left;
-		result->next = _mergesort_merge(list_left->next, list_right, sortopts);
+		LOG("dirlist: unable to allocate %lu byte arena block\n", (unsigned long)blocksz);
+		return NULL;
 	}
-	else
+	block->next = arena->blocks;
+	block->size = blocksz;
+	block->used = hdrsz + size;
+	arena->blocks = block;
+	arena->bytes += blocksz;
+	_dirlist_count(blocksz, 0);
+
+	return (unsigned char *)block + hdrsz;
+}
+
+/* Returns a new, empty listing of the directory at path holding one
+   reference for the caller, or NULL */
+dir_listing *dirlist_new(const char *path)
+{
+	dir_listing *listing = calloc(1, sizeof(dir_listing));
+	if (listing == NULL)
+		return NULL;
+	strlcpy(listing->path, path, sizeof(listing->path));
+	listing->loaded = time(NULL);
+	listing->refs = 1;
+	return listing;
+}
+
+/* Returns a zeroed entry at the end of the listing with a copy of name,
+   or NULL. The pointer is only good until the next entry is added */
+directory_entry *dirlist_add(dir_listing *listing, const char *name)
+{
+	directory_entry *entry;
+	size_t namesz = strlen(name) + 1;
+	char *copy;
+
+	if (listing->count == listing->size)
 	{
-		result = list_right;
-		result->next = _mergesort_merge(list_left, list_right->next, sortopts);
+		uint32_t newsize = listing->size ? listing->size * 2 : 64;
+		directory_entry *n = realloc(listing->entries, newsize * sizeof(directory_entry));
+		if (n == NULL)
+		{
+			LOG("dirlist: unable to allocate %u entries\n", newsize);
+			return NULL;
+		}
+		_dirlist_count((newsize - listing->size) * sizeof(directory_entry), 0);
+		listing->entries = n;
+		listing->size = newsize;
 	}
+	if ((copy = _dirlist_arena_alloc(&listing->arena, namesz, 1)) == NULL)
+		return NULL;
+	memcpy(copy, name, namesz);
+
+	entry = &listing->entries[listing->count++];
+	entry->entrypath = copy;
+	entry->flags = 0;
+	entry->size = entry->mtime = entry->ctime = 0;
+
+	listing->arena.entries++;
+	_dirlist_count(0, 1);
+	return entry;
+}
 
-	return result;
+/* Drops a reference to a listing, freeing it when it was the last */
+void dirlist_release(dir_listing *listing)
+{
+	if (listing == NULL)
+		return;
+	dirlist_lock();
+	dirlist_unref(listing);
+	dirlist_unlock();
 }
 
-directory_entry_list _mergesort_get_middle(directory_entry_list head)
+void dirlist_unref(dir_listing *listing)
 {
-	if (head == NULL)
-		return head;
+	dir_pages *pages;
+	int i;
 
-	directory_entry_list slow, fast;
-	slow = fast = head;
+	if (--listing->refs > 0)
+		return;
 
-	while (fast->next != NULL && fast->next->next != NULL)
+	for (i = 0; i < DIRLIST_ORDERS; i++)
+		free(listing->orders[i]);
+	while ((pages = listing->pages) != NULL)
 	{
-		slow = slow->next;
-		fast = fast->next->next;
+		listing->pages = pages->next;
+		_dirpages_free(pages);
 	}
-	return slow;
+	dirlist_total_bytes -= listing->size * sizeof(directory_entry);
+	dirlist_total_bytes -= listing->arena.bytes;
+	dirlist_total_entries -= listing->arena.entries;
+	free(listing->entries);
+	dirlist_free(&listing->arena);
+	free(listing);
 }
 
-void _mergesort(directory_entry_list *headP, uint8_t sortopts)
+/* Returns the permutation that sorts the listing's entries in ascending
+   order for the sort options, sorting them the first time it's asked
+   for. Descending order is the same permutation read backwards */
+const uint32_t *dirlist_order(dir_listing *listing, uint8_t sortopts)
 {
-	directory_entry_list head = *headP;
+	uint32_t *order;
+	int key;
 
-	if (head == NULL || head->next == NULL)
-		return;
+	if (sortopts & TNFS_DIRSORT_SIZE)
+		key = 3;
+	else if (sortopts & TNFS_DIRSORT_MODIFIED)
+		key = 2;
+	else if (sortopts & TNFS_DIRSORT_CASE)
+		key = 1;
+	else
+		key = 0;
+
+	dirlist_lock();
+	order = listing->orders[key];
+	dirlist_unlock();
+	if (order != NULL)
+		return order;
+
+	/* sorted without the lock, keeping whichever is done first */
+	order = dirlist_sort(listing, sortopts);
+	dirlist_lock();
+	if (listing->orders[key] == NULL)
+		listing->orders[key] = order;
+	else
+	{
+		free(order);
+		order = listing->orders[key];
+	}
+	dirlist_unlock();
+	return order;
+}
+
+/* Free every entry in a listing by releasing its arena blocks */
+void dirlist_free(dir_arena *arena)
+{
+	dir_arena_block *block = arena->blocks;
+	while (block)
+	{
+		dir_arena_block *next = block->next;
+		free(block);
+		block = next;
+	}
+
+	arena->blocks = NULL;
+	arena->bytes = 0;
+	arena->entries = 0;
+}
+
+/* Reports the number of entries held in listings and the bytes they use */
+void dirlist_stats(uint32_t *entries, size_t *bytes)
+{
+	dirlist_lock();
+	*entries = dirlist_total_entries;
+	*bytes = dirlist_total_bytes;
+	dirlist_unlock();
+}
 
-	directory_entry_list list_left;
-	directory_entry_list list_right;
-	directory_entry_list list_mid;
+/* Builds the collation prefix for a name: its first eight bytes packed
+   so that comparing two prefixes as integers orders them the same way
+   strcmp() would order the names */
+uint64_t _dirlist_nameprefix(const char *name)
+{
+	uint64_t key = 0;
+	int i;
 
-	// Split the list into two separate lists
-	list_left = head;
-	list_mid = _mergesort_get_middle(head);
-	list_right = list_mid->next;
-	list_mid->next = NULL;
+	for (i = 0; i < 8 && name[i] != '\0'; i++)
+		key |= (uint64_t)(unsigned char)name[i] << (56 - 8 * i);
 
-	// Merge the two lists
-	_mergesort(&list_left, sortopts);
-	_mergesort(&list_right, sortopts);
-	*headP = _mergesort_merge(list_left, list_right, sortopts);
+	return key;
 }
 
-/* Merge sort on a singly-linked list */
-void dirlist_sort(directory_entry_list *dlist, uint8_t sortopts)
+/* Returns <0, 0 or >0 as item a sorts before, with or after item b */
+int _dirlist_compare(const dirlist_sortitem *a, const dirlist_sortitem *b)
 {
-	_mergesort(dlist, sortopts);
+	int r;
+
+	// The integer keys settle most comparisons without touching the names
+	if (a->key != b->key)
+		r = a->key < b->key ? -1 : 1;
+	// Size and timestamp keys are the whole value
+	else if (a->name == NULL)
+		r = 0;
+	// Equal prefixes with a zero last byte mean both names ended within them
+	else if ((a->key & 0xFF) == 0)
+		r = 0;
+	else
+		r = strcmp(a->name + 8, b->name + 8);
+
+	return r;
+}
+
+/* Stable bottom-up merge sort of the entries in a listing, returning the
+   ascending order as an array of entry indexes, or NULL.
+   The entries are gathered into an array of sort items holding a collation
+   key computed once per entry (case-folded copies of the names for a
+   case-insensitive sort), and runs of doubling width are merged back and
+   forth between two halves of a single allocation. There is no recursion,
+   so the stack depth does not grow with the size of the directory. */
+uint32_t *dirlist_sort(const dir_listing *listing, uint8_t sortopts)
+{
+	const directory_entry *entry;
+	dirlist_sortitem *items, *src, *dst, *swap;
+	uint32_t count, width, lo, mid, hi, l, r, o;
+	uint32_t *order;
+	size_t foldsz;
+	char *fold, *p;
+	const char *c;
+
+	count = listing->count;
+	if ((order = malloc((count ? count : 1) * sizeof(uint32_t))) == NULL)
+	{
+		LOG("dirlist_sort: unable to allocate order of %u entries\n", count);
+		return NULL;
+	}
+	if (count < 2)
+	{
+		for (o = 0; o < count; o++)
+			order[o] = o;
+		return order;
+	}
+
+	bool byname = !(sortopts & (TNFS_DIRSORT_SIZE | TNFS_DIRSORT_MODIFIED));
+	bool casefold = byname && !(sortopts & TNFS_DIRSORT_CASE);
+
+	foldsz = 0;
+	if (casefold)
+	{
+		for (o = 0; o < count; o++)
+			foldsz += strlen(listing->entries[o].entrypath) + 1;
+	}
+
+	if ((items = malloc(2 * count * sizeof(dirlist_sortitem) + foldsz)) == NULL)
+	{
+		LOG("dirlist_sort: unable to allocate %u sort items\n", count);
+		free(order);
+		return NULL;
+	}
+
+	src = items;
+	dst = items + count;
+	fold = (char *)(items + 2 * count);
+	for (o = 0; o < count; o++)
+	{
+		entry = &listing->entries[o];
+		src[o].index = o;
+		if (sortopts & TNFS_DIRSORT_SIZE)
+		{
+			src[o].key = entry->size;
+			src[o].name = NULL;
+		}
+		else if (sortopts & TNFS_DIRSORT_MODIFIED)
+		{
+			src[o].key = entry->mtime;
+			src[o].name = NULL;
+		}
+		else
+		{
+			if (casefold)
+			{
+				// strcasecmp() order is strcmp() order over the lowercased names
+				for (c = entry->entrypath, p = fold; *c; c++)
+					*p++ = tolower((unsigned char)*c);
+				*p++ = '\0';
+				src[o].name = fold;
+				fold = p;
+			}
+			else
+			{
+				src[o].name = entry->entrypath;
+			}
+			src[o].key = _dirlist_nameprefix(src[o].name);
+		}
+	}
+
+	for (width = 1; width < count; width *= 2)
+	{
+		for (lo = 0; lo < count; lo += 2 * width)
+		{
+			mid = lo + width < count ? lo + width : count;
+			hi = mid + width < count ? mid + width : count;
+
+			// Merge the two runs, taking from the left on ties to stay stable
+			for (l = lo, r = mid, o = lo; o < hi; o++)
+			{
+				if (l < mid && (r >= hi || _dirlist_compare(&src[l], &src[r]) <= 0))
+					dst[o] = src[l++];
+				else
+					dst[o] = src[r++];
+			}
+		}
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	for (o = 0; o < count; o++)
+		order[o] = src[o].index;
+
+	free(items);
+	return order;
 }
@@ -33,6 +33,7 @@
 #define TNFS_DIROPT_NO_SKIPHIDDEN 0x02
 #define TNFS_DIROPT_NO_SKIPSPECIAL 0x04
 #define TNFS_DIROPT_DIR_PATTERN 0x08
+#define TNFS_DIROPT_TOKEN 0x10
 
 #define TNFS_DIRSORT_NONE 0x01
 #define TNFS_DIRSORT_CASE 0x02
@@ -42,8 +43,12 @@
 
 #define TNFS_DIRSTATUS_EOF 0x01
 
+/* in place of a handle when a listing matches the client's token */
+#define TNFS_DIRHANDLE_UNCHANGED 0xFF
+
 /* initialize and set the root dir */
 int tnfs_setroot(char *rootdir);
+extern char root[MAX_ROOT];
 
 /* validates a path points to an actual directory */
 int validate_dir(Session *s, const char *path);
@@ -52,12 +57,37 @@ void normalize_path(char *dst, char *src, int pathsz);
 /* get the root directory for the given session */
 void get_root(Session *s, char *buf, int bufsz);
 
-/* handle list of directory entries */
-void dirlist_free(directory_entry_list dlist);
-void dirlist_push(directory_entry_list *dlist, directory_entry_list_node *node);
-directory_entry_list_node * dirlist_get_node_at_index(directory_entry_list dlist, uint32_t index);
-uint32_t dirlist_get_index_for_node(directory_entry_list dlist, directory_entry_list_node *node);
-void dirlist_sort(directory_entry_list *dlist, uint8_t sortopts);
+/* precomputed collation keys for the entries sorted by dirlist_sort() */
+typedef struct _dirlist_sortitem
+{
+	uint64_t key;		/* size, mtime or name prefix */
+	const char *name;	/* name as collated, NULL unless sorting by name */
+	uint32_t index;		/* of the entry in its listing */
+} dirlist_sortitem;
+
+/* directory listings */
+dir_listing *dirlist_new(const char *path);
+directory_entry *dirlist_add(dir_listing *listing, const char *name);
+void dirlist_release(dir_listing *listing);
+
+/* A listing's references, sort orders and pages, and the directory
+ * cache holding it, are shared with the threads requests run on under
+ * this lock. dirlist_unref() is dirlist_release() with it held */
+void dirlist_lock();
+void dirlist_unlock();
+void dirlist_unref(dir_listing *listing);
+const uint32_t *dirlist_order(dir_listing *listing, uint8_t sortopts);
+uint32_t *dirlist_sort(const dir_listing *listing, uint8_t sortopts);
+void dirlist_free(dir_arena *arena);
+void dirlist_stats(uint32_t *entries, size_t *bytes);
+
+/* release what a directory handle holds besides its DIR */
+void dirhandle_free(dir_handle *dirh);
+/* close its DIR or virtual directory too */
+void dirhandle_close(dir_handle *dirh);
+
+/* whether a session's directory handle is in use */
+#define DIRHANDLE_OPEN(dirh) ((dirh)->handle != NULL || (dirh)->vdir != NULL)
 
 /* open, read, close directories */
 void tnfs_opendir(Header *hdr, Session *s, unsigned char *databuf, int datasz);
@@ -67,8 +97,14 @@ void tnfs_seekdir(Header *hdr, Session *s, unsigned char *databuf, int datasz);
 void tnfs_telldir(Header *hdr, Session *s, unsigned char *databuf, int datasz);
 
 void tnfs_opendirx(Header *hdr, Session *s, unsigned char *databuf, int datasz);
+/* Whether tnfs_opendirx would list a directory the dircache is keeping
+   current, without reading it */
+int tnfs_opendirx_cached(Header *hdr, Session *s, unsigned char *databuf, int datasz);
 void tnfs_readdirx(Header *hdr, Session *s, unsigned char *databuf, int datasz);
 
+/* recursive search below a directory */
+void tnfs_search(Header *hdr, Session *s, unsigned char *databuf, int datasz);
+
 /* create and remove directories */
 void tnfs_mkdir(Header *hdr, Session *s, unsigned char *databuf, int datasz);
 void tnfs_rmdir(Header *hdr, Session *s, unsigned char *databuf, int datasz);
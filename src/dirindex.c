@@ -0,0 +1,620 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Persistent directory index
+ *
+ * */
+
+#ifdef ENABLE_DIRINDEX
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#endif
+
+#include "dirindex.h"
+#include "fileinfo.h"
+#include "notify.h"
+#include "log.h"
+#include "bsdcompat.h"
+#include "config.h"
+
+#ifdef __APPLE__
+#define ST_MTIME_NSEC(st) ((st)->st_mtimespec.tv_nsec)
+#else
+#define ST_MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+#endif
+
+/* what is known about each indexed directory since the index was mapped */
+#define DIRSTATE_UNCHECKED 0	/* compare its mtime before use */
+#define DIRSTATE_WATCHED 1	/* fresh, and a change will be notified */
+#define DIRSTATE_STALE 2	/* changed since indexing, read it from disk */
+
+char *indexpath = NULL;
+char indexroot[MAX_ROOT];
+unsigned char *indexmap = NULL;
+size_t indexmapsz = 0;
+dev_t indexdev;
+ino_t indexino;
+uint8_t *dirstate = NULL;
+time_t indexchecked = 0;
+int indexusers = 0;		/* lookups still reading the mapping */
+
+/* Directories are read on the worker threads too. The mapping and
+   dirstate are shared with them under indexlock, and the mapping is
+   only replaced while nobody is reading it */
+#ifdef ENABLE_THREADS
+static pthread_mutex_t indexlock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void _dirindex_lock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_lock(&indexlock);
+#endif
+}
+
+void _dirindex_unlock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_unlock(&indexlock);
+#endif
+}
+
+#define IDXHDR ((const dirindex_header *)indexmap)
+#define IDXDIRS ((const dirindex_dir *)(indexmap + IDXHDR->dirtab))
+#define IDXENTS ((const dirindex_entry *)(indexmap + IDXHDR->enttab))
+
+/* Check that every directory's entries lie within the entry table and
+ * every string offset within the string table, so nothing read from the
+ * mapping later can run off the end of it. The tables themselves are
+ * already known to fit. Returns -1 if any record is out of range */
+int _dirindex_valid(const unsigned char *map)
+{
+	const dirindex_header *h = (const dirindex_header *)map;
+	const dirindex_dir *dirs = (const dirindex_dir *)(map + h->dirtab);
+	const dirindex_entry *ents = (const dirindex_entry *)(map + h->enttab);
+	uint64_t strsz = h->size - h->strtab;
+	uint32_t i;
+
+	for (i = 0; i < h->dircount; i++)
+	{
+		if (dirs[i].path >= strsz || dirs[i].first > h->entrycount ||
+			dirs[i].count > h->entrycount - dirs[i].first)
+			return -1;
+	}
+	for (i = 0; i < h->entrycount; i++)
+	{
+		if (ents[i].name >= strsz)
+			return -1;
+	}
+	return 0;
+}
+
+/* Map the index file, replacing any current mapping if it is valid.
+   Returns 1 if it's in use, to try again later */
+int _dirindex_map()
+{
+	struct stat st;
+	unsigned char *map;
+	const dirindex_header *h;
+	int fd;
+
+	if ((fd = open(indexpath, O_RDONLY)) < 0)
+	{
+		LOG("dirindex: unable to open %s: %s\n", indexpath, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(dirindex_header))
+	{
+		LOG("dirindex: %s is not an index file\n", indexpath);
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		LOG("dirindex: unable to map %s: %s\n", indexpath, strerror(errno));
+		return -1;
+	}
+
+	h = (const dirindex_header *)map;
+	if (memcmp(h->magic, DIRINDEX_MAGIC, sizeof(DIRINDEX_MAGIC)) != 0 ||
+		h->version != DIRINDEX_VERSION ||
+		h->byteorder != DIRINDEX_BYTEORDER ||
+		h->size != st.st_size ||
+		h->dirtab > h->size || h->enttab > h->size || h->strtab >= h->size ||
+		(uint64_t)h->dircount * sizeof(dirindex_dir) > h->size - h->dirtab ||
+		(uint64_t)h->entrycount * sizeof(dirindex_entry) > h->size - h->enttab ||
+		map[h->size - 1] != '\0' || _dirindex_valid(map) < 0)
+	{
+		LOG("dirindex: %s is damaged or from another version\n", indexpath);
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	_dirindex_lock();
+	if (indexusers > 0)
+	{
+		_dirindex_unlock();
+		munmap(map, st.st_size);
+		return 1;
+	}
+	if (indexmap != NULL)
+		munmap(indexmap, indexmapsz);
+	free(dirstate);
+
+	indexmap = map;
+	indexmapsz = st.st_size;
+	indexdev = st.st_dev;
+	indexino = st.st_ino;
+	/* allocated on first use so mapping stays cheap however big the tree */
+	dirstate = NULL;
+	_dirindex_unlock();
+
+	LOG("dirindex: mapped %s: %u directories, %u entries\n",
+		indexpath, h->dircount, h->entrycount);
+	return 0;
+}
+
+int dirindex_open(const char *indexfile, const char *rootdir)
+{
+	size_t len;
+
+	if ((indexpath = strdup(indexfile)) == NULL)
+		return -1;
+
+	/* index paths are relative to the root without leading or trailing
+	 * slashes, so keep the root the way normalize_path() leaves the
+	 * paths it is compared with, less its trailing slashes */
+	for (len = 0; *rootdir && len < sizeof(indexroot) - 1; rootdir++)
+	{
+		if (*rootdir != '/' || len == 0 || indexroot[len - 1] != '/')
+			indexroot[len++] = *rootdir;
+	}
+	indexroot[len] = '\0';
+	while (len > 0 && indexroot[len - 1] == '/')
+		indexroot[--len] = '\0';
+
+	indexchecked = time(NULL);
+	return _dirindex_map();
+}
+
+void dirindex_check()
+{
+	struct stat st;
+	time_t now;
+
+	if (indexpath == NULL)
+		return;
+
+	now = time(NULL);
+	if (now == indexchecked)
+		return;
+
+	/* tnfsd-index renames a complete new file over the old one; while
+	   a directory is being read from the old one, look again later */
+	if (stat(indexpath, &st) == 0 &&
+		(st.st_ino != indexino || st.st_dev != indexdev) &&
+		_dirindex_map() == 1)
+		return;
+	indexchecked = now;
+}
+
+const char *dirindex_string(uint32_t offset)
+{
+	return (const char *)indexmap + IDXHDR->strtab + offset;
+}
+
+const dirindex_entry *dirindex_entries(const dirindex_dir *dir)
+{
+	return IDXENTS + dir->first;
+}
+
+/* Turn a full path into the form used by the index, or return -1 if
+ * it isn't below the root */
+int _dirindex_relpath(const char *path, char *rel, size_t relsz)
+{
+	size_t rootlen = strlen(indexroot);
+	size_t len;
+
+	if (strncmp(path, indexroot, rootlen) != 0 ||
+		(path[rootlen] != '/' && path[rootlen] != '\0'))
+		return -1;
+
+	path += rootlen;
+	while (*path == '/')
+		path++;
+	if (strlcpy(rel, path, relsz) >= relsz)
+		return -1;
+
+	len = strlen(rel);
+	while (len > 0 && rel[len - 1] == '/')
+		rel[--len] = '\0';
+	return 0;
+}
+
+/* Binary search of the directory table, returning -1 if not found */
+int _dirindex_find(const char *rel)
+{
+	int lo = 0, hi = (int)IDXHDR->dircount - 1;
+
+	while (lo <= hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		int r = strcmp(dirindex_string(IDXDIRS[mid].path), rel);
+		if (r == 0)
+			return mid;
+		if (r < 0)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1;
+}
+
+/* A watched directory changed: stop serving it from the index */
+void _dirindex_changed(const char *dirpath, const char *name, void *ctx)
+{
+	char rel[MAX_FILEPATH];
+	int i;
+
+	_dirindex_lock();
+	if (indexmap == NULL || dirstate == NULL)
+	{
+		/* nothing to forget */
+	}
+	else if (dirpath == NULL)
+	{
+		/* lost events: recheck everything against its mtime */
+		memset(dirstate, DIRSTATE_UNCHECKED, IDXHDR->dircount);
+	}
+	else if (_dirindex_relpath(dirpath, rel, sizeof(rel)) == 0 &&
+		(i = _dirindex_find(rel)) >= 0)
+	{
+		/* no longer watched, or gone: check it again before use */
+		if (name == NULL)
+		{
+			if (dirstate[i] == DIRSTATE_WATCHED)
+				dirstate[i] = DIRSTATE_UNCHECKED;
+		}
+		else
+		{
+#ifdef DEBUG
+			fprintf(stderr, "dirindex: '%s' changed, no longer served from the index\n", rel);
+#endif
+			dirstate[i] = DIRSTATE_STALE;
+		}
+	}
+	_dirindex_unlock();
+}
+
+const dirindex_dir *dirindex_lookup(const char *path, int dirfd, int *verify)
+{
+	char rel[MAX_FILEPATH];
+	struct stat st;
+	const dirindex_dir *dir;
+	int i, watched, changed;
+
+	_dirindex_lock();
+	if (indexmap == NULL || _dirindex_relpath(path, rel, sizeof(rel)) < 0 ||
+		(i = _dirindex_find(rel)) < 0)
+	{
+		_dirindex_unlock();
+		return NULL;
+	}
+
+	if (dirstate == NULL &&
+		(dirstate = calloc(IDXHDR->dircount, sizeof(uint8_t))) == NULL)
+	{
+		_dirindex_unlock();
+		return NULL;
+	}
+
+	dir = &IDXDIRS[i];
+	*verify = 1;
+	switch (dirstate[i])
+	{
+	case DIRSTATE_WATCHED:
+		*verify = 0;
+		indexusers++;
+		_dirindex_unlock();
+		return dir;
+	case DIRSTATE_STALE:
+		_dirindex_unlock();
+		return NULL;
+	}
+	indexusers++;
+	_dirindex_unlock();
+
+	/* start watching before comparing so no change can slip between */
+	watched = notify_watch(path, _dirindex_changed, NULL) == 0;
+	changed = fstat(dirfd, &st) < 0 ||
+		st.st_mtime != dir->mtime_sec || ST_MTIME_NSEC(&st) != dir->mtime_nsec;
+
+	_dirindex_lock();
+	if (changed)
+	{
+		dirstate[i] = DIRSTATE_STALE;
+		indexusers--;
+		_dirindex_unlock();
+		return NULL;
+	}
+
+	/* a file rewritten in place leaves the directory's mtime alone, so
+	 * its entries are checked this once; from then on the watch reports
+	 * any change to them, unless one already has */
+	if (watched && dirstate[i] == DIRSTATE_UNCHECKED)
+		dirstate[i] = DIRSTATE_WATCHED;
+	_dirindex_unlock();
+	return dir;
+}
+
+void dirindex_release()
+{
+	_dirindex_lock();
+	indexusers--;
+	_dirindex_unlock();
+}
+
+/*
+ * Building the index
+ */
+
+typedef struct _build_dir
+{
+	char *path;
+	uint32_t first;
+	uint32_t count;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+} build_dir;
+
+typedef struct _build_entry
+{
+	char *name;
+	fileinfo_t fi;
+} build_entry;
+
+build_dir *bdirs = NULL;
+uint32_t bdircount = 0, bdirsize = 0;
+build_entry *bents = NULL;
+uint32_t bentcount = 0, bentsize = 0;
+
+int _build_entry_cmp(const void *a, const void *b)
+{
+	return strcmp(((const build_entry *)a)->name, ((const build_entry *)b)->name);
+}
+
+int _build_dir_cmp(const void *a, const void *b)
+{
+	return strcmp(((const build_dir *)a)->path, ((const build_dir *)b)->path);
+}
+
+/* Grow an array by doubling so it can hold at least one more element */
+int _build_grow(void **array, uint32_t *size, uint32_t count, size_t elemsz)
+{
+	if (count < *size)
+		return 0;
+	uint32_t newsize = *size ? *size * 2 : 1024;
+	void *n = realloc(*array, newsize * elemsz);
+	if (n == NULL)
+		return -1;
+	*array = n;
+	*size = newsize;
+	return 0;
+}
+
+/* Index one directory, queueing its subdirectories on the pending list */
+int _build_scan(const char *rootdir, const char *rel,
+				char ***pending, uint32_t *npending, uint32_t *pendingsz)
+{
+	char full[MAX_FILEPATH], entpath[MAX_FILEPATH];
+	struct stat st;
+	struct dirent *de;
+	build_dir *d;
+	DIR *dh;
+
+	snprintf(full, sizeof(full), "%s/%s", rootdir, rel);
+
+	/* take the mtime before reading so changes made meanwhile show up */
+	if (stat(full, &st) < 0 || (dh = opendir(full)) == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", full, strerror(errno));
+		return 0;
+	}
+
+	if (_build_grow((void **)&bdirs, &bdirsize, bdircount, sizeof(build_dir)) < 0)
+		return -1;
+	d = &bdirs[bdircount++];
+	d->path = strdup(rel);
+	d->first = bentcount;
+	d->count = 0;
+	d->mtime_sec = st.st_mtime;
+	d->mtime_nsec = ST_MTIME_NSEC(&st);
+
+	while ((de = readdir(dh)) != NULL)
+	{
+		build_entry *e;
+
+		if (snprintf(entpath, sizeof(entpath), "%s%c%s",
+					 full, FILEINFO_PATHSEPARATOR, de->d_name) >= sizeof(entpath))
+			continue;
+		if (_build_grow((void **)&bents, &bentsize, bentcount, sizeof(build_entry)) < 0)
+			return -1;
+		e = &bents[bentcount];
+		if (get_fileinfo(entpath, &e->fi) != 0)
+			continue;
+		e->name = strdup(de->d_name);
+		bentcount++;
+		d->count++;
+
+		/* descend into real subdirectories, but not through symlinks */
+		if ((e->fi.flags & FILEINFOFLAG_DIRECTORY) &&
+			strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0 &&
+			lstat(entpath, &st) == 0 && S_ISDIR(st.st_mode))
+		{
+			if (snprintf(entpath, sizeof(entpath), "%s%s%s",
+						 rel, *rel ? "/" : "", de->d_name) >= sizeof(entpath))
+				continue;
+			if (_build_grow((void **)pending, pendingsz, *npending, sizeof(char *)) < 0)
+				return -1;
+			(*pending)[(*npending)++] = strdup(entpath);
+		}
+	}
+	closedir(dh);
+
+	qsort(bents + d->first, d->count, sizeof(build_entry), _build_entry_cmp);
+	return 0;
+}
+
+/* Append a string to the string table, returning its offset */
+uint32_t _build_string(FILE *f, uint64_t *strsz, const char *s)
+{
+	uint32_t offset = (uint32_t)*strsz;
+	size_t len = strlen(s) + 1;
+	fwrite(s, len, 1, f);
+	*strsz += len;
+	return offset;
+}
+
+int dirindex_build(const char *rootdir, const char *indexfile)
+{
+	char tmpfile[MAX_FILEPATH];
+	char **pending = NULL;
+	uint32_t npending = 0, pendingsz = 0;
+	dirindex_header h;
+	uint64_t strsz = 0;
+	uint32_t i, j;
+	FILE *f;
+
+	/* walk the tree with an explicit work list rather than recursion */
+	if (_build_grow((void **)&pending, &pendingsz, 0, sizeof(char *)) < 0)
+		return -1;
+	pending[npending++] = strdup("");
+	while (npending > 0)
+	{
+		char *rel = pending[--npending];
+		if (_build_scan(rootdir, rel, &pending, &npending, &pendingsz) < 0)
+		{
+			fprintf(stderr, "Out of memory\n");
+			return -1;
+		}
+		free(rel);
+	}
+	free(pending);
+
+	qsort(bdirs, bdircount, sizeof(build_dir), _build_dir_cmp);
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, DIRINDEX_MAGIC, sizeof(DIRINDEX_MAGIC));
+	h.version = DIRINDEX_VERSION;
+	h.byteorder = DIRINDEX_BYTEORDER;
+	h.dircount = bdircount;
+	h.entrycount = bentcount;
+	h.dirtab = sizeof(dirindex_header);
+	h.enttab = h.dirtab + (uint64_t)bdircount * sizeof(dirindex_dir);
+	h.strtab = h.enttab + (uint64_t)bentcount * sizeof(dirindex_entry);
+
+	/* write to a temporary file and rename it into place, so a running
+	 * tnfsd only ever sees a complete index */
+	snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", indexfile);
+	if ((f = fopen(tmpfile, "wb")) == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", tmpfile, strerror(errno));
+		return -1;
+	}
+
+	/* the string table goes first, at its final offset, so the
+	 * tables can be written afterwards knowing every offset */
+	fseek(f, h.strtab, SEEK_SET);
+	for (i = 0; i < bdircount; i++)
+	{
+		bdirs[i].path = (char *)(uintptr_t)_build_string(f, &strsz, bdirs[i].path);
+		for (j = bdirs[i].first; j < bdirs[i].first + bdirs[i].count; j++)
+			bents[j].name = (char *)(uintptr_t)_build_string(f, &strsz, bents[j].name);
+	}
+	if (strsz > UINT32_MAX)
+	{
+		fprintf(stderr, "Too many names for one index\n");
+		fclose(f);
+		unlink(tmpfile);
+		return -1;
+	}
+	h.size = h.strtab + strsz;
+
+	fseek(f, 0, SEEK_SET);
+	fwrite(&h, sizeof(h), 1, f);
+	for (i = 0; i < bdircount; i++)
+	{
+		dirindex_dir d;
+		memset(&d, 0, sizeof(d));
+		d.path = (uint32_t)(uintptr_t)bdirs[i].path;
+		d.first = bdirs[i].first;
+		d.count = bdirs[i].count;
+		d.mtime_sec = bdirs[i].mtime_sec;
+		d.mtime_nsec = bdirs[i].mtime_nsec;
+		fwrite(&d, sizeof(d), 1, f);
+	}
+	for (i = 0; i < bentcount; i++)
+	{
+		dirindex_entry e;
+		memset(&e, 0, sizeof(e));
+		e.name = (uint32_t)(uintptr_t)bents[i].name;
+		e.flags = bents[i].fi.flags;
+		e.size = bents[i].fi.size;
+		e.mtime = bents[i].fi.m_time;
+		e.ctime = bents[i].fi.c_time;
+		fwrite(&e, sizeof(e), 1, f);
+	}
+
+	if (ferror(f) | fclose(f))
+	{
+		fprintf(stderr, "%s: write failed\n", tmpfile);
+		unlink(tmpfile);
+		return -1;
+	}
+	if (rename(tmpfile, indexfile) < 0)
+	{
+		fprintf(stderr, "%s: %s\n", indexfile, strerror(errno));
+		unlink(tmpfile);
+		return -1;
+	}
+
+	printf("Indexed %u directories, %u entries into %s\n", bdircount, bentcount, indexfile);
+	return 0;
+}
+
+#endif
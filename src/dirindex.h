@@ -0,0 +1,105 @@
+#ifndef _TNFS_DIRINDEX_H
+#define _TNFS_DIRINDEX_H
+
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Persistent directory index
+ *
+ * An index file holds, for every directory below the TNFS root, the
+ * directory's modification time and a table of its entries sorted by
+ * name with the same flags, size and times that get_fileinfo() reports.
+ * It is written by tnfsd-index and mapped read-only by tnfsd, so a
+ * directory whose modification time still matches can be listed without
+ * reading it.
+ *
+ * Writing to a file doesn't change its directory's modification time,
+ * so the first time tnfsd uses a directory from the index it still
+ * stat()s the entries. Once it is watching the directory any change is
+ * reported, and the entries are served as they are until one comes.
+ *
+ * The file is in host byte order; it is not meant to be moved between
+ * machines.
+ *
+ * */
+
+#include <stdint.h>
+
+#define DIRINDEX_MAGIC "TNFSIDX"
+#define DIRINDEX_VERSION 1
+#define DIRINDEX_BYTEORDER 0x01020304
+
+typedef struct _dirindex_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	uint32_t dircount;
+	uint32_t entrycount;
+	uint64_t dirtab;	/* offset of dircount dirindex_dir, sorted by path */
+	uint64_t enttab;	/* offset of entrycount dirindex_entry */
+	uint64_t strtab;	/* offset of the NULL terminated strings */
+	uint64_t size;		/* size of the whole file */
+} dirindex_header;
+
+typedef struct _dirindex_dir
+{
+	uint32_t path;		/* strtab offset of the path relative to the root */
+	uint32_t first;		/* index of the first entry in enttab */
+	uint32_t count;		/* number of entries */
+	uint32_t reserved;
+	int64_t mtime_sec;	/* directory modification time when indexed */
+	int64_t mtime_nsec;
+} dirindex_dir;
+
+typedef struct _dirindex_entry
+{
+	uint32_t name;		/* strtab offset of the entry name */
+	uint8_t flags;		/* FILEINFOFLAG_* */
+	uint8_t reserved[3];
+	uint32_t size;
+	uint32_t mtime;
+	uint32_t ctime;
+} dirindex_entry;
+
+/* Map an index file built for the given root directory.
+ * Returns 0 on success, -1 on failure. */
+int dirindex_open(const char *indexfile, const char *rootdir);
+
+/* Pick up an index file that tnfsd-index has replaced */
+void dirindex_check();
+
+/* Returns the indexed copy of the directory at path (a full path below
+ * the root) if the index holds it and it is still fresh, or NULL if it
+ * has to be read from disk. dirfd is an open descriptor on it. verify
+ * is set if the names are current but the details of the entries must
+ * still be checked against the files. What it returns stays mapped
+ * until dirindex_release() is called. */
+const dirindex_dir *dirindex_lookup(const char *path, int dirfd, int *verify);
+const dirindex_entry *dirindex_entries(const dirindex_dir *dir);
+const char *dirindex_string(uint32_t offset);
+void dirindex_release();
+
+/* Walk rootdir and write a new index file. Returns 0 on success. */
+int dirindex_build(const char *rootdir, const char *indexfile);
+
+#endif
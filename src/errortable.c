@@ -57,6 +57,8 @@ void tnfs_init_errtable()
 	etable[ENOSYS]=TNFS_ENOSYS;
 	etable[ENAMETOOLONG]=TNFS_ENAMETOOLONG;
 	etable[ENOTEMPTY]=TNFS_ENOTEMPTY;
+	/* paths that would lead outside the tnfs root, see resolve.c */
+	etable[EXDEV]=TNFS_EACCES;
 #ifdef ELOOP
 	etable[ELOOP]=TNFS_ELOOP;
 #endif
@@ -6,6 +6,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <errno.h>
+#include <string.h>
+#include <strings.h>
 
 #include "fileinfo.h"
 
@@ -74,16 +76,7 @@ int get_fileinfo(const char *path, fileinfo_t *fileinf)
 
     if (stat(path, &statinfo) == 0)
     {
-        if (S_ISDIR(statinfo.st_mode))
-        {
-            fileinf->flags |= FILEINFOFLAG_DIRECTORY;
-        }
-        fileinf->size =  statinfo.st_size;
-        fileinf->m_time = statinfo.st_mtime;
-        fileinf->c_time = statinfo.st_ctime;
-
-        if(namestart[0] == '.')
-            fileinf->flags |= FILEINFOFLAG_HIDDEN;
+        fileinfo_fromstat(path, &statinfo, fileinf);
     }
     else
     {
@@ -94,3 +87,30 @@ int get_fileinfo(const char *path, fileinfo_t *fileinf)
 
     return 0;
 }
+
+#ifndef WIN32
+void fileinfo_fromstat(const char *path, const struct stat *statinfo, fileinfo_t *fileinf)
+{
+    const char *namestart = strrchr(path, FILEINFO_PATHSEPARATOR);
+    namestart = namestart ? namestart + 1 : path;
+
+    fileinf->flags = 0;
+    if (S_ISDIR(statinfo->st_mode))
+    {
+        fileinf->flags |= FILEINFOFLAG_DIRECTORY;
+    }
+    fileinf->size =  statinfo->st_size;
+    fileinf->m_time = statinfo->st_mtime;
+    fileinf->c_time = statinfo->st_ctime;
+
+    if(namestart[0] == '.')
+        fileinf->flags |= FILEINFOFLAG_HIDDEN;
+
+#ifdef WITH_ZIP
+    // ZIP archives can be opened as directories
+    size_t namelen = strlen(namestart);
+    if (S_ISREG(statinfo->st_mode) && namelen > 4 && strcasecmp(namestart + namelen - 4, ".zip") == 0)
+        fileinf->flags |= FILEINFOFLAG_DIRECTORY;
+#endif
+}
+#endif
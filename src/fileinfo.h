@@ -25,4 +25,10 @@ typedef struct fileinfo fileinfo_t;
 
 int get_fileinfo(const char *path, fileinfo_t *fi);
 
+#ifndef WIN32
+struct stat;
+/* fill in fi from what stat() returned for path */
+void fileinfo_fromstat(const char *path, const struct stat *st, fileinfo_t *fi);
+#endif
+
 #endif // _FILEINFO_H
@@ -0,0 +1,277 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon gzip compressed files served decompressed
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "config.h"
+#include "gzfs.h"
+#include "zseek.h"
+#include "resolve.h"
+#include "directory.h"
+#include "fileinfo.h"
+#include "endian.h"
+#include "bsdcompat.h"
+
+#define GZ_SUFFIX ".gz"
+#define GZ_HEADER_SIZE 10
+#define GZ_TRAILER_SIZE 8	/* CRC32 and the size, mod 2^32 */
+#define GZ_FHCRC 0x02
+#define GZ_FEXTRA 0x04
+#define GZ_FNAME 0x08
+#define GZ_FCOMMENT 0x10
+
+typedef struct _gzfs_file
+{
+	int fd;
+	zseek *z;
+} gzfs_file;
+
+/* Step pos past a zero terminated field of the header */
+int _gzfs_skipstring(int fd, off_t *pos, off_t end)
+{
+	unsigned char buf[256];
+	unsigned char *nul;
+	ssize_t n;
+
+	while (*pos < end)
+	{
+		if ((n = pread(fd, buf, sizeof(buf), *pos)) <= 0)
+			return -1;
+		if ((nul = memchr(buf, 0, n)) != NULL)
+		{
+			*pos += nul - buf + 1;
+			return 0;
+		}
+		*pos += n;
+	}
+	return -1;
+}
+
+/* Find the deflate stream in a gzip file and the size it inflates to.
+   Returns -1 with errno set to EIO if it isn't a gzip file */
+int _gzfs_stream(int fd, off_t filesize, off_t *start, off_t *compsize, uint64_t *size)
+{
+	unsigned char header[GZ_HEADER_SIZE];
+	unsigned char trailer[GZ_TRAILER_SIZE];
+	off_t pos = GZ_HEADER_SIZE;
+	off_t end = filesize - GZ_TRAILER_SIZE;
+
+	if (end < pos ||
+		pread(fd, header, sizeof(header), 0) != sizeof(header) ||
+		header[0] != 0x1f || header[1] != 0x8b || header[2] != Z_DEFLATED)
+		goto bad;
+	if (header[3] & GZ_FEXTRA)
+	{
+		if (pread(fd, trailer, 2, pos) != 2)
+			goto bad;
+		pos += 2 + tnfs16uint(trailer);
+	}
+	if ((header[3] & GZ_FNAME) && _gzfs_skipstring(fd, &pos, end) < 0)
+		goto bad;
+	if ((header[3] & GZ_FCOMMENT) && _gzfs_skipstring(fd, &pos, end) < 0)
+		goto bad;
+	if (header[3] & GZ_FHCRC)
+		pos += 2;
+	if (pos > end || pread(fd, trailer, sizeof(trailer), end) != sizeof(trailer))
+		goto bad;
+
+	*start = pos;
+	*compsize = end - pos;
+	*size = tnfs32uint(trailer + 4);
+	return 0;
+
+bad:
+	errno = EIO;
+	return -1;
+}
+
+/* Open the compressed file a client path stands for. Returns the fd,
+   -1 with errno set, or -2 if there's no such file */
+int _gzfs_open(Session *s, const char *path, struct stat *st)
+{
+	char gzpath[MAX_TNFSPATH];
+	size_t len = strlen(path);
+	int fd, err;
+
+	if (len == 0 || path[len - 1] == '/' ||
+		snprintf(gzpath, sizeof(gzpath), "%s%s", path, GZ_SUFFIX) >= (int)sizeof(gzpath))
+		return -2;
+	if ((fd = resolve_open(s, gzpath, O_RDONLY, 0)) < 0)
+		return errno == ENOENT || errno == ENOTDIR ? -2 : -1;
+	if (fstat(fd, st) < 0)
+	{
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	if (!S_ISREG(st->st_mode))
+	{
+		close(fd);
+		return -2;
+	}
+	return fd;
+}
+
+int _gzfs_fileopen(Session *s, const char *path, vfs_file *f)
+{
+	struct stat st;
+	gzfs_file *gf;
+	off_t start, compsize;
+	uint64_t size;
+	int fd, err;
+
+	if ((fd = _gzfs_open(s, path, &st)) == -2)
+		return 1;
+	if (fd < 0)
+		return -1;
+	if (_gzfs_stream(fd, st.st_size, &start, &compsize, &size) < 0)
+		err = errno;
+	else if ((gf = calloc(1, sizeof(gzfs_file))) == NULL)
+		err = ENOMEM;
+	else if ((gf->z = zseek_new(fd, start, compsize, size)) == NULL)
+	{
+		free(gf);
+		err = ENOMEM;
+	}
+	else
+	{
+		gf->fd = fd;
+		f->handle = gf;
+		f->size = size;
+		return 0;
+	}
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+ssize_t _gzfs_pread(vfs_file *f, void *buf, size_t count, uint64_t offset)
+{
+	return zseek_pread(((gzfs_file *)f->handle)->z, buf, count, offset);
+}
+
+void _gzfs_close(vfs_file *f)
+{
+	gzfs_file *gf = (gzfs_file *)f->handle;
+
+	zseek_free(gf->z);
+	close(gf->fd);
+	free(gf);
+}
+
+int _gzfs_stat(Session *s, const char *path, struct stat *st)
+{
+	off_t start, compsize;
+	uint64_t size;
+	int fd, err = 0;
+
+	if ((fd = _gzfs_open(s, path, st)) == -2)
+		return 1;
+	if (fd < 0)
+		return -1;
+	if (_gzfs_stream(fd, st->st_size, &start, &compsize, &size) < 0)
+		err = errno;
+	close(fd);
+	if (err)
+	{
+		errno = err;
+		return -1;
+	}
+	st->st_size = size;
+	st->st_mode &= ~(S_IWUSR | S_IWGRP | S_IWOTH);
+	return 0;
+}
+
+int _gzfs_alias(const char *name, char *buf, size_t bufsz)
+{
+	size_t len = strlen(name);
+	size_t suffixlen = strlen(GZ_SUFFIX);
+
+	if (len <= suffixlen || len - suffixlen >= bufsz ||
+		strcmp(name + len - suffixlen, GZ_SUFFIX) != 0)
+		return -1;
+	memcpy(buf, name, len - suffixlen);
+	buf[len - suffixlen] = 0;
+	return 0;
+}
+
+/* List foo.atr.gz as foo.atr, with its decompressed size; runs on the
+   worker threads */
+int _gzfs_listentry(const char *dirpath, directory_entry *e)
+{
+	char path[MAX_FILEPATH];
+	struct stat st;
+	off_t start, compsize;
+	uint64_t size;
+	size_t len;
+	int fd, result;
+
+	if ((e->flags & FILEINFOFLAG_DIRECTORY) ||
+		_gzfs_alias(e->entrypath, path, sizeof(path)) < 0)
+		return 1;
+	len = strlen(e->entrypath);
+
+	/* a file of the plain name is listed as itself */
+	if (snprintf(path, sizeof(path), "%s/%.*s", dirpath,
+				 (int)(len - strlen(GZ_SUFFIX)), e->entrypath) >= (int)sizeof(path) ||
+		lstat(path, &st) == 0)
+		return 1;
+
+	strlcat(path, GZ_SUFFIX, sizeof(path));
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 1;
+	result = fstat(fd, &st) == 0 &&
+			 _gzfs_stream(fd, st.st_size, &start, &compsize, &size) == 0;
+	close(fd);
+	if (!result)
+		return 1;
+
+	e->entrypath[len - strlen(GZ_SUFFIX)] = 0;
+	e->size = (uint32_t)size;
+	return 0;
+}
+
+const vfs_provider gzfs_provider = {
+	"gz",
+	_gzfs_fileopen,
+	_gzfs_pread,
+	NULL,
+	NULL,
+	_gzfs_close,
+	_gzfs_stat,
+	NULL,
+	NULL,
+	NULL,
+	_gzfs_alias,
+	_gzfs_listentry
+};
@@ -0,0 +1,267 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon file content hashes
+ *
+ * */
+
+#include <string.h>
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CRC32C_SSE42
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARM
+#include <arm_acle.h>
+#endif
+
+#include "config.h"
+#include "hashcache.h"
+
+#if defined(WIN32)
+#define ST_MTIME_NSEC(st) 0
+#elif defined(__APPLE__)
+#define ST_MTIME_NSEC(st) ((st)->st_mtimespec.tv_nsec)
+#else
+#define ST_MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+#endif
+
+#define CRC32C_POLY 0x82F63B78	/* reversed */
+
+typedef struct _hashcache_entry
+{
+	uint64_t pathhash;	/* 0 if unused */
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	long mtime_nsec;
+	uint32_t crc;
+} hashcache_entry;
+
+static hashcache_entry hashcache[HASHCACHE_MAX];
+
+#ifdef ENABLE_THREADS
+static pthread_mutex_t hashcachelock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+#endif
+
+void _hashcache_lock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_lock(&hashcachelock);
+#endif
+}
+
+void _hashcache_unlock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_unlock(&hashcachelock);
+#endif
+}
+
+typedef uint32_t (*crc32c_func)(uint32_t crc, const unsigned char *p, size_t len);
+static crc32c_func crc32c_impl = NULL;
+
+/* slicing-by-8, for CPUs without a CRC32C instruction */
+static uint32_t crc32c_table[8][256];
+
+uint32_t _crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint32_t lo, hi;
+
+	while (len && ((uintptr_t)p & 7))
+	{
+		crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+		len--;
+	}
+	while (len >= 8)
+	{
+		lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+			(uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+		hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 |
+			(uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+		crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+			crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+			crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF] ^
+			crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+#ifdef CRC32C_SSE42
+__attribute__((target("sse4.2")))
+uint32_t _crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t v;
+	uint32_t w;
+
+	while (len && ((uintptr_t)p & 7))
+	{
+		crc = _mm_crc32_u8(crc, *p++);
+		len--;
+	}
+#ifdef __x86_64__
+	while (len >= 8)
+	{
+		memcpy(&v, p, 8);
+		crc = (uint32_t)_mm_crc32_u64(crc, v);
+		p += 8;
+		len -= 8;
+	}
+#else
+	(void)v;
+#endif
+	while (len >= 4)
+	{
+		memcpy(&w, p, 4);
+		crc = _mm_crc32_u32(crc, w);
+		p += 4;
+		len -= 4;
+	}
+	while (len--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+#endif
+
+#ifdef CRC32C_ARM
+uint32_t _crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t v;
+
+	while (len && ((uintptr_t)p & 7))
+	{
+		crc = __crc32cb(crc, *p++);
+		len--;
+	}
+	while (len >= 8)
+	{
+		memcpy(&v, p, 8);
+		crc = __crc32cd(crc, v);
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = __crc32cb(crc, *p++);
+	return crc;
+}
+#endif
+
+/* Builds the tables, and picks the instruction if the CPU has one */
+void _crc32c_init()
+{
+	uint32_t crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++)
+	{
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+		crc32c_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8) ^
+				crc32c_table[0][crc32c_table[j - 1][i] & 0xFF];
+	crc32c_impl = _crc32c_sw;
+
+#if defined(CRC32C_SSE42)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+		crc32c_impl = _crc32c_hw;
+#elif defined(CRC32C_ARM)
+	crc32c_impl = _crc32c_hw;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+#ifdef ENABLE_THREADS
+	pthread_once(&crc32c_once, _crc32c_init);
+#else
+	if (crc32c_impl == NULL)
+		_crc32c_init();
+#endif
+	return ~crc32c_impl(~crc, (const unsigned char *)buf, len);
+}
+
+/* FNV-1a, never 0 so that marks an unused entry */
+uint64_t _hashcache_pathhash(const char *path)
+{
+	uint64_t h = 0xCBF29CE484222325ULL;
+
+	while (*path)
+	{
+		h ^= (unsigned char)*path++;
+		h *= 0x100000001B3ULL;
+	}
+	return h ? h : 1;
+}
+
+hashcache_entry *_hashcache_slot(uint64_t pathhash)
+{
+	return &hashcache[(pathhash ^ (pathhash >> 32)) % HASHCACHE_MAX];
+}
+
+int hashcache_lookup(const char *path, const struct stat *st, uint32_t *crc)
+{
+	uint64_t pathhash = _hashcache_pathhash(path);
+	hashcache_entry *e = _hashcache_slot(pathhash);
+	int result = -1;
+
+	_hashcache_lock();
+	if (e->pathhash == pathhash && e->dev == st->st_dev &&
+		e->ino == st->st_ino && e->size == st->st_size &&
+		e->mtime == st->st_mtime && e->mtime_nsec == ST_MTIME_NSEC(st))
+	{
+		*crc = e->crc;
+		result = 0;
+	}
+	_hashcache_unlock();
+	return result;
+}
+
+void hashcache_store(const char *path, const struct stat *st, uint32_t crc)
+{
+	uint64_t pathhash = _hashcache_pathhash(path);
+	hashcache_entry *e = _hashcache_slot(pathhash);
+
+	_hashcache_lock();
+	e->pathhash = pathhash;
+	e->dev = st->st_dev;
+	e->ino = st->st_ino;
+	e->size = st->st_size;
+	e->mtime = st->st_mtime;
+	e->mtime_nsec = ST_MTIME_NSEC(st);
+	e->crc = crc;
+	_hashcache_unlock();
+}
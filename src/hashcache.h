@@ -0,0 +1,48 @@
+#ifndef _TNFS_HASHCACHE_H
+#define _TNFS_HASHCACHE_H
+
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon file content hashes
+ *
+ * */
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* Clients ask whether a file they already hold has changed by its
+ * CRC32C, so the checksum of each file is kept until its size or
+ * modification time changes, or it's replaced by another file. Files
+ * are known by their full path as built from the root. Large files are
+ * checksummed by a job, so these may be called from any thread */
+
+/* CRC32C (Castagnoli) of buf, continuing from crc; start from 0 */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* Returns 0 with crc set if path, as st describes it now, has a
+ * checksum kept, or -1 */
+int hashcache_lookup(const char *path, const struct stat *st, uint32_t *crc);
+void hashcache_store(const char *path, const struct stat *st, uint32_t crc);
+
+#endif
@@ -0,0 +1,345 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon background jobs
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#endif
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
+
+#include "config.h"
+#include "tnfs.h"
+#include "job.h"
+#include "datagram.h"
+#include "errortable.h"
+#include "endian.h"
+#include "log.h"
+
+struct _job
+{
+	int used;
+	uint16_t sid;		/* of the session that started it */
+	in_addr_t ipaddr;
+	int state;			/* TNFS_JOB_RUNNING or TNFS_JOB_DONE */
+	int err;			/* its outcome, once done */
+	uint64_t done;
+	uint64_t total;
+	time_t finished;
+	job_func fn;
+	void *ctx;
+	job_free freectx;
+	int steps;			/* run a step at a time by job_poll */
+	unsigned char result[TNFS_JOB_RESULT_MAX];
+	int resultlen;
+};
+
+static job jobs[JOBS_MAX];
+
+#ifdef ENABLE_THREADS
+static pthread_mutex_t joblock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void _job_lock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_lock(&joblock);
+#endif
+}
+
+void _job_unlock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_unlock(&joblock);
+#endif
+}
+
+void _job_done(job *j, int err)
+{
+	if (j->freectx)
+		j->freectx(j->ctx);
+	_job_lock();
+	j->err = err;
+	j->state = TNFS_JOB_DONE;
+	j->finished = time(NULL);
+	_job_unlock();
+}
+
+void _job_run(job *j)
+{
+	_job_done(j, j->fn(j, j->ctx));
+}
+
+#ifdef ENABLE_THREADS
+void *_job_thread(void *arg)
+{
+	_job_run((job *)arg);
+	return NULL;
+}
+#endif
+
+/* A free slot for a job, or NULL with errno set and ctx freed */
+job *_job_new(Session *s, job_func fn, void *ctx, job_free freectx)
+{
+	time_t now = time(NULL);
+	job *j = NULL;
+	int i;
+
+	/* a finished job whose outcome nobody has asked for in a while
+	   makes way */
+	_job_lock();
+	for (i = 0; i < JOBS_MAX && j == NULL; i++)
+	{
+		if (!jobs[i].used ||
+			(jobs[i].state == TNFS_JOB_DONE && now - jobs[i].finished > JOB_KEEP))
+			j = &jobs[i];
+	}
+	if (j != NULL)
+	{
+		memset(j, 0, sizeof(job));
+		j->used = 1;
+		j->sid = s->sid;
+		j->ipaddr = s->ipaddr;
+		j->state = TNFS_JOB_RUNNING;
+		j->fn = fn;
+		j->ctx = ctx;
+		j->freectx = freectx;
+	}
+	_job_unlock();
+
+	if (j == NULL)
+	{
+		if (freectx)
+			freectx(ctx);
+		errno = EAGAIN;
+	}
+	return j;
+}
+
+int job_full()
+{
+	time_t now = time(NULL);
+	int i, full = 1;
+
+	_job_lock();
+	for (i = 0; i < JOBS_MAX && full; i++)
+	{
+		if (!jobs[i].used ||
+			(jobs[i].state == TNFS_JOB_DONE && now - jobs[i].finished > JOB_KEEP))
+			full = 0;
+	}
+	_job_unlock();
+	return full;
+}
+
+int job_start(Session *s, job_func fn, void *ctx, job_free freectx)
+{
+	job *j;
+#ifdef ENABLE_THREADS
+	pthread_t t;
+#endif
+
+	if ((j = _job_new(s, fn, ctx, freectx)) == NULL)
+		return -1;
+
+#ifdef ENABLE_THREADS
+	if (pthread_create(&t, NULL, _job_thread, j) == 0)
+	{
+		pthread_detach(t);
+		return j - jobs;
+	}
+	LOG("job: unable to start thread, running it in the main loop\n");
+#endif
+	_job_run(j);
+	return j - jobs;
+}
+
+int job_start_steps(Session *s, job_func fn, void *ctx, job_free freectx)
+{
+	job *j;
+
+	if ((j = _job_new(s, fn, ctx, freectx)) == NULL)
+		return -1;
+	j->steps = 1;
+	return j - jobs;
+}
+
+/* Only the main loop starts and runs these, so they're looked at
+   without the lock */
+int job_pending()
+{
+	int i;
+
+	for (i = 0; i < JOBS_MAX; i++)
+	{
+		if (jobs[i].used && jobs[i].steps && jobs[i].state == TNFS_JOB_RUNNING)
+			return 1;
+	}
+	return 0;
+}
+
+void job_poll()
+{
+	int i, err;
+
+	for (i = 0; i < JOBS_MAX; i++)
+	{
+		job *j = &jobs[i];
+		if (j->used && j->steps && j->state == TNFS_JOB_RUNNING &&
+			(err = j->fn(j, j->ctx)) != EINPROGRESS)
+			_job_done(j, err);
+	}
+}
+
+void job_result(job *j, const void *data, int len)
+{
+	if (len > TNFS_JOB_RESULT_MAX)
+		len = TNFS_JOB_RESULT_MAX;
+	_job_lock();
+	memcpy(j->result, data, len);
+	j->resultlen = len;
+	_job_unlock();
+}
+
+void job_progress(job *j, uint64_t done, uint64_t total)
+{
+	_job_lock();
+	j->done = done;
+	j->total = total;
+	_job_unlock();
+}
+
+int job_copyfd(job *j, int in, int out, uint64_t *done, uint64_t total)
+{
+	unsigned char *buf;
+	ssize_t n, w;
+	uint64_t start = *done;
+	int err = 0;
+
+#ifdef __linux__
+	/* on a filesystem that can share blocks between files, such as
+	   btrfs or XFS, nothing needs copying at all */
+	struct stat st;
+	if (fstat(in, &st) == 0 && ioctl(out, FICLONE, in) == 0)
+	{
+		*done += st.st_size;
+		job_progress(j, *done, total);
+		return 0;
+	}
+
+#ifdef SYS_copy_file_range
+	/* otherwise let the kernel copy without going through userspace,
+	   which on NFS or SMB can be done by the server itself */
+	while ((n = syscall(SYS_copy_file_range, in, NULL, out, NULL, JOB_COPY_CHUNK, 0)) > 0)
+	{
+		*done += n;
+		job_progress(j, *done, total);
+	}
+	if (n == 0)
+		return 0;
+	/* not between these two filesystems, or not by this kernel */
+	if (*done != start || (errno != EXDEV && errno != EINVAL &&
+						   errno != ENOSYS && errno != EOPNOTSUPP))
+		return errno;
+#endif
+#endif
+
+	if ((buf = malloc(JOB_COPY_CHUNK)) == NULL)
+		return ENOMEM;
+	while (err == 0 && (n = read(in, buf, JOB_COPY_CHUNK)) != 0)
+	{
+		if (n < 0)
+		{
+			err = errno;
+			break;
+		}
+		for (w = 0; w < n && err == 0; )
+		{
+			ssize_t r = write(out, buf + w, n - w);
+			if (r < 0)
+				err = errno;
+			else
+				w += r;
+		}
+		*done += w;
+		job_progress(j, *done, total);
+	}
+	free(buf);
+	return err;
+}
+
+void tnfs_jobstatus(Header *hdr, Session *s, unsigned char *buf, int bufsz)
+{
+	unsigned char reply[TNFS_JOBSTATUS_SIZE + TNFS_JOB_RESULT_MAX];
+	int len = TNFS_JOBSTATUS_SIZE;
+	job *j;
+
+	if (bufsz < 1 || *buf >= JOBS_MAX)
+	{
+		hdr->status = TNFS_EBADF;
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+
+	j = &jobs[*buf];
+	_job_lock();
+	if (!j->used || j->sid != s->sid || j->ipaddr != s->ipaddr)
+	{
+		_job_unlock();
+		hdr->status = TNFS_EBADF;
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+	reply[0] = (unsigned char)j->state;
+	reply[1] = j->state == TNFS_JOB_DONE && j->err ? tnfs_error(j->err) : TNFS_SUCCESS;
+	uint32tnfs(reply + 2, j->done > UINT32_MAX ? UINT32_MAX : (uint32_t)j->done);
+	uint32tnfs(reply + 6, j->total > UINT32_MAX ? UINT32_MAX : (uint32_t)j->total);
+	/* the outcome is only told once, with whatever the job found */
+	if (j->state == TNFS_JOB_DONE)
+	{
+		if (j->err == 0)
+		{
+			memcpy(reply + len, j->result, j->resultlen);
+			len += j->resultlen;
+		}
+		j->used = 0;
+	}
+	_job_unlock();
+
+	hdr->status = TNFS_SUCCESS;
+	tnfs_send(s, hdr, reply, len);
+}
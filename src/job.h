@@ -0,0 +1,92 @@
+#ifndef _TNFS_JOB_H
+#define _TNFS_JOB_H
+
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon background jobs
+ *
+ * */
+
+#include <stdint.h>
+
+#include "tnfs.h"
+
+/* Copies and other long operations run on a thread of their own so the
+ * main loop carries on serving everyone else, and the client polls for
+ * the outcome with JOBSTATUS. Whatever a job needs from its session,
+ * such as paths resolved beneath the root and files opened, is set up
+ * on the main thread before it starts. Without ENABLE_THREADS a job
+ * runs to the end before the command that started it replies */
+
+#define TNFS_JOB_RUNNING 0x00
+#define TNFS_JOB_DONE 0x01
+
+/* state (1) + outcome (1) + done (4) + total (4) */
+#define TNFS_JOBSTATUS_SIZE 10
+/* and what a finished job found, told after that */
+#define TNFS_JOB_RESULT_MAX 16
+
+typedef struct _job job;
+
+/* Does a job's work on its thread. Returns 0 or errno */
+typedef int (*job_func)(job *j, void *ctx);
+/* Lets go of a job's ctx once it has finished */
+typedef void (*job_free)(void *ctx);
+
+/* Returns 1 if every slot is taken, so a command can refuse with EAGAIN
+ * before doing anything it can't undo. Only the main loop starts jobs,
+ * so while it's handling a command a slot found free stays free */
+int job_full();
+
+/* Start fn for a session. Returns the job's handle, or -1 with errno
+ * set, in which case ctx has already been freed */
+int job_start(Session *s, job_func fn, void *ctx, job_free freectx);
+
+/* Start fn on the main loop instead, for work that can't be done on
+ * another thread, such as reading a client's overlay. Each pass of the
+ * main loop calls fn, which does a little more and returns EINPROGRESS
+ * until it's finished */
+int job_start_steps(Session *s, job_func fn, void *ctx, job_free freectx);
+
+/* Returns 1 while a job started with job_start_steps has more to do */
+int job_pending();
+
+/* Give each of those its next step */
+void job_poll();
+
+/* Keep len bytes for JOBSTATUS to tell the client once the job has
+ * finished, such as a checksum */
+void job_result(job *j, const void *data, int len);
+
+/* Report how far a job has got, in whatever it counts */
+void job_progress(job *j, uint64_t done, uint64_t total);
+
+/* Copy all of in to out, sharing its blocks where the filesystem can.
+ * Adds what's copied to *done, reporting progress against total.
+ * Returns 0 or errno */
+int job_copyfd(job *j, int in, int out, uint64_t *done, uint64_t total);
+
+/* the progress and outcome of a job */
+void tnfs_jobstatus(Header *hdr, Session *s, unsigned char *buf, int bufsz);
+
+#endif
@@ -34,11 +34,40 @@
 #include "errortable.h"
 #include "chroot.h"
 #include "log.h"
+#include "notify.h"
+#include "dirindex.h"
+#include "search.h"
+#include "taskpool.h"
+#include "offload.h"
+#include "overlay.h"
 
 /* declare the main() - it won't be used elsewhere so I'll not bother
  * with putting it in a .h file */
 int main(int argc, char **argv);
 
+/* the options each feature adds */
+#ifdef ENABLE_CHROOT
+#define CHROOT_OPTS "u:g:"
+#define CHROOT_USAGE "-u <username> -g <group> "
+#else
+#define CHROOT_OPTS ""
+#define CHROOT_USAGE ""
+#endif
+#ifdef ENABLE_DIRINDEX
+#define INDEX_OPTS "i:"
+#define INDEX_USAGE " -i <index file>"
+#else
+#define INDEX_OPTS ""
+#define INDEX_USAGE ""
+#endif
+#ifdef ENABLE_OVERLAY
+#define OVERLAY_OPTS "o:"
+#define OVERLAY_USAGE " -o <overlay dir>"
+#else
+#define OVERLAY_OPTS ""
+#define OVERLAY_USAGE ""
+#endif
+
 int main(int argc, char **argv)
 {
     int opt;
@@ -47,14 +76,17 @@ int main(int argc, char **argv)
     char *gvalue = NULL;
 #endif
     char *pvalue = NULL;
+    int svalue = 0;
+#ifdef ENABLE_DIRINDEX
+    char *ivalue = NULL;
+#endif
+#ifdef ENABLE_OVERLAY
+    char *ovalue = NULL;
+#endif
 
     if(argc >= 2)
     {
-        #ifdef ENABLE_CHROOT
-        while((opt = getopt(argc, argv, "u:g:p:")) != -1)
-        #else
-        while((opt = getopt(argc, argv, "p:")) != -1)
-        #endif
+        while((opt = getopt(argc, argv, CHROOT_OPTS "p:s" INDEX_OPTS OVERLAY_OPTS)) != -1)
         {
             switch(opt)
             {
@@ -62,6 +94,9 @@ int main(int argc, char **argv)
                 case 'p':
                     pvalue = optarg;
                     break;
+                case 's':
+                    svalue = 1;
+                    break;
                 #ifdef ENABLE_CHROOT
                 case 'u':
                     uvalue = optarg;
@@ -70,6 +105,16 @@ int main(int argc, char **argv)
                     gvalue = optarg;
                     break;
                 #endif
+                #ifdef ENABLE_DIRINDEX
+                case 'i':
+                    ivalue = optarg;
+                    break;
+                #endif
+                #ifdef ENABLE_OVERLAY
+                case 'o':
+                    ovalue = optarg;
+                    break;
+                #endif
                 case ':':
                     LOG("option needs a value\n");
                     break;
@@ -81,14 +126,16 @@ int main(int argc, char **argv)
     }
     else
     {
-    #ifdef ENABLE_CHROOT
-    LOG("Usage: tnfsd <root dir> [-u <username> -g <group> -p <port>]\n");
-    #else
-    LOG("Usage: tnfsd <root dir> [-p <port>]\n");
-    #endif
+    LOG("Usage: tnfsd <root dir> [" CHROOT_USAGE "-p <port> -s" INDEX_USAGE OVERLAY_USAGE "]\n");
     exit(-1);
     }
 
+    #ifdef ENABLE_OVERLAY
+    /* opened before any chroot, so it can be outside the new root */
+    if (ovalue && overlay_init(ovalue) < 0)
+        exit(-1);
+    #endif
+
     #ifdef ENABLE_CHROOT
     if (uvalue || gvalue)
     {
@@ -139,6 +186,17 @@ int main(int argc, char **argv)
 
 	LOG("Starting tnfsd version %s on port %d using root directory \"%s\"\n", version, port, argv[optind]);
 
+	notify_init();		/* watch for changes where supported */
+#ifdef ENABLE_DIRINDEX
+	/* the index is opened after any chroot, so its path and the
+	 * tree it was built from are taken from inside the new root */
+	if (ivalue && dirindex_open(ivalue, root) < 0)
+		LOG("Continuing without the directory index\n");
+#endif
+	taskpool_init(TASKPOOL_THREADS);	/* start the worker threads */
+	if (svalue)
+		search_init(root);	/* index names for SEARCH in the background */
+	offload_init();		/* and those slow requests run on */
 	tnfs_init();		/* initialize structures etc. */
 	tnfs_init_errtable();	/* initialize error lookup table */
 	tnfs_sockinit(port);	/* initialize communications */
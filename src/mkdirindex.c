@@ -0,0 +1,50 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * tnfsd-index: build the directory index used by tnfsd -i
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dirindex.h"
+
+int main(int argc, char **argv);
+
+int main(int argc, char **argv)
+{
+#ifdef ENABLE_DIRINDEX
+	if (argc != 3)
+	{
+		fprintf(stderr, "Usage: tnfsd-index <root dir> <index file>\n");
+		exit(-1);
+	}
+
+	if (dirindex_build(argv[1], argv[2]) < 0)
+		exit(-1);
+	return 0;
+#else
+	fprintf(stderr, "tnfsd-index: directory indexes are not supported on this platform\n");
+	return -1;
+#endif
+}
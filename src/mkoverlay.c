@@ -0,0 +1,275 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon overlay tool
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef ENABLE_OVERLAY
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#endif
+
+#include "config.h"
+#include "overlay.h"
+
+int main(int argc, char **argv);
+
+#ifdef ENABLE_OVERLAY
+
+#define OVERLAY_LIST 0
+#define OVERLAY_COMMIT 1
+#define OVERLAY_DISCARD 2
+
+typedef struct _overlay_job
+{
+	int action;
+	const char *dir;		/* the overlay directory */
+	const char *root;		/* the tnfs root, to commit into */
+	const char *path;		/* only this file or directory, if set */
+	int failed;
+} overlay_job;
+
+/* Commit, discard or list one client's overlay of a file */
+void _overlay_one(overlay_job *job, const char *client, const char *path)
+{
+	char mappath[MAX_FILEPATH * 2];
+	char datapath[MAX_FILEPATH * 2];
+	char basepath[MAX_FILEPATH * 2];
+	overlay_map map;
+	uint64_t block, held = 0;
+	int mapfd, datafd, basefd, result;
+
+	snprintf(mappath, sizeof(mappath), "%s/%s/map/%s", job->dir, client, path);
+	snprintf(datapath, sizeof(datapath), "%s/%s/data/%s", job->dir, client, path);
+
+	if ((mapfd = open(mappath, O_RDWR)) < 0)
+	{
+		fprintf(stderr, "%s: %s\n", mappath, strerror(errno));
+		job->failed = 1;
+		return;
+	}
+	/* tnfsd holds a shared lock while the client has the file open */
+	if (flock(mapfd, LOCK_EX | LOCK_NB) < 0)
+	{
+		fprintf(stderr, "%s %s: in use, skipped\n", client, path);
+		job->failed = 1;
+		close(mapfd);
+		return;
+	}
+	if (overlay_readmap(mapfd, &map) < 0)
+	{
+		fprintf(stderr, "%s: %s\n", mappath, strerror(errno));
+		job->failed = 1;
+		close(mapfd);
+		return;
+	}
+
+	if (job->action == OVERLAY_LIST)
+	{
+		for (block = 0; block < (uint64_t)map.bitmapsz * 8; block++)
+		{
+			if (map.bitmap[block / 8] & (1 << (block % 8)))
+				held++;
+		}
+		printf("%s\t%s\t%llu bytes, %llu written\n", client, path,
+			   (unsigned long long)map.size, (unsigned long long)(held * map.blocksize));
+	}
+	else
+	{
+		if (job->action == OVERLAY_COMMIT)
+		{
+			snprintf(basepath, sizeof(basepath), "%s/%s", job->root, path);
+			result = -1;
+			if ((datafd = open(datapath, O_RDONLY)) >= 0)
+			{
+				if ((basefd = open(basepath, O_WRONLY | O_CREAT, 0644)) >= 0)
+				{
+					result = overlay_apply(&map, datafd, basefd);
+					if (fsync(basefd) < 0)
+						result = -1;
+					close(basefd);
+				}
+				close(datafd);
+			}
+			if (result < 0)
+			{
+				fprintf(stderr, "%s %s: unable to commit: %s\n", client, path, strerror(errno));
+				job->failed = 1;
+				free(map.bitmap);
+				close(mapfd);
+				return;
+			}
+			printf("%s\t%s\tcommitted\n", client, path);
+		}
+		else
+			printf("%s\t%s\tdiscarded\n", client, path);
+		unlink(datapath);
+		unlink(mappath);
+	}
+	free(map.bitmap);
+	close(mapfd);
+}
+
+/* Go through the overlays below dir, one of a client's map directories */
+void _overlay_walk(overlay_job *job, const char *client, const char *mapdir, const char *rel)
+{
+	char path[MAX_FILEPATH * 2];
+	char sub[MAX_FILEPATH];
+	struct dirent *entry;
+	struct stat st;
+	size_t len;
+	DIR *dh;
+
+	snprintf(path, sizeof(path), "%s%s%s", mapdir, *rel ? "/" : "", rel);
+	if ((dh = opendir(path)) == NULL)
+		return;
+	while ((entry = readdir(dh)) != NULL)
+	{
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		snprintf(sub, sizeof(sub), "%s%s%s", rel, *rel ? "/" : "", entry->d_name);
+		snprintf(path, sizeof(path), "%s/%s", mapdir, sub);
+		if (lstat(path, &st) < 0)
+			continue;
+		if (S_ISDIR(st.st_mode))
+		{
+			_overlay_walk(job, client, mapdir, sub);
+			continue;
+		}
+
+		/* the file asked for, or anything below the directory */
+		if (job->path)
+		{
+			len = strlen(job->path);
+			if (strncmp(sub, job->path, len) != 0 || (sub[len] != 0 && sub[len] != '/'))
+				continue;
+		}
+		_overlay_one(job, client, sub);
+	}
+	closedir(dh);
+}
+
+/* Remove the directories left empty below dir, and dir itself */
+void _overlay_prune(const char *dir)
+{
+	char path[MAX_FILEPATH * 2];
+	struct dirent *entry;
+	struct stat st;
+	DIR *dh;
+
+	if ((dh = opendir(dir)) == NULL)
+		return;
+	while ((entry = readdir(dh)) != NULL)
+	{
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode))
+			_overlay_prune(path);
+	}
+	closedir(dh);
+	rmdir(dir);
+}
+
+void _overlay_client(overlay_job *job, const char *client)
+{
+	char path[MAX_FILEPATH * 2];
+
+	snprintf(path, sizeof(path), "%s/%s/map", job->dir, client);
+	_overlay_walk(job, client, path, "");
+	if (job->action != OVERLAY_LIST)
+	{
+		snprintf(path, sizeof(path), "%s/%s", job->dir, client);
+		_overlay_prune(path);
+	}
+}
+
+void _overlay_usage()
+{
+	fprintf(stderr, "Usage: tnfsd-overlay <overlay dir> list [<client> [<path>]]\n");
+	fprintf(stderr, "       tnfsd-overlay <overlay dir> commit <root dir> [<client> [<path>]]\n");
+	fprintf(stderr, "       tnfsd-overlay <overlay dir> discard [<client> [<path>]]\n");
+	exit(-1);
+}
+
+#endif
+
+int main(int argc, char **argv)
+{
+#ifdef ENABLE_OVERLAY
+	overlay_job job;
+	struct dirent *entry;
+	DIR *dh;
+	int arg = 3;
+
+	if (argc < 3)
+		_overlay_usage();
+	memset(&job, 0, sizeof(job));
+	job.dir = argv[1];
+	if (strcmp(argv[2], "list") == 0)
+		job.action = OVERLAY_LIST;
+	else if (strcmp(argv[2], "commit") == 0 && argc >= 4)
+	{
+		job.action = OVERLAY_COMMIT;
+		job.root = argv[arg++];
+	}
+	else if (strcmp(argv[2], "discard") == 0)
+		job.action = OVERLAY_DISCARD;
+	else
+		_overlay_usage();
+	if (argc > arg + 2)
+		_overlay_usage();
+	if (argc > arg + 1)
+		job.path = argv[arg + 1];
+
+	if (argc > arg)
+		_overlay_client(&job, argv[arg]);
+	else
+	{
+		/* every client */
+		if ((dh = opendir(job.dir)) == NULL)
+		{
+			fprintf(stderr, "%s: %s\n", job.dir, strerror(errno));
+			exit(-1);
+		}
+		while ((entry = readdir(dh)) != NULL)
+		{
+			if (entry->d_name[0] != '.')
+				_overlay_client(&job, entry->d_name);
+		}
+		closedir(dh);
+	}
+	return job.failed ? -1 : 0;
+#else
+	fprintf(stderr, "tnfsd-overlay: overlays are not supported on this platform\n");
+	return -1;
+#endif
+}
@@ -0,0 +1,405 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon filesystem change notification
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef ENABLE_INOTIFY
+#include <fcntl.h>
+#include <sys/inotify.h>
+#endif
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#endif
+
+#include "notify.h"
+#include "log.h"
+#include "config.h"
+
+#ifdef ENABLE_INOTIFY
+
+#define NOTIFY_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+	IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct _notify_sub
+{
+	notify_callback cb;
+	void *ctx;
+	char *path;		/* as this subscriber asked for it */
+	struct _notify_sub *next;
+} notify_sub;
+
+/* inotify watch descriptors are small integers handed out in order,
+ * so the watches are kept in an array indexed by descriptor */
+typedef struct _notify_watch
+{
+	notify_sub *subs;
+	uint64_t used;		/* when it was last asked for */
+	int removed;		/* dropped by us, its IN_IGNORED is still to come */
+} notify_watchent;
+
+int inotifyfd = -1;
+notify_watchent *watches = NULL;
+int watches_size = 0;
+int watches_count = 0;
+uint64_t watches_clock = 0;
+int watches_short = 0;	/* watches a worker thread couldn't make room for */
+
+#ifdef ENABLE_THREADS
+static pthread_mutex_t notifylock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t notifymain;	/* the thread that called notify_init() */
+#endif
+
+void _notify_lock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_lock(&notifylock);
+#endif
+}
+
+void _notify_unlock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_unlock(&notifylock);
+#endif
+}
+
+/* Callbacks only run on the main thread, so dropping a watch to make
+   room for another is left to it */
+int _notify_main()
+{
+#ifdef ENABLE_THREADS
+	return pthread_equal(pthread_self(), notifymain);
+#else
+	return 1;
+#endif
+}
+
+int notify_init()
+{
+	if (inotifyfd >= 0)
+		return inotifyfd;
+#ifdef ENABLE_THREADS
+	notifymain = pthread_self();
+#endif
+
+	inotifyfd = inotify_init();
+	if (inotifyfd < 0)
+	{
+		LOG("notify_init: inotify unavailable: %s\n", strerror(errno));
+		return -1;
+	}
+	fcntl(inotifyfd, F_SETFL, fcntl(inotifyfd, F_GETFL) | O_NONBLOCK);
+	return inotifyfd;
+}
+
+int notify_fd()
+{
+	return inotifyfd;
+}
+
+/* Forget a watch's subscribers */
+void _notify_remove(int wd)
+{
+	notify_sub *sub, *next;
+
+	for (sub = watches[wd].subs; sub != NULL; sub = next)
+	{
+		next = sub->next;
+		free(sub->path);
+		free(sub);
+	}
+	if (watches[wd].subs != NULL)
+		watches_count--;
+	watches[wd].subs = NULL;
+}
+
+/* Stop watching a directory, after telling its subscribers */
+void _notify_drop(int wd)
+{
+	notify_sub *sub;
+
+#ifdef DEBUG
+	fprintf(stderr, "notify: no longer watching '%s'\n", watches[wd].subs->path);
+#endif
+	for (sub = watches[wd].subs; sub != NULL; sub = sub->next)
+		sub->cb(sub->path, NULL, sub->ctx);
+	inotify_rm_watch(inotifyfd, wd);
+	watches[wd].removed = 1;
+	_notify_remove(wd);
+}
+
+/* Drop the watch asked for least recently, other than keep.
+ * Returns -1 if there's none */
+int _notify_evict(int keep)
+{
+	int i, lru = -1;
+
+	for (i = 0; i < watches_size; i++)
+	{
+		if (i != keep && watches[i].subs != NULL &&
+			(lru < 0 || watches[i].used < watches[lru].used))
+			lru = i;
+	}
+	if (lru < 0)
+		return -1;
+	_notify_drop(lru);
+	return 0;
+}
+
+/* Make room for the watches the worker threads went without, and get
+   back down to NOTIFY_WATCHES. Called with the lock held */
+void _notify_trim(int keep)
+{
+	while (watches_short > 0)
+	{
+		watches_short--;
+		_notify_evict(keep);
+	}
+	while (watches_count > NOTIFY_WATCHES && _notify_evict(keep) == 0)
+		;
+}
+
+int notify_watch(const char *dirpath, notify_callback cb, void *ctx)
+{
+	notify_watchent *w;
+	notify_sub *sub;
+	int wd, result = -1;
+
+	if (inotifyfd < 0)
+		return -1;
+
+	/* the lookup may be slow, and needs no lock */
+	wd = inotify_add_watch(inotifyfd, dirpath, NOTIFY_MASK | IN_ONLYDIR);
+
+	_notify_lock();
+	/* out of watches: make room at the expense of the oldest */
+	if (wd < 0 && errno == ENOSPC)
+	{
+		if (!_notify_main())
+			watches_short++;
+		else if (_notify_evict(-1) == 0)
+			wd = inotify_add_watch(inotifyfd, dirpath, NOTIFY_MASK | IN_ONLYDIR);
+	}
+	if (wd < 0)
+	{
+#ifdef DEBUG
+		fprintf(stderr, "notify_watch: %s: %s\n", dirpath, strerror(errno));
+#endif
+		goto out;
+	}
+
+	if (wd >= watches_size)
+	{
+		int newsize = watches_size ? watches_size * 2 : 64;
+		while (newsize <= wd)
+			newsize *= 2;
+		notify_watchent *n = realloc(watches, newsize * sizeof(notify_watchent));
+		if (n == NULL)
+			goto out;
+		memset(n + watches_size, 0, (newsize - watches_size) * sizeof(notify_watchent));
+		watches = n;
+		watches_size = newsize;
+	}
+
+	/* the same directory may be watched on behalf of several users, and
+	 * under several names when it's reached through a link or has been
+	 * moved; each subscriber hears about it by the name it asked for */
+	w = &watches[wd];
+	/* descriptors are handed out in turn, so one we dropped is only
+	 * given back long after its IN_IGNORED was read; one still waiting
+	 * for it was dropped by another thread since it was added to */
+	if (w->removed)
+		goto out;
+	w->used = ++watches_clock;
+	for (sub = w->subs; sub != NULL; sub = sub->next)
+	{
+		if (sub->cb == cb && sub->ctx == ctx && strcmp(sub->path, dirpath) == 0)
+		{
+			result = 0;
+			goto out;
+		}
+	}
+	if ((sub = malloc(sizeof(notify_sub))) == NULL)
+		goto out;
+	if ((sub->path = strdup(dirpath)) == NULL)
+	{
+		free(sub);
+		goto out;
+	}
+	sub->cb = cb;
+	sub->ctx = ctx;
+	sub->next = w->subs;
+	if (w->subs == NULL)
+		watches_count++;
+	w->subs = sub;
+	result = 0;
+
+	if (_notify_main())
+		_notify_trim(wd);
+out:
+	_notify_unlock();
+	return result;
+}
+
+void notify_unwatch(const char *dirpath, notify_callback cb, void *ctx)
+{
+	notify_sub **p, *sub;
+	int wd;
+
+	if (inotifyfd < 0)
+		return;
+
+	_notify_lock();
+	/* the directory may be gone, so look for the subscription by name */
+	for (wd = 0; wd < watches_size; wd++)
+	{
+		for (p = &watches[wd].subs; (sub = *p) != NULL; p = &sub->next)
+		{
+			if (sub->cb == cb && sub->ctx == ctx && strcmp(sub->path, dirpath) == 0)
+				break;
+		}
+		if (sub == NULL)
+			continue;
+
+		*p = sub->next;
+		free(sub->path);
+		free(sub);
+		if (watches[wd].subs == NULL)
+		{
+			watches_count--;
+			inotify_rm_watch(inotifyfd, wd);
+			watches[wd].removed = 1;
+		}
+		break;
+	}
+	_notify_unlock();
+}
+
+/* Tell every subscriber of every watch that it may have missed events */
+void _notify_overflow()
+{
+	notify_sub *sub;
+	int i;
+
+	LOG("notify: event queue overflowed\n");
+	for (i = 0; i < watches_size; i++)
+	{
+		for (sub = watches[i].subs; sub != NULL; sub = sub->next)
+			sub->cb(NULL, NULL, sub->ctx);
+	}
+}
+
+void notify_dispatch()
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	notify_sub *sub;
+	ssize_t len;
+	char *p;
+
+	if (inotifyfd < 0)
+		return;
+
+	/* callbacks run with the lock held, so the worker threads' watches
+	   go in before or after them */
+	while ((len = read(inotifyfd, buf, sizeof(buf))) > 0)
+	{
+		_notify_lock();
+		for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len)
+		{
+			ev = (const struct inotify_event *)p;
+
+			if (ev->mask & IN_Q_OVERFLOW)
+			{
+				_notify_overflow();
+				continue;
+			}
+			if (ev->wd < 0 || ev->wd >= watches_size)
+				continue;
+			/* the end of a watch we dropped ourselves */
+			if (watches[ev->wd].removed)
+			{
+				if (ev->mask & IN_IGNORED)
+					watches[ev->wd].removed = 0;
+				continue;
+			}
+			if (watches[ev->wd].subs == NULL)
+				continue;
+
+			for (sub = watches[ev->wd].subs; sub != NULL; sub = sub->next)
+				sub->cb(sub->path, ev->len ? ev->name : NULL, sub->ctx);
+
+			if (ev->mask & IN_IGNORED)
+				_notify_remove(ev->wd);
+		}
+		_notify_unlock();
+	}
+}
+
+void notify_trim()
+{
+	if (inotifyfd < 0)
+		return;
+	_notify_lock();
+	_notify_trim(-1);
+	_notify_unlock();
+}
+
+#else
+
+int notify_init()
+{
+	return -1;
+}
+
+int notify_fd()
+{
+	return -1;
+}
+
+int notify_watch(const char *dirpath, notify_callback cb, void *ctx)
+{
+	return -1;
+}
+
+void notify_unwatch(const char *dirpath, notify_callback cb, void *ctx)
+{
+}
+
+void notify_dispatch()
+{
+}
+
+void notify_trim()
+{
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef _TNFS_NOTIFY_H
+#define _TNFS_NOTIFY_H
+
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon filesystem change notification
+ *
+ * */
+
+#include <stdint.h>
+
+/* Called from notify_dispatch() when something changes in a watched
+ * directory, with dirpath as it was given to notify_watch(). name is the entry that changed, or NULL if the directory
+ * itself went away or is no longer watched, having been dropped to
+ * make room for another. dirpath is NULL if events were lost and every
+ * watcher must assume everything changed. Callbacks must not call
+ * notify_watch() or notify_unwatch(). They run on the main thread with
+ * a lock held that notify_watch() and notify_unwatch() take too, so
+ * nothing may call those holding a lock a callback takes */
+typedef void (*notify_callback)(const char *dirpath, const char *name, void *ctx);
+
+/* Set up change notification. Returns the descriptor to select() on,
+ * or -1 if notification isn't available on this platform */
+int notify_init();
+int notify_fd();
+
+/* Ask for cb to be called with ctx when dirpath changes.
+ * Returns 0 on success or -1 if the directory can't be watched.
+ * At most NOTIFY_WATCHES directories are watched; past that, or when
+ * the kernel runs out of watches, the one least recently asked for
+ * is dropped, so watchers keep asking while they rely on a watch.
+ * Any thread may ask, but callbacks only run on the one that called
+ * notify_init(), so a watch asked for elsewhere makes no room: it
+ * fails instead, and the room is made by notify_trim() */
+int notify_watch(const char *dirpath, notify_callback cb, void *ctx);
+
+/* Stop calling cb with ctx for dirpath, and stop watching the
+ * directory once nobody is interested in it */
+void notify_unwatch(const char *dirpath, notify_callback cb, void *ctx);
+
+/* Read pending events and run the callbacks */
+void notify_dispatch();
+
+/* Drop the watches other threads needed room for */
+void notify_trim();
+
+#endif
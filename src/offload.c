@@ -0,0 +1,403 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * TNFS daemon slow requests run off the main loop
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef ENABLE_THREADS
+#include <fcntl.h>
+#include <pthread.h>
+#endif
+
+#include "config.h"
+#include "tnfs.h"
+#include "offload.h"
+#include "datagram.h"
+#include "session.h"
+#include "directory.h"
+#include "tnfs_file.h"
+#include "log.h"
+
+#ifdef ENABLE_THREADS
+
+typedef struct _offload_msg
+{
+	struct sockaddr_in cliaddr;
+	int cli_fd;
+	int len;
+	unsigned char *buf;
+} offload_msg;
+
+/* A request off the main loop. The thread has hdr, s, sindex and data;
+   the rest is the main loop's */
+typedef struct _offload_req
+{
+	Header hdr;
+	Session *s;
+	int sindex;
+	unsigned char *data;
+	int datasz;
+	int orphaned;		/* its session went while it ran */
+	offload_msg held[OFFLOAD_QUEUE];	/* the session's since, oldest first */
+	int nheld;
+	struct _offload_req *next;		/* waiting or done after it */
+	struct _offload_req *others;	/* the next handed over, for the main loop */
+} offload_req;
+
+static int started = 0;
+static int donefd[2] = {-1, -1};
+static offload_req *running = NULL;	/* those handed over, for the main loop */
+
+/* waiting for a thread, and done, shared with them under offloadlock */
+static offload_req *queuehead = NULL;
+static offload_req *queuetail = NULL;
+static offload_req *donehead = NULL;
+static offload_req *donetail = NULL;
+
+static pthread_mutex_t offloadlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t offloadcond = PTHREAD_COND_INITIALIZER;
+
+void _offload_lock()
+{
+	pthread_mutex_lock(&offloadlock);
+}
+
+void _offload_unlock()
+{
+	pthread_mutex_unlock(&offloadlock);
+}
+
+void *_offload_thread(void *arg)
+{
+	offload_req *r;
+	unsigned char c = 0;
+
+	_offload_lock();
+	for (;;)
+	{
+		while (queuehead == NULL)
+			pthread_cond_wait(&offloadcond, &offloadlock);
+		r = queuehead;
+		if ((queuehead = r->next) == NULL)
+			queuetail = NULL;
+		_offload_unlock();
+
+		tnfs_dispatch(&r->hdr, r->s, r->sindex, r->data, r->datasz);
+
+		_offload_lock();
+		r->next = NULL;
+		if (donetail != NULL)
+			donetail->next = r;
+		else
+			donehead = r;
+		donetail = r;
+		if (write(donefd[1], &c, 1) < 1 && errno != EAGAIN)
+			LOG("offload: unable to wake the main loop: %s\n", strerror(errno));
+	}
+	return NULL;
+}
+
+int offload_init()
+{
+	pthread_t t;
+	int i;
+
+	if (pipe(donefd) < 0)
+	{
+		LOG("offload: pipe failed: %s\n", strerror(errno));
+		return 0;
+	}
+	/* one byte waiting is as good as many */
+	fcntl(donefd[0], F_SETFL, O_NONBLOCK);
+	fcntl(donefd[1], F_SETFL, O_NONBLOCK);
+	fcntl(donefd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(donefd[1], F_SETFD, FD_CLOEXEC);
+	for (i = 0; i < OFFLOAD_THREADS; i++)
+	{
+		if (pthread_create(&t, NULL, _offload_thread, NULL) != 0)
+			break;
+		pthread_detach(t);
+	}
+	if (i == 0)
+	{
+		LOG("offload: unable to start the threads\n");
+		close(donefd[0]);
+		close(donefd[1]);
+		donefd[0] = donefd[1] = -1;
+		return 0;
+	}
+	started = 1;
+	return 1;
+}
+
+int offload_wanted(Header *hdr, Session *s)
+{
+	/* a window keeps its own order */
+	if (!started || s->window != NULL)
+		return 0;
+	switch (hdr->cmd)
+	{
+	case TNFS_STATFILE:
+	case TNFS_OPENFILE:
+	case TNFS_OPENDIR:
+	case TNFS_OPENDIRX:
+		return 1;
+	}
+	return 0;
+}
+
+/* Whether a request would be answered from what's cached, without
+   waiting on the storage */
+int _offload_cached(Header *hdr, Session *s, unsigned char *databuf, int datasz)
+{
+	switch (hdr->cmd)
+	{
+	case TNFS_STATFILE:
+		return tnfs_stat_cached(s, databuf, datasz);
+	case TNFS_OPENDIRX:
+		return tnfs_opendirx_cached(hdr, s, databuf, datasz);
+	}
+	return 0;
+}
+
+void offload_run(Header *hdr, Session *s, int sindex,
+	unsigned char *databuf, int datasz)
+{
+	offload_req *r;
+
+	/* handing over costs more than a cache hit takes */
+	if (_offload_cached(hdr, s, databuf, datasz))
+	{
+		tnfs_dispatch(hdr, s, sindex, databuf, datasz);
+		return;
+	}
+
+	if ((r = calloc(1, sizeof(offload_req))) == NULL ||
+		(r->data = malloc(datasz > 0 ? datasz : 1)) == NULL)
+	{
+		free(r);
+		tnfs_dispatch(hdr, s, sindex, databuf, datasz);
+		return;
+	}
+	r->hdr = *hdr;
+	r->s = s;
+	r->sindex = sindex;
+	memcpy(r->data, databuf, datasz);
+	r->datasz = datasz;
+	s->offload = r;
+
+	r->others = running;
+	running = r;
+
+	_offload_lock();
+	r->next = NULL;
+	if (queuetail != NULL)
+		queuetail->next = r;
+	else
+		queuehead = r;
+	queuetail = r;
+	pthread_cond_signal(&offloadcond);
+	_offload_unlock();
+}
+
+int offload_fd()
+{
+	return donefd[0];
+}
+
+int offload_full(Session *s)
+{
+	return s->offload != NULL && s->offload->nheld == OFFLOAD_QUEUE;
+}
+
+int offload_pending(int cli_fd)
+{
+	offload_req *r;
+	int i;
+
+	for (r = running; r != NULL; r = r->others)
+	{
+		if (r->hdr.cli_fd == cli_fd || (!r->orphaned && r->s->cli_fd == cli_fd))
+			return 1;
+		for (i = 0; i < r->nheld; i++)
+		{
+			if (r->held[i].cli_fd == cli_fd)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+void offload_hold(Session *s, struct sockaddr_in *cliaddr, int cli_fd,
+	unsigned char *rxbuf, int rxbytes)
+{
+	offload_req *r = s->offload;
+	offload_msg *m;
+	int i;
+
+	/* the client hasn't had a reply to it yet */
+	if (rxbuf[2] == r->hdr.seqno && rxbuf[3] == r->hdr.cmd)
+		return;
+
+	/* nor to this, which it has already sent once */
+	for (i = 0; i < r->nheld; i++)
+	{
+		m = &r->held[i];
+		if (m->cli_fd == cli_fd && m->len == rxbytes &&
+			m->cliaddr.sin_addr.s_addr == cliaddr->sin_addr.s_addr &&
+			m->cliaddr.sin_port == cliaddr->sin_port &&
+			memcmp(m->buf, rxbuf, rxbytes) == 0)
+			return;
+	}
+
+	/* if there's no room, the client will send it again */
+	if (r->nheld == OFFLOAD_QUEUE)
+	{
+		MSGLOG(cliaddr->sin_addr.s_addr, "Too many requests waiting, dropped one");
+		return;
+	}
+	m = &r->held[r->nheld];
+	if ((m->buf = malloc(rxbytes)) == NULL)
+		return;
+	memcpy(m->buf, rxbuf, rxbytes);
+	m->len = rxbytes;
+	m->cliaddr = *cliaddr;
+	m->cli_fd = cli_fd;
+	r->nheld++;
+}
+
+int offload_orphan(Session *s)
+{
+	offload_req *r = s->offload;
+	int i;
+
+	if (r == NULL)
+		return 0;
+	r->orphaned = 1;
+	for (i = 0; i < r->nheld; i++)
+		free(r->held[i].buf);
+	r->nheld = 0;
+	return 1;
+}
+
+void _offload_free(offload_req *r)
+{
+	offload_req **p;
+
+	for (p = &running; *p != r; p = &(*p)->others)
+		;
+	*p = r->others;
+	free(r->data);
+	free(r);
+}
+
+void offload_finish()
+{
+	offload_req *done, *r;
+	unsigned char c[64];
+	int i;
+
+	while (read(donefd[0], c, sizeof(c)) > 0)
+		;
+	_offload_lock();
+	done = donehead;
+	donehead = donetail = NULL;
+	_offload_unlock();
+
+	while ((r = done) != NULL)
+	{
+		done = r->next;
+		r->s->offload = NULL;
+		if (r->orphaned)
+		{
+			tnfs_closesession(r->s);
+			_offload_free(r);
+			continue;
+		}
+		/* in the order they came. One that goes off the main loop
+		   again holds the rest */
+		for (i = 0; i < r->nheld; i++)
+		{
+			tnfs_decode(&r->held[i].cliaddr, r->held[i].cli_fd,
+				r->held[i].len, r->held[i].buf);
+			free(r->held[i].buf);
+		}
+		_offload_free(r);
+	}
+}
+
+#else
+
+int offload_init()
+{
+	return 0;
+}
+
+int offload_wanted(Header *hdr, Session *s)
+{
+	return 0;
+}
+
+void offload_run(Header *hdr, Session *s, int sindex,
+	unsigned char *databuf, int datasz)
+{
+	tnfs_dispatch(hdr, s, sindex, databuf, datasz);
+}
+
+int offload_fd()
+{
+	return -1;
+}
+
+int offload_full(Session *s)
+{
+	return 0;
+}
+
+int offload_pending(int cli_fd)
+{
+	return 0;
+}
+
+void offload_hold(Session *s, struct sockaddr_in *cliaddr, int cli_fd,
+	unsigned char *rxbuf, int rxbytes)
+{
+}
+
+int offload_orphan(Session *s)
+{
+	return 0;
+}
+
+void offload_finish()
+{
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef _TNFS_OFFLOAD_H
+#define _TNFS_OFFLOAD_H
+
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * TNFS daemon slow requests run off the main loop
+ *
+ * */
+
+#include "tnfs.h"
+
+/* STAT, OPEN, OPENDIR and OPENDIRX can take longer than a client's
+ * retransmit timeout on a slow or networked root, so unless what's
+ * cached answers them they're handed to one of OFFLOAD_THREADS threads
+ * and the main loop goes on with other sessions. A session has one request off the main loop at most:
+ * retransmits of it are absorbed so that its reply goes out once, when
+ * it's ready, and anything else the session sends is put aside to run
+ * after it. With ENABLE_THREADS undefined everything runs on the main
+ * loop */
+
+/* Start the threads. Returns 0 if there aren't any */
+int offload_init();
+
+/* Returns 1 if a request from s should go through offload_run */
+int offload_wanted(Header *hdr, Session *s);
+
+/* Run a request a STAT or OPENDIRX cache hit answers, or hand it to a
+ * thread. Until that's done s->offload is set */
+void offload_run(Header *hdr, Session *s, int sindex,
+	unsigned char *databuf, int datasz);
+
+/* Readable once a request handed over is done */
+int offload_fd();
+
+/* Returns 1 while nothing more from s can be put aside. A datagram
+ * that doesn't fit is sent again by its client, so TCP is left unread */
+int offload_full(Session *s);
+
+/* Returns 1 while a request for a session on a TCP connection is off the
+ * main loop or put aside, so the connection can't be closed yet */
+int offload_pending(int cli_fd);
+
+/* While s->offload is set, absorb a datagram that repeats the request
+ * running, or put it aside until offload_finish */
+void offload_hold(Session *s, struct sockaddr_in *cliaddr, int cli_fd,
+	unsigned char *rxbuf, int rxbytes);
+
+/* As s is freed. Returns 1 if a request of its is still running, when
+ * what was put aside is dropped and offload_finish closes it instead */
+int offload_orphan(Session *s);
+
+/* Once offload_fd() is readable, run what the sessions whose requests
+ * are done put aside meanwhile */
+void offload_finish();
+
+#endif
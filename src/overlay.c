@@ -0,0 +1,593 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon copy-on-write overlays
+ *
+ * */
+
+#ifdef ENABLE_OVERLAY
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#endif
+
+#include "config.h"
+#include "overlay.h"
+#include "endian.h"
+#include "bsdcompat.h"
+#include "log.h"
+
+/* An overlay open by any number of a client's file handles */
+typedef struct _overlay_image
+{
+	char *key;				/* client/path */
+	int basefd;
+	int datafd;
+	int mapfd;				/* share locked while open */
+	overlay_map map;
+	int refs;
+	struct _overlay_image *next;
+#ifdef ENABLE_THREADS
+	pthread_mutex_t lock;	/* its map, as its handles read and write */
+#endif
+} overlay_image;
+
+static int overlayfd = -1;	/* the overlay directory */
+static overlay_image *images = NULL;
+
+/* Files are opened on the worker threads too. The images and their
+   references are shared under overlaylock */
+#ifdef ENABLE_THREADS
+static pthread_mutex_t overlaylock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void _overlay_lock(overlay_image *img)
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_lock(img ? &img->lock : &overlaylock);
+#endif
+}
+
+void _overlay_unlock(overlay_image *img)
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_unlock(img ? &img->lock : &overlaylock);
+#endif
+}
+
+extern const vfs_provider overlay_provider;
+
+uint64_t _overlay_get64(unsigned char *buf)
+{
+	return tnfs32uint(buf) | ((uint64_t)tnfs32uint(buf + 4) << 32);
+}
+
+void _overlay_put64(unsigned char *buf, uint64_t value)
+{
+	uint32tnfs(buf, (uint32_t)value);
+	uint32tnfs(buf + 4, (uint32_t)(value >> 32));
+}
+
+size_t _overlay_bitmapsz(uint64_t size, uint32_t blocksize)
+{
+	return (size_t)(((size + blocksize - 1) / blocksize + 7) / 8);
+}
+
+/* Make the bitmap big enough for the file's size */
+int _overlay_growmap(overlay_map *map)
+{
+	size_t need = _overlay_bitmapsz(map->size, map->blocksize);
+	uint8_t *grown;
+
+	if (need <= map->bitmapsz)
+		return 0;
+	if ((grown = realloc(map->bitmap, need)) == NULL)
+		return -1;
+	memset(grown + map->bitmapsz, 0, need - map->bitmapsz);
+	map->bitmap = grown;
+	map->bitmapsz = need;
+	return 0;
+}
+
+int _overlay_held(const overlay_map *map, uint64_t block)
+{
+	return block / 8 < map->bitmapsz && (map->bitmap[block / 8] & (1 << (block % 8)));
+}
+
+int overlay_readmap(int mapfd, overlay_map *map)
+{
+	unsigned char header[OVERLAY_HEADER_SIZE];
+	struct stat st;
+	ssize_t n;
+
+	memset(map, 0, sizeof(overlay_map));
+	if (fstat(mapfd, &st) < 0)
+		return -1;
+	if (st.st_size < OVERLAY_HEADER_SIZE ||
+		pread(mapfd, header, sizeof(header), 0) != sizeof(header) ||
+		memcmp(header, OVERLAY_MAGIC, 8) != 0 ||
+		(map->blocksize = tnfs32uint(header + 8)) == 0 ||
+		map->blocksize > OVERLAY_BLOCK_MAX)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	map->size = _overlay_get64(header + 16);
+	map->basesize = _overlay_get64(header + 24);
+	if (_overlay_growmap(map) < 0)
+		return -1;
+
+	/* bits never set may not have been written out */
+	n = st.st_size - OVERLAY_HEADER_SIZE;
+	if (n > (ssize_t)map->bitmapsz)
+		n = map->bitmapsz;
+	if (n > 0 && pread(mapfd, map->bitmap, n, OVERLAY_HEADER_SIZE) != n)
+	{
+		free(map->bitmap);
+		map->bitmap = NULL;
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+int overlay_writeheader(int mapfd, const overlay_map *map)
+{
+	unsigned char header[OVERLAY_HEADER_SIZE];
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, OVERLAY_MAGIC, 8);
+	uint32tnfs(header + 8, map->blocksize);
+	_overlay_put64(header + 16, map->size);
+	_overlay_put64(header + 24, map->basesize);
+	if (pwrite(mapfd, header, sizeof(header), 0) != sizeof(header))
+		return -1;
+	return 0;
+}
+
+int overlay_apply(const overlay_map *map, int datafd, int basefd)
+{
+	unsigned char buf[65536];
+	uint64_t block, blocks = (map->size + map->blocksize - 1) / map->blocksize;
+	uint64_t offset, end;
+	size_t n;
+
+	for (block = 0; block < blocks; block++)
+	{
+		if (!_overlay_held(map, block))
+			continue;
+
+		/* copy each run of held blocks in one go where it fits */
+		offset = block * map->blocksize;
+		while (block + 1 < blocks && _overlay_held(map, block + 1) &&
+			   (block + 2) * map->blocksize - offset <= sizeof(buf))
+			block++;
+		end = (block + 1) * map->blocksize;
+		if (end > map->size)
+			end = map->size;
+		n = end - offset;
+
+		/* a sparse data file reads back zeros where nothing was written */
+		memset(buf, 0, n);
+		if (pread(datafd, buf, n, offset) < 0 ||
+			pwrite(basefd, buf, n, offset) != (ssize_t)n)
+			return -1;
+	}
+	return ftruncate(basefd, map->size);
+}
+
+int overlay_init(const char *dir)
+{
+	if ((overlayfd = open(dir, O_RDONLY | O_DIRECTORY)) < 0)
+	{
+		LOG("Unable to open overlay directory %s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int overlay_enabled()
+{
+	return overlayfd >= 0;
+}
+
+/* Make the directories an overlay file at path lives in */
+int _overlay_mkdirs(const char *path)
+{
+	char dir[MAX_FILEPATH];
+	char *slash;
+
+	strlcpy(dir, path, sizeof(dir));
+	for (slash = strchr(dir, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+	{
+		*slash = 0;
+		if (mkdirat(overlayfd, dir, 0755) < 0 && errno != EEXIST)
+			return -1;
+		*slash = '/';
+	}
+	return 0;
+}
+
+overlay_image *_overlay_find(const char *key)
+{
+	overlay_image *img;
+
+	for (img = images; img != NULL; img = img->next)
+	{
+		if (strcmp(img->key, key) == 0)
+			return img;
+	}
+	return NULL;
+}
+
+void _overlay_free(overlay_image *img)
+{
+	close(img->basefd);
+	close(img->datafd);
+	close(img->mapfd);
+	free(img->map.bitmap);
+	free(img->key);
+#ifdef ENABLE_THREADS
+	pthread_mutex_destroy(&img->lock);
+#endif
+	free(img);
+}
+
+void _overlay_release(overlay_image *img)
+{
+	overlay_image **p;
+
+	_overlay_lock(NULL);
+	if (--img->refs > 0)
+	{
+		_overlay_unlock(NULL);
+		return;
+	}
+	for (p = &images; *p != img; p = &(*p)->next)
+		;
+	*p = img->next;
+	_overlay_unlock(NULL);
+	_overlay_free(img);
+}
+
+/* Open or create the overlay files for a key not already open */
+overlay_image *_overlay_load(const char *key, const char *client, const char *path, int basefd)
+{
+	char datapath[MAX_FILEPATH];
+	char mappath[MAX_FILEPATH];
+	overlay_image *img;
+	struct stat st;
+	int err;
+
+	if (snprintf(datapath, sizeof(datapath), "%s/data/%s", client, path) >= (int)sizeof(datapath) ||
+		snprintf(mappath, sizeof(mappath), "%s/map/%s", client, path) >= (int)sizeof(mappath))
+	{
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	if ((img = calloc(1, sizeof(overlay_image))) == NULL)
+		return NULL;
+	img->datafd = img->mapfd = -1;
+
+	if (_overlay_mkdirs(datapath) < 0 || _overlay_mkdirs(mappath) < 0 ||
+		(img->mapfd = openat(overlayfd, mappath, O_RDWR | O_CREAT, 0644)) < 0)
+		goto fail;
+	/* tnfsd-overlay won't commit or discard it while it's open */
+	if (flock(img->mapfd, LOCK_SH | LOCK_NB) < 0)
+	{
+		errno = EBUSY;
+		goto fail;
+	}
+	if ((img->datafd = openat(overlayfd, datapath, O_RDWR | O_CREAT, 0644)) < 0 ||
+		fstat(img->mapfd, &st) < 0)
+		goto fail;
+
+	if (st.st_size == 0)
+	{
+		/* a new overlay, of the file as it is now */
+		if (fstat(basefd, &st) < 0)
+			goto fail;
+		img->map.blocksize = OVERLAY_BLOCK;
+		img->map.size = img->map.basesize = st.st_size;
+		if (_overlay_growmap(&img->map) < 0 ||
+			overlay_writeheader(img->mapfd, &img->map) < 0)
+			goto fail;
+	}
+	else if (overlay_readmap(img->mapfd, &img->map) < 0)
+		goto fail;
+
+	if ((img->key = strdup(key)) == NULL)
+		goto fail;
+	img->basefd = basefd;
+#ifdef ENABLE_THREADS
+	pthread_mutex_init(&img->lock, NULL);
+#endif
+	return img;
+
+fail:
+	err = errno;
+	if (img->datafd >= 0)
+		close(img->datafd);
+	if (img->mapfd >= 0)
+		close(img->mapfd);
+	free(img->map.bitmap);
+	free(img);
+	errno = err;
+	return NULL;
+}
+
+int overlay_open(const char *client, const char *path, int basefd, int flags, vfs_file **f)
+{
+	char key[MAX_FILEPATH];
+	overlay_image *img, *loaded = NULL;
+
+	snprintf(key, sizeof(key), "%s/%s", client, path);
+	_overlay_lock(NULL);
+	if ((img = _overlay_find(key)) != NULL)
+		img->refs++;
+	_overlay_unlock(NULL);
+	if (img == NULL)
+	{
+		if ((img = _overlay_load(key, client, path, basefd)) == NULL)
+			return -1;
+		/* another thread may have opened it meanwhile */
+		_overlay_lock(NULL);
+		if ((loaded = _overlay_find(key)) == NULL)
+		{
+			img->next = images;
+			images = img;
+			img->refs++;
+		}
+		else
+			loaded->refs++;
+		_overlay_unlock(NULL);
+		if (loaded != NULL)
+		{
+			_overlay_free(img);
+			img = loaded;
+		}
+	}
+	else
+		close(basefd);
+
+	if ((*f = calloc(1, sizeof(vfs_file))) == NULL)
+	{
+		_overlay_release(img);
+		return -1;
+	}
+	_overlay_lock(img);
+	if ((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY)
+	{
+		/* nothing shows through any more */
+		img->map.size = img->map.basesize = 0;
+		memset(img->map.bitmap, 0, img->map.bitmapsz);
+		if (ftruncate(img->datafd, 0) < 0 ||
+			ftruncate(img->mapfd, OVERLAY_HEADER_SIZE) < 0 ||
+			overlay_writeheader(img->mapfd, &img->map) < 0)
+			LOG("overlay: unable to truncate %s: %s\n", img->key, strerror(errno));
+	}
+	(*f)->provider = &overlay_provider;
+	(*f)->handle = img;
+	(*f)->size = img->map.size;
+	(*f)->flags = flags;
+	_overlay_unlock(img);
+	return 0;
+}
+
+int overlay_size(const char *client, const char *path, uint64_t *size)
+{
+	char key[MAX_FILEPATH];
+	char mappath[MAX_FILEPATH];
+	overlay_image *img;
+	overlay_map map;
+	int fd, result;
+
+	snprintf(key, sizeof(key), "%s/%s", client, path);
+	_overlay_lock(NULL);
+	if ((img = _overlay_find(key)) != NULL)
+	{
+		_overlay_lock(img);
+		*size = img->map.size;
+		_overlay_unlock(img);
+		_overlay_unlock(NULL);
+		return 0;
+	}
+	_overlay_unlock(NULL);
+
+	snprintf(mappath, sizeof(mappath), "%s/map/%s", client, path);
+	if ((fd = openat(overlayfd, mappath, O_RDONLY)) < 0)
+		return 1;
+	result = overlay_readmap(fd, &map) == 0 ? 0 : 1;
+	close(fd);
+	free(map.bitmap);
+	*size = map.size;
+	return result;
+}
+
+/* Read what the client sees: its own blocks, the file beneath up to
+   where it ended, and zeros past that. Called with the image locked */
+ssize_t _overlay_read(overlay_image *img, void *buf, size_t count, uint64_t offset)
+{
+	uint32_t bs = img->map.blocksize;
+	unsigned char *p = buf;
+	size_t done = 0, n, from;
+	uint64_t block;
+	ssize_t r;
+	int held;
+
+	if (offset >= img->map.size)
+		return 0;
+	if (count > img->map.size - offset)
+		count = img->map.size - offset;
+
+	while (done < count)
+	{
+		/* a run of blocks all from the same place */
+		block = offset / bs;
+		held = _overlay_held(&img->map, block);
+		n = bs - offset % bs;
+		while (n < count - done && _overlay_held(&img->map, block + (offset % bs + n) / bs) == held)
+			n += bs;
+		if (n > count - done)
+			n = count - done;
+
+		from = 0;
+		if (held)
+		{
+			if ((r = pread(img->datafd, p + done, n, offset)) < 0)
+				return done ? (ssize_t)done : -1;
+			from = r;
+		}
+		else if (offset < img->map.basesize)
+		{
+			from = img->map.basesize - offset < n ? img->map.basesize - offset : n;
+			if ((r = pread(img->basefd, p + done, from, offset)) < 0)
+				return done ? (ssize_t)done : -1;
+			from = r;
+		}
+		memset(p + done + from, 0, n - from);
+		done += n;
+		offset += n;
+	}
+	return done;
+}
+
+/* Copy a block into the data file as the client sees it, so that it can
+   be written to in part */
+int _overlay_fill(overlay_image *img, uint64_t block)
+{
+	unsigned char buf[OVERLAY_BLOCK_MAX];
+	uint64_t offset = block * img->map.blocksize;
+
+	/* past the end there's nothing to keep */
+	if (offset >= img->map.size)
+		return 0;
+	memset(buf, 0, img->map.blocksize);
+	if (_overlay_read(img, buf, img->map.blocksize, offset) < 0)
+		return -1;
+	return pwrite(img->datafd, buf, img->map.blocksize, offset) == img->map.blocksize ? 0 : -1;
+}
+
+ssize_t _overlay_pread(vfs_file *f, void *buf, size_t count, uint64_t offset)
+{
+	overlay_image *img = (overlay_image *)f->handle;
+	ssize_t result;
+
+	_overlay_lock(img);
+	result = _overlay_read(img, buf, count, offset);
+	_overlay_unlock(img);
+	return result;
+}
+
+/* Write to the client's blocks. Called with the image locked */
+ssize_t _overlay_write(overlay_image *img, const void *buf, size_t count, uint64_t offset)
+{
+	uint32_t bs = img->map.blocksize;
+	uint64_t first, last, block, end = offset + count;
+	size_t from, to;
+
+	if (count == 0)
+		return 0;
+	first = offset / bs;
+	last = (end - 1) / bs;
+
+	/* blocks written only in part keep the rest of what was there */
+	if ((offset % bs || (end % bs && last == first)) &&
+		!_overlay_held(&img->map, first) && _overlay_fill(img, first) < 0)
+		return -1;
+	if (end % bs && last != first &&
+		!_overlay_held(&img->map, last) && _overlay_fill(img, last) < 0)
+		return -1;
+	if (pwrite(img->datafd, buf, count, offset) != (ssize_t)count)
+		return -1;
+
+	if (end > img->map.size)
+	{
+		img->map.size = end;
+		if (_overlay_growmap(&img->map) < 0 ||
+			overlay_writeheader(img->mapfd, &img->map) < 0)
+			return -1;
+	}
+
+	/* the data is down before the map says it's there */
+	for (block = first; block <= last; block++)
+		img->map.bitmap[block / 8] |= 1 << (block % 8);
+	from = first / 8;
+	to = last / 8 + 1;
+	if (pwrite(img->mapfd, img->map.bitmap + from, to - from, OVERLAY_HEADER_SIZE + from) != (ssize_t)(to - from))
+		return -1;
+	return count;
+}
+
+ssize_t _overlay_pwrite(vfs_file *f, const void *buf, size_t count, uint64_t offset)
+{
+	overlay_image *img = (overlay_image *)f->handle;
+	ssize_t result;
+
+	_overlay_lock(img);
+	result = _overlay_write(img, buf, count, offset);
+	_overlay_unlock(img);
+	return result;
+}
+
+/* Other handles on the same overlay may have grown or truncated it */
+uint64_t _overlay_size(vfs_file *f)
+{
+	overlay_image *img = (overlay_image *)f->handle;
+	uint64_t size;
+
+	_overlay_lock(img);
+	size = img->map.size;
+	_overlay_unlock(img);
+	return size;
+}
+
+void _overlay_close(vfs_file *f)
+{
+	_overlay_release((overlay_image *)f->handle);
+}
+
+const vfs_provider overlay_provider = {
+	"overlay",
+	NULL,
+	_overlay_pread,
+	_overlay_pwrite,
+	_overlay_size,
+	_overlay_close,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef _TNFS_OVERLAY_H
+#define _TNFS_OVERLAY_H
+
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon copy-on-write overlays
+ *
+ * */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "vfs.h"
+
+/* With an overlay directory, a client's writes to a file never reach
+ * the file itself. Each block written goes to a sparse copy kept for
+ * that client's address, and reads take the blocks it holds over the
+ * rest of the file, which stays the same for everyone else. In the
+ * overlay directory, client/data/<path> holds the blocks at their own
+ * offsets and client/map/<path> records which are there, after a header
+ * with the block size and the file's size. tnfsd-overlay lists overlays,
+ * writes them back into the files, or throws them away. */
+
+#define OVERLAY_MAGIC "TNFSOVL1"
+#define OVERLAY_HEADER_SIZE 32
+#define OVERLAY_BLOCK_MAX 65536	/* the largest block size a map may have */
+
+typedef struct _overlay_map
+{
+	uint32_t blocksize;
+	uint64_t size;			/* of the file as the client sees it */
+	uint64_t basesize;		/* of the file beneath that shows through */
+	uint8_t *bitmap;		/* a bit for each block held in the data file */
+	size_t bitmapsz;
+} overlay_map;
+
+/* Read a map file's header and bitmap, returns -1 with errno set, EINVAL
+ * if it isn't a map */
+int overlay_readmap(int mapfd, overlay_map *map);
+int overlay_writeheader(int mapfd, const overlay_map *map);
+/* Write the blocks held in datafd into the file beneath, leaving it the
+ * size the client saw */
+int overlay_apply(const overlay_map *map, int datafd, int basefd);
+
+/* Open the overlay directory, before any chroot */
+int overlay_init(const char *dir);
+int overlay_enabled();
+
+/* Open the overlay of the file at path for client, creating it if need
+ * be, and take over basefd, the file itself opened read-only. Returns 0,
+ * or -1 with errno set */
+int overlay_open(const char *client, const char *path, int basefd, int flags, vfs_file **f);
+/* The size of the file as client sees it, if it has an overlay. Returns
+ * 0, or 1 if it has none */
+int overlay_size(const char *client, const char *path, uint64_t *size);
+
+#endif
@@ -0,0 +1,230 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon wildcard pattern matching
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "pattern.h"
+
+/* Fills in the failure links for each run of characters between two
+ * stars: next[j] is the length of the longest proper prefix of the run
+ * that is also a suffix of its first j + 1 characters. A run with a '?'
+ * can't be searched for that way, which its first link of -1 says */
+static void _pattern_links(tnfs_pattern *p)
+{
+	const char *run = p->glob + p->prefixlen;
+	const char *end = p->glob + p->len - p->suffixlen;
+	int *next;
+	int j, k, len;
+
+	while (run < end)
+	{
+		if (*run == '*')
+		{
+			run++;
+			continue;
+		}
+		for (len = 0; run + len < end && run[len] != '*'; len++)
+			;
+		next = p->next + (run - p->glob);
+		next[0] = memchr(run, '?', len) != NULL ? -1 : 0;
+		for (j = 1, k = 0; j < len && next[0] == 0; j++)
+		{
+			while (k > 0 && run[j] != run[k])
+				k = next[k - 1];
+			if (run[j] == run[k])
+				k++;
+			next[j] = k;
+		}
+		run += len;
+	}
+}
+
+tnfs_pattern *pattern_compile(const char *glob, int flags)
+{
+	tnfs_pattern *p;
+	const char *g;
+	char *o;
+	int firststar = -1, laststar = -1;
+
+	if (glob == NULL)
+		return NULL;
+
+	if ((p = calloc(1, sizeof(tnfs_pattern))) == NULL)
+		return NULL;
+	if ((p->glob = malloc(strlen(glob) + 1)) == NULL ||
+		(p->next = malloc((strlen(glob) + 1) * sizeof(int))) == NULL)
+	{
+		free(p->glob);
+		free(p);
+		return NULL;
+	}
+
+	/* Fold the pattern once so matching only has to fold the subject,
+	 * and collapse "**" since it matches exactly what "*" does */
+	for (g = glob, o = p->glob; *g; g++)
+	{
+		if (*g == '*')
+		{
+			if (o > p->glob && o[-1] == '*')
+				continue;
+			if (firststar < 0)
+				firststar = o - p->glob;
+			laststar = o - p->glob;
+		}
+		else
+		{
+			p->minlen++;
+		}
+		*o++ = tolower((unsigned char)*g);
+	}
+	*o = '\0';
+
+	p->len = o - p->glob;
+	p->flags = flags;
+	p->hasstar = firststar >= 0;
+	if (p->hasstar)
+	{
+		p->prefixlen = firststar;
+		p->suffixlen = p->len - laststar - 1;
+	}
+	else
+	{
+		p->prefixlen = p->len;
+		p->suffixlen = 0;
+	}
+	_pattern_links(p);
+
+	return p;
+}
+
+void pattern_free(tnfs_pattern *pattern)
+{
+	if (pattern == NULL)
+		return;
+	free(pattern->glob);
+	free(pattern->next);
+	free(pattern);
+}
+
+/* Matches a single non-'*' pattern character against a subject character */
+static inline bool _pattern_charmatch(const tnfs_pattern *p, char pc, char sc)
+{
+	if (pc == '?')
+		return !((p->flags & PATTERN_QMARK_NODOT) && sc == '.');
+	return pc == tolower((unsigned char)sc);
+}
+
+/* Returns the leftmost place in [s, send) the run of len characters at
+ * run matches, or NULL. Runs without a '?' are searched Knuth-Morris-Pratt
+ * fashion, never looking at a character of the subject twice */
+static const char *_pattern_find(const tnfs_pattern *p, const char *run, int len,
+								 const char *s, const char *send)
+{
+	const int *next = p->next + (run - p->glob);
+	int j;
+	char c;
+
+	if (next[0] < 0)
+	{
+		for (; s + len <= send; s++)
+		{
+			for (j = 0; j < len && _pattern_charmatch(p, run[j], s[j]); j++)
+				;
+			if (j == len)
+				return s;
+		}
+		return NULL;
+	}
+
+	for (j = 0; s < send; s++)
+	{
+		c = tolower((unsigned char)*s);
+		while (j > 0 && run[j] != c)
+			j = next[j - 1];
+		if (run[j] == c && ++j == len)
+			return s + 1 - len;
+	}
+	return NULL;
+}
+
+/* Returns true if str matches the compiled pattern.
+ * The literal prefix and suffix are checked first, which rejects most
+ * names after a character or two. The part in between always begins and
+ * ends with a '*', so each run of characters between two stars matches
+ * wherever it is first found after the run before it: finding it any
+ * later only leaves less for the runs after it. Nothing is backtracked,
+ * and without a '?' in the middle the work is linear in the length of
+ * the name. */
+bool pattern_match(const tnfs_pattern *pattern, const char *str)
+{
+	const char *pat, *pend, *s, *send;
+	int i, n, len;
+
+	if (pattern == NULL || str == NULL)
+		return false;
+
+	n = strlen(str);
+	if (n < pattern->minlen || (!pattern->hasstar && n != pattern->len))
+		return false;
+
+	for (i = 0; i < pattern->prefixlen; i++)
+	{
+		if (!_pattern_charmatch(pattern, pattern->glob[i], str[i]))
+			return false;
+	}
+	if (!pattern->hasstar)
+		return true;
+
+	pend = pattern->glob + pattern->len - pattern->suffixlen;
+	send = str + n - pattern->suffixlen;
+	for (i = 0; i < pattern->suffixlen; i++)
+	{
+		if (!_pattern_charmatch(pattern, pend[i], send[i]))
+			return false;
+	}
+
+	pat = pattern->glob + pattern->prefixlen;
+	s = str + pattern->prefixlen;
+	while (pat < pend)
+	{
+		if (*pat == '*')
+		{
+			pat++;
+			continue;
+		}
+		for (len = 0; pat + len < pend && pat[len] != '*'; len++)
+			;
+		if ((s = _pattern_find(pattern, pat, len, s, send)) == NULL)
+			return false;
+		s += len;
+		pat += len;
+	}
+
+	return true;
+}
@@ -0,0 +1,55 @@
+#ifndef _TNFS_PATTERN_H
+#define _TNFS_PATTERN_H
+
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon wildcard pattern matching
+ *
+ * */
+
+#include <stdbool.h>
+
+/* '?' does not match a '.' (the TNFS_DIR_EXT wildcard behaviour) */
+#define PATTERN_QMARK_NODOT 0x01
+
+/* A wildcard pattern compiled for repeated matching. '*' matches any
+ * run of characters, '?' any single character, and everything else
+ * matches itself ignoring case. */
+typedef struct _tnfs_pattern
+{
+	char *glob;		/* lowercased pattern, runs of '*' collapsed */
+	int len;		/* length of glob */
+	int prefixlen;	/* characters before the first '*' */
+	int suffixlen;	/* characters after the last '*' */
+	int minlen;		/* shortest string that can match */
+	bool hasstar;	/* pattern contains at least one '*' */
+	int flags;		/* PATTERN_* flags */
+	int *next;		/* KMP failure links of the runs between stars */
+} tnfs_pattern;
+
+/* Returns NULL if the pattern could not be allocated */
+tnfs_pattern *pattern_compile(const char *glob, int flags);
+bool pattern_match(const tnfs_pattern *pattern, const char *str);
+void pattern_free(tnfs_pattern *pattern);
+
+#endif
@@ -0,0 +1,839 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon path resolution beneath the root directory
+ *
+ * */
+
+#ifdef __linux__
+#define _GNU_SOURCE	/* O_PATH */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#define HAVE_OPENAT2
+#endif
+#endif
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#endif
+
+#include "resolve.h"
+#include "directory.h"
+#include "log.h"
+#include "notify.h"
+#include "bsdcompat.h"
+
+#define RESOLVE_LINKS 40	/* dangling symlinks followed in a row, as the kernel would */
+
+static char resolveroot[MAX_ROOT];	/* the root, fully resolved */
+#ifdef HAVE_OPENAT2
+static int rootfd = -1;				/* held on the root */
+static int beneath = 1;				/* cleared if the kernel lacks openat2() */
+
+/* Directories paths were recently resolved in, kept open so the next
+ * lookup below one starts from there rather than from the root. Only a
+ * directory that is watched, along with every directory above it, is
+ * kept, so renaming or removing anything on the way drops it before it
+ * can be used again. Requests run off the main loop share them under
+ * resolvelock, each lookup taking a descriptor of its own */
+typedef struct _resolve_dir
+{
+	char rel[MAX_FILEPATH];		/* relative to the root */
+	uint32_t hash;
+	int fd;					/* O_PATH */
+	struct _resolve_dir *chain;	/* same hash bucket */
+	struct _resolve_dir *prev;	/* most recently used first */
+	struct _resolve_dir *next;
+} resolve_dir;
+
+#define RESOLVE_BUCKETS 256
+
+static resolve_dir *buckets[RESOLVE_BUCKETS];
+static resolve_dir *dirhead = NULL;
+static resolve_dir *dirtail = NULL;
+static int dircount = 0;
+static char watchroot[MAX_ROOT];	/* the root as the other watchers name it */
+static uint32_t dirgen = 0;		/* bumped whenever anything is dropped */
+
+#ifdef ENABLE_THREADS
+static pthread_mutex_t resolvelock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void _resolve_lock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_lock(&resolvelock);
+#endif
+}
+
+void _resolve_unlock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_unlock(&resolvelock);
+#endif
+}
+#endif
+
+int resolve_init(const char *realroot)
+{
+	strlcpy(resolveroot, realroot, sizeof(resolveroot));
+#ifdef HAVE_OPENAT2
+	if (rootfd >= 0)
+		close(rootfd);
+	if ((rootfd = open(realroot, O_PATH | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return -1;
+	normalize_path(watchroot, root, sizeof(watchroot));
+#endif
+	return 0;
+}
+
+int resolve_inside(const char *realpath)
+{
+	size_t len = strlen(resolveroot);
+
+	/* a plain prefix match would let /srv/tnfs2 through for /srv/tnfs */
+	while (len > 0 && resolveroot[len - 1] == '/')
+		len--;
+	return strncmp(realpath, resolveroot, len) == 0 &&
+		   (realpath[len] == '/' || realpath[len] == 0);
+}
+
+/* The path relative to the root: under the session's mount point, with
+   no leading slash, "." for the root itself */
+int _resolve_rel(Session *s, const char *path, char *rel, int relsz)
+{
+	char joined[MAX_FILEPATH];
+	char *p;
+
+	if (snprintf(joined, sizeof(joined), "%s/%s", s->root ? s->root : "", path) >= (int)sizeof(joined))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	normalize_path(joined, joined, sizeof(joined));
+	for (p = joined; *p == '/'; p++)
+		;
+	strlcpy(rel, *p ? p : ".", relsz);
+	for (p = rel + strlen(rel) - 1; p > rel && *p == '/'; p--)
+		*p = 0;
+	return 0;
+}
+
+/* Check that full lies within the root once resolved. If follow is
+   clear only its directory is resolved, so the last component itself
+   may be a symlink that points anywhere. If it's set and the path
+   doesn't exist yet, a dangling symlink it ends in is followed as far
+   as creating it would */
+int _resolve_check(const char *full, int follow, int links)
+{
+	char real[MAX_FILEPATH];
+	char dir[MAX_FILEPATH];
+	char *slash;
+	int found;
+#ifndef WIN32
+	char target[MAX_FILEPATH];
+	char next[MAX_FILEPATH];
+	ssize_t len;
+#endif
+
+#ifdef WIN32
+	found = follow && GetFullPathNameA(full, sizeof(real), real, NULL) != 0;
+#else
+	found = follow && realpath(full, real) != NULL;
+#endif
+	if (!found)
+	{
+		if (follow && errno != ENOENT)
+			return -1;
+
+		strlcpy(dir, full, sizeof(dir));
+		if ((slash = strrchr(dir, '/')) != NULL)
+			*slash = 0;
+		if (strcmp(slash ? slash + 1 : dir, "..") == 0)
+		{
+			errno = EXDEV;
+			return -1;
+		}
+#ifndef WIN32
+		if (follow && (len = readlink(full, target, sizeof(target) - 1)) > 0)
+		{
+			if (links == 0)
+			{
+				errno = ELOOP;
+				return -1;
+			}
+			target[len] = 0;
+			if (snprintf(next, sizeof(next), "%s/%s", *target == '/' ? "" : dir,
+					target) >= (int)sizeof(next))
+			{
+				errno = ENAMETOOLONG;
+				return -1;
+			}
+			return _resolve_check(next, follow, links - 1);
+		}
+#endif
+#ifdef WIN32
+		if (GetFullPathNameA(dir, sizeof(real), real, NULL) == 0)
+#else
+		if (realpath(dir, real) == NULL)
+#endif
+			return -1;
+	}
+
+	if (!resolve_inside(real))
+	{
+		errno = EXDEV;
+		return -1;
+	}
+	return 0;
+}
+
+/* Without openat2(): the absolute path of rel, checked to lie within the
+   root once resolved */
+int _resolve_full(const char *rel, int follow, char *full, int fullsz)
+{
+	if (snprintf(full, fullsz, "%s/%s", resolveroot, rel) >= fullsz)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return _resolve_check(full, follow, RESOLVE_LINKS);
+}
+
+#ifdef HAVE_OPENAT2
+/* Open rel beneath dirfd, with any further RESOLVE_* flags. Returns -2
+   if openat2() isn't there */
+int _resolve_openat2(int dirfd, const char *rel, int flags, int mode, int resolve)
+{
+	struct open_how how;
+	int fd, tries;
+
+	if (!beneath)
+		return -2;
+
+	memset(&how, 0, sizeof(how));
+	how.flags = flags | O_CLOEXEC;
+	how.mode = (flags & O_CREAT) ? mode : 0;
+	how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS | resolve;
+
+	/* EAGAIN is a rename racing the lookup, which may be tried again */
+	for (tries = 0; tries < 4; tries++)
+	{
+		if ((fd = syscall(SYS_openat2, dirfd, rel, &how, sizeof(how))) >= 0 || errno != EAGAIN)
+			break;
+	}
+
+	if (fd < 0 && errno == ENOSYS)
+	{
+		LOG("openat2() is not available, checking resolved paths instead\n");
+		beneath = 0;
+		return -2;
+	}
+	return fd;
+}
+
+uint32_t _resolve_hash(const char *rel)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*rel)
+		hash = (hash ^ (uint8_t)*rel++) * 16777619u;
+	return hash;
+}
+
+void _resolve_forget(resolve_dir *d)
+{
+	resolve_dir **pp = &buckets[d->hash % RESOLVE_BUCKETS];
+
+	while (*pp != d)
+		pp = &(*pp)->chain;
+	*pp = d->chain;
+
+	if (d->prev)
+		d->prev->next = d->next;
+	else
+		dirhead = d->next;
+	if (d->next)
+		d->next->prev = d->prev;
+	else
+		dirtail = d->prev;
+
+	close(d->fd);
+	free(d);
+	dircount--;
+}
+
+/* Forget rel and every directory below it; "." is everything */
+void _resolve_drop(const char *rel)
+{
+	resolve_dir *d, *next;
+	size_t len = strlen(rel);
+
+	_resolve_lock();
+	dirgen++;
+	for (d = dirhead; d != NULL; d = next)
+	{
+		next = d->next;
+		if (strcmp(rel, ".") == 0 ||
+			(strncmp(d->rel, rel, len) == 0 && (d->rel[len] == '/' || d->rel[len] == 0)))
+		{
+#ifdef DEBUG
+			fprintf(stderr, "resolve: dropping '%s'\n", d->rel);
+#endif
+			_resolve_forget(d);
+		}
+	}
+	_resolve_unlock();
+}
+
+/* notify callback: whatever changed in or below a watched directory, or
+   the directory itself, may no longer be where it was */
+void _resolve_changed(const char *dirpath, const char *name, void *ctx)
+{
+	char rel[MAX_FILEPATH];
+	size_t len = strlen(watchroot);
+	const char *p;
+
+	while (len > 0 && watchroot[len - 1] == '/')
+		len--;
+	if (dirpath == NULL || strncmp(dirpath, watchroot, len) != 0 ||
+		(dirpath[len] != '/' && dirpath[len] != 0))
+	{
+		_resolve_drop(".");
+		return;
+	}
+
+	for (p = dirpath + len; *p == '/'; p++)
+		;
+	if (name == NULL)
+		snprintf(rel, sizeof(rel), "%s", *p ? p : ".");
+	else if (*p)
+		snprintf(rel, sizeof(rel), "%s/%s", p, name);
+	else
+		snprintf(rel, sizeof(rel), "%s", name);
+
+	len = strlen(rel);
+	while (len > 1 && rel[len - 1] == '/')
+		rel[--len] = 0;
+	_resolve_drop(rel);
+}
+
+/* Watch rel and each directory above it. Returns -1 if any can't be */
+int _resolve_watch(const char *rel)
+{
+	char path[MAX_FILEPATH];
+	char *p;
+
+	if (notify_watch(watchroot, _resolve_changed, NULL) < 0)
+		return -1;
+	if (snprintf(path, sizeof(path), "%s/%s", watchroot, rel) >= (int)sizeof(path))
+		return -1;
+	normalize_path(path, path, sizeof(path));
+
+	for (p = path + strlen(watchroot) + 1; (p = strchr(p, '/')) != NULL; p++)
+	{
+		*p = 0;
+		if (notify_watch(path, _resolve_changed, NULL) < 0)
+			return -1;
+		*p = '/';
+	}
+	return notify_watch(path, _resolve_changed, NULL);
+}
+
+/* Returns 1 if rel has no "." or ".." components, which would make the
+   same directory appear under more than one name */
+int _resolve_plain(const char *rel)
+{
+	const char *p = rel;
+	size_t n;
+
+	while (*p)
+	{
+		n = strcspn(p, "/");
+		if ((n == 1 && p[0] == '.') || (n == 2 && p[0] == '.' && p[1] == '.'))
+			return 0;
+		p += n;
+		while (*p == '/')
+			p++;
+	}
+	return 1;
+}
+
+/* An O_PATH descriptor on the directory rel, the root's or a copy of
+   one from the cache if it's there. *owned is set if the caller must
+   close it. Returns -2 if openat2() isn't there */
+int _resolve_dirfd(const char *rel, int *owned)
+{
+	uint32_t hash, gen;
+	resolve_dir *d, *l;
+	int fd;
+
+	*owned = 0;
+	if (strcmp(rel, ".") == 0)
+		return beneath ? rootfd : -2;
+
+	hash = _resolve_hash(rel);
+	_resolve_lock();
+	for (d = buckets[hash % RESOLVE_BUCKETS]; d != NULL; d = d->chain)
+	{
+		if (d->hash != hash || strcmp(d->rel, rel) != 0)
+			continue;
+
+		if (d != dirhead)
+		{
+			d->prev->next = d->next;
+			if (d->next)
+				d->next->prev = d->prev;
+			else
+				dirtail = d->prev;
+			d->prev = NULL;
+			d->next = dirhead;
+			dirhead->prev = d;
+			dirhead = d;
+		}
+		/* another thread may drop it while this one uses it */
+		fd = fcntl(d->fd, F_DUPFD_CLOEXEC, 0);
+		_resolve_unlock();
+		*owned = fd >= 0;
+		return fd;
+	}
+	gen = dirgen;
+	_resolve_unlock();
+
+	/* a directory reached through a symlink isn't kept: watching it by
+	   that name would rename it for everyone else watching it */
+	*owned = 1;
+	fd = _resolve_openat2(rootfd, rel, O_PATH | O_DIRECTORY, 0, RESOLVE_NO_SYMLINKS);
+	if (fd < 0 && errno == ELOOP)
+		return _resolve_openat2(rootfd, rel, O_PATH | O_DIRECTORY, 0, 0);
+	if (fd < 0)
+		return fd;
+
+	/* keep it if it can be watched, watching before it's used so no
+	   change can slip between, and unless something was dropped while
+	   it was looked up, which may have been on the way to it */
+	if (RESOLVE_CACHE == 0 || !_resolve_plain(rel) ||
+		strlen(rel) >= sizeof(d->rel) || _resolve_watch(rel) < 0 ||
+		(d = malloc(sizeof(resolve_dir))) == NULL)
+		return fd;
+
+	strlcpy(d->rel, rel, sizeof(d->rel));
+	d->hash = hash;
+	if ((d->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) < 0)
+	{
+		free(d);
+		return fd;
+	}
+
+	_resolve_lock();
+	for (l = buckets[hash % RESOLVE_BUCKETS]; l != NULL; l = l->chain)
+	{
+		if (l->hash == hash && strcmp(l->rel, rel) == 0)
+			break;
+	}
+	/* another thread has kept it meanwhile */
+	if (gen != dirgen || l != NULL)
+	{
+		_resolve_unlock();
+		close(d->fd);
+		free(d);
+		return fd;
+	}
+	if (dircount >= RESOLVE_CACHE)
+		_resolve_forget(dirtail);
+	d->chain = buckets[hash % RESOLVE_BUCKETS];
+	buckets[hash % RESOLVE_BUCKETS] = d;
+	d->prev = NULL;
+	d->next = dirhead;
+	if (dirhead)
+		dirhead->prev = d;
+	else
+		dirtail = d;
+	dirhead = d;
+	dircount++;
+	_resolve_unlock();
+	return fd;
+}
+
+/* Split rel into the directory holding it, left in dir ("." for the
+   root), and its last component, *name */
+void _resolve_split(const char *rel, char *dir, int dirsz, const char **name)
+{
+	char *slash;
+
+	strlcpy(dir, rel, dirsz);
+	if ((slash = strrchr(dir, '/')) != NULL)
+	{
+		*slash = 0;
+		*name = slash + 1;
+	}
+	else
+	{
+		*name = rel;
+		strlcpy(dir, ".", dirsz);
+	}
+}
+
+/* The directory holding rel, for the *at() calls, with its last
+   component in *name. *owned is set if the caller must close it */
+int _resolve_parent(const char *rel, char *dir, int dirsz, const char **name, int *owned)
+{
+	_resolve_split(rel, dir, dirsz, name);
+	if (strcmp(*name, "..") == 0 || strcmp(*name, ".") == 0)
+	{
+		*owned = 0;
+		errno = strcmp(*name, ".") == 0 ? EINVAL : EXDEV;
+		return beneath ? -1 : -2;
+	}
+	return _resolve_dirfd(dir, owned);
+}
+
+/* Open rel beneath the root, starting from the directory holding it */
+int _resolve_lookup(const char *rel, int flags, int mode)
+{
+	char dir[MAX_FILEPATH];
+	const char *name;
+	int dirfd, fd, owned;
+
+	if ((dirfd = _resolve_parent(rel, dir, sizeof(dir), &name, &owned)) == -2)
+		return -2;
+	if (dirfd < 0)
+		return _resolve_openat2(rootfd, rel, flags, mode, 0);
+
+	fd = _resolve_openat2(dirfd, name, flags, mode, 0);
+	if (owned)
+		close(dirfd);
+
+	/* a symlink may go up and still stay within the root */
+	if (fd < 0 && errno == EXDEV)
+		fd = _resolve_openat2(rootfd, rel, flags, mode, 0);
+	return fd;
+}
+#endif
+
+int resolve_open(Session *s, const char *path, int flags, int mode)
+{
+	char rel[MAX_FILEPATH];
+	char full[MAX_FILEPATH];
+#ifdef HAVE_OPENAT2
+	int fd;
+#endif
+
+	if (_resolve_rel(s, path, rel, sizeof(rel)) < 0)
+		return -1;
+#ifdef HAVE_OPENAT2
+	if ((fd = _resolve_lookup(rel, flags, mode)) != -2)
+		return fd;
+#endif
+	if (_resolve_full(rel, 1, full, sizeof(full)) < 0)
+		return -1;
+	return open(full, flags, mode);
+}
+
+DIR *resolve_opendir(Session *s, const char *path)
+{
+	char rel[MAX_FILEPATH];
+	char full[MAX_FILEPATH];
+#ifdef HAVE_OPENAT2
+	DIR *dir;
+	int dirfd, fd, owned;
+#endif
+
+	if (_resolve_rel(s, path, rel, sizeof(rel)) < 0)
+		return NULL;
+#ifdef HAVE_OPENAT2
+	if ((dirfd = _resolve_dirfd(rel, &owned)) != -2)
+	{
+		if (dirfd < 0)
+			return NULL;
+		fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (owned)
+			close(dirfd);
+		if (fd < 0)
+			return NULL;
+		if ((dir = fdopendir(fd)) == NULL)
+			close(fd);
+		return dir;
+	}
+#endif
+	if (_resolve_full(rel, 1, full, sizeof(full)) < 0)
+		return NULL;
+	return opendir(full);
+}
+
+int resolve_stat(Session *s, const char *path, struct stat *st)
+{
+	char rel[MAX_FILEPATH];
+	char full[MAX_FILEPATH];
+#ifdef HAVE_OPENAT2
+	int fd, result;
+#endif
+
+	if (_resolve_rel(s, path, rel, sizeof(rel)) < 0)
+		return -1;
+#ifdef HAVE_OPENAT2
+	if ((fd = _resolve_lookup(rel, O_PATH, 0)) != -2)
+	{
+		if (fd < 0)
+			return -1;
+		result = fstat(fd, st);
+		close(fd);
+		return result;
+	}
+#endif
+	if (_resolve_full(rel, 1, full, sizeof(full)) < 0)
+		return -1;
+	return stat(full, st);
+}
+
+int resolve_real(Session *s, const char *path, char *real, int realsz)
+{
+	char rel[MAX_FILEPATH];
+	char full[MAX_FILEPATH];
+	char found[MAX_FILEPATH];
+	size_t len = strlen(resolveroot);
+	const char *p;
+
+	if (_resolve_rel(s, path, rel, sizeof(rel)) < 0)
+		return -1;
+	if (snprintf(full, sizeof(full), "%s/%s", resolveroot, rel) >= (int)sizeof(full))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+#ifdef WIN32
+	if (GetFullPathNameA(full, sizeof(found), found, NULL) == 0)
+#else
+	if (realpath(full, found) == NULL)
+#endif
+		return -1;
+	if (!resolve_inside(found))
+	{
+		errno = EXDEV;
+		return -1;
+	}
+
+	while (len > 0 && resolveroot[len - 1] == '/')
+		len--;
+	for (p = found + len; *p == '/'; p++)
+		;
+	strlcpy(real, *p ? p : ".", realsz);
+	return 0;
+}
+
+int resolve_unlink(Session *s, const char *path)
+{
+	char rel[MAX_FILEPATH];
+	char full[MAX_FILEPATH];
+#ifdef HAVE_OPENAT2
+	char dir[MAX_FILEPATH];
+	const char *name;
+	int fd, owned, result;
+#endif
+
+	if (_resolve_rel(s, path, rel, sizeof(rel)) < 0)
+		return -1;
+#ifdef HAVE_OPENAT2
+	if ((fd = _resolve_parent(rel, dir, sizeof(dir), &name, &owned)) != -2)
+	{
+		if (fd < 0)
+			return -1;
+		result = unlinkat(fd, name, 0);
+		if (owned)
+			close(fd);
+		/* it may have been a symlink to a directory that was kept */
+		_resolve_drop(rel);
+		return result;
+	}
+#endif
+	if (_resolve_full(rel, 0, full, sizeof(full)) < 0)
+		return -1;
+	return unlink(full);
+}
+
+int resolve_rmdir(Session *s, const char *path)
+{
+	char rel[MAX_FILEPATH];
+	char full[MAX_FILEPATH];
+#ifdef HAVE_OPENAT2
+	char dir[MAX_FILEPATH];
+	const char *name;
+	int fd, owned, result;
+#endif
+
+	if (_resolve_rel(s, path, rel, sizeof(rel)) < 0)
+		return -1;
+#ifdef HAVE_OPENAT2
+	if ((fd = _resolve_parent(rel, dir, sizeof(dir), &name, &owned)) != -2)
+	{
+		if (fd < 0)
+			return -1;
+		result = unlinkat(fd, name, AT_REMOVEDIR);
+		if (owned)
+			close(fd);
+		_resolve_drop(rel);
+		return result;
+	}
+#endif
+	if (_resolve_full(rel, 0, full, sizeof(full)) < 0)
+		return -1;
+	return rmdir(full);
+}
+
+int resolve_mkdir(Session *s, const char *path, int mode)
+{
+	char rel[MAX_FILEPATH];
+	char full[MAX_FILEPATH];
+#ifdef HAVE_OPENAT2
+	char dir[MAX_FILEPATH];
+	const char *name;
+	int fd, owned, result;
+#endif
+
+	if (_resolve_rel(s, path, rel, sizeof(rel)) < 0)
+		return -1;
+#ifdef HAVE_OPENAT2
+	if ((fd = _resolve_parent(rel, dir, sizeof(dir), &name, &owned)) != -2)
+	{
+		if (fd < 0)
+			return -1;
+		result = mkdirat(fd, name, mode);
+		if (owned)
+			close(fd);
+		return result;
+	}
+#endif
+	if (_resolve_full(rel, 0, full, sizeof(full)) < 0)
+		return -1;
+#ifdef WIN32
+	return mkdir(full);
+#else
+	return mkdir(full, mode);
+#endif
+}
+
+#ifndef WIN32
+int resolve_parent(Session *s, const char *path, char *name, int namesz)
+{
+	char rel[MAX_FILEPATH];
+	char full[MAX_FILEPATH];
+	char *slash;
+	const char *last;
+#ifdef HAVE_OPENAT2
+	char dir[MAX_FILEPATH];
+	int fd, owned;
+#endif
+
+	if (_resolve_rel(s, path, rel, sizeof(rel)) < 0 ||
+		_resolve_rel(s, "", full, sizeof(full)) < 0)
+		return -1;
+	/* nor does the directory a session is mounted at, as far as the
+	   session is concerned */
+	if (strcmp(rel, full) == 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	last = (last = strrchr(rel, '/')) != NULL ? last + 1 : rel;
+	if (strcmp(last, ".") == 0 || strcmp(last, "..") == 0)
+	{
+		errno = strcmp(last, ".") == 0 ? EINVAL : EXDEV;
+		return -1;
+	}
+	if (strlcpy(name, last, namesz) >= (size_t)namesz)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+#ifdef HAVE_OPENAT2
+	if ((fd = _resolve_parent(rel, dir, sizeof(dir), &last, &owned)) != -2)
+	{
+		if (fd < 0 || owned)
+			return fd;
+		/* the root's is kept */
+		return fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	}
+#endif
+	if (_resolve_full(rel, 0, full, sizeof(full)) < 0)
+		return -1;
+	if ((slash = strrchr(full, '/')) != NULL)
+		*slash = 0;
+	return open(*full ? full : "/", O_RDONLY | O_DIRECTORY);
+}
+#endif
+
+int resolve_rename(Session *s, const char *from, const char *to)
+{
+	char relfrom[MAX_FILEPATH], relto[MAX_FILEPATH];
+	char fullfrom[MAX_FILEPATH], fullto[MAX_FILEPATH];
+#ifdef HAVE_OPENAT2
+	char dirfrom[MAX_FILEPATH], dirto[MAX_FILEPATH];
+	const char *namefrom, *nameto;
+	int fdfrom, fdto, ownedfrom, ownedto, result;
+#endif
+
+	if (_resolve_rel(s, from, relfrom, sizeof(relfrom)) < 0 ||
+		_resolve_rel(s, to, relto, sizeof(relto)) < 0)
+		return -1;
+#ifdef HAVE_OPENAT2
+	if ((fdfrom = _resolve_parent(relfrom, dirfrom, sizeof(dirfrom), &namefrom, &ownedfrom)) != -2)
+	{
+		if (fdfrom < 0)
+			return -1;
+		if ((fdto = _resolve_parent(relto, dirto, sizeof(dirto), &nameto, &ownedto)) < 0)
+		{
+			if (ownedfrom)
+				close(fdfrom);
+			return -1;
+		}
+		result = renameat(fdfrom, namefrom, fdto, nameto);
+		if (ownedfrom)
+			close(fdfrom);
+		if (ownedto)
+			close(fdto);
+		/* neither name leads where it did */
+		_resolve_drop(relfrom);
+		_resolve_drop(relto);
+		return result;
+	}
+#endif
+	if (_resolve_full(relfrom, 0, fullfrom, sizeof(fullfrom)) < 0 ||
+		_resolve_full(relto, 0, fullto, sizeof(fullto)) < 0)
+		return -1;
+	return rename(fullfrom, fullto);
+}
@@ -0,0 +1,72 @@
+#ifndef _TNFS_RESOLVE_H
+#define _TNFS_RESOLVE_H
+
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon path resolution beneath the root directory
+ *
+ * */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include "tnfs.h"
+
+/* Client paths are taken relative to the session's mount point and may
+ * never lead outside the tnfs root, whether by "..", an absolute path or
+ * a symlink. Where the kernel has openat2() the lookup is made beneath a
+ * descriptor held on the root with RESOLVE_BENEATH; otherwise the path is
+ * resolved and must lie within the root. Anything that would escape
+ * fails with errno set to EXDEV. All return -1 (NULL) on failure with
+ * errno set, like the calls they stand for */
+
+/* hold the root directory, from tnfs_setroot(). Returns 0 on success */
+int resolve_init(const char *realroot);
+
+/* Returns 1 if a resolved absolute path is the root or below it */
+int resolve_inside(const char *realpath);
+
+int resolve_open(Session *s, const char *path, int flags, int mode);
+DIR *resolve_opendir(Session *s, const char *path);
+int resolve_stat(Session *s, const char *path, struct stat *st);
+int resolve_unlink(Session *s, const char *path);
+int resolve_rename(Session *s, const char *from, const char *to);
+int resolve_mkdir(Session *s, const char *path, int mode);
+int resolve_rmdir(Session *s, const char *path);
+
+/* The path of something that exists, relative to the root, once every
+ * symlink and ".." on the way there is followed, so that it has the same
+ * name however it was reached. "." for the root itself */
+int resolve_real(Session *s, const char *path, char *real, int realsz);
+
+#ifndef WIN32
+/* A descriptor of its own on the directory holding path, with the last
+ * component copied to name, for a caller that carries on with the *at()
+ * calls itself, perhaps on another thread. The root itself has no
+ * directory holding it, nor has the directory the session is mounted
+ * at as far as the session goes, and both fail with EINVAL */
+int resolve_parent(Session *s, const char *path, char *name, int namesz);
+#endif
+
+#endif
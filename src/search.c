@@ -0,0 +1,749 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * Recursive name search
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#endif
+
+#include "search.h"
+#include "notify.h"
+#include "fileinfo.h"
+#include "log.h"
+#include "bsdcompat.h"
+#include "config.h"
+
+#ifdef WIN32
+#define lstat stat
+#endif
+
+#if defined(WIN32)
+#define ST_MTIME_NSEC(st) 0
+#elif defined(__APPLE__)
+#define ST_MTIME_NSEC(st) ((st)->st_mtimespec.tv_nsec)
+#else
+#define ST_MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+#endif
+
+#define SEARCHNODE_DIR 0x01
+#define SEARCHNODE_DEAD 0x02	/* removed; its descendants die with it */
+
+#define SEARCH_NONE UINT32_MAX
+#define SEARCH_ROOT 0
+
+#define CHILDMAP_EMPTY 0
+#define CHILDMAP_DELETED UINT32_MAX
+
+typedef struct _search_node
+{
+	uint32_t parent;	/* node of the containing directory */
+	uint32_t name;		/* offset of the name in the name pool */
+	uint8_t flags;
+} search_node;
+
+typedef struct _search_posting
+{
+	uint32_t *nodes;	/* in ascending order */
+	uint32_t count;
+	uint32_t size;
+} search_posting;
+
+/* a directory's modification time when it was read for a build */
+typedef struct _search_stamp
+{
+	uint32_t node;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+} search_stamp;
+
+/* An index is built whole on a thread of its own, then handed to the
+ * main loop, which keeps it in step with changes until the next one */
+typedef struct _search_index
+{
+	search_node *nodes;
+	uint32_t nodecount, nodesize;
+	uint32_t nodesbuilt;	/* node count when the build finished */
+
+	char *names;
+	size_t namesused, namessize;
+
+	search_posting postings[SEARCH_BUCKETS];
+
+	/* open addressed (parent, name) -> node + 1 */
+	uint32_t *childmap;
+	uint32_t childmapsize, childmapused;
+
+	/* every directory read by the build, until it's being watched */
+	search_stamp *stamps;
+	uint32_t stampcount, stampsize;
+} search_index;
+
+char searchroot[MAX_ROOT];
+bool searchenabled = false;
+
+/* the index searches use, only touched by the main loop */
+search_index *sindex = NULL;
+time_t searchbuilt = 0;
+
+/* directories created or moved in since the last search_update() */
+uint32_t *spending = NULL;
+uint32_t spendingcount = 0, spendingsize = 0;
+bool srebuild = false;
+bool sunwatched = false;	/* a watch was dropped, so fall back to refreshing */
+uint32_t swatchnext = 0;	/* next directory of a new index to watch */
+
+/* the build in progress */
+#define SEARCHBUILD_IDLE 0
+#define SEARCHBUILD_RUNNING 1
+#define SEARCHBUILD_DONE 2
+
+int sbuildstate = SEARCHBUILD_IDLE;
+search_index *sbuilt = NULL;	/* handed over when it's done, NULL on failure */
+time_t sbuildstarted = 0;
+
+#ifdef ENABLE_THREADS
+pthread_mutex_t searchlock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+#define SNAME(ix, n) ((ix)->names + (ix)->nodes[n].name)
+
+void _search_lock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_lock(&searchlock);
+#endif
+}
+
+void _search_unlock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_unlock(&searchlock);
+#endif
+}
+
+/* Grow an array by doubling so it can hold at least one more element */
+int _search_grow(void **array, uint32_t *size, uint32_t count, size_t elemsz)
+{
+	if (count < *size)
+		return 0;
+	uint32_t newsize = *size ? *size * 2 : 256;
+	void *n = realloc(*array, (size_t)newsize * elemsz);
+	if (n == NULL)
+		return -1;
+	*array = n;
+	*size = newsize;
+	return 0;
+}
+
+uint32_t _search_hash(uint32_t parent, const char *name)
+{
+	uint32_t h = 2166136261u ^ parent;
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	return h;
+}
+
+uint32_t _search_trigram(const char *t)
+{
+	uint32_t v = ((uint32_t)(unsigned char)t[0] << 16) |
+				 ((uint32_t)(unsigned char)t[1] << 8) | (unsigned char)t[2];
+	return (v * 2654435761u) >> 16 & (SEARCH_BUCKETS - 1);
+}
+
+void _search_free(search_index *ix)
+{
+	uint32_t i;
+
+	if (ix == NULL)
+		return;
+	for (i = 0; i < SEARCH_BUCKETS; i++)
+		free(ix->postings[i].nodes);
+	free(ix->nodes);
+	free(ix->names);
+	free(ix->childmap);
+	free(ix->stamps);
+	free(ix);
+}
+
+void _search_childmap_insert(search_index *ix, uint32_t node)
+{
+	uint32_t mask = ix->childmapsize - 1;
+	uint32_t i = _search_hash(ix->nodes[node].parent, SNAME(ix, node)) & mask;
+
+	while (ix->childmap[i] != CHILDMAP_EMPTY && ix->childmap[i] != CHILDMAP_DELETED)
+		i = (i + 1) & mask;
+	if (ix->childmap[i] == CHILDMAP_EMPTY)
+		ix->childmapused++;
+	ix->childmap[i] = node + 1;
+}
+
+/* Rebuild the child map at a size that keeps it at most half full */
+int _search_childmap_resize(search_index *ix, uint32_t need)
+{
+	uint32_t size = 1024, n;
+
+	while (size < need * 2)
+		size *= 2;
+	free(ix->childmap);
+	if ((ix->childmap = calloc(size, sizeof(uint32_t))) == NULL)
+	{
+		ix->childmapsize = ix->childmapused = 0;
+		return -1;
+	}
+	ix->childmapsize = size;
+	ix->childmapused = 0;
+	for (n = 1; n < ix->nodecount; n++)
+	{
+		if (!(ix->nodes[n].flags & SEARCHNODE_DEAD))
+			_search_childmap_insert(ix, n);
+	}
+	return 0;
+}
+
+/* Find the slot holding the named child of parent, or SEARCH_NONE */
+uint32_t _search_childslot(search_index *ix, uint32_t parent, const char *name)
+{
+	uint32_t mask = ix->childmapsize - 1;
+	uint32_t i = _search_hash(parent, name) & mask;
+
+	while (ix->childmap[i] != CHILDMAP_EMPTY)
+	{
+		uint32_t n = ix->childmap[i] - 1;
+		if (ix->childmap[i] != CHILDMAP_DELETED &&
+			ix->nodes[n].parent == parent && strcmp(SNAME(ix, n), name) == 0)
+			return i;
+		i = (i + 1) & mask;
+	}
+	return SEARCH_NONE;
+}
+
+uint32_t _search_child(search_index *ix, uint32_t parent, const char *name)
+{
+	uint32_t slot = _search_childslot(ix, parent, name);
+	return slot == SEARCH_NONE ? SEARCH_NONE : ix->childmap[slot] - 1;
+}
+
+/* Add a name to the tree and to the posting list of each of its trigrams */
+uint32_t _search_add(search_index *ix, uint32_t parent, const char *name, bool isdir)
+{
+	char folded[MAX_FILENAME_LEN];
+	size_t len = strlen(name);
+	uint32_t id = ix->nodecount, i;
+
+	if (len >= sizeof(folded) ||
+		_search_grow((void **)&ix->nodes, &ix->nodesize, ix->nodecount, sizeof(search_node)) < 0)
+		return SEARCH_NONE;
+	while (ix->namesused + len + 1 > ix->namessize)
+	{
+		size_t newsize = ix->namessize ? ix->namessize * 2 : 65536;
+		char *n = realloc(ix->names, newsize);
+		if (n == NULL)
+			return SEARCH_NONE;
+		ix->names = n;
+		ix->namessize = newsize;
+	}
+	if ((ix->childmapused + 1) * 2 > ix->childmapsize &&
+		_search_childmap_resize(ix, ix->nodecount + 1) < 0)
+		return SEARCH_NONE;
+
+	memcpy(ix->names + ix->namesused, name, len + 1);
+	ix->nodes[id].parent = parent;
+	ix->nodes[id].name = ix->namesused;
+	ix->nodes[id].flags = isdir ? SEARCHNODE_DIR : 0;
+	ix->namesused += len + 1;
+	ix->nodecount++;
+	if (id != SEARCH_ROOT)
+		_search_childmap_insert(ix, id);
+
+	for (i = 0; i < len; i++)
+		folded[i] = tolower((unsigned char)name[i]);
+	for (i = 0; i + 3 <= len; i++)
+	{
+		search_posting *p = &ix->postings[_search_trigram(folded + i)];
+		/* a name repeating a trigram is only listed once */
+		if (p->count > 0 && p->nodes[p->count - 1] == id)
+			continue;
+		if (_search_grow((void **)&p->nodes, &p->size, p->count, sizeof(uint32_t)) < 0)
+			break;
+		p->nodes[p->count++] = id;
+	}
+	return id;
+}
+
+void _search_remove(search_index *ix, uint32_t node)
+{
+	uint32_t slot = _search_childslot(ix, ix->nodes[node].parent, SNAME(ix, node));
+	if (slot != SEARCH_NONE)
+		ix->childmap[slot] = CHILDMAP_DELETED;
+	ix->nodes[node].flags |= SEARCHNODE_DEAD;
+}
+
+/* Write the path of node relative to the directory node start. Returns
+ * -1 if node isn't a live descendant of start or the path is too long */
+int _search_path(search_index *ix, uint32_t node, uint32_t start, char *buf, size_t bufsz)
+{
+	uint32_t chain[MAX_TNFSPATH / 2];
+	int depth = 0;
+	size_t len = 0;
+
+	for (; node != start; node = ix->nodes[node].parent)
+	{
+		if (node == SEARCH_ROOT || depth == sizeof(chain) / sizeof(chain[0]) ||
+			(ix->nodes[node].flags & SEARCHNODE_DEAD))
+			return -1;
+		chain[depth++] = node;
+	}
+
+	buf[0] = '\0';
+	while (depth-- > 0)
+	{
+		const char *name = SNAME(ix, chain[depth]);
+		size_t namelen = strlen(name);
+		if (len + namelen + 2 > bufsz)
+			return -1;
+		if (len > 0)
+			buf[len++] = '/';
+		memcpy(buf + len, name, namelen + 1);
+		len += namelen;
+	}
+	return 0;
+}
+
+/* Turn a full path into a path below the root, or return -1 */
+int _search_relpath(const char *path, const char **rel)
+{
+	size_t rootlen = strlen(searchroot);
+
+	if (strncmp(path, searchroot, rootlen) != 0 ||
+		(path[rootlen] != '/' && path[rootlen] != '\0'))
+		return -1;
+	path += rootlen;
+	while (*path == '/')
+		path++;
+	*rel = path;
+	return 0;
+}
+
+/* Find the node for a full path, or SEARCH_NONE */
+uint32_t _search_resolve(search_index *ix, const char *path)
+{
+	char component[MAX_FILENAME_LEN];
+	const char *rel, *end;
+	uint32_t node = SEARCH_ROOT;
+
+	if (_search_relpath(path, &rel) < 0)
+		return SEARCH_NONE;
+
+	while (*rel && node != SEARCH_NONE)
+	{
+		end = strchr(rel, '/');
+		if (end == NULL)
+			end = rel + strlen(rel);
+		if (end - rel >= sizeof(component))
+			return SEARCH_NONE;
+		memcpy(component, rel, end - rel);
+		component[end - rel] = '\0';
+		node = _search_child(ix, node, component);
+		for (rel = end; *rel == '/'; rel++)
+			;
+	}
+	return node;
+}
+
+void _search_changed(const char *dirpath, const char *name, void *ctx);
+
+/* Index everything below the directory node start. The main loop
+ * watches each directory as it goes; a build on its own thread can't,
+ * so it notes their modification times to compare once they're watched */
+void _search_scan(search_index *ix, uint32_t start, bool watch)
+{
+	char path[MAX_FILEPATH], rel[MAX_FILEPATH], entpath[MAX_FILEPATH];
+	uint32_t *stack = NULL, stackcount = 0, stacksize = 0;
+	struct dirent *de;
+	struct stat st;
+	DIR *dh;
+
+	if (_search_grow((void **)&stack, &stacksize, 0, sizeof(uint32_t)) < 0)
+		return;
+	stack[stackcount++] = start;
+
+	/* an explicit stack rather than recursion, trees can be deep */
+	while (stackcount > 0)
+	{
+		uint32_t dir = stack[--stackcount];
+
+		if (_search_path(ix, dir, SEARCH_ROOT, rel, sizeof(rel)) < 0 ||
+			snprintf(path, sizeof(path), "%s/%s", searchroot, rel) >= sizeof(path))
+			continue;
+		if ((dh = opendir(path)) == NULL)
+			continue;
+
+		/* watch, or take the time, before reading so nothing created
+		 * meanwhile is missed */
+		if (watch)
+		{
+			notify_watch(path, _search_changed, NULL);
+		}
+		else if (fstat(dirfd(dh), &st) == 0 &&
+				 _search_grow((void **)&ix->stamps, &ix->stampsize, ix->stampcount, sizeof(search_stamp)) == 0)
+		{
+			search_stamp *s = &ix->stamps[ix->stampcount++];
+			s->node = dir;
+			s->mtime_sec = st.st_mtime;
+			s->mtime_nsec = ST_MTIME_NSEC(&st);
+		}
+
+		while ((de = readdir(dh)) != NULL)
+		{
+			bool isdir;
+			uint32_t id;
+
+			if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+				continue;
+			if (_search_child(ix, dir, de->d_name) != SEARCH_NONE)
+				continue;
+
+#ifdef _DIRENT_HAVE_D_TYPE
+			if (de->d_type != DT_UNKNOWN)
+				isdir = de->d_type == DT_DIR;
+			else
+#endif
+			{
+				if (snprintf(entpath, sizeof(entpath), "%s/%s", path, de->d_name) >= sizeof(entpath) ||
+					lstat(entpath, &st) < 0)
+					continue;
+				isdir = S_ISDIR(st.st_mode);
+			}
+
+			/* symlinked directories are listed but not descended into */
+			if ((id = _search_add(ix, dir, de->d_name, isdir)) == SEARCH_NONE)
+				break;
+			if (isdir && _search_grow((void **)&stack, &stacksize, stackcount, sizeof(uint32_t)) == 0)
+				stack[stackcount++] = id;
+		}
+		closedir(dh);
+	}
+	free(stack);
+}
+
+/* Index the whole tree. Returns NULL if memory ran out */
+search_index *_search_build()
+{
+	search_index *ix;
+
+	if ((ix = calloc(1, sizeof(search_index))) == NULL ||
+		_search_childmap_resize(ix, 0) < 0 || _search_add(ix, SEARCH_ROOT, "", true) != SEARCH_ROOT)
+	{
+		LOG("search: out of memory\n");
+		_search_free(ix);
+		return NULL;
+	}
+
+	_search_scan(ix, SEARCH_ROOT, false);
+	ix->nodesbuilt = ix->nodecount;
+	LOG("search: indexed %u names\n", ix->nodecount - 1);
+	return ix;
+}
+
+/* Put a new index in use, and start watching its directories */
+void _search_install(search_index *ix)
+{
+	_search_free(sindex);
+	sindex = ix;
+	searchbuilt = time(NULL);
+	spendingcount = 0;
+	srebuild = false;
+	swatchnext = 0;
+
+	/* leave room for the caches, which make better use of the watches */
+	sunwatched = notify_fd() < 0;
+	if (!sunwatched && ix->stampcount > NOTIFY_WATCHES / 2)
+	{
+		LOG("search: too many directories to watch, refreshing every %d seconds\n", SEARCH_REFRESH);
+		sunwatched = true;
+	}
+}
+
+#ifdef ENABLE_THREADS
+void *_search_thread(void *arg)
+{
+	search_index *ix = _search_build();
+
+	_search_lock();
+	sbuilt = ix;
+	sbuildstate = SEARCHBUILD_DONE;
+	_search_unlock();
+	return NULL;
+}
+#endif
+
+/* Start a build unless one is running or one started too recently */
+void _search_start()
+{
+	time_t now = time(NULL);
+
+	if (sbuildstate != SEARCHBUILD_IDLE ||
+		(sindex != NULL && now - sbuildstarted < SEARCH_REBUILD_WAIT))
+		return;
+	sbuildstarted = now;
+
+#ifdef ENABLE_THREADS
+	pthread_t thread;
+
+	sbuildstate = SEARCHBUILD_RUNNING;
+	if (pthread_create(&thread, NULL, _search_thread, NULL) == 0)
+	{
+		pthread_detach(thread);
+		return;
+	}
+	LOG("search: unable to start a thread to build the index\n");
+	sbuildstate = SEARCHBUILD_IDLE;
+#else
+	search_index *ix = _search_build();
+	if (ix != NULL)
+		_search_install(ix);
+#endif
+}
+
+/* A watched directory changed. Keep the tree in step for files and
+ * removals; new directories are queued and walked by search_update(),
+ * since callbacks can't start new watches. */
+void _search_changed(const char *dirpath, const char *name, void *ctx)
+{
+	char path[MAX_FILEPATH];
+	struct stat st;
+	uint32_t dir, node;
+	bool exists;
+
+	if (dirpath == NULL)
+	{
+		srebuild = true;
+		return;
+	}
+	/* removals are seen from the parent, but a directory that's still
+	 * there has lost its watch and changes to it would go unseen */
+	if (name == NULL)
+	{
+		if (!sunwatched && stat(dirpath, &st) == 0 && S_ISDIR(st.st_mode))
+		{
+			LOG("search: too many directories to watch, refreshing every %d seconds\n", SEARCH_REFRESH);
+			sunwatched = true;
+		}
+		return;
+	}
+	if (sindex == NULL || (dir = _search_resolve(sindex, dirpath)) == SEARCH_NONE)
+		return;
+	if (snprintf(path, sizeof(path), "%s/%s", dirpath, name) >= sizeof(path))
+		return;
+
+	exists = lstat(path, &st) == 0;
+	node = _search_child(sindex, dir, name);
+
+	if (node != SEARCH_NONE &&
+		(!exists || S_ISDIR(st.st_mode) != !!(sindex->nodes[node].flags & SEARCHNODE_DIR)))
+	{
+		_search_remove(sindex, node);
+		node = SEARCH_NONE;
+	}
+
+	if (exists && node == SEARCH_NONE)
+	{
+		node = _search_add(sindex, dir, name, S_ISDIR(st.st_mode));
+		if (node != SEARCH_NONE && S_ISDIR(st.st_mode) &&
+			_search_grow((void **)&spending, &spendingsize, spendingcount, sizeof(uint32_t)) == 0)
+			spending[spendingcount++] = node;
+	}
+}
+
+int search_init(const char *rootdir)
+{
+	size_t len;
+
+	/* keep the root the way normalize_path() leaves the paths it is
+	 * compared with, less its trailing slashes */
+	for (len = 0; *rootdir && len < sizeof(searchroot) - 1; rootdir++)
+	{
+		if (*rootdir != '/' || len == 0 || searchroot[len - 1] != '/')
+			searchroot[len++] = *rootdir;
+	}
+	while (len > 0 && searchroot[len - 1] == '/')
+		len--;
+	searchroot[len] = '\0';
+
+	searchenabled = true;
+	if (notify_fd() < 0)
+		LOG("search: no change notification, refreshing every %d seconds\n", SEARCH_REFRESH);
+	_search_start();
+	return 0;
+}
+
+/* Watch some more directories of a new index, checking that each is
+ * as it was when it was read */
+void _search_watch()
+{
+	char path[MAX_FILEPATH], rel[MAX_FILEPATH];
+	struct stat st;
+	uint32_t n;
+
+	for (n = 0; n < SEARCH_WATCH_STEP && !sunwatched && swatchnext < sindex->stampcount; n++)
+	{
+		const search_stamp *s = &sindex->stamps[swatchnext++];
+
+		if (_search_path(sindex, s->node, SEARCH_ROOT, rel, sizeof(rel)) < 0 ||
+			snprintf(path, sizeof(path), "%s/%s", searchroot, rel) >= sizeof(path))
+			continue;
+		if (notify_watch(path, _search_changed, NULL) < 0)
+		{
+			LOG("search: unable to watch %s, refreshing every %d seconds\n", path, SEARCH_REFRESH);
+			sunwatched = true;
+		}
+		/* changed after it was read but before it was watched */
+		else if (stat(path, &st) < 0 || st.st_mtime != s->mtime_sec ||
+				 ST_MTIME_NSEC(&st) != s->mtime_nsec)
+		{
+			srebuild = true;
+		}
+	}
+
+	if (sunwatched || swatchnext >= sindex->stampcount)
+	{
+		free(sindex->stamps);
+		sindex->stamps = NULL;
+		sindex->stampcount = sindex->stampsize = 0;
+		swatchnext = 0;
+	}
+}
+
+bool search_update()
+{
+	search_index *ix = NULL;
+	bool built = false;
+	uint32_t i;
+
+	if (!searchenabled)
+		return false;
+
+	_search_lock();
+	if (sbuildstate == SEARCHBUILD_DONE)
+	{
+		ix = sbuilt;
+		sbuilt = NULL;
+		sbuildstate = SEARCHBUILD_IDLE;
+		built = true;
+	}
+	_search_unlock();
+	if (ix != NULL)
+		_search_install(ix);
+	else if (built && sindex == NULL)
+		searchenabled = false;
+	if (sindex == NULL)
+		return false;
+
+	/* removed names stay in the tree as dead nodes, so start afresh
+	 * once they could make up half of it. Searches go on using this
+	 * index, kept in step, until the new one is ready */
+	if (srebuild || sindex->nodecount > sindex->nodesbuilt * 2 + 4096 ||
+		(sunwatched && SEARCH_REFRESH > 0 && time(NULL) - searchbuilt > SEARCH_REFRESH))
+		_search_start();
+
+	for (i = 0; i < spendingcount; i++)
+	{
+		char rel[MAX_FILEPATH];
+		/* skip any that went away again before we got here */
+		if (_search_path(sindex, spending[i], SEARCH_ROOT, rel, sizeof(rel)) == 0)
+			_search_scan(sindex, spending[i], !sunwatched);
+	}
+	spendingcount = 0;
+
+	if (sindex->stampcount > 0)
+		_search_watch();
+	return sindex->stampcount > 0;
+}
+
+/* The literal trigram of the pattern with the fewest names listed, or
+ * NULL if the pattern has no run of three literal characters */
+const search_posting *_search_rarest(search_index *ix, const char *glob)
+{
+	const search_posting *best = NULL;
+	const char *p;
+
+	for (p = glob; p[0] && p[1] && p[2]; p++)
+	{
+		if (p[0] == '*' || p[0] == '?' || p[1] == '*' || p[1] == '?' ||
+			p[2] == '*' || p[2] == '?')
+			continue;
+		const search_posting *post = &ix->postings[_search_trigram(p)];
+		if (best == NULL || post->count < best->count)
+			best = post;
+	}
+	return best;
+}
+
+int search_find(const char *startpath, const tnfs_pattern *pattern,
+				bool matchdirs, search_callback cb, void *ctx)
+{
+	char rel[MAX_FILEPATH];
+	const search_posting *post;
+	uint32_t start, i, count, node;
+
+	if (!searchenabled || pattern == NULL)
+		return ENOSYS;
+	if (sindex == NULL)
+		return EAGAIN;
+	start = _search_resolve(sindex, startpath);
+	if (start == SEARCH_NONE || !(sindex->nodes[start].flags & SEARCHNODE_DIR))
+		return ENOENT;
+
+	/* the compiled glob is already folded, as the trigrams are */
+	post = _search_rarest(sindex, pattern->glob);
+	count = post ? post->count : sindex->nodecount;
+
+	for (i = 0; i < count; i++)
+	{
+		node = post ? post->nodes[i] : i;
+		if (node == SEARCH_ROOT || (sindex->nodes[node].flags & SEARCHNODE_DEAD))
+			continue;
+		if (!matchdirs && (sindex->nodes[node].flags & SEARCHNODE_DIR))
+			continue;
+		if (!pattern_match(pattern, SNAME(sindex, node)))
+			continue;
+		if (_search_path(sindex, node, start, rel, sizeof(rel)) < 0)
+			continue;
+		if (!cb(rel, ctx))
+			break;
+	}
+	return 0;
+}
@@ -0,0 +1,64 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Recursive name search
+ *
+ * Every name below the TNFS root is kept in memory as a tree of nodes,
+ * with each node listed under the trigrams (three character runs,
+ * case folded) of its name. A search looks up the rarest trigram of the
+ * pattern's literal text and only matches the names listed under it.
+ *
+ * The index is built on a thread of its own and then kept in step with
+ * change notification by the main loop. When it can't be, or has
+ * drifted too far, a new one is built the same way while searches go
+ * on using the old.
+ *
+ * */
+
+#ifndef _TNFS_SEARCH_H
+#define _TNFS_SEARCH_H
+
+#include <stdbool.h>
+#include "pattern.h"
+
+/* Start indexing everything below rootdir on a thread of its own.
+ * Returns 0 on success. SEARCH is only answered once this is called. */
+int search_init(const char *rootdir);
+
+/* Put a finished index in use and apply changes queued by change
+ * notification, called from the main loop. Returns true if there's
+ * more to do, so the main loop shouldn't wait long before calling again */
+bool search_update();
+
+/* Called for each match with its path relative to the search's start
+ * directory. Return false to end the search. */
+typedef bool (*search_callback)(const char *relpath, void *ctx);
+
+/* Find the names below the directory startpath (a full path below the
+ * root) that match pattern. Directories are only matched if matchdirs
+ * is set. Returns 0, ENOENT if startpath isn't an indexed directory,
+ * EAGAIN while the first index is being built or ENOSYS if searching
+ * isn't enabled. */
+int search_find(const char *startpath, const tnfs_pattern *pattern,
+				bool matchdirs, search_callback cb, void *ctx);
+
+#endif
@@ -34,9 +34,14 @@
 
 #include "session.h"
 #include "log.h"
+#include "endian.h"
 #include "tnfs.h"
 #include "directory.h"
+#include "vfs.h"
 #include "datagram.h"
+#include "watch.h"
+#include "window.h"
+#include "offload.h"
 #include "errortable.h"
 #include "bsdcompat.h"
 
@@ -68,18 +73,27 @@ int tnfs_mount(Header *hdr, unsigned char *buf, int bufsz)
 	int mplen;
 	int sindex;
 	Session *s;
-	unsigned char repbuf[4];
+	unsigned char repbuf[6];
+	int repsz = 4;
 	char *cliroot;
 	uint16_t recycledSid = 0;
+	int reqmsgsz = 0;
+	unsigned char *lastmsg;
 
 #ifdef DEBUG
 	TNFSMSGLOG(hdr, "TNFS_MOUNT");
 #endif
 	/* Mount packet looks like:
-	 * Header + mountpoint + user + pass.
+	 * Header + mountpoint + user + pass, optionally followed by
+	 * the largest message size the client can take (TCP only).
 	 * Check that there is at least one null terminator so we
 	 * won't create an invalid string ever*/
-	if (*(buf + bufsz - 1) != 0)
+	if (bufsz >= 5 && *(buf + bufsz - 1) != 0 && *(buf + bufsz - 3) == 0)
+	{
+		reqmsgsz = tnfs16uint(buf + bufsz - 2);
+		bufsz -= 2;
+	}
+	if (bufsz < 1 || *(buf + bufsz - 1) != 0)
 	{
 		TNFSMSGLOG(hdr, "Unterminated MOUNT operation");
 		return -1;
@@ -130,15 +144,34 @@ int tnfs_mount(Header *hdr, unsigned char *buf, int bufsz)
 	repbuf[2] = TIMEOUT_LSB;
 	repbuf[3] = TIMEOUT_MSB;
 
+	/* Datagrams stay at MAXMSGSZ, a TCP connection can carry anything
+	 * up to TNFS_MAX_TCPMSG. The client is told what it got */
+	if (reqmsgsz)
+	{
+		if (hdr->cli_fd != 0 && reqmsgsz > MAXMSGSZ)
+		{
+			if (reqmsgsz > TNFS_MAX_TCPMSG)
+				reqmsgsz = TNFS_MAX_TCPMSG;
+			if ((lastmsg = realloc(s->lastmsg, reqmsgsz)) != NULL)
+			{
+				s->lastmsg = lastmsg;
+				s->maxmsgsz = reqmsgsz;
+				s->maxiosz = reqmsgsz - TNFS_HEADERSZ - 3;
+			}
+		}
+		uint16tnfs(repbuf + 4, (uint16_t)s->maxmsgsz);
+		repsz = 6;
+	}
+
 	/* verify that the root path is valid */
 	if (validate_dir(s, "") == 0)
 	{
 		/* all OK - send a response */
 		hdr->status = 0;
 		hdr->sid = s->sid;
-		tnfs_send(s, hdr, repbuf, 4);
+		tnfs_send(s, hdr, repbuf, repsz);
 #ifdef DEBUG
-		TNFSMSGLOG(hdr, "Mounted %s OK, SID=%x", s->root, s->sid);
+		TNFSMSGLOG(hdr, "Mounted %s OK, SID=%x, max message %d", s->root, s->sid, s->maxmsgsz);
 #endif
 #ifdef USAGELOG
 		USGLOG(hdr, "Session started at: %s", s->root);
@@ -195,6 +228,13 @@ Session *tnfs_allocsession(int *sindex, uint16_t withSid)
 			if (s)
 			{
 				memset(s, 0, sizeof(Session));
+				if ((s->lastmsg = malloc(MAXMSGSZ)) == NULL)
+				{
+					free(s);
+					return NULL;
+				}
+				s->maxmsgsz = MAXMSGSZ;
+				s->maxiosz = MAX_IOSZ;
 				if (withSid > 0)
 				{
 					s->sid = withSid;
@@ -214,29 +254,38 @@ Session *tnfs_allocsession(int *sindex, uint16_t withSid)
 	return NULL;
 }
 
-/* Free a session */
+/* Free a session. One with a request still off the main loop is closed
+   once that's done */
 void tnfs_freesession(Session *s, int sindex)
 {
 	LOG("Freeing session ID index %d\n", sindex);	
+	slist[sindex] = NULL;
+	if (!offload_orphan(s))
+		tnfs_closesession(s);
+}
+
+/* Let go of everything a session has open */
+void tnfs_closesession(Session *s)
+{
 	int i;
+	watch_cancel(s);
+	window_free(s);
 	if (s->root)
 		free(s->root);
 
 	/* close open fds, directories etc. */
 	for (i = 0; i < MAX_FD_PER_CONN; i++)
 	{
-		if (s->fd[i])
+		if (s->fd[i] == VFS_FD)
+			vfs_close(s->vfile[i]);
+		else if (s->fd[i])
 			close(s->fd[i]);
+		free(s->fdpath[i]);
 	}
 	for (i = 0; i < MAX_DHND_PER_CONN; i++)
-	{
-		if (s->dhandles[i].handle)
-			closedir(s->dhandles[i].handle);
-		dirlist_free(s->dhandles[i].entry_list);
-		s->dhandles[i].entry_count = 0;
-	}
+		dirhandle_close(&s->dhandles[i]);
+	free(s->lastmsg);
 	free(s);
-	slist[sindex] = NULL;
 }
 
 /* Find a session by its SID. Return NULL if not found */
@@ -334,7 +383,11 @@ void tnfs_reset_cli_fd_in_sessions(int cli_fd)
 			if (s->cli_fd == cli_fd)
 			{
 				LOG("Removing TCP connection handle from session 0x%02x\n", s->sid);
+				watch_cancel(s);
 				s->cli_fd = 0;
+				/* a negotiated size only lasts as long as its connection */
+				s->maxmsgsz = MAXMSGSZ;
+				s->maxiosz = MAX_IOSZ;
 			}
 		}
 	}
@@ -44,6 +44,7 @@ void tnfs_umount(Header *hdr, Session *s, int sindex);
 /* if withSid is nonzero, use the specified sid */
 Session *tnfs_allocsession(int *sindex, uint16_t withSid);
 void tnfs_freesession(Session *s, int sindex);
+void tnfs_closesession(Session *s);
 Session *tnfs_findsession_sid(uint16_t sid, int *sindex);
 Session *tnfs_findsession_ipaddr(in_addr_t ipaddr, int *sindex);
 void tnfs_reset_cli_fd_in_sessions(int cli_fd);
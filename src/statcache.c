@@ -0,0 +1,388 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon stat() cache
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#endif
+
+#include "config.h"
+#include "statcache.h"
+#include "notify.h"
+#include "vfs.h"
+#include "bsdcompat.h"
+
+typedef struct _statcache_entry
+{
+	char *path;			/* no repeated or trailing slashes */
+	uint32_t hash;
+	struct stat st;
+	int err;			/* 0 or ENOENT */
+	int checked;		/* stored by tnfs_stat() after resolve_stat() */
+	time_t loaded;
+	struct _statcache_entry *chain;	/* same hash bucket */
+	struct _statcache_entry *prev;	/* most recently used first */
+	struct _statcache_entry *next;
+} statcache_entry;
+
+#define STATCACHE_BUCKETS 1024
+
+static statcache_entry *buckets[STATCACHE_BUCKETS];
+static statcache_entry *cachehead = NULL;
+static statcache_entry *cachetail = NULL;
+static int cachecount = 0;
+static uint32_t generation = 0;	/* bumped whenever anything is dropped */
+
+#ifdef ENABLE_THREADS
+static pthread_mutex_t cachelock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void _statcache_lock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_lock(&cachelock);
+#endif
+}
+
+void _statcache_unlock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_unlock(&cachelock);
+#endif
+}
+
+/* Copy path without repeated or trailing slashes, so the same file is
+   always found under the same key. Returns -1 if it doesn't fit */
+int _statcache_key(const char *path, char *key, size_t keysz)
+{
+	size_t n = 0;
+
+	for (; *path; path++)
+	{
+		if (*path == '/' && n > 0 && key[n - 1] == '/')
+			continue;
+		if (n + 1 >= keysz)
+			return -1;
+		key[n++] = *path;
+	}
+	while (n > 1 && key[n - 1] == '/')
+		n--;
+	key[n] = 0;
+	return 0;
+}
+
+uint32_t _statcache_hash(const char *key)
+{
+	uint32_t h = 2166136261u;
+
+	while (*key)
+	{
+		h ^= (unsigned char)*key++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+statcache_entry *_statcache_find(const char *key, uint32_t hash)
+{
+	statcache_entry *e;
+
+	for (e = buckets[hash % STATCACHE_BUCKETS]; e != NULL; e = e->chain)
+	{
+		if (e->hash == hash && strcmp(e->path, key) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+void _statcache_remove(statcache_entry *e)
+{
+	statcache_entry **pp;
+
+	for (pp = &buckets[e->hash % STATCACHE_BUCKETS]; *pp != e; pp = &(*pp)->chain)
+		;
+	*pp = e->chain;
+
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		cachehead = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		cachetail = e->prev;
+
+	cachecount--;
+	free(e->path);
+	free(e);
+}
+
+/* Drop key, and with below everything underneath it too; the lock is held */
+void _statcache_forget(const char *key, int below)
+{
+	statcache_entry *e, *next;
+	size_t len;
+
+	generation++;
+	if ((e = _statcache_find(key, _statcache_hash(key))) != NULL)
+	{
+		/* only a directory can have anything underneath it */
+		if (e->err == 0 && !S_ISDIR(e->st.st_mode))
+			below = 0;
+		_statcache_remove(e);
+	}
+	if (!below)
+		return;
+
+	len = strlen(key);
+	for (e = cachehead; e != NULL; e = next)
+	{
+		next = e->next;
+		if (strncmp(e->path, key, len) == 0 && e->path[len] == '/')
+			_statcache_remove(e);
+	}
+}
+
+/* Drop the directory key is in; the lock is held */
+void _statcache_forget_parent(char *key)
+{
+	char *slash = strrchr(key, '/');
+
+	if (slash == NULL || slash == key)
+		return;
+	*slash = 0;
+	_statcache_forget(key, 0);
+	*slash = '/';
+}
+
+int statcache_lookup(const char *path, struct stat *st, int checked)
+{
+	char key[MAX_FILEPATH];
+	statcache_entry *e;
+	int result = -1;
+
+	if (_statcache_key(path, key, sizeof(key)) < 0)
+		return -1;
+
+	_statcache_lock();
+	if ((e = _statcache_find(key, _statcache_hash(key))) != NULL)
+	{
+		if (time(NULL) - e->loaded >= STATCACHE_TTL)
+		{
+			_statcache_remove(e);
+		}
+		else if (e->checked || !checked)
+		{
+			if (e->err == 0)
+				memcpy(st, &e->st, sizeof(struct stat));
+			result = e->err;
+
+			/* move it to the front */
+			if (e != cachehead)
+			{
+				e->prev->next = e->next;
+				if (e->next)
+					e->next->prev = e->prev;
+				else
+					cachetail = e->prev;
+				e->prev = NULL;
+				e->next = cachehead;
+				cachehead->prev = e;
+				cachehead = e;
+			}
+		}
+	}
+	_statcache_unlock();
+	return result;
+}
+
+uint32_t statcache_generation()
+{
+	uint32_t gen;
+
+	_statcache_lock();
+	gen = generation;
+	_statcache_unlock();
+	return gen;
+}
+
+void statcache_store(const char *path, const struct stat *st, int err, int checked, uint32_t gen)
+{
+	char key[MAX_FILEPATH];
+	statcache_entry *e;
+	uint32_t hash;
+
+	/* other failures may well not last */
+	if (err != 0 && err != ENOENT)
+		return;
+	if (_statcache_key(path, key, sizeof(key)) < 0)
+		return;
+	hash = _statcache_hash(key);
+
+	_statcache_lock();
+	if (gen != generation)
+	{
+		_statcache_unlock();
+		return;
+	}
+
+	if ((e = _statcache_find(key, hash)) != NULL)
+	{
+		_statcache_remove(e);
+	}
+	else if (cachecount >= STATCACHE_MAX)
+	{
+		_statcache_remove(cachetail);
+	}
+
+	if ((e = malloc(sizeof(statcache_entry))) == NULL ||
+		(e->path = strdup(key)) == NULL)
+	{
+		free(e);
+		_statcache_unlock();
+		return;
+	}
+	e->hash = hash;
+	e->err = err;
+	if (err == 0)
+		memcpy(&e->st, st, sizeof(struct stat));
+	e->checked = checked;
+	e->loaded = time(NULL);
+
+	e->chain = buckets[hash % STATCACHE_BUCKETS];
+	buckets[hash % STATCACHE_BUCKETS] = e;
+	e->prev = NULL;
+	e->next = cachehead;
+	if (cachehead)
+		cachehead->prev = e;
+	else
+		cachetail = e;
+	cachehead = e;
+	cachecount++;
+	_statcache_unlock();
+}
+
+int statcache_stat(const char *path, struct stat *st)
+{
+	uint32_t gen;
+	int err;
+
+	if ((err = statcache_lookup(path, st, 0)) >= 0)
+		return err;
+
+	gen = statcache_generation();
+	err = stat(path, st) == 0 ? 0 : errno;
+	statcache_store(path, st, err, 0, gen);
+	return err;
+}
+
+/* Something changed in a watched directory */
+void _statcache_changed(const char *dirpath, const char *name, void *ctx)
+{
+	char key[MAX_FILEPATH];
+	char changed[MAX_FILEPATH];
+	char alias[MAX_FILENAME_LEN];
+	statcache_entry *e, *next;
+
+	_statcache_lock();
+	if (dirpath == NULL)
+	{
+		/* events were lost */
+		generation++;
+		for (e = cachehead; e != NULL; e = next)
+		{
+			next = e->next;
+			_statcache_remove(e);
+		}
+	}
+	else if (name == NULL)
+	{
+		/* the directory itself moved or went away */
+		if (_statcache_key(dirpath, key, sizeof(key)) == 0)
+			_statcache_forget(key, 1);
+	}
+	else
+	{
+		/* the entry, and the directory's own times along with it */
+		snprintf(changed, sizeof(changed), "%s/%s", dirpath, name);
+		if (_statcache_key(changed, key, sizeof(key)) == 0)
+		{
+			/* anything kept below a directory that isn't cached
+			   itself is in a watched directory of its own, which
+			   will hear if it moves */
+			e = _statcache_find(key, _statcache_hash(key));
+			_statcache_forget(key, e != NULL && e->err == 0 && S_ISDIR(e->st.st_mode));
+			_statcache_forget_parent(key);
+		}
+		/* and whatever the file is served as instead */
+		if (vfs_alias(name, alias, sizeof(alias)) == 0)
+		{
+			snprintf(changed, sizeof(changed), "%s/%s", dirpath, alias);
+			if (_statcache_key(changed, key, sizeof(key)) == 0)
+				_statcache_forget(key, 0);
+		}
+	}
+	_statcache_unlock();
+}
+
+int statcache_watch(const char *dirpath)
+{
+	char key[MAX_FILEPATH];
+
+	if (_statcache_key(dirpath, key, sizeof(key)) < 0)
+		return -1;
+	/* without notification there's only the TTL to go by */
+	if (notify_fd() < 0)
+		return 0;
+	return notify_watch(key, _statcache_changed, NULL);
+}
+
+void statcache_drop(const char *path, int below)
+{
+	char key[MAX_FILEPATH];
+	char alias[MAX_FILEPATH];
+	char *slash;
+
+	if (_statcache_key(path, key, sizeof(key)) < 0)
+		return;
+
+	_statcache_lock();
+	_statcache_forget(key, below);
+	_statcache_forget_parent(key);
+	/* and whatever the file is served as instead */
+	if ((slash = strrchr(key, '/')) != NULL &&
+		vfs_alias(slash + 1, alias, sizeof(alias)) == 0)
+	{
+		strlcpy(slash + 1, alias, sizeof(key) - (slash + 1 - key));
+		_statcache_forget(key, 0);
+	}
+	_statcache_unlock();
+}
@@ -0,0 +1,64 @@
+#ifndef _TNFS_STATCACHE_H
+#define _TNFS_STATCACHE_H
+
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon stat() cache
+ *
+ * */
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* Clients check the same few files over and over, most often for ones
+ * that aren't there, so the results of stat() are kept for a short
+ * while, including that a file doesn't exist. Paths are full paths as
+ * built from the root. An entry is dropped when its directory reports
+ * a change, when the server changes the file itself, or after
+ * STATCACHE_TTL seconds, whichever comes first. All of it may be
+ * called from the worker threads */
+
+/* Returns 0 with st filled in, or ENOENT, if path has a fresh entry;
+ * -1 on a miss. If checked is set only a result that went through
+ * resolve_stat() will do */
+int statcache_lookup(const char *path, struct stat *st, int checked);
+
+/* Take before the stat() whose result is passed to statcache_store(),
+ * so a change dropped while it ran isn't stored afterwards */
+uint32_t statcache_generation();
+void statcache_store(const char *path, const struct stat *st, int err, int checked, uint32_t gen);
+
+/* stat() through the cache. Returns 0 or errno */
+int statcache_stat(const char *path, struct stat *st);
+
+/* Drop entries in dirpath as it changes. Call before the stat()s whose
+ * results are stored. Returns -1 if the directory can't be watched,
+ * when nothing in it should be stored */
+int statcache_watch(const char *dirpath);
+
+/* The server changed path: drop it, its directory, and if below is set
+ * everything underneath it */
+void statcache_drop(const char *path, int below);
+
+#endif
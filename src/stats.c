@@ -1,12 +1,19 @@
 #include <time.h>
 
 #include "stats.h"
+#include "directory.h"
 
 void stats_report(TcpConnection *tcp_conn_list)
 {
-    LOG("Stats | Sessions: %d. TCP connections: %d.\n",
+    uint32_t entries;
+    size_t bytes;
+
+    dirlist_stats(&entries, &bytes);
+    LOG("Stats | Sessions: %d. TCP connections: %d. Listed entries: %u (%lu bytes/entry).\n",
         tnfs_session_count(),
-        tcp_connections_count(tcp_conn_list));
+        tcp_connections_count(tcp_conn_list),
+        entries,
+        entries ? (unsigned long)(bytes / entries) : 0UL);
 }
 
 uint8_t tcp_connections_count(TcpConnection *tcp_conn_list)
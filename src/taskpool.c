@@ -0,0 +1,157 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * Worker threads
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#endif
+
+#include "taskpool.h"
+#include "log.h"
+
+#ifdef ENABLE_THREADS
+
+/* The loop being run in parallel, if any. Chunks are handed out in
+ * order under the lock, so a worker that finishes early takes more */
+typedef struct _taskpool_loop
+{
+	taskpool_range fn;
+	void *ctx;
+	uint32_t count;
+	uint32_t chunk;
+	uint32_t next;		/* first item not yet handed out */
+	uint32_t done;		/* items finished */
+} taskpool_loop;
+
+pthread_mutex_t poollock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t poolwork = PTHREAD_COND_INITIALIZER;
+pthread_cond_t pooldone = PTHREAD_COND_INITIALIZER;
+taskpool_loop *poolloop = NULL;
+int poolthreads = 0;
+
+/* Take and run chunks of the current loop until none are left.
+ * Called and returns with the lock held. */
+void _taskpool_run(taskpool_loop *loop)
+{
+	while (loop->next < loop->count)
+	{
+		uint32_t begin = loop->next;
+		uint32_t end = loop->count - begin > loop->chunk ? begin + loop->chunk : loop->count;
+		loop->next = end;
+
+		pthread_mutex_unlock(&poollock);
+		loop->fn(loop->ctx, begin, end);
+		pthread_mutex_lock(&poollock);
+
+		loop->done += end - begin;
+		if (loop->done == loop->count)
+			pthread_cond_signal(&pooldone);
+	}
+}
+
+void *_taskpool_worker(void *arg)
+{
+	pthread_mutex_lock(&poollock);
+	while (1)
+	{
+		while (poolloop == NULL || poolloop->next >= poolloop->count)
+			pthread_cond_wait(&poolwork, &poollock);
+		_taskpool_run(poolloop);
+	}
+	return NULL;
+}
+
+int taskpool_init(int nthreads)
+{
+	pthread_t t;
+	int i;
+
+	for (i = 0; i < nthreads; i++)
+	{
+		if (pthread_create(&t, NULL, _taskpool_worker, NULL) != 0)
+		{
+			LOG("taskpool: unable to start worker thread\n");
+			break;
+		}
+		pthread_detach(t);
+	}
+	poolthreads = i;
+	return poolthreads;
+}
+
+void taskpool_parallel(taskpool_range fn, void *ctx, uint32_t count, uint32_t chunk)
+{
+	taskpool_loop loop;
+
+	if (poolthreads == 0 || count <= chunk)
+	{
+		fn(ctx, 0, count);
+		return;
+	}
+
+	loop.fn = fn;
+	loop.ctx = ctx;
+	loop.count = count;
+	loop.chunk = chunk;
+	loop.next = 0;
+	loop.done = 0;
+
+	pthread_mutex_lock(&poollock);
+	/* the workers are busy with another thread's loop */
+	if (poolloop != NULL)
+	{
+		pthread_mutex_unlock(&poollock);
+		fn(ctx, 0, count);
+		return;
+	}
+	poolloop = &loop;
+	pthread_cond_broadcast(&poolwork);
+
+	/* pitch in rather than sit idle */
+	_taskpool_run(&loop);
+	while (loop.done < loop.count)
+		pthread_cond_wait(&pooldone, &poollock);
+	poolloop = NULL;
+	pthread_mutex_unlock(&poollock);
+}
+
+#else
+
+int taskpool_init(int nthreads)
+{
+	return 0;
+}
+
+void taskpool_parallel(taskpool_range fn, void *ctx, uint32_t count, uint32_t chunk)
+{
+	fn(ctx, 0, count);
+}
+
+#endif
@@ -0,0 +1,48 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * Worker threads
+ *
+ * A small pool of threads that the main loop can hand work to. With
+ * ENABLE_THREADS undefined everything runs on the calling thread.
+ *
+ * */
+
+#ifndef _TNFS_TASKPOOL_H
+#define _TNFS_TASKPOOL_H
+
+#include <stdint.h>
+
+/* Does the items in [begin, end) of a parallel loop */
+typedef void (*taskpool_range)(void *ctx, uint32_t begin, uint32_t end);
+
+/* Start the worker threads. Returns the number started. */
+int taskpool_init(int nthreads);
+
+/* Run fn over count items split into chunks, on the workers and the
+ * calling thread together, returning when every chunk is done. fn
+ * must be safe to run on several threads at once. While the workers
+ * are running another thread's loop the caller runs it all alone. */
+void taskpool_parallel(taskpool_range fn, void *ctx, uint32_t count, uint32_t chunk);
+
+#endif
@@ -51,9 +51,18 @@
 
 #include "config.h"
 
+/* For what the threads requests run on would otherwise share */
+#ifdef ENABLE_THREADS
+#define THREADLOCAL __thread
+#else
+#define THREADLOCAL
+#endif
+
 /* tnfs command IDs */
 #define TNFS_MOUNT	0x00
 #define TNFS_UMOUNT	0x01
+#define TNFS_COMPOUND	0x02
+#define TNFS_WINDOW	0x03
 
 #define TNFS_OPENDIR	0x10
 #define TNFS_READDIR	0x11
@@ -64,6 +73,10 @@
 #define TNFS_SEEKDIR    0x16
 #define TNFS_OPENDIRX   0x17
 #define TNFS_READDIRX   0x18
+#define TNFS_SEARCH     0x19
+#define TNFS_RMTREE     0x1A
+#define TNFS_COPYTREE   0x1B
+#define TNFS_WATCH      0x1C
 
 #define TNFS_OPENFILE_OLD 0x20
 #define	TNFS_READBLOCK	0x21
@@ -75,15 +88,27 @@
 #define TNFS_CHMODFILE	0x27
 #define TNFS_RENAMEFILE	0x28
 #define TNFS_OPENFILE	0x29
+#define TNFS_HASHFILE	0x2A
+#define TNFS_COPYFILE	0x2B
+#define TNFS_JOBSTATUS	0x2C
+
+#define TNFS_SIZE	0x30
+#define TNFS_FREE	0x31
 
 /* command classes etc. */
 #define CLASS_SESSION	0x00
 #define CLASS_DIRECTORY	0x10
 #define CLASS_FILE	0x20
+#define CLASS_DEVICE	0x30
+
+#define NUM_SESSCMDS 4
+#define NUM_DIRCMDS	13
+#define NUM_FILECMDS 13
+#define NUM_DEVCMDS 2
 
-#define NUM_SESSCMDS 2
-#define NUM_DIRCMDS	9
-#define NUM_FILECMDS 10
+/* flags of each part of a COMPOUND */
+#define TNFS_COMPOUND_CHAIN 0x01	/* first argument is the last handle opened */
+#define TNFS_COMPOUND_ALWAYS 0x02	/* run even after an earlier part failed */
 
 #define TNFS_DIRENTRY_DIR 0x01
 #define TNFS_DIRENTRY_HIDDEN 0x02
@@ -96,27 +121,81 @@ struct _dir_entry
     uint32_t size;
     uint32_t mtime;
     uint32_t ctime;
-    char entrypath[MAX_FILENAME_LEN];
-} __attribute__((packed));
+    char *entrypath;	/* held in the listing's arena */
+};
 
 typedef struct _dir_entry directory_entry;
 
-struct _dir_entry_list_node
+/* Directory listings are carved out of a chain of arena blocks: the
+ * entry names are bump-allocated side by side and all released
+ * together by dirlist_free() */
+typedef struct _dir_arena_block
 {
-	directory_entry entry;
-	struct _dir_entry_list_node *next;
-} __attribute__((packed));
+	struct _dir_arena_block *next;
+	size_t used;
+	size_t size;
+} dir_arena_block;
 
-typedef struct _dir_entry_list_node directory_entry_list_node;
-typedef directory_entry_list_node * directory_entry_list;
+typedef struct _dir_arena
+{
+	dir_arena_block *blocks;	/* most recent block first */
+	size_t bytes;			/* total size of all blocks */
+	uint32_t entries;		/* entries allocated from the arena */
+} dir_arena;
+
+#define DIRLIST_ORDERS 4	/* by name, case-sensitive name, mtime, size */
+
+/* READDIRX replies encoded once for a view of a listing and a page
+ * geometry, appended as clients first read them and served as they are
+ * to every handle with the same view after that */
+typedef struct _dir_pages
+{
+	struct _dir_pages *next;	/* other views of the same listing */
+	uint32_t *view;			/* the view the pages were made from */
+	uint32_t entry_count;
+	uint8_t req_count;		/* entries asked for per page, 0 as many as fit */
+	int reply_max;			/* largest reply the pages were made for */
+	uint32_t npages;
+	uint32_t pagecap;		/* room in starts and offsets */
+	uint32_t *starts;		/* view position each page starts at, npages + 1 */
+	uint32_t *offsets;		/* where each page starts in data, npages + 1 */
+	uint8_t *data;
+	size_t datasize;
+} dir_pages;
+
+/* The entries of a directory as read from disk. A listing is shared by
+ * every handle open on the directory, each seeing it through a view of
+ * its own, and stays in the directory cache after they close */
+typedef struct _dir_listing
+{
+	char path[MAX_TNFSPATH];
+	directory_entry *entries;	/* in the order they were read */
+	uint32_t count;
+	uint32_t size;
+	uint32_t *orders[DIRLIST_ORDERS];	/* ascending permutations, made on first use */
+	dir_arena arena;		/* the entry names */
+	int64_t mtime_sec;		/* directory modification time when read */
+	int64_t mtime_nsec;
+	time_t loaded;
+	int refs;			/* handles using it, plus one while cached */
+	uint8_t state;			/* DIRCACHE_* */
+	dir_pages *pages;		/* encoded READDIRX replies, up to DIRPAGES_MAX views */
+	size_t pagebytes;
+	struct _dir_listing *prev;	/* cache order, most recently used first */
+	struct _dir_listing *next;
+} dir_listing;
 
 typedef struct _dir_handle
 {
 	DIR *handle;
+	struct _vfs_dir *vdir;		/* instead of handle, for a virtual directory */
 	char path[MAX_TNFSPATH];
-	uint16_t entry_count;
-	directory_entry_list entry_list;
-	directory_entry_list_node * current_entry;
+	dir_listing *listing;		/* set by OPENDIRX and SEARCH */
+	uint32_t *view;			/* listing entries in the order returned */
+	uint32_t entry_count;
+	uint32_t position;		/* next entry of the view */
+	dir_pages *pages;		/* the listing's pages for this view, if any */
+	uint32_t token;			/* of the view, with TNFS_DIROPT_TOKEN */
 } dir_handle;
 
 typedef struct _session
@@ -125,17 +204,23 @@ typedef struct _session
 	uint16_t sid;			/* session ID */
 	in_addr_t ipaddr;		/* client addr */
 	uint8_t seqno;			/* last sequence number */
-	int fd[MAX_FD_PER_CONN];	/* file descriptors */
+	int fd[MAX_FD_PER_CONN];	/* file descriptors, VFS_FD for virtual files */
+	char *fdpath[MAX_FD_PER_CONN];	/* full path of each opened for writing */
+	struct _vfs_file *vfile[MAX_FD_PER_CONN];	/* where fd is VFS_FD */
 	//DIR *dhnd[MAX_DHND_PER_CONN];	/* directory handles */
 	//char dpaths[MAX_DHND_PER_CONN][MAX_TNFSPATH]; /* directory path for each handle */
 	dir_handle dhandles[MAX_DHND_PER_CONN];
 	char *root;			/* requested root dir */
-	unsigned char lastmsg[MAXMSGSZ];/* last message sent */
+	unsigned char *lastmsg;		/* last message sent, maxmsgsz bytes */
 #ifdef USAGELOG
 	char lastpath[MAX_TNFSPATH];    /* last path visited */
 #endif
 	int lastmsgsz;			/* last message's size inc. hdr */
+	int maxmsgsz;			/* largest message either way, MAXMSGSZ unless negotiated */
+	int maxiosz;			/* largest READ or WRITE */
 	uint8_t lastseqno;		/* last sequence number */
+	struct _window *window;	/* replies kept after WINDOW, NULL if stop-and-wait */
+	struct _offload_req *offload;	/* its request off the main loop, NULL if none */
 	int cli_fd;				/* FD for the TCP connection */
 } Session;
 
@@ -157,6 +242,10 @@ typedef struct _tcp_conn
 {
 	struct sockaddr_in cliaddr;  /* client address */
 	int cli_fd;					 /* FD for the TCP connection */
+	unsigned char *rxbuf;		 /* bytes received but not yet decoded */
+	int rxlen;
+	int rxsize;
+	int closed;					 /* the client has gone; closed once what it sent is done */
 } TcpConnection;
 
 #endif
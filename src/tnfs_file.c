@@ -50,9 +50,15 @@
 #include "endian.h"
 #include "bsdcompat.h"
 #include "log.h"
+#include "resolve.h"
+#include "statcache.h"
+#include "vfs.h"
+#include "overlay.h"
+#include "hashcache.h"
+#include "job.h"
 
-char fnbuf[MAX_FILEPATH];
-unsigned char iobuf[MAX_IOSZ + 2]; /* 2 bytes added for the size param */
+THREADLOCAL char fnbuf[MAX_FILEPATH];
+unsigned char iobuf[TNFS_MAX_TCPMSG]; /* file contents being checksummed */
 
 void tnfs_open_deprecated(Header *hdr, Session *s, unsigned char *buf,
 						  int bufsz)
@@ -80,6 +86,104 @@ void tnfs_open_deprecated(Header *hdr, Session *s, unsigned char *buf,
 	free(newbuf);
 }
 
+#ifdef ENABLE_OVERLAY
+/* Where a session's overlays are kept, and the file's real path beneath
+   the tnfs root, which is the same whatever name it was reached by.
+   Returns -1 if there's no such file */
+int _tnfs_overlay_path(Session *s, const char *path, char *client, char *rel)
+{
+	unsigned char *ip = (unsigned char *)&s->ipaddr;
+
+	snprintf(client, 16, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+	if (resolve_real(s, path, rel, MAX_FILEPATH) < 0)
+		return -1;
+	return strcmp(rel, ".") != 0 ? 0 : -1;
+}
+
+/* Open a file through the client's overlay when it's being written to,
+   or has been. Returns 0 with f set, 1 to open it as usual, or -1 with
+   errno set */
+int _tnfs_overlay_open(Session *s, const char *path, int flags, vfs_file **f)
+{
+	char client[16];
+	char rel[MAX_FILEPATH];
+	struct stat st;
+	uint64_t size;
+	int basefd;
+
+	if (!overlay_enabled() || _tnfs_overlay_path(s, path, client, rel) < 0)
+		return 1;
+	/* reading a file the client has never written to */
+	if ((flags & O_ACCMODE) == O_RDONLY && !(flags & O_TRUNC) &&
+		overlay_size(client, rel, &size) == 1)
+		return 1;
+
+	/* anything that isn't an existing file is for the usual open to
+	   create or turn down */
+	if ((basefd = resolve_open(s, path, O_RDONLY, 0)) < 0)
+		return 1;
+	if (fstat(basefd, &st) < 0 || !S_ISREG(st.st_mode))
+	{
+		close(basefd);
+		return 1;
+	}
+	if ((flags & O_CREAT) && (flags & O_EXCL))
+	{
+		close(basefd);
+		errno = EEXIST;
+		return -1;
+	}
+	if (overlay_open(client, rel, basefd, flags, f) < 0)
+	{
+		close(basefd);
+		return -1;
+	}
+	return 0;
+}
+
+/* The size of a file as the client sees it */
+void _tnfs_overlay_stat(Session *s, const char *path, struct stat *st)
+{
+	char client[16];
+	char rel[MAX_FILEPATH];
+	uint64_t size;
+
+	if (overlay_enabled() && _tnfs_overlay_path(s, path, client, rel) == 0 &&
+		overlay_size(client, rel, &size) == 0)
+		st->st_size = size;
+}
+#endif
+
+/* Open a file into a session's slot i, however it's served. Returns the
+   descriptor, VFS_FD with the slot's vfile set, or -1 with errno set */
+int _tnfs_openfile(Session *s, int i, const char *path, int flags, int mode)
+{
+	struct stat statinfo;
+	int fd;
+#ifdef ENABLE_OVERLAY
+	int result;
+
+	/* a client's writes go to its own overlay of the file */
+	if ((result = _tnfs_overlay_open(s, path, flags, &s->vfile[i])) != 1)
+		return result == 0 ? VFS_FD : -1;
+#endif
+
+	/* creating a file would hide one served in its place */
+	if ((flags & O_CREAT) && resolve_stat(s, path, &statinfo) < 0 &&
+		vfs_stat(s, path, &statinfo) == 0)
+	{
+		errno = (flags & O_EXCL) ? EEXIST : EROFS;
+		return -1;
+	}
+
+	fd = resolve_open(s, path, flags, mode);
+	/* not on disk as such, but maybe inside an archive */
+	if (fd < 0 && (errno == ENOENT || errno == ENOTDIR) &&
+		(s->vfile[i] = vfs_open(s, path, flags)) != NULL)
+		fd = VFS_FD;
+	return fd;
+}
+
 void tnfs_open(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 {
 	int i, fd;
@@ -102,11 +206,7 @@ void tnfs_open(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 			flags = *buf + (*(buf + 1) * 256);
 			mode = *(buf + 2) + (*(buf + 3) * 256);
 
-#ifdef WITH_ZIP
-			fd = zipopen(fnbuf, tnfs_make_mode(flags), mode);
-#else
-			fd = open(fnbuf, tnfs_make_mode(flags), mode);
-#endif
+			fd = _tnfs_openfile(s, i, (char *)buf + 4, tnfs_make_mode(flags), mode);
 #ifdef DEBUG
 			fprintf(stderr, "filename: %s\n", (char *)buf + 4);
 			fprintf(stderr, "flags: %u\n", flags);
@@ -117,13 +217,20 @@ void tnfs_open(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 	                USGLOG(hdr, "File mounted: %s", (char *)buf + 4);
 #endif
 
-			if (fd <= 0)
+			if (fd == 0 || (fd < 0 && fd != VFS_FD))
 			{
 				hdr->status = tnfs_error(errno);
 				tnfs_send(s, hdr, NULL, 0);
 				return;
 			}
 
+			/* remember what's being written so its cached stat()
+			   can be dropped as it changes */
+			if (fd != VFS_FD && (tnfs_make_mode(flags) & (O_WRONLY | O_RDWR | O_CREAT | O_TRUNC)))
+			{
+				statcache_drop(fnbuf, 0);
+				s->fdpath[i] = strdup(fnbuf);
+			}
 			s->fd[i] = fd;
 			hdr->status = TNFS_SUCCESS;
 			reply[0] = (unsigned char)i;
@@ -139,23 +246,29 @@ void tnfs_read(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 {
 	int readsz;
 	int requestsz;
+	unsigned char *reply;
 
 	/* incoming data buffer must be 3 bytes, fd + readbytes */
 	int fd = validate_fd(hdr, s, buf, bufsz, 3);
 	if (!fd)
 		return;
 
+	/* read straight into the reply */
+	reply = tnfs_replybuf(s, hdr);
 	requestsz = tnfs16uint(buf + 1);
-	if (requestsz > MAX_IOSZ)
-		requestsz = MAX_IOSZ;
-	readsz = read(fd, iobuf + 2, (size_t)requestsz);
+	if (requestsz > s->maxiosz)
+		requestsz = s->maxiosz;
+	if (fd == VFS_FD)
+		readsz = vfs_read(s->vfile[*buf], reply + 2, (size_t)requestsz);
+	else
+		readsz = read(fd, reply + 2, (size_t)requestsz);
 	if (readsz > 0)
 	{
 		hdr->status = TNFS_SUCCESS;
-		uint16tnfs(iobuf, (uint16_t)readsz);
+		uint16tnfs(reply, (uint16_t)readsz);
 
 		/* final data buffer is size of read + 2 bytes */
-		tnfs_send(s, hdr, iobuf, readsz + 2);
+		tnfs_send(s, hdr, reply, readsz + 2);
 	}
 	else if (readsz == 0)
 	{
@@ -187,10 +300,18 @@ void tnfs_write(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 	if (!fd)
 		return;
 
+	/* never more than actually arrived */
 	writesz = tnfs16uint(buf + 1);
-	writesz = write(fd, buf + 3, (size_t)writesz);
+	if (writesz > bufsz - 3)
+		writesz = bufsz - 3;
+	if (fd == VFS_FD)
+		writesz = vfs_write(s->vfile[*buf], buf + 3, (size_t)writesz);
+	else
+		writesz = write(fd, buf + 3, (size_t)writesz);
 	if (writesz > 0)
 	{
+		if (s->fdpath[*buf])
+			statcache_drop(s->fdpath[*buf], 0);
 		hdr->status = 0;
 		uint16tnfs(response, (uint16_t)writesz);
 		tnfs_send(s, hdr, response, 2);
@@ -222,7 +343,11 @@ void tnfs_lseek(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 	fprintf(stderr, "lseek: offset=%d (%x) whence=%d tnfs_whence=%d\n",
 			offset, offset, whence, *(buf + 1));
 #endif
-	if ((result = lseek(fd, (off_t)offset, whence)) < 0)
+	if (fd == VFS_FD)
+		result = vfs_lseek(s->vfile[*buf], (off_t)offset, whence);
+	else
+		result = lseek(fd, (off_t)offset, whence);
+	if (result < 0)
 	{
 		hdr->status = tnfs_error(errno);
 #ifdef DEBUG
@@ -248,9 +373,23 @@ void tnfs_close(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 	if (!fd)
 		return;
 
-	if (close(fd) == 0)
+	if (fd == VFS_FD)
+	{
+		vfs_close(s->vfile[*buf]);
+		s->vfile[*buf] = NULL;
+		s->fd[*buf] = 0;
+		hdr->status = TNFS_SUCCESS;
+		tnfs_send(s, hdr, NULL, 0);
+	}
+	else if (close(fd) == 0)
 	{
 		s->fd[*buf] = 0; /* clear the session's descriptor */
+		if (s->fdpath[*buf])
+		{
+			statcache_drop(s->fdpath[*buf], 0);
+			free(s->fdpath[*buf]);
+			s->fdpath[*buf] = NULL;
+		}
 		hdr->status = TNFS_SUCCESS;
 		tnfs_send(s, hdr, NULL, 0);
 	}
@@ -265,6 +404,11 @@ void tnfs_stat(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 {
 	struct stat statinfo;
 	unsigned char msgbuf[TNFS_STAT_SIZE];
+	char dirpath[MAX_FILEPATH];
+	char *slash;
+	uint32_t gen;
+	int watched;
+	int err;
 #ifdef DEBUG
 	fprintf(stderr, "stat: bufsz=%d buf=%s\n", bufsz, buf);
 #endif
@@ -281,7 +425,28 @@ void tnfs_stat(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 	fprintf(stderr, "stat: path=%s\n", fnbuf);
 #endif
 
-	if (stat(fnbuf, &statinfo) == 0)
+	/* clients look for the same files, present or not, over and over */
+	if ((err = statcache_lookup(fnbuf, &statinfo, 1)) < 0)
+	{
+		strlcpy(dirpath, fnbuf, sizeof(dirpath));
+		if ((slash = strrchr(dirpath, '/')) != NULL)
+			*(slash == dirpath ? slash + 1 : slash) = 0;
+		watched = statcache_watch(dirpath) == 0;
+		gen = statcache_generation();
+		err = resolve_stat(s, (char *)buf, &statinfo) == 0 ? 0 : errno;
+		if (err == ENOENT || err == ENOTDIR)
+			err = vfs_stat(s, (char *)buf, &statinfo) == 0 ? 0 : errno;
+		if (watched)
+			statcache_store(fnbuf, &statinfo, err, 1, gen);
+	}
+
+#ifdef ENABLE_OVERLAY
+	/* the client sees its own writes */
+	if (err == 0 && S_ISREG(statinfo.st_mode))
+		_tnfs_overlay_stat(s, (char *)buf, &statinfo);
+#endif
+
+	if (err == 0)
 	{
 #ifdef DEBUG
 		fprintf(stderr, "stat: OK\n");
@@ -298,15 +463,34 @@ void tnfs_stat(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 	}
 	else
 	{
-		hdr->status = tnfs_error(errno);
+		hdr->status = tnfs_error(err);
 #ifdef DEBUG
 		fprintf(stderr, "stat: Failed with errno=%d (%d)\n",
-				hdr->status, errno);
+				hdr->status, err);
 #endif
 		tnfs_send(s, hdr, NULL, 0);
 	}
 }
 
+int tnfs_stat_cached(Session *s, unsigned char *buf, int bufsz)
+{
+	char path[MAX_FILEPATH];
+	struct stat statinfo;
+	int err;
+
+	/* one that can't be named is refused at once */
+	if (bufsz < 2 || tnfs_valid_filename(s, path, (char *)buf, bufsz) < 0)
+		return 1;
+	if ((err = statcache_lookup(path, &statinfo, 1)) < 0)
+		return 0;
+#ifdef ENABLE_OVERLAY
+	/* the client's own overlay may have to be read */
+	if (err == 0 && S_ISREG(statinfo.st_mode) && overlay_enabled())
+		return 0;
+#endif
+	return 1;
+}
+
 void tnfs_unlink(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 {
 	if (*(buf + bufsz - 1) != 0 ||
@@ -317,8 +501,9 @@ void tnfs_unlink(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 	}
 	else
 	{
-		if (unlink(fnbuf) == 0)
+		if (resolve_unlink(s, (char *)buf) == 0)
 		{
+			statcache_drop(fnbuf, 0);
 			hdr->status = TNFS_SUCCESS;
 			tnfs_send(s, hdr, NULL, 0);
 		}
@@ -356,7 +541,7 @@ void tnfs_rename(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 		return;
 	}
 
-	if (rename((char *)fnbuf, tobuf) < 0)
+	if (resolve_rename(s, (char *)buf, to) < 0)
 	{
 		hdr->status = tnfs_error(errno);
 		tnfs_send(s, hdr, NULL, 0);
@@ -368,11 +553,399 @@ void tnfs_rename(Header *hdr, Session *s, unsigned char *buf, int bufsz)
 	}
 	else
 	{
+		statcache_drop(fnbuf, 1);
+		statcache_drop(tobuf, 1);
 		hdr->status = TNFS_SUCCESS;
 		tnfs_send(s, hdr, NULL, 0);
 	}
 }
 
+/* Open a file to checksum it, as the client would read it, with st
+   describing it. Returns the descriptor, or VFS_FD with f set, or -1
+   with errno set. keep is cleared if the checksum is only the client's */
+int _tnfs_hashopen(Session *s, const char *path, struct stat *st, vfs_file **f, int *keep)
+{
+	int fd;
+#ifdef ENABLE_OVERLAY
+	int result;
+
+	if ((result = _tnfs_overlay_open(s, path, O_RDONLY, f)) != 1)
+	{
+		if (result < 0)
+			return -1;
+		if (resolve_stat(s, path, st) < 0)
+		{
+			vfs_close(*f);
+			return -1;
+		}
+		st->st_size = (*f)->size;
+		*keep = 0;
+		return VFS_FD;
+	}
+#endif
+
+	*keep = 1;
+	if ((fd = resolve_open(s, path, O_RDONLY, 0)) >= 0)
+	{
+		if (fstat(fd, st) == 0)
+			return fd;
+		close(fd);
+		return -1;
+	}
+	if ((errno != ENOENT && errno != ENOTDIR) ||
+		(*f = vfs_open(s, path, O_RDONLY)) == NULL)
+		return -1;
+	if (vfs_stat(s, path, st) < 0)
+	{
+		vfs_close(*f);
+		return -1;
+	}
+	return VFS_FD;
+}
+
+/* Carry on with the CRC32C of an open file, reading up to max bytes
+   more through buf and adding them to *done. Returns 1 if there's more
+   to read, 0 once it's all read, or -1 with errno set */
+int _tnfs_hashfile(int fd, vfs_file *f, unsigned char *buf, size_t bufsz,
+				   uint64_t max, uint64_t *done, uint32_t *crc)
+{
+	uint64_t start = *done;
+	ssize_t n;
+
+	while (*done - start < max)
+	{
+		if ((n = fd == VFS_FD ? vfs_read(f, buf, bufsz) : read(fd, buf, bufsz)) <= 0)
+			return n < 0 ? -1 : 0;
+		*crc = crc32c(*crc, buf, (size_t)n);
+		*done += n;
+	}
+	return 1;
+}
+
+/* Keep a checksum unless the file changed while it was being read */
+void _tnfs_hashstore(const char *path, int fd, const struct stat *st, uint32_t crc)
+{
+	struct stat after;
+
+	if (fd == VFS_FD || (fstat(fd, &after) == 0 &&
+		after.st_size == st->st_size && after.st_mtime == st->st_mtime))
+		hashcache_store(path, st, crc);
+}
+
+/* What HASH replies with, and JOBSTATUS once a job has worked it out */
+void _tnfs_hashreply(unsigned char *reply, uint32_t crc, const struct stat *st)
+{
+	reply[HASH_TYPE_OFFSET] = TNFS_HASH_CRC32C;
+	uint32tnfs(reply + HASH_VALUE_OFFSET, crc);
+	uint32tnfs(reply + HASH_SIZE_OFFSET, (uint32_t)st->st_size);
+	uint32tnfs(reply + HASH_MTIME_OFFSET, (uint32_t)st->st_mtime);
+}
+
+typedef struct _hashjob
+{
+	int fd;
+	vfs_file *f;
+	struct stat st;
+	int keep;			/* the checksum is everyone's, not a client's overlay */
+	uint32_t crc;
+	uint64_t done;
+	unsigned char *buf;
+	char path[MAX_FILEPATH];
+} hashjob;
+
+/* Runs on the job's own thread, or for a client's overlay a step at a
+   time on the main loop. The client gets the checksum from JOBSTATUS */
+int _tnfs_hashjob(job *j, void *ctx)
+{
+	hashjob *h = (hashjob *)ctx;
+	unsigned char reply[TNFS_HASH_SIZE];
+	int more;
+
+	if (h->buf == NULL && (h->buf = malloc(sizeof(iobuf))) == NULL)
+		return ENOMEM;
+	do
+	{
+		if ((more = _tnfs_hashfile(h->fd, h->f, h->buf, sizeof(iobuf),
+								   h->keep ? JOB_COPY_CHUNK : HASH_INLINE, &h->done, &h->crc)) < 0)
+			return errno;
+		job_progress(j, h->done, h->st.st_size);
+	} while (more && h->keep);
+	if (more)
+		return EINPROGRESS;
+
+	if (h->keep)
+		_tnfs_hashstore(h->path, h->fd, &h->st, h->crc);
+	_tnfs_hashreply(reply, h->crc, &h->st);
+	job_result(j, reply, TNFS_HASH_SIZE);
+	return 0;
+}
+
+void _tnfs_hashfree(void *ctx)
+{
+	hashjob *h = (hashjob *)ctx;
+
+	if (h->fd == VFS_FD)
+		vfs_close(h->f);
+	else
+		close(h->fd);
+	free(h->buf);
+	free(h);
+}
+
+void tnfs_hash(Header *hdr, Session *s, unsigned char *buf, int bufsz)
+{
+	struct stat statinfo;
+	unsigned char reply[TNFS_HASH_SIZE];
+	vfs_file *f = NULL;
+	hashjob *h;
+	uint32_t crc = 0;
+	uint64_t done = 0;
+	int fd, keep, handle, err = 0;
+
+	if (bufsz < 2 || *(buf + bufsz - 1) != 0 ||
+		tnfs_valid_filename(s, fnbuf, (char *)buf, bufsz) < 0)
+	{
+		hdr->status = TNFS_EINVAL;
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+
+	if ((fd = _tnfs_hashopen(s, (char *)buf, &statinfo, &f, &keep)) == -1)
+	{
+		hdr->status = tnfs_error(errno);
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+
+	if (S_ISDIR(statinfo.st_mode))
+	{
+		err = EISDIR;
+	}
+	else if (keep && hashcache_lookup(fnbuf, &statinfo, &crc) == 0)
+	{
+		/* unchanged since it was last checksummed */
+	}
+	/* reading a large file, or inflating one, would hold up everyone,
+	   so that's left to a job while the client polls for it to finish.
+	   A client's own overlay is read on the main loop, where its writes
+	   are made, but a piece at a time */
+	else if (statinfo.st_size > HASH_INLINE)
+	{
+		if ((h = calloc(1, sizeof(hashjob))) == NULL)
+		{
+			err = ENOMEM;
+		}
+		else
+		{
+			h->fd = fd;
+			h->f = f;
+			h->st = statinfo;
+			h->keep = keep;
+			strlcpy(h->path, fnbuf, sizeof(h->path));
+			/* the job closes the file from now on */
+			if ((handle = keep ? job_start(s, _tnfs_hashjob, h, _tnfs_hashfree) :
+				 job_start_steps(s, _tnfs_hashjob, h, _tnfs_hashfree)) < 0)
+			{
+				hdr->status = tnfs_error(errno);
+				tnfs_send(s, hdr, NULL, 0);
+				return;
+			}
+			reply[0] = (unsigned char)handle;
+			hdr->status = TNFS_EAGAIN;
+			tnfs_send(s, hdr, reply, 1);
+			return;
+		}
+	}
+	else
+	{
+		if (_tnfs_hashfile(fd, f, iobuf, sizeof(iobuf), UINT64_MAX, &done, &crc) < 0)
+			err = errno;
+		else if (keep)
+			_tnfs_hashstore(fnbuf, fd, &statinfo, crc);
+	}
+
+	if (fd == VFS_FD)
+		vfs_close(f);
+	else
+		close(fd);
+
+	if (err)
+	{
+		hdr->status = tnfs_error(err);
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+	_tnfs_hashreply(reply, crc, &statinfo);
+	hdr->status = TNFS_SUCCESS;
+	tnfs_send(s, hdr, reply, TNFS_HASH_SIZE);
+}
+
+typedef struct _copyjob
+{
+	int in;
+	int out;
+	uint64_t size;
+	char dst[MAX_FILEPATH];
+} copyjob;
+
+/* Runs in the job's own thread */
+int _tnfs_copyjob(job *j, void *ctx)
+{
+	copyjob *c = (copyjob *)ctx;
+	uint64_t done = 0;
+	int err;
+
+	job_progress(j, 0, c->size);
+	err = job_copyfd(j, c->in, c->out, &done, c->size);
+	if (close(c->out) < 0 && err == 0)
+		err = errno;
+	c->out = -1;
+	statcache_drop(c->dst, 0);
+	return err;
+}
+
+void _tnfs_copyfree(void *ctx)
+{
+	copyjob *c = (copyjob *)ctx;
+
+	if (c->in >= 0)
+		close(c->in);
+	if (c->out >= 0)
+		close(c->out);
+	free(c);
+}
+
+/* Open the two ends of a copy. Returns 0, or -1 with errno set */
+int _tnfs_copyopen(Session *s, const char *src, const char *dst,
+				   int excl, copyjob *c)
+{
+	struct stat in, out;
+	int flags = tnfs_make_mode(TNFS_O_WRONLY | TNFS_O_CREAT |
+							   (excl ? TNFS_O_EXCL : 0));
+#ifdef ENABLE_OVERLAY
+	char client[16];
+	char rel[MAX_FILEPATH];
+	uint64_t size;
+#endif
+
+	/* only plain files on disk: members of an archive are left to be
+	   read the usual way */
+	if ((c->in = resolve_open(s, src, tnfs_make_mode(TNFS_O_RDONLY), 0)) < 0)
+		return -1;
+	if (fstat(c->in, &in) < 0)
+		return -1;
+	if (!S_ISREG(in.st_mode))
+	{
+		errno = S_ISDIR(in.st_mode) ? EISDIR : EINVAL;
+		return -1;
+	}
+#ifdef ENABLE_OVERLAY
+	/* the client's own version of either file lives in its overlay,
+	   which the copy would go around */
+	if (overlay_enabled() && _tnfs_overlay_path(s, src, client, rel) == 0 &&
+		overlay_size(client, rel, &size) != 1)
+	{
+		errno = EBUSY;
+		return -1;
+	}
+	if (overlay_enabled() && resolve_stat(s, dst, &out) == 0)
+	{
+		errno = excl ? EEXIST : EROFS;
+		return -1;
+	}
+#endif
+	/* creating a file would hide one served in its place */
+	if (resolve_stat(s, dst, &out) < 0 && vfs_stat(s, dst, &out) == 0)
+	{
+		errno = excl ? EEXIST : EROFS;
+		return -1;
+	}
+
+	if ((c->out = resolve_open(s, dst, flags, in.st_mode & 0777)) < 0)
+		return -1;
+	if (fstat(c->out, &out) < 0)
+		return -1;
+	if (out.st_dev == in.st_dev && out.st_ino == in.st_ino)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if (!S_ISREG(out.st_mode))
+	{
+		errno = EISDIR;
+		return -1;
+	}
+	if (ftruncate(c->out, 0) < 0)
+		return -1;
+	c->size = in.st_size;
+	return 0;
+}
+
+void tnfs_copy(Header *hdr, Session *s, unsigned char *buf, int bufsz)
+{
+	char tobuf[MAX_FILEPATH];
+	unsigned char *from = buf + 1;
+	char *to;
+	copyjob *c;
+	int handle;
+
+	if (bufsz < 4 || *(buf + bufsz - 1) != 0 ||
+		(to = memchr(from, 0x00, bufsz - 1)) == NULL ||
+		to == (char *)buf + bufsz - 1)
+	{
+		hdr->status = TNFS_EINVAL;
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+
+	/* point at byte after the NULL */
+	to++;
+	if (tnfs_valid_filename(s, fnbuf, (char *)from, (unsigned char *)to - from) < 0 ||
+		tnfs_valid_filename(s, tobuf, to,
+							(buf + bufsz) - (unsigned char *)to) < 0)
+	{
+		hdr->status = TNFS_EINVAL;
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+
+	/* opening the destination creates or truncates it, so check there
+	   is room for the job first */
+	if (job_full())
+	{
+		hdr->status = TNFS_EAGAIN;
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+	if ((c = malloc(sizeof(copyjob))) == NULL)
+	{
+		hdr->status = TNFS_ENOMEM;
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+	c->in = c->out = -1;
+	strlcpy(c->dst, tobuf, sizeof(c->dst));
+	if (_tnfs_copyopen(s, (char *)from, to, *buf & TNFS_COPY_EXCL, c) < 0)
+	{
+		hdr->status = tnfs_error(errno);
+		_tnfs_copyfree(c);
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+	statcache_drop(tobuf, 0);
+
+	/* the copy goes on without holding up anyone else's requests */
+	if ((handle = job_start(s, _tnfs_copyjob, c, _tnfs_copyfree)) < 0)
+	{
+		hdr->status = tnfs_error(errno);
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+	hdr->status = TNFS_SUCCESS;
+	*buf = (unsigned char)handle;
+	tnfs_send(s, hdr, buf, 1);
+}
+
 int tnfs_valid_filename(Session *s,
 						char *fullpath,
 						char *filename, int fnsize)
@@ -47,6 +47,16 @@
 #define ST_CTIME_OFFSET	0x12
 #define TNFS_STAT_SIZE	0x16
 
+#define HASH_TYPE_OFFSET	0x00
+#define HASH_VALUE_OFFSET	0x01
+#define HASH_SIZE_OFFSET	0x05
+#define HASH_MTIME_OFFSET	0x09
+#define TNFS_HASH_SIZE	0x0D
+
+#define TNFS_HASH_CRC32C	0x01
+
+#define TNFS_COPY_EXCL	0x01
+
 #define TNFS_SEEK_SET	0x00
 #define TNFS_SEEK_CUR	0x01
 #define TNFS_SEEK_END	0x02
@@ -58,9 +68,13 @@ void tnfs_write(Header *hdr, Session *s, unsigned char *buf, int bufsz);
 void tnfs_lseek(Header *hdr, Session *s, unsigned char *buf, int bufsz);
 void tnfs_close(Header *hdr, Session *s, unsigned char *buf, int bufsz);
 void tnfs_stat(Header *hdr, Session *s, unsigned char *buf, int bufsz);
+/* Whether tnfs_stat would answer from the statcache alone */
+int tnfs_stat_cached(Session *s, unsigned char *buf, int bufsz);
 void tnfs_unlink(Header *hdr, Session *s, unsigned char *buf, int bufsz);
 void tnfs_chmod(Header *hdr, Session *s, unsigned char *buf, int bufsz);
 void tnfs_rename(Header *hdr, Session *s, unsigned char *buf, int bufsz);
+void tnfs_hash(Header *hdr, Session *s, unsigned char *buf, int bufsz);
+void tnfs_copy(Header *hdr, Session *s, unsigned char *buf, int bufsz);
 
 int tnfs_valid_filename(Session *s,
                         char *fullpath,
@@ -0,0 +1,404 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon recursive directory operations
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "tnfs.h"
+#include "tree.h"
+#include "job.h"
+#include "datagram.h"
+#include "errortable.h"
+#include "tnfs_file.h"
+#include "resolve.h"
+#include "statcache.h"
+#include "bsdcompat.h"
+#include "log.h"
+
+#ifndef WIN32
+typedef struct _treejob
+{
+	int srcdir;			/* holding the source */
+	char srcname[MAX_FILENAME_LEN];
+	int dstdir;			/* holding the destination, -1 to remove the source */
+	char dstname[MAX_FILENAME_LEN];
+	int move;
+	char srcpath[MAX_FILEPATH];	/* as the stat cache knows them */
+	char dstpath[MAX_FILEPATH];
+	uint64_t done;
+	uint64_t total;
+	dev_t topdev;		/* the directory a copy made first, which a */
+	ino_t topino;		/* copy into its own source meets again */
+} treejob;
+
+/* Open the directory name in parent, unless it's a symlink */
+DIR *_tree_opendir(int parent, const char *name)
+{
+	DIR *dir;
+	int fd;
+
+	if ((fd = openat(parent, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) < 0)
+		return NULL;
+	if ((dir = fdopendir(fd)) == NULL)
+		close(fd);
+	return dir;
+}
+
+/* The next entry other than "." and "..". At the end errno is 0 unless
+   the directory couldn't be read */
+struct dirent *_tree_readdir(DIR *dir)
+{
+	struct dirent *entry;
+
+	errno = 0;
+	while ((entry = readdir(dir)) != NULL &&
+		   (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0))
+		;
+	return entry;
+}
+
+/* Add up what there is to do for name and everything below it: entries
+   to remove, or if bytes is set, bytes to copy. Returns 0 or errno */
+int _tree_count(int parent, const char *name, int bytes, int depth, uint64_t *total)
+{
+	struct stat st;
+	struct dirent *entry;
+	DIR *dir;
+	int err = 0;
+
+	if (depth > TREE_DEPTH_MAX)
+		return ELOOP;
+	if (fstatat(parent, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+		return errno;
+	if (!bytes)
+		(*total)++;
+	else if (S_ISREG(st.st_mode))
+		*total += st.st_size;
+	if (!S_ISDIR(st.st_mode))
+		return 0;
+
+	if ((dir = _tree_opendir(parent, name)) == NULL)
+		return errno;
+	while (err == 0 && (entry = _tree_readdir(dir)) != NULL)
+		err = _tree_count(dirfd(dir), entry->d_name, bytes, depth + 1, total);
+	if (err == 0)
+		err = errno;
+	closedir(dir);
+	return err;
+}
+
+/* Remove name from parent, and everything below it. Returns 0 or errno */
+int _tree_remove(job *j, treejob *t, int parent, const char *name, int depth)
+{
+	struct stat st;
+	struct dirent *entry;
+	DIR *dir;
+	int err = 0;
+
+	if (depth > TREE_DEPTH_MAX)
+		return ELOOP;
+	if (fstatat(parent, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+		return errno;
+
+	if (S_ISDIR(st.st_mode))
+	{
+		if ((dir = _tree_opendir(parent, name)) == NULL)
+			return errno;
+		while (err == 0 && (entry = _tree_readdir(dir)) != NULL)
+			err = _tree_remove(j, t, dirfd(dir), entry->d_name, depth + 1);
+		if (err == 0)
+			err = errno;
+		closedir(dir);
+		if (err == 0 && unlinkat(parent, name, AT_REMOVEDIR) < 0)
+			err = errno;
+	}
+	else if (unlinkat(parent, name, 0) < 0)
+		err = errno;
+
+	/* a move's progress is in what it copied */
+	if (err == 0 && t->dstdir < 0)
+	{
+		t->done++;
+		job_progress(j, t->done, t->total);
+	}
+	return err;
+}
+
+/* Copy name in sparent to dname in dparent, and everything below it.
+   Returns 0 or errno */
+int _tree_copy(job *j, treejob *t, int sparent, const char *name,
+			   int dparent, const char *dname, int depth)
+{
+	struct stat st, top;
+	struct dirent *entry;
+	char link[MAX_FILEPATH];
+	DIR *dir;
+	ssize_t n;
+	int in, out, err = 0;
+
+	if (depth > TREE_DEPTH_MAX)
+		return ELOOP;
+	if (fstatat(sparent, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+		return errno;
+
+	if (S_ISDIR(st.st_mode))
+	{
+		if (depth > 0 && st.st_dev == t->topdev && st.st_ino == t->topino)
+			return 0;
+		/* left writable by its owner so the copy can fill it */
+		if (mkdirat(dparent, dname, (st.st_mode & 0777) | S_IRWXU) < 0)
+			return errno;
+		if ((out = openat(dparent, dname, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) < 0)
+			return errno;
+		if (depth == 0 && fstat(out, &top) == 0)
+		{
+			t->topdev = top.st_dev;
+			t->topino = top.st_ino;
+		}
+		if ((dir = _tree_opendir(sparent, name)) == NULL)
+		{
+			err = errno;
+			close(out);
+			return err;
+		}
+		while (err == 0 && (entry = _tree_readdir(dir)) != NULL)
+			err = _tree_copy(j, t, dirfd(dir), entry->d_name, out, entry->d_name, depth + 1);
+		if (err == 0)
+			err = errno;
+		closedir(dir);
+		close(out);
+		return err;
+	}
+
+	if (S_ISLNK(st.st_mode))
+	{
+		if ((n = readlinkat(sparent, name, link, sizeof(link))) < 0)
+			return errno;
+		if (n == sizeof(link))
+			return ENAMETOOLONG;
+		link[n] = 0;
+		return symlinkat(link, dparent, dname) < 0 ? errno : 0;
+	}
+
+	/* devices, pipes and sockets aren't copied */
+	if (!S_ISREG(st.st_mode))
+		return 0;
+	if ((in = openat(sparent, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) < 0)
+		return errno;
+	if ((out = openat(dparent, dname, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+					  st.st_mode & 0777)) < 0)
+	{
+		err = errno;
+		close(in);
+		return err;
+	}
+	err = job_copyfd(j, in, out, &t->done, t->total);
+	close(in);
+	if (close(out) < 0 && err == 0)
+		err = errno;
+	return err;
+}
+
+/* Runs in the job's own thread */
+int _tree_job(job *j, void *ctx)
+{
+	treejob *t = (treejob *)ctx;
+	int err;
+
+	if (t->dstdir < 0)
+	{
+		if ((err = _tree_count(t->srcdir, t->srcname, 0, 0, &t->total)) == 0)
+		{
+			job_progress(j, 0, t->total);
+			err = _tree_remove(j, t, t->srcdir, t->srcname, 0);
+		}
+		statcache_drop(t->srcpath, 1);
+		return err;
+	}
+
+	/* within one filesystem a move is only a rename */
+	if (t->move && renameat(t->srcdir, t->srcname, t->dstdir, t->dstname) == 0)
+		err = 0;
+	else if (t->move && errno != EXDEV)
+		err = errno;
+	else if ((err = _tree_count(t->srcdir, t->srcname, 1, 0, &t->total)) == 0)
+	{
+		job_progress(j, 0, t->total);
+		err = _tree_copy(j, t, t->srcdir, t->srcname, t->dstdir, t->dstname, 0);
+		if (err == 0 && t->move)
+			err = _tree_remove(j, t, t->srcdir, t->srcname, 0);
+	}
+	statcache_drop(t->dstpath, 1);
+	if (t->move)
+		statcache_drop(t->srcpath, 1);
+	return err;
+}
+
+void _tree_free(void *ctx)
+{
+	treejob *t = (treejob *)ctx;
+
+	if (t->srcdir >= 0)
+		close(t->srcdir);
+	if (t->dstdir >= 0)
+		close(t->dstdir);
+	free(t);
+}
+
+/* A job on path, which must exist, with fullpath its name for the stat
+   cache. Returns NULL with errno set */
+treejob *_tree_new(Session *s, const char *path, const char *fullpath)
+{
+	struct stat st;
+	treejob *t;
+	int err;
+
+	if ((t = calloc(1, sizeof(treejob))) == NULL)
+		return NULL;
+	t->dstdir = -1;
+	strlcpy(t->srcpath, fullpath, sizeof(t->srcpath));
+	if ((t->srcdir = resolve_parent(s, path, t->srcname, sizeof(t->srcname))) < 0 ||
+		fstatat(t->srcdir, t->srcname, &st, AT_SYMLINK_NOFOLLOW) < 0)
+	{
+		err = errno;
+		_tree_free(t);
+		errno = err;
+		return NULL;
+	}
+	return t;
+}
+
+/* Add where a copy goes to t. Returns -1 with errno set */
+int _tree_dest(Session *s, treejob *t, const char *path, const char *fullpath)
+{
+	struct stat st;
+	size_t len = strlen(t->srcpath);
+
+	/* a tree can't be copied into itself */
+	if (strncmp(fullpath, t->srcpath, len) == 0 && fullpath[len] == '/')
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	strlcpy(t->dstpath, fullpath, sizeof(t->dstpath));
+	if ((t->dstdir = resolve_parent(s, path, t->dstname, sizeof(t->dstname))) < 0)
+		return -1;
+	if (fstatat(t->dstdir, t->dstname, &st, AT_SYMLINK_NOFOLLOW) == 0)
+	{
+		errno = EEXIST;
+		return -1;
+	}
+	return errno == ENOENT ? 0 : -1;
+}
+#endif
+
+void _tree_start(Header *hdr, Session *s, unsigned char *buf, void *t)
+{
+#ifndef WIN32
+	int handle;
+
+	if (t != NULL && (handle = job_start(s, _tree_job, t, _tree_free)) >= 0)
+	{
+		hdr->status = TNFS_SUCCESS;
+		*buf = (unsigned char)handle;
+		tnfs_send(s, hdr, buf, 1);
+		return;
+	}
+	hdr->status = tnfs_error(errno);
+#else
+	hdr->status = TNFS_ENOSYS;
+#endif
+	tnfs_send(s, hdr, NULL, 0);
+}
+
+void tnfs_rmtree(Header *hdr, Session *s, unsigned char *buf, int bufsz)
+{
+	char path[MAX_FILEPATH];
+	void *t = NULL;
+
+	if (bufsz < 2 || *(buf + bufsz - 1) != 0 ||
+		tnfs_valid_filename(s, path, (char *)buf, bufsz) < 0)
+	{
+		hdr->status = TNFS_EINVAL;
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+
+#ifndef WIN32
+	t = _tree_new(s, (char *)buf, path);
+#endif
+	_tree_start(hdr, s, buf, t);
+}
+
+void tnfs_copytree(Header *hdr, Session *s, unsigned char *buf, int bufsz)
+{
+	char frompath[MAX_FILEPATH], topath[MAX_FILEPATH];
+	unsigned char *from = buf + 1;
+	char *to;
+	void *t = NULL;
+
+	if (bufsz < 4 || *(buf + bufsz - 1) != 0 ||
+		(to = memchr(from, 0x00, bufsz - 1)) == NULL ||
+		to == (char *)buf + bufsz - 1)
+	{
+		hdr->status = TNFS_EINVAL;
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+
+	/* point at byte after the NULL */
+	to++;
+	if (tnfs_valid_filename(s, frompath, (char *)from, (unsigned char *)to - from) < 0 ||
+		tnfs_valid_filename(s, topath, to, (buf + bufsz) - (unsigned char *)to) < 0)
+	{
+		hdr->status = TNFS_EINVAL;
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+
+#ifndef WIN32
+	if ((t = _tree_new(s, (char *)from, frompath)) != NULL)
+	{
+		((treejob *)t)->move = *buf & TNFS_TREE_MOVE;
+		if (_tree_dest(s, t, to, topath) < 0)
+		{
+			int err = errno;
+			_tree_free(t);
+			errno = err;
+			t = NULL;
+		}
+	}
+#endif
+	_tree_start(hdr, s, buf, t);
+}
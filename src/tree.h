@@ -0,0 +1,42 @@
+#ifndef _TNFS_TREE_H
+#define _TNFS_TREE_H
+
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon recursive directory operations
+ *
+ * */
+
+#include "tnfs.h"
+
+/* Removing, copying or moving a whole tree runs as a job (see job.h),
+ * working down from a descriptor on the directory holding it, which is
+ * resolved on the main thread like any other path. Symlinks met on the
+ * way are removed or copied as links and never followed */
+
+#define TNFS_TREE_MOVE 0x01	/* COPYTREE removes the source once copied */
+
+void tnfs_rmtree(Header *hdr, Session *s, unsigned char *buf, int bufsz);
+void tnfs_copytree(Header *hdr, Session *s, unsigned char *buf, int bufsz);
+
+#endif
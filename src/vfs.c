@@ -0,0 +1,236 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon virtual files
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vfs.h"
+#ifdef WITH_ZIP
+#include "zipfs.h"
+#endif
+#ifdef WITH_GZ
+#include "gzfs.h"
+#endif
+
+/* Asked in turn */
+static const vfs_provider *providers[] = {
+#ifdef WITH_ZIP
+	&zipfs_provider,
+#endif
+#ifdef WITH_GZ
+	&gzfs_provider,
+#endif
+	NULL
+};
+
+vfs_file *vfs_open(Session *s, const char *path, int flags)
+{
+	const vfs_provider **p;
+	vfs_file *f;
+	int saved = errno;
+	int result;
+
+	if ((f = calloc(1, sizeof(vfs_file))) == NULL)
+		return NULL;
+	for (p = providers; *p != NULL; p++)
+	{
+		if ((result = (*p)->open(s, path, f)) == 1)
+			continue;
+		if (result == 0)
+		{
+			f->provider = *p;
+			f->flags = flags;
+			if ((flags & O_ACCMODE) == O_RDONLY && !(flags & (O_CREAT | O_TRUNC)))
+				return f;
+			(*p)->close(f);
+			errno = EROFS;
+		}
+		/* inside an archive, where nothing new can be made either */
+		else if (errno == ENOENT && (flags & O_CREAT))
+			errno = EROFS;
+		free(f);
+		return NULL;
+	}
+	free(f);
+	errno = saved;
+	return NULL;
+}
+
+/* The file's size now, which for some may have changed since it was
+   opened */
+uint64_t _vfs_size(vfs_file *f)
+{
+	if (f->provider->size != NULL)
+		f->size = f->provider->size(f);
+	return f->size;
+}
+
+ssize_t vfs_read(vfs_file *f, void *buf, size_t count)
+{
+	uint64_t size = _vfs_size(f);
+	ssize_t n;
+
+	if (f->pos >= size)
+		return 0;
+	if (count > size - f->pos)
+		count = size - f->pos;
+	if ((n = f->provider->pread(f, buf, count, f->pos)) > 0)
+		f->pos += n;
+	return n;
+}
+
+ssize_t vfs_write(vfs_file *f, const void *buf, size_t count)
+{
+	ssize_t n;
+
+	if (f->provider->pwrite == NULL || (f->flags & O_ACCMODE) == O_RDONLY)
+	{
+		errno = EBADF;
+		return -1;
+	}
+	if (f->flags & O_APPEND)
+		f->pos = _vfs_size(f);
+	if ((n = f->provider->pwrite(f, buf, count, f->pos)) > 0)
+	{
+		f->pos += n;
+		if (f->pos > f->size)
+			f->size = f->pos;
+	}
+	return n;
+}
+
+off_t vfs_lseek(vfs_file *f, off_t offset, int whence)
+{
+	int64_t pos;
+
+	switch (whence)
+	{
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = (int64_t)f->pos + offset;
+		break;
+	case SEEK_END:
+		pos = (int64_t)_vfs_size(f) + offset;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+	if (pos < 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	f->pos = pos;
+	return pos;
+}
+
+void vfs_close(vfs_file *f)
+{
+	f->provider->close(f);
+	free(f);
+}
+
+int vfs_stat(Session *s, const char *path, struct stat *st)
+{
+	const vfs_provider **p;
+	int saved = errno;
+	int result;
+
+	for (p = providers; *p != NULL; p++)
+	{
+		if ((*p)->stat != NULL && (result = (*p)->stat(s, path, st)) != 1)
+			return result;
+	}
+	errno = saved;
+	return -1;
+}
+
+vfs_dir *vfs_opendir(Session *s, const char *path)
+{
+	const vfs_provider **p;
+	vfs_dir *d;
+	int saved = errno;
+	int result;
+
+	if ((d = calloc(1, sizeof(vfs_dir))) == NULL)
+		return NULL;
+	for (p = providers; *p != NULL; p++)
+	{
+		if ((*p)->opendir == NULL || (result = (*p)->opendir(s, path, d)) == 1)
+			continue;
+		if (result == 0)
+		{
+			d->provider = *p;
+			return d;
+		}
+		free(d);
+		return NULL;
+	}
+	free(d);
+	errno = saved;
+	return NULL;
+}
+
+int vfs_loaddir(vfs_dir *d, dir_listing *listing)
+{
+	return d->provider->loaddir(d, listing);
+}
+
+void vfs_closedir(vfs_dir *d)
+{
+	d->provider->closedir(d);
+	free(d);
+}
+
+int vfs_alias(const char *name, char *buf, size_t bufsz)
+{
+	const vfs_provider **p;
+
+	for (p = providers; *p != NULL; p++)
+	{
+		if ((*p)->alias != NULL && (*p)->alias(name, buf, bufsz) == 0)
+			return 0;
+	}
+	return -1;
+}
+
+void vfs_listentry(const char *dirpath, directory_entry *e)
+{
+	const vfs_provider **p;
+
+	for (p = providers; *p != NULL; p++)
+	{
+		if ((*p)->listentry != NULL && (*p)->listentry(dirpath, e) == 0)
+			return;
+	}
+}
@@ -0,0 +1,101 @@
+#ifndef _TNFS_VFS_H
+#define _TNFS_VFS_H
+
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon virtual files
+ *
+ * */
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "tnfs.h"
+
+/* Files and directories that aren't on disk as such, like the members
+ * of a ZIP archive, are served by providers. A path is only offered to
+ * them once the real filesystem has failed to find it, and if none of
+ * them serves it either errno is left as that failure set it. Virtual
+ * files are read-only unless their provider can write. All return -1
+ * (NULL) on failure with errno set, like the calls they stand for */
+
+#define VFS_FD -2	/* in a session's fd[] for a file opened through the vfs */
+
+struct _vfs_provider;
+
+typedef struct _vfs_file
+{
+	const struct _vfs_provider *provider;
+	void *handle;			/* the provider's own */
+	uint64_t size;
+	uint64_t pos;
+	int flags;				/* as it was opened with */
+} vfs_file;
+
+typedef struct _vfs_dir
+{
+	const struct _vfs_provider *provider;
+	void *handle;
+} vfs_dir;
+
+/* Provider calls return 0 on success, 1 if the path isn't one the
+ * provider serves, or -1 with errno set. Paths are as the client gave
+ * them, relative to the session's mount point */
+typedef struct _vfs_provider
+{
+	const char *name;
+	int (*open)(Session *s, const char *path, vfs_file *f);
+	ssize_t (*pread)(vfs_file *f, void *buf, size_t count, uint64_t offset);
+	ssize_t (*pwrite)(vfs_file *f, const void *buf, size_t count, uint64_t offset);	/* optional */
+	uint64_t (*size)(vfs_file *f);	/* optional, for files another handle may grow */
+	void (*close)(vfs_file *f);
+	int (*stat)(Session *s, const char *path, struct stat *st);
+	int (*opendir)(Session *s, const char *path, vfs_dir *d);
+	int (*loaddir)(vfs_dir *d, dir_listing *listing);	/* returns errno, or 0 */
+	void (*closedir)(vfs_dir *d);
+	/* optional, for files served under another name than their own */
+	int (*alias)(const char *name, char *buf, size_t bufsz);
+	int (*listentry)(const char *dirpath, directory_entry *e);
+} vfs_provider;
+
+vfs_file *vfs_open(Session *s, const char *path, int flags);
+ssize_t vfs_read(vfs_file *f, void *buf, size_t count);
+ssize_t vfs_write(vfs_file *f, const void *buf, size_t count);
+off_t vfs_lseek(vfs_file *f, off_t offset, int whence);
+void vfs_close(vfs_file *f);
+int vfs_stat(Session *s, const char *path, struct stat *st);
+
+vfs_dir *vfs_opendir(Session *s, const char *path);
+/* Fill in a listing of the directory. Returns errno, or 0 */
+int vfs_loaddir(vfs_dir *d, dir_listing *listing);
+void vfs_closedir(vfs_dir *d);
+
+/* Copies into buf the name a file called name is served under instead,
+ * returning 0, or -1 if it's served as itself */
+int vfs_alias(const char *name, char *buf, size_t bufsz);
+/* Has an entry read from the directory at dirpath listed as what's
+ * served in its place, if anything is */
+void vfs_listentry(const char *dirpath, directory_entry *e);
+
+#endif
@@ -0,0 +1,320 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon directory change notification for clients
+ *
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "tnfs.h"
+#include "watch.h"
+#include "datagram.h"
+#include "directory.h"
+#include "errortable.h"
+#include "notify.h"
+#include "bsdcompat.h"
+#include "log.h"
+
+#if defined(WIN32)
+#define ST_MTIME_NSEC(st) 0
+#elif defined(__APPLE__)
+#define ST_MTIME_NSEC(st) ((st)->st_mtimespec.tv_nsec)
+#else
+#define ST_MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+#endif
+
+typedef struct _watch
+{
+	Session *s;			/* NULL if unused */
+	Header hdr;			/* of the WATCH being held */
+	char path[MAX_TNFSPATH];
+	int name;			/* where its last component starts, 0 for "/" */
+	int64_t mtime_sec;	/* of the directory as the client last saw it */
+	int64_t mtime_nsec;
+	time_t until;
+	int polled;			/* no change notification, so its mtime is checked */
+	int subscribed;		/* notify_watch() was asked about it and its parent */
+} watch;
+
+static watch held[WATCH_MAX];
+static int nheld = 0;
+static int nsubscribed = 0;
+static time_t lastpoll = 0;
+
+void _watch_changed(const char *dirpath, const char *name, void *ctx);
+
+/* The directory above a watched one, or "" for the root */
+void _watch_parent(const watch *w, char *parent, size_t size)
+{
+	*parent = 0;
+	if (w->name > 0)
+	{
+		strlcpy(parent, w->path, size);
+		parent[w->name > 1 ? w->name - 1 : 1] = 0;
+	}
+}
+
+/* Whether another held watch needs notification for path */
+int _watch_needed(const watch *w, const char *path)
+{
+	char parent[MAX_TNFSPATH];
+	int i;
+
+	for (i = 0; i < WATCH_MAX; i++)
+	{
+		if (&held[i] == w || held[i].s == NULL)
+			continue;
+		_watch_parent(&held[i], parent, sizeof(parent));
+		if (strcmp(held[i].path, path) == 0 || strcmp(parent, path) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* Let go of the notification a finished watch asked for. Not from a
+   notify callback, so released ones wait for watch_check() */
+void _watch_unsubscribe(watch *w)
+{
+	char parent[MAX_TNFSPATH];
+
+	if (!w->subscribed)
+		return;
+	_watch_parent(w, parent, sizeof(parent));
+	if (!_watch_needed(w, w->path))
+		notify_unwatch(w->path, _watch_changed, NULL);
+	if (*parent && !_watch_needed(w, parent))
+		notify_unwatch(parent, _watch_changed, NULL);
+	w->subscribed = 0;
+	nsubscribed--;
+}
+
+void _watch_release(watch *w)
+{
+	w->s = NULL;
+	nheld--;
+}
+
+void _watch_reply(watch *w, uint8_t result)
+{
+	Session *s = w->s;
+
+	_watch_release(w);
+	w->hdr.status = TNFS_SUCCESS;
+	tnfs_send(s, &w->hdr, &result, 1);
+}
+
+/* Whether the directory is no longer as the client saw it */
+int _watch_moved(watch *w)
+{
+	struct stat st;
+
+	return stat(w->path, &st) < 0 || st.st_mtime != w->mtime_sec ||
+		   ST_MTIME_NSEC(&st) != w->mtime_nsec;
+}
+
+/* Whether dirpath and name are the watched directory as its parent
+   sees it. A directory that's still open is only gone for good once
+   it's closed, so its own watch doesn't hear it removed or moved */
+int _watch_entry(watch *w, const char *dirpath, const char *name)
+{
+	int len = w->name > 1 ? w->name - 1 : w->name;
+
+	return name != NULL && w->name > 0 && strcmp(w->path + w->name, name) == 0 &&
+		   strncmp(w->path, dirpath, len) == 0 && dirpath[len] == 0;
+}
+
+/* notify callback: an entry of a watched directory, or the directory
+   itself, has changed */
+void _watch_changed(const char *dirpath, const char *name, void *ctx)
+{
+	char parent[MAX_TNFSPATH];
+	int i;
+
+	for (i = 0; i < WATCH_MAX && nheld > 0; i++)
+	{
+		if (held[i].s == NULL)
+			continue;
+		/* a watch dropped to make room: keep an eye on it by polling */
+		if (dirpath != NULL && name == NULL && !_watch_moved(&held[i]))
+		{
+			_watch_parent(&held[i], parent, sizeof(parent));
+			if (strcmp(dirpath, held[i].path) == 0 || strcmp(dirpath, parent) == 0)
+			{
+				held[i].polled = 1;
+				continue;
+			}
+		}
+		if (dirpath == NULL || strcmp(dirpath, held[i].path) == 0 ||
+			_watch_entry(&held[i], dirpath, name))
+			_watch_reply(&held[i], TNFS_WATCH_CHANGED);
+	}
+}
+
+void tnfs_watch(Header *hdr, Session *s, unsigned char *buf, int bufsz)
+{
+	char parent[MAX_TNFSPATH];
+	dir_handle *dirh;
+	struct stat st;
+	watch *w = NULL;
+	char *slash;
+	int i;
+
+	if (bufsz < 1 || bufsz > 2 || *buf >= MAX_DHND_PER_CONN ||
+		!DIRHANDLE_OPEN(&s->dhandles[*buf]))
+	{
+		hdr->status = TNFS_EBADF;
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+	dirh = &s->dhandles[*buf];
+
+	for (i = 0; i < WATCH_MAX && w == NULL; i++)
+	{
+		if (held[i].s == NULL)
+			w = &held[i];
+	}
+	if (w == NULL)
+	{
+		hdr->status = TNFS_EAGAIN;
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+	_watch_unsubscribe(w);
+
+	/* watched before it's looked at so no change can slip between */
+	strlcpy(w->path, dirh->path, sizeof(w->path));
+	for (i = strlen(w->path) - 1; i > 0 && w->path[i] == '/'; i--)
+		w->path[i] = 0;
+	w->polled = notify_watch(w->path, _watch_changed, NULL) < 0;
+	w->name = 0;
+	if ((slash = strrchr(w->path, '/')) != NULL && slash[1] != 0)
+	{
+		w->name = slash + 1 - w->path;
+		_watch_parent(w, parent, sizeof(parent));
+		if (notify_watch(parent, _watch_changed, NULL) < 0)
+			w->polled = 1;
+	}
+	w->subscribed = 1;
+	nsubscribed++;
+	if (stat(w->path, &st) < 0)
+	{
+		hdr->status = tnfs_error(errno);
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+	/* such as a directory inside an archive */
+	if (!S_ISDIR(st.st_mode))
+	{
+		hdr->status = TNFS_ENOTDIR;
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+
+	/* a listing shows the directory as it was when read, which may
+	   already be out of date */
+	if (dirh->listing != NULL && dirh->listing->mtime_sec != 0)
+	{
+		w->mtime_sec = dirh->listing->mtime_sec;
+		w->mtime_nsec = dirh->listing->mtime_nsec;
+	}
+	else
+	{
+		w->mtime_sec = st.st_mtime;
+		w->mtime_nsec = ST_MTIME_NSEC(&st);
+	}
+
+	w->hdr = *hdr;
+	w->until = time(NULL) + (bufsz > 1 && buf[1] ? buf[1] : WATCH_WAIT);
+	w->s = s;
+	nheld++;
+	if (st.st_mtime != w->mtime_sec || ST_MTIME_NSEC(&st) != w->mtime_nsec)
+		_watch_reply(w, TNFS_WATCH_CHANGED);
+}
+
+int watch_held(Session *s, Header *hdr)
+{
+	int i;
+
+	for (i = 0; i < WATCH_MAX && nheld > 0; i++)
+	{
+		if (held[i].s != s)
+			continue;
+		if (held[i].hdr.seqno == hdr->seqno && held[i].hdr.cmd == hdr->cmd)
+		{
+			held[i].hdr.port = hdr->port;
+			return 1;
+		}
+		/* a late copy of the request before */
+		if (hdr->seqno == s->lastseqno)
+			return 0;
+		_watch_release(&held[i]);
+		return 0;
+	}
+	return 0;
+}
+
+void watch_cancel(Session *s)
+{
+	int i;
+
+	for (i = 0; i < WATCH_MAX && nheld > 0; i++)
+	{
+		if (held[i].s == s)
+			_watch_release(&held[i]);
+	}
+}
+
+void watch_check()
+{
+	time_t now;
+	int i, poll;
+
+	/* those finished since last time no longer need notification */
+	for (i = 0; i < WATCH_MAX && nsubscribed > nheld; i++)
+	{
+		if (held[i].s == NULL)
+			_watch_unsubscribe(&held[i]);
+	}
+
+	if (nheld == 0)
+		return;
+	now = time(NULL);
+	poll = now != lastpoll;
+	lastpoll = now;
+
+	for (i = 0; i < WATCH_MAX && nheld > 0; i++)
+	{
+		if (held[i].s == NULL)
+			continue;
+		if (held[i].polled && poll && _watch_moved(&held[i]))
+			_watch_reply(&held[i], TNFS_WATCH_CHANGED);
+		else if (now >= held[i].until)
+			_watch_reply(&held[i], TNFS_WATCH_TIMEOUT);
+	}
+}
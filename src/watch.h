@@ -0,0 +1,56 @@
+#ifndef _TNFS_WATCH_H
+#define _TNFS_WATCH_H
+
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon directory change notification for clients
+ *
+ * */
+
+#include "tnfs.h"
+
+/* A WATCH request is held without a reply until the directory it names
+ * changes, or for as long as the client asked to wait. Retransmits of it
+ * are absorbed meanwhile, and any other request from the session lets it
+ * go unanswered, since the client has given up on it. A session with a
+ * window runs later requests while it waits instead */
+
+#define TNFS_WATCH_TIMEOUT 0x00
+#define TNFS_WATCH_CHANGED 0x01
+
+void tnfs_watch(Header *hdr, Session *s, unsigned char *buf, int bufsz);
+
+/* Returns 1 if hdr is a retransmit of the WATCH s is waiting on, which
+ * needs no reply yet. Otherwise s stops waiting */
+int watch_held(Session *s, Header *hdr);
+
+/* Forget any WATCH s is waiting on, before the session or its TCP
+ * connection goes */
+void watch_cancel(Session *s);
+
+/* Answer WATCHes that have waited long enough, or whose directory has
+ * changed where there's no change notification. Called from the main
+ * loop */
+void watch_check();
+
+#endif
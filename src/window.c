@@ -0,0 +1,231 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * TNFS daemon request pipelining over UDP
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "tnfs.h"
+#include "window.h"
+#include "datagram.h"
+#include "errortable.h"
+#include "log.h"
+
+typedef struct _window_req
+{
+	Header hdr;
+	unsigned char *data;	/* NULL if none is waiting */
+	int datasz;
+} window_req;
+
+struct _window
+{
+	int size;			/* requests the client may have outstanding, a power of 2 */
+	uint8_t next;		/* seqno of the next request to run */
+	int slotsz;			/* bytes each reply may take */
+	unsigned char *tx;	/* replies, slotsz bytes each, by seqno */
+	int txlen[WINDOW_MAX];	/* length of each, 0 until it's sent */
+	uint8_t txseq[WINDOW_MAX];	/* seqno each is the reply to */
+	window_req rx[WINDOW_MAX];	/* requests waiting for an earlier one */
+};
+
+void window_free(Session *s)
+{
+	struct _window *w = s->window;
+	int i;
+
+	if (w == NULL)
+		return;
+	for (i = 0; i < w->size; i++)
+		free(w->rx[i].data);
+	free(w->tx);
+	free(w);
+	s->window = NULL;
+}
+
+unsigned char *window_reply(Session *s, uint8_t seqno)
+{
+	struct _window *w = s->window;
+	int slot = seqno & (w->size - 1);
+
+	w->txseq[slot] = seqno;
+	w->txlen[slot] = 0;
+	return w->tx + slot * w->slotsz;
+}
+
+void window_replied(Session *s, uint8_t seqno, int len)
+{
+	struct _window *w = s->window;
+
+	w->txlen[seqno & (w->size - 1)] = len;
+}
+
+void _window_hold(struct _window *w, Header *hdr,
+	unsigned char *databuf, int datasz)
+{
+	window_req *r = &w->rx[hdr->seqno & (w->size - 1)];
+
+	/* already waiting, this is a retransmit of it */
+	if (r->data != NULL)
+		return;
+	/* if there's no memory for it, the client will send it again */
+	r->data = malloc(datasz > 0 ? datasz : 1);
+	if (r->data == NULL)
+		return;
+	memcpy(r->data, databuf, datasz);
+	r->datasz = datasz;
+	r->hdr = *hdr;
+}
+
+void _window_drop(struct _window *w)
+{
+	int i;
+
+	for (i = 0; i < w->size; i++)
+	{
+		free(w->rx[i].data);
+		w->rx[i].data = NULL;
+	}
+}
+
+void window_decode(Session *s, int sindex, Header *hdr,
+	struct sockaddr_in *cliaddr, unsigned char *databuf, int datasz)
+{
+	struct _window *w = s->window;
+	uint8_t ahead = hdr->seqno - w->next;
+	uint8_t behind = w->next - hdr->seqno;
+	unsigned char *held = NULL;
+	window_req *r;
+	Header run;
+	int slot;
+
+	/* a request the client sent again, answered again once it has been
+	   answered at all */
+	if (behind >= 1 && behind <= w->size)
+	{
+		slot = hdr->seqno & (w->size - 1);
+		if (w->txseq[slot] == hdr->seqno && w->txlen[slot] > 0)
+			tnfs_retransmit(cliaddr, hdr->cli_fd,
+				w->tx + slot * w->slotsz, w->txlen[slot]);
+		return;
+	}
+
+	/* one sent before it hasn't arrived yet */
+	if (ahead > 0 && ahead < w->size)
+	{
+		_window_hold(w, hdr, databuf, datasz);
+		return;
+	}
+
+	/* anything else means the client has lost track of what it sent,
+	   and starts again from this one */
+	if (ahead != 0)
+	{
+		TNFSMSGLOG(hdr, "Request is outside the window, expected seqno %d",
+			w->next);
+		_window_drop(w);
+	}
+
+	run = *hdr;
+	for (;;)
+	{
+		w->next = run.seqno + 1;
+		window_reply(s, run.seqno);
+
+		/* these leave the window behind, with anything waiting in it */
+		if (run.cmd == TNFS_UMOUNT || run.cmd == TNFS_WINDOW)
+		{
+			tnfs_dispatch(&run, s, sindex, databuf, datasz);
+			free(held);
+			return;
+		}
+		tnfs_dispatch(&run, s, sindex, databuf, datasz);
+		free(held);
+
+		/* run whatever was waiting for it */
+		r = &w->rx[w->next & (w->size - 1)];
+		if (r->data == NULL || r->hdr.seqno != w->next)
+			return;
+		run = r->hdr;
+		held = databuf = r->data;
+		datasz = r->datasz;
+		r->data = NULL;
+	}
+}
+
+void tnfs_window(Header *hdr, Session *s, unsigned char *buf, int bufsz)
+{
+	unsigned char reply[1];
+	struct _window *w;
+	int size;
+
+	if (bufsz < 1)
+	{
+		hdr->status = TNFS_EINVAL;
+		tnfs_send(s, hdr, NULL, 0);
+		return;
+	}
+
+	/* TCP already delivers requests in order and without loss; there
+	   the window stays at 1 */
+	size = hdr->cli_fd == 0 ? *buf : 1;
+	if (size > WINDOW_MAX)
+		size = WINDOW_MAX;
+	/* a power of 2, so that replies are kept in the same place however
+	   the sequence number wraps */
+	while (size & (size - 1))
+		size &= size - 1;
+
+	window_free(s);
+	if (size > 1)
+	{
+		w = calloc(1, sizeof(struct _window));
+		if (w != NULL)
+			w->tx = malloc(size * s->maxmsgsz);
+		if (w == NULL || w->tx == NULL)
+		{
+			free(w);
+			hdr->status = TNFS_ENOMEM;
+			tnfs_send(s, hdr, NULL, 0);
+			return;
+		}
+		w->size = size;
+		w->slotsz = s->maxmsgsz;
+		w->next = hdr->seqno + 1;
+		s->window = w;
+	}
+	else
+		size = 1;
+
+#ifdef DEBUG
+	TNFSMSGLOG(hdr, "Window of %d requests", size);
+#endif
+	reply[0] = (unsigned char)size;
+	hdr->status = TNFS_SUCCESS;
+	tnfs_send(s, hdr, reply, sizeof(reply));
+}
@@ -0,0 +1,52 @@
+#ifndef _TNFS_WINDOW_H
+#define _TNFS_WINDOW_H
+
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * TNFS daemon request pipelining over UDP
+ *
+ * */
+
+#include "tnfs.h"
+
+/* After WINDOW a session may have several requests outstanding. The
+ * reply to each is kept under its sequence number, so a retransmit of
+ * any request in the window is answered again, and a request arriving
+ * ahead of one that was lost waits for it, so requests still run in the
+ * order the client sent them */
+
+void tnfs_window(Header *hdr, Session *s, unsigned char *buf, int bufsz);
+
+/* Run, hold or answer again a request to a session with a window */
+void window_decode(Session *s, int sindex, Header *hdr,
+	struct sockaddr_in *cliaddr, unsigned char *databuf, int datasz);
+
+/* Where the reply to seqno is put together and kept, maxmsgsz bytes,
+ * and how long it turned out */
+unsigned char *window_reply(Session *s, uint8_t seqno);
+void window_replied(Session *s, uint8_t seqno, int len);
+
+void window_free(Session *s);
+
+#endif
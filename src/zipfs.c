@@ -0,0 +1,774 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon ZIP archives as directories
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#endif
+
+#include "config.h"
+#include "zipfs.h"
+#include "zseek.h"
+#include "resolve.h"
+#include "directory.h"
+#include "fileinfo.h"
+#include "endian.h"
+#include "bsdcompat.h"
+#include "log.h"
+
+#define ZIP_EOCD_SIG 0x06054b50
+#define ZIP_EOCD_SIZE 22
+#define ZIP64_LOCATOR_SIG 0x07064b50
+#define ZIP64_LOCATOR_SIZE 20
+#define ZIP64_EOCD_SIG 0x06064b50
+#define ZIP64_EOCD_SIZE 56
+#define ZIP_CENTRAL_SIG 0x02014b50
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_LOCAL_SIG 0x04034b50
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_MAX_COMMENT 65535
+#define ZIP_MAX_CENTRAL (256 * 1024 * 1024)	/* refuse central directories bigger than this */
+
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+#define ZIP_ENCRYPTED 0x0001
+
+typedef struct _zipfs_entry
+{
+	const char *name;		/* as in the archive without a trailing slash */
+	uint64_t compsize;
+	uint64_t size;
+	uint64_t offset;		/* of its local header */
+	time_t mtime;
+	uint16_t method;
+	uint16_t flags;
+	uint8_t isdir;
+} zipfs_entry;
+
+/* The index of an archive's central directory */
+typedef struct _zipfs_archive
+{
+	dev_t dev;				/* the file it was read from, as it was */
+	ino_t ino;
+	time_t mtime;
+	off_t size;
+	uid_t uid;
+	gid_t gid;
+	zipfs_entry *entries;	/* sorted by _zipfs_compare() */
+	uint32_t count;
+	char *names;
+	int refs;				/* open directories, plus one while cached */
+	struct _zipfs_archive *next;	/* most recently used first */
+} zipfs_archive;
+
+typedef struct _zipfs_file
+{
+	int fd;					/* on the archive */
+	off_t data;				/* where the member's data starts */
+	zseek *z;				/* for a deflated member */
+} zipfs_file;
+
+typedef struct _zipfs_dir
+{
+	zipfs_archive *archive;
+	char member[MAX_FILEPATH];	/* "" for the top of the archive */
+} zipfs_dir;
+
+/* the cache of indexes, shared with the worker threads under ziplock */
+static zipfs_archive *archives = NULL;
+static int archivecount = 0;
+
+#ifdef ENABLE_THREADS
+static pthread_mutex_t ziplock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void _zipfs_lock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_lock(&ziplock);
+#endif
+}
+
+void _zipfs_unlock()
+{
+#ifdef ENABLE_THREADS
+	pthread_mutex_unlock(&ziplock);
+#endif
+}
+
+uint64_t _zip64(unsigned char *p)
+{
+	return (uint64_t)tnfs32uint(p) | ((uint64_t)tnfs32uint(p + 4) << 32);
+}
+
+/* Names compare with '/' before anything else, so everything below a
+   directory comes straight after the directory itself */
+int _zipfs_strcmp(const char *a, const char *b)
+{
+	unsigned char ca, cb;
+
+	for (;; a++, b++)
+	{
+		ca = *a == '/' ? 1 : (unsigned char)*a;
+		cb = *b == '/' ? 1 : (unsigned char)*b;
+		if (ca != cb || ca == 0)
+			return ca - cb;
+	}
+}
+
+int _zipfs_compare(const void *a, const void *b)
+{
+	return _zipfs_strcmp(((const zipfs_entry *)a)->name, ((const zipfs_entry *)b)->name);
+}
+
+/* The first entry at or after name */
+uint32_t _zipfs_lower(const zipfs_archive *a, const char *name)
+{
+	uint32_t lo = 0, hi = a->count, mid;
+
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (_zipfs_strcmp(a->entries[mid].name, name) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+time_t _zipfs_dostime(uint16_t time, uint16_t date)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_sec = (time & 0x1f) * 2;
+	tm.tm_min = (time >> 5) & 0x3f;
+	tm.tm_hour = time >> 11;
+	tm.tm_mday = date & 0x1f;
+	tm.tm_mon = ((date >> 5) & 0x0f) - 1;
+	tm.tm_year = (date >> 9) + 80;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+/* Find the central directory from the end of the archive */
+int _zipfs_central(int fd, off_t size, off_t *cdoffset, uint64_t *cdsize, uint64_t *count)
+{
+	unsigned char *tail, *p;
+	unsigned char z64[ZIP64_EOCD_SIZE];
+	size_t tailsize = size < ZIP_EOCD_SIZE + ZIP_MAX_COMMENT + ZIP64_LOCATOR_SIZE ?
+					  size : ZIP_EOCD_SIZE + ZIP_MAX_COMMENT + ZIP64_LOCATOR_SIZE;
+	int result = -1;
+
+	if (tailsize < ZIP_EOCD_SIZE || (tail = malloc(tailsize)) == NULL)
+		return -1;
+	if (pread(fd, tail, tailsize, size - tailsize) != (ssize_t)tailsize)
+		goto done;
+
+	for (p = tail + tailsize - ZIP_EOCD_SIZE; p >= tail; p--)
+	{
+		if (tnfs32uint(p) == ZIP_EOCD_SIG)
+			break;
+	}
+	if (p < tail)
+		goto done;
+
+	*count = tnfs16uint(p + 10);
+	*cdsize = tnfs32uint(p + 12);
+	*cdoffset = tnfs32uint(p + 16);
+
+	/* too big for the fields: look for the ZIP64 record */
+	if (*count == 0xffff || *cdsize == 0xffffffff || *cdoffset == 0xffffffff)
+	{
+		p -= ZIP64_LOCATOR_SIZE;
+		if (p < tail || tnfs32uint(p) != ZIP64_LOCATOR_SIG ||
+			pread(fd, z64, sizeof(z64), (off_t)_zip64(p + 8)) != sizeof(z64) ||
+			tnfs32uint(z64) != ZIP64_EOCD_SIG)
+			goto done;
+		*count = _zip64(z64 + 32);
+		*cdsize = _zip64(z64 + 40);
+		*cdoffset = (off_t)_zip64(z64 + 48);
+	}
+
+	if (*cdoffset >= 0 && (uint64_t)*cdoffset + *cdsize <= (uint64_t)size && *cdsize <= ZIP_MAX_CENTRAL)
+		result = 0;
+
+done:
+	free(tail);
+	return result;
+}
+
+void _zipfs_free(zipfs_archive *a)
+{
+	free(a->entries);
+	free(a->names);
+	free(a);
+}
+
+/* Read an archive's central directory into an index */
+zipfs_archive *_zipfs_read(int fd, const struct stat *st)
+{
+	zipfs_archive *a;
+	unsigned char *cd = NULL, *p, *end, *x, *xend;
+	uint64_t cdsize, count, i;
+	off_t cdoffset;
+	char *name, *n;
+	size_t namelen, xlen, clen;
+	zipfs_entry *e;
+
+	if (_zipfs_central(fd, st->st_size, &cdoffset, &cdsize, &count) < 0)
+	{
+		errno = EIO;
+		return NULL;
+	}
+	if ((a = calloc(1, sizeof(zipfs_archive))) == NULL)
+		return NULL;
+	a->dev = st->st_dev;
+	a->ino = st->st_ino;
+	a->mtime = st->st_mtime;
+	a->size = st->st_size;
+	a->uid = st->st_uid;
+	a->gid = st->st_gid;
+
+	/* every entry takes at least ZIP_CENTRAL_SIZE bytes */
+	if (count > cdsize / ZIP_CENTRAL_SIZE)
+	{
+		free(a);
+		errno = EIO;
+		return NULL;
+	}
+	if ((cd = malloc(cdsize ? cdsize : 1)) == NULL ||
+		(a->entries = malloc((count ? count : 1) * sizeof(zipfs_entry))) == NULL ||
+		(a->names = malloc(cdsize + 1)) == NULL)
+		goto fail;
+	if (pread(fd, cd, cdsize, cdoffset) != (ssize_t)cdsize)
+		goto fail;
+
+	name = a->names;
+	end = cd + cdsize;
+	for (p = cd, i = 0; i < count && p + ZIP_CENTRAL_SIZE <= end; i++)
+	{
+		if (tnfs32uint(p) != ZIP_CENTRAL_SIG)
+			break;
+		namelen = tnfs16uint(p + 28);
+		xlen = tnfs16uint(p + 30);
+		clen = tnfs16uint(p + 32);
+		if (p + ZIP_CENTRAL_SIZE + namelen + xlen + clen > end)
+			break;
+
+		e = &a->entries[a->count];
+		e->flags = tnfs16uint(p + 8);
+		e->method = tnfs16uint(p + 10);
+		e->mtime = _zipfs_dostime(tnfs16uint(p + 12), tnfs16uint(p + 14));
+		e->compsize = tnfs32uint(p + 20);
+		e->size = tnfs32uint(p + 24);
+		e->offset = tnfs32uint(p + 42);
+
+		/* sizes and offset too big for their fields are in the ZIP64 extra field */
+		x = p + ZIP_CENTRAL_SIZE + namelen;
+		for (xend = x + xlen; x + 4 <= xend; x += 4 + tnfs16uint(x + 2))
+		{
+			unsigned char *f = x + 4, *fend = f + tnfs16uint(x + 2);
+			if (tnfs16uint(x) != 0x0001 || fend > xend)
+				continue;
+			if (e->size == 0xffffffff && f + 8 <= fend)
+				e->size = _zip64(f), f += 8;
+			if (e->compsize == 0xffffffff && f + 8 <= fend)
+				e->compsize = _zip64(f), f += 8;
+			if (e->offset == 0xffffffff && f + 8 <= fend)
+				e->offset = _zip64(f);
+		}
+
+		/* names are kept relative to the top of the archive, and
+		   without the slash that marks a directory */
+		memcpy(name, p + ZIP_CENTRAL_SIZE, namelen);
+		name[namelen] = 0;
+		p += ZIP_CENTRAL_SIZE + namelen + xlen + clen;
+		e->isdir = namelen > 0 && name[namelen - 1] == '/';
+		for (n = name + namelen; n > name && n[-1] == '/'; n--)
+			n[-1] = 0;
+		for (e->name = name; *e->name == '/'; e->name++)
+			;
+		name += namelen + 1;
+		if (*e->name != 0)
+			a->count++;
+	}
+	free(cd);
+
+	/* the central directory ended before all the entries it should hold */
+	if (i < count)
+	{
+		_zipfs_free(a);
+		errno = EIO;
+		return NULL;
+	}
+
+	qsort(a->entries, a->count, sizeof(zipfs_entry), _zipfs_compare);
+	return a;
+
+fail:
+	free(cd);
+	free(a->entries);
+	free(a->names);
+	free(a);
+	errno = ENOMEM;
+	return NULL;
+}
+
+void _zipfs_release(zipfs_archive *a)
+{
+	int refs;
+
+	if (a == NULL)
+		return;
+	_zipfs_lock();
+	refs = --a->refs;
+	_zipfs_unlock();
+	if (refs == 0)
+		_zipfs_free(a);
+}
+
+/* Take the cache's reference from an archive it no longer holds.
+   Returns it if that was the last, to be freed without the lock */
+zipfs_archive *_zipfs_uncache(zipfs_archive *a)
+{
+	archivecount--;
+	return --a->refs == 0 ? a : NULL;
+}
+
+/* The index of the archive open on fd, read again if the archive has
+   changed since. Returns it with a reference for the caller */
+zipfs_archive *_zipfs_index(int fd)
+{
+	zipfs_archive *a, *n, *old = NULL, **pp;
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+		return NULL;
+
+	_zipfs_lock();
+	for (pp = &archives; (a = *pp) != NULL; pp = &a->next)
+	{
+		if (a->dev == st.st_dev && a->ino == st.st_ino)
+		{
+			*pp = a->next;
+			if (a->mtime != st.st_mtime || a->size != st.st_size)
+			{
+				old = _zipfs_uncache(a);
+				a = NULL;
+			}
+			else
+				archivecount--;
+			break;
+		}
+	}
+	if (a != NULL)
+	{
+		a->next = archives;
+		archives = a;
+		archivecount++;
+		a->refs++;
+		_zipfs_unlock();
+		return a;
+	}
+	_zipfs_unlock();
+	if (old != NULL)
+		_zipfs_free(old);
+
+	/* reading the central directory may take a while */
+	if ((n = _zipfs_read(fd, &st)) == NULL)
+		return NULL;
+#ifdef DEBUG
+	fprintf(stderr, "zipfs: indexed %u members\n", n->count);
+#endif
+	n->refs = 2;
+
+	_zipfs_lock();
+	/* another thread may have read it meanwhile, which will do */
+	for (a = archives; a != NULL; a = a->next)
+	{
+		if (a->dev == n->dev && a->ino == n->ino &&
+			a->mtime == n->mtime && a->size == n->size)
+		{
+			a->refs++;
+			_zipfs_unlock();
+			_zipfs_free(n);
+			return a;
+		}
+	}
+
+	/* make room by forgetting the least recently used */
+	old = NULL;
+	if (archivecount >= ZIPCACHE_MAX)
+	{
+		for (pp = &archives; (*pp)->next != NULL; pp = &(*pp)->next)
+			;
+		old = _zipfs_uncache(*pp);
+		*pp = NULL;
+	}
+	n->next = archives;
+	archives = n;
+	archivecount++;
+	_zipfs_unlock();
+	if (old != NULL)
+		_zipfs_free(old);
+	return n;
+}
+
+/* Open the archive a client path leads into, copying the rest of the
+   path to member. Returns the archive's descriptor, -1 with errno set,
+   or -2 if the path doesn't lead into an archive */
+int _zipfs_split(Session *s, const char *path, char *member, size_t membersz)
+{
+	char archive[MAX_FILEPATH];
+	const char *p, *end;
+	struct stat st;
+	size_t n, len;
+	int fd;
+
+	for (p = path; *p; p = end)
+	{
+		while (*p == '/')
+			p++;
+		end = p + strcspn(p, "/");
+		if (end - p <= 4 || strncasecmp(end - 4, ".zip", 4) != 0)
+			continue;
+
+		if (end - path >= (int)sizeof(archive))
+		{
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		memcpy(archive, path, end - path);
+		archive[end - path] = 0;
+		if ((fd = resolve_open(s, archive, O_RDONLY, 0)) < 0)
+			return errno == ENOENT ? -2 : -1;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+			break;
+		/* a directory that just happens to be called .zip */
+		close(fd);
+	}
+	if (*p == 0)
+		return -2;
+
+	/* the rest, without empty or "." components */
+	for (n = 0, p = end; *p; p += len)
+	{
+		while (*p == '/')
+			p++;
+		len = strcspn(p, "/");
+		if (len == 0 || (len == 1 && p[0] == '.'))
+			continue;
+		if ((len == 2 && p[0] == '.' && p[1] == '.') || n + len + 2 > membersz)
+		{
+			close(fd);
+			errno = ENOENT;
+			return -1;
+		}
+		if (n > 0)
+			member[n++] = '/';
+		memcpy(member + n, p, len);
+		n += len;
+	}
+	member[n] = 0;
+	return fd;
+}
+
+/* The entry for member, or NULL if it has none. *isdir is set if it's a
+   directory, whether or not it has an entry of its own */
+const zipfs_entry *_zipfs_lookup(const zipfs_archive *a, const char *member, int *isdir)
+{
+	size_t len = strlen(member);
+	const zipfs_entry *e;
+	uint32_t i;
+
+	*isdir = len == 0;
+	if (len == 0)
+		return NULL;
+
+	i = _zipfs_lower(a, member);
+	if (i < a->count && strcmp(a->entries[i].name, member) == 0)
+	{
+		e = &a->entries[i];
+		*isdir = e->isdir || (i + 1 < a->count &&
+							  strncmp(a->entries[i + 1].name, member, len) == 0 &&
+							  a->entries[i + 1].name[len] == '/');
+		return e;
+	}
+
+	/* a directory can be implied by the names below it alone */
+	*isdir = i < a->count && strncmp(a->entries[i].name, member, len) == 0 &&
+			 a->entries[i].name[len] == '/';
+	return NULL;
+}
+
+int _zipfs_open(Session *s, const char *path, vfs_file *f)
+{
+	char member[MAX_FILEPATH];
+	unsigned char local[ZIP_LOCAL_SIZE];
+	const zipfs_entry *e;
+	zipfs_archive *a;
+	zipfs_file *zf;
+	uint64_t data;
+	int fd, isdir, err = 0;
+
+	if ((fd = _zipfs_split(s, path, member, sizeof(member))) == -2)
+		return 1;
+	if (fd < 0)
+		return -1;
+	if ((a = _zipfs_index(fd)) == NULL)
+	{
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	e = _zipfs_lookup(a, member, &isdir);
+	if (isdir)
+		err = EISDIR;
+	else if (e == NULL)
+		err = ENOENT;
+	else if (e->flags & ZIP_ENCRYPTED)
+		err = EACCES;
+	else if (e->method != ZIP_STORED && e->method != ZIP_DEFLATED)
+		err = EIO;
+	else if (pread(fd, local, sizeof(local), (off_t)e->offset) != sizeof(local) ||
+			 tnfs32uint(local) != ZIP_LOCAL_SIG)
+		err = EIO;
+	else if ((data = e->offset + ZIP_LOCAL_SIZE + tnfs16uint(local + 26) + tnfs16uint(local + 28)) > (uint64_t)a->size ||
+			 e->compsize > (uint64_t)a->size - data)
+		err = EIO;		/* it would run off the end of the archive */
+	else if ((zf = calloc(1, sizeof(zipfs_file))) == NULL)
+		err = ENOMEM;
+	else
+	{
+		zf->fd = fd;
+		zf->data = data;
+		if (e->method == ZIP_DEFLATED &&
+			(zf->z = zseek_new(fd, zf->data, e->compsize, e->size)) == NULL)
+		{
+			free(zf);
+			err = ENOMEM;
+		}
+		else
+		{
+			f->handle = zf;
+			f->size = e->size;
+		}
+	}
+
+	_zipfs_release(a);
+	if (err)
+	{
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+ssize_t _zipfs_pread(vfs_file *f, void *buf, size_t count, uint64_t offset)
+{
+	zipfs_file *zf = (zipfs_file *)f->handle;
+
+	if (zf->z)
+		return zseek_pread(zf->z, buf, count, offset);
+	return pread(zf->fd, buf, count, zf->data + offset);
+}
+
+void _zipfs_close(vfs_file *f)
+{
+	zipfs_file *zf = (zipfs_file *)f->handle;
+
+	zseek_free(zf->z);
+	close(zf->fd);
+	free(zf);
+}
+
+int _zipfs_stat(Session *s, const char *path, struct stat *st)
+{
+	char member[MAX_FILEPATH];
+	const zipfs_entry *e;
+	zipfs_archive *a;
+	int fd, isdir, err = 0;
+
+	if ((fd = _zipfs_split(s, path, member, sizeof(member))) == -2)
+		return 1;
+	if (fd < 0)
+		return -1;
+	a = _zipfs_index(fd);
+	err = errno;
+	close(fd);
+	if (a == NULL)
+	{
+		errno = err;
+		return -1;
+	}
+
+	e = _zipfs_lookup(a, member, &isdir);
+	memset(st, 0, sizeof(struct stat));
+	st->st_nlink = 1;
+	st->st_uid = a->uid;
+	st->st_gid = a->gid;
+	st->st_mtime = e ? e->mtime : a->mtime;
+	st->st_atime = st->st_ctime = st->st_mtime;
+	if (isdir)
+		st->st_mode = S_IFDIR | 0555;
+	else if (e != NULL)
+	{
+		st->st_mode = S_IFREG | 0444;
+		st->st_size = e->size;
+	}
+	else
+		err = ENOENT;
+
+	_zipfs_release(a);
+	if (!isdir && e == NULL)
+	{
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+int _zipfs_opendir(Session *s, const char *path, vfs_dir *d)
+{
+	zipfs_dir *zd;
+	const zipfs_entry *e;
+	int fd, isdir, err;
+
+	if ((zd = malloc(sizeof(zipfs_dir))) == NULL)
+		return -1;
+	if ((fd = _zipfs_split(s, path, zd->member, sizeof(zd->member))) < 0)
+	{
+		free(zd);
+		return fd == -2 ? 1 : -1;
+	}
+	zd->archive = _zipfs_index(fd);
+	err = errno;
+	close(fd);
+	if (zd->archive == NULL)
+	{
+		free(zd);
+		errno = err;
+		return -1;
+	}
+
+	e = _zipfs_lookup(zd->archive, zd->member, &isdir);
+	if (!isdir)
+	{
+		_zipfs_release(zd->archive);
+		free(zd);
+		errno = e ? ENOTDIR : ENOENT;
+		return -1;
+	}
+	d->handle = zd;
+	return 0;
+}
+
+/* List what's directly below the directory, whether it has an entry of
+   its own or is just implied by the names of what's in it */
+int _zipfs_loaddir(vfs_dir *d, dir_listing *listing)
+{
+	zipfs_dir *zd = (zipfs_dir *)d->handle;
+	const zipfs_archive *a = zd->archive;
+	const zipfs_entry *e;
+	directory_entry *entry;
+	char name[MAX_FILENAME_LEN];
+	size_t len = strlen(zd->member), namelen;
+	const char *rest;
+	uint32_t i;
+	bool isdir;
+
+	name[0] = 0;
+	for (i = len ? _zipfs_lower(a, zd->member) : 0; i < a->count; i++)
+	{
+		e = &a->entries[i];
+		rest = e->name;
+		if (len)
+		{
+			/* everything below comes straight after the directory */
+			if (strncmp(rest, zd->member, len) != 0 || (rest[len] != 0 && rest[len] != '/'))
+				break;
+			if (rest[len] == 0)
+				continue;
+			rest += len + 1;
+		}
+
+		namelen = strcspn(rest, "/");
+		if (namelen == 0 || namelen >= sizeof(name) ||
+			(strncmp(name, rest, namelen) == 0 && name[namelen] == 0))
+			continue;
+		memcpy(name, rest, namelen);
+		name[namelen] = 0;
+
+		if ((entry = dirlist_add(listing, name)) == NULL)
+			return ENOMEM;
+		isdir = e->isdir || rest[namelen] == '/';
+		if (isdir)
+			entry->flags |= FILEINFOFLAG_DIRECTORY;
+		if (name[0] == '.')
+			entry->flags |= FILEINFOFLAG_HIDDEN;
+		if (!isdir)
+			entry->size = e->size > 0xffffffff ? 0xffffffff : e->size;
+		entry->mtime = entry->ctime = rest[namelen] == '/' ? a->mtime : e->mtime;
+	}
+	return 0;
+}
+
+void _zipfs_closedir(vfs_dir *d)
+{
+	zipfs_dir *zd = (zipfs_dir *)d->handle;
+
+	_zipfs_release(zd->archive);
+	free(zd);
+}
+
+const vfs_provider zipfs_provider = {
+	"zip",
+	_zipfs_open,
+	_zipfs_pread,
+	NULL,
+	NULL,
+	_zipfs_close,
+	_zipfs_stat,
+	_zipfs_opendir,
+	_zipfs_loaddir,
+	_zipfs_closedir,
+	NULL,
+	NULL
+};
@@ -0,0 +1,312 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon random access to deflate streams
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "config.h"
+#include "zseek.h"
+
+#define ZSEEK_WINDOW 32768	/* the furthest back deflate can refer */
+#define ZSEEK_INBUF 16384
+
+#if ZSEEK_SPAN < ZSEEK_WINDOW
+#error ZSEEK_SPAN must be at least 32K
+#endif
+
+typedef struct _zseek_point
+{
+	uint64_t out;			/* offset in the output */
+	off_t in;				/* offset in the file of the next whole byte */
+	int bits;				/* bits of the byte before in not yet used */
+	unsigned char *window;	/* the output just before out, NULL at the start */
+} zseek_point;
+
+typedef struct _zseek_chunk
+{
+	uint32_t point;			/* the checkpoint it starts at */
+	unsigned char *data;	/* NULL if the slot is unused */
+	size_t size;
+	uint32_t used;			/* when last read */
+} zseek_chunk;
+
+struct _zseek
+{
+	int fd;
+	off_t end;				/* just past the stream in the file */
+	uint64_t size;
+	zseek_point *points;	/* in order of output offset */
+	uint32_t npoints;
+	uint32_t pointcap;
+	int complete;			/* the last checkpoint's chunk ends the stream */
+	zseek_chunk chunks[ZSEEK_CHUNKS];
+	uint32_t clock;
+};
+
+zseek *zseek_new(int fd, off_t start, off_t compsize, uint64_t size)
+{
+	zseek *z;
+
+	if ((z = calloc(1, sizeof(zseek))) == NULL)
+		return NULL;
+	if ((z->points = malloc(16 * sizeof(zseek_point))) == NULL)
+	{
+		free(z);
+		return NULL;
+	}
+	z->fd = fd;
+	z->end = start + compsize;
+	z->size = size;
+	z->pointcap = 16;
+	z->npoints = 1;
+	z->points[0].out = 0;
+	z->points[0].in = start;
+	z->points[0].bits = 0;
+	z->points[0].window = NULL;
+	return z;
+}
+
+void zseek_free(zseek *z)
+{
+	uint32_t i;
+
+	if (z == NULL)
+		return;
+	for (i = 0; i < z->npoints; i++)
+		free(z->points[i].window);
+	for (i = 0; i < ZSEEK_CHUNKS; i++)
+		free(z->chunks[i].data);
+	free(z->points);
+	free(z);
+}
+
+/* Record where the next chunk starts, with the history it needs */
+int _zseek_addpoint(zseek *z, uint64_t out, off_t in, int bits, const unsigned char *history)
+{
+	zseek_point *pt;
+
+	if (z->npoints == z->pointcap)
+	{
+		zseek_point *n = realloc(z->points, z->pointcap * 2 * sizeof(zseek_point));
+		if (n == NULL)
+			return -1;
+		z->points = n;
+		z->pointcap *= 2;
+	}
+	pt = &z->points[z->npoints];
+	if ((pt->window = malloc(ZSEEK_WINDOW)) == NULL)
+		return -1;
+	memcpy(pt->window, history, ZSEEK_WINDOW);
+	pt->out = out;
+	pt->in = in;
+	pt->bits = bits;
+	z->npoints++;
+	return 0;
+}
+
+/* Inflate from checkpoint p to the next one into chunk, adding the next
+   checkpoint if it's the furthest yet. Returns -1 with errno set if the
+   stream can't be read */
+int _zseek_inflate(zseek *z, uint32_t p, zseek_chunk *chunk)
+{
+	z_stream strm;
+	unsigned char in[ZSEEK_INBUF];
+	unsigned char *out, *grown;
+	size_t outsize = 0, outcap = ZSEEK_SPAN + ZSEEK_WINDOW;
+	uint64_t startout = z->points[p].out;
+	off_t pos = z->points[p].in;
+	int bits = z->points[p].bits;
+	ssize_t n;
+	int ret;
+
+	memset(&strm, 0, sizeof(strm));
+	if ((out = malloc(outcap)) == NULL)
+		return -1;
+	if (inflateInit2(&strm, -MAX_WBITS) != Z_OK)
+	{
+		free(out);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* pick up partway through a byte, with the history it may refer to */
+	if (bits)
+	{
+		if (pread(z->fd, in, 1, pos - 1) != 1)
+			goto fail;
+		inflatePrime(&strm, bits, in[0] >> (8 - bits));
+	}
+	if (z->points[p].window)
+		inflateSetDictionary(&strm, z->points[p].window, ZSEEK_WINDOW);
+
+	for (;;)
+	{
+		if (strm.avail_in == 0)
+		{
+			n = z->end - pos < (off_t)sizeof(in) ? z->end - pos : (off_t)sizeof(in);
+			if (n <= 0 || (n = pread(z->fd, in, n, pos)) <= 0)
+				goto fail;
+			pos += n;
+			strm.next_in = in;
+			strm.avail_in = n;
+		}
+		if (outsize == outcap)
+		{
+			if ((grown = realloc(out, outcap * 2)) == NULL)
+				goto fail;
+			out = grown;
+			outcap *= 2;
+		}
+		strm.next_out = out + outsize;
+		strm.avail_out = outcap - outsize;
+
+		/* Z_BLOCK stops at the end of every deflate block */
+		ret = inflate(&strm, Z_BLOCK);
+		outsize = outcap - strm.avail_out;
+		/* it stops after the last block without getting to the end */
+		if (ret == Z_STREAM_END || (ret == Z_OK && (strm.data_type & 192) == 192))
+		{
+			if (p + 1 == z->npoints)
+			{
+				z->complete = 1;
+				z->size = startout + outsize;
+			}
+			break;
+		}
+		if (ret != Z_OK)
+			goto fail;
+		if ((strm.data_type & 128) && !(strm.data_type & 64) && outsize >= ZSEEK_SPAN)
+		{
+			/* a block boundary far enough on to start the next chunk */
+			if (p + 1 == z->npoints &&
+				_zseek_addpoint(z, startout + outsize, pos - strm.avail_in,
+								strm.data_type & 7, out + outsize - ZSEEK_WINDOW) < 0)
+				goto fail;
+			break;
+		}
+	}
+
+	inflateEnd(&strm);
+	chunk->point = p;
+	chunk->data = out;
+	chunk->size = outsize;
+	return 0;
+
+fail:
+	inflateEnd(&strm);
+	free(out);
+	errno = EIO;
+	return -1;
+}
+
+/* The chunk starting at checkpoint p, inflating it into the least
+   recently used slot if it isn't kept already */
+zseek_chunk *_zseek_chunk(zseek *z, uint32_t p)
+{
+	zseek_chunk *chunk = &z->chunks[0];
+	int i;
+
+	for (i = 0; i < ZSEEK_CHUNKS; i++)
+	{
+		if (z->chunks[i].data && z->chunks[i].point == p)
+		{
+			z->chunks[i].used = ++z->clock;
+			return &z->chunks[i];
+		}
+		if (z->chunks[i].data == NULL || (chunk->data && z->chunks[i].used < chunk->used))
+			chunk = &z->chunks[i];
+	}
+
+	free(chunk->data);
+	chunk->data = NULL;
+	if (_zseek_inflate(z, p, chunk) < 0)
+		return NULL;
+	chunk->used = ++z->clock;
+	return chunk;
+}
+
+/* The chunk holding offset, inflating the stream up to it if no
+   checkpoint has been found that far on yet */
+zseek_chunk *_zseek_find(zseek *z, uint64_t offset)
+{
+	zseek_chunk *chunk;
+	uint32_t lo, hi, mid;
+
+	for (;;)
+	{
+		/* the last checkpoint at or before offset */
+		lo = 0;
+		hi = z->npoints;
+		while (hi - lo > 1)
+		{
+			mid = lo + (hi - lo) / 2;
+			if (z->points[mid].out <= offset)
+				lo = mid;
+			else
+				hi = mid;
+		}
+
+		if ((chunk = _zseek_chunk(z, lo)) == NULL)
+			return NULL;
+		if (offset < z->points[lo].out + chunk->size)
+			return chunk;
+		if (lo + 1 == z->npoints)
+		{
+			/* past the end */
+			errno = 0;
+			return NULL;
+		}
+	}
+}
+
+ssize_t zseek_pread(zseek *z, void *buf, size_t count, uint64_t offset)
+{
+	zseek_chunk *chunk;
+	size_t done = 0, n;
+	uint64_t from;
+
+	while (done < count && offset < z->size)
+	{
+		if ((chunk = _zseek_find(z, offset)) == NULL)
+		{
+			if (errno == 0)
+				break;
+			return done ? (ssize_t)done : -1;
+		}
+		from = offset - z->points[chunk->point].out;
+		n = chunk->size - from;
+		if (n > count - done)
+			n = count - done;
+		memcpy((unsigned char *)buf + done, chunk->data + from, n);
+		done += n;
+		offset += n;
+	}
+	return done;
+}
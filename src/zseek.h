@@ -0,0 +1,53 @@
+#ifndef _TNFS_ZSEEK_H
+#define _TNFS_ZSEEK_H
+
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * TNFS daemon random access to deflate streams
+ *
+ * */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Reads a raw deflate stream held in a file at any offset. Decompressing
+ * always has to start from somewhere it can resume, so as the stream is
+ * first read a checkpoint is kept at the first deflate block boundary
+ * every ZSEEK_SPAN bytes of output, with the 32K of history the next
+ * block may refer back to. A read then inflates from the checkpoint
+ * before it, and the last ZSEEK_CHUNKS stretches between checkpoints
+ * are kept decompressed for the reads that follow. */
+
+typedef struct _zseek zseek;
+
+/* The stream is the compsize bytes at start in fd, which must stay open,
+ * and inflates to size bytes */
+zseek *zseek_new(int fd, off_t start, off_t compsize, uint64_t size);
+
+/* Returns the number of bytes read, 0 at the end, or -1 with errno set
+ * to EIO if the stream is corrupt */
+ssize_t zseek_pread(zseek *z, void *buf, size_t count, uint64_t offset);
+
+void zseek_free(zseek *z);
+
+#endif
@@ -0,0 +1,209 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * Microbenchmark of pattern_match() against the matchers it replaced and
+ * fnmatch(), on ordinary patterns and ones made to make matchers backtrack
+ *
+ * */
+
+/* Usage: benchglob. Each pattern is matched against its name for at
+ * least MIN_SECONDS and the time of one match reported. Every matcher
+ * has to agree on whether it matches */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <time.h>
+
+#include "pattern.h"
+
+#define MIN_SECONDS 0.1
+#define NAMELEN 255
+
+/* The TNFS_DIR_EXT matcher before pattern.c, which recurses at every '*' */
+static int _old_wildcard(const char *pattern, const char *str)
+{
+	if (*pattern == '\0')
+		return !*str;
+	if (*pattern == '*')
+		return _old_wildcard(pattern + 1, str) || (*str && _old_wildcard(pattern, str + 1));
+	if (*pattern == '?')
+		return *str && (*str != '.') && _old_wildcard(pattern + 1, str + 1);
+	return ((*str | 32) == (*pattern | 32)) && _old_wildcard(pattern + 1, str + 1);
+}
+
+/* The OPENDIRX matcher before pattern.c, which fills a table of every
+   name prefix against every pattern prefix */
+static bool _old_table(const char *src, const char *pattern)
+{
+	int m = strlen(pattern);
+	int n = strlen(src);
+	int i, j;
+
+	if (m == 0)
+		return n == 0;
+
+	bool lookup[n + 1][m + 1];
+	memset(lookup, false, sizeof(lookup));
+	lookup[0][0] = true;
+	for (j = 1; j <= m; j++)
+		if (pattern[j - 1] == '*')
+			lookup[0][j] = lookup[0][j - 1];
+	for (i = 1; i <= n; i++)
+	{
+		for (j = 1; j <= m; j++)
+		{
+			if (pattern[j - 1] == '*')
+				lookup[i][j] = lookup[i][j - 1] || lookup[i - 1][j];
+			else if (pattern[j - 1] == '?' || tolower(src[i - 1]) == tolower(pattern[j - 1]))
+				lookup[i][j] = lookup[i - 1][j - 1];
+			else
+				lookup[i][j] = false;
+		}
+	}
+	return lookup[n][m];
+}
+
+typedef struct _bench_case
+{
+	const char *pattern;
+	const char *name;	/* or NULL for NAMELEN of fill and then last */
+	char fill;
+	char last;
+	bool recursive;		/* time the recursive matcher, which may never finish */
+} bench_case;
+
+static const bench_case cases[] = {
+	{"*.atr", "Star Raiders (1979)(Atari)(US).ATR", 0, 0, true},
+	{"*.atr", "Star Raiders (1979)(Atari)(US).XEX", 0, 0, true},
+	{"star*", "Star Raiders (1979)(Atari)(US).ATR", 0, 0, true},
+	{"*raiders*", "Star Raiders (1979)(Atari)(US).ATR", 0, 0, true},
+	{"??????????????????????????????.atr", "Star Raiders (1979)(Atari)(US).ATR", 0, 0, true},
+	// the suffix alone rules these out for pattern_match()
+	{"*a*a*a*b", NULL, 'a', 'a', true},
+	{"*a*a*a*b", NULL, 'a', 'b', true},
+	// and here it can't, so the middle has to fail
+	{"*a*a*a*b*a", NULL, 'a', 'a', false},
+	{"*a*a*a*a*a*a*a*b*a", NULL, 'a', 'a', false},
+	{"*a*a*a*a*a*a*a*b", NULL, 'a', 'b', false},
+	{"*?*?*?*?*?*?*x*", NULL, 'y', 'y', false},
+	{"*aaaaaaaaaaaaaaab*", NULL, 'a', 'a', false},
+	{"a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a", NULL, 'a', 'a', false},
+};
+
+static double _now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Nanoseconds a match takes, and what it gave in *result */
+#define TIME(call, result)                                    \
+	do                                                        \
+	{                                                         \
+		long calls = 0, batch = 1, b;                         \
+		double start = _now(), t;                             \
+		do                                                    \
+		{                                                     \
+			for (b = 0; b < batch; b++)                       \
+				result = (call);                              \
+			calls += batch;                                   \
+			batch *= 2;                                       \
+		} while ((t = _now() - start) < MIN_SECONDS);         \
+		ns = t * 1e9 / calls;                                 \
+	} while (0)
+
+int main(int argc, char **argv)
+{
+	char name[NAMELEN + 1];
+	const char *subject;
+	tnfs_pattern *compiled;
+	volatile bool matched, table, fn;
+	volatile int recursive;
+	double ns;
+	int i, mismatches = 0;
+
+	printf("%-36s %-10s %5s %11s %11s %11s %11s\n", "pattern", "name", "match",
+		   "compiled", "old table", "old recurse", "fnmatch");
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		const bench_case *c = &cases[i];
+		char shown[16];
+
+		if (c->name != NULL)
+		{
+			subject = c->name;
+			snprintf(shown, sizeof(shown), "%.7s%s", subject, strlen(subject) > 7 ? "..." : "");
+		}
+		else
+		{
+			memset(name, c->fill, NAMELEN - 1);
+			name[NAMELEN - 1] = c->last;
+			name[NAMELEN] = '\0';
+			subject = name;
+			snprintf(shown, sizeof(shown), "%c*%d%s%c", c->fill, NAMELEN - 1,
+					 c->last != c->fill ? "+" : "", c->last != c->fill ? c->last : ' ');
+		}
+
+		if ((compiled = pattern_compile(c->pattern, PATTERN_QMARK_NODOT)) == NULL)
+		{
+			fprintf(stderr, "pattern_compile failed\n");
+			return 1;
+		}
+		printf("%-36s %-10s ", c->pattern, shown);
+		fflush(stdout);
+
+		TIME(pattern_match(compiled, subject), matched);
+		printf("%5s %8.0f ns ", matched ? "yes" : "no", ns);
+		fflush(stdout);
+		TIME(_old_table(subject, c->pattern), table);
+		printf("%8.0f ns ", ns);
+		fflush(stdout);
+		recursive = matched;
+		if (c->recursive)
+		{
+			TIME(_old_wildcard(c->pattern, subject), recursive);
+			printf("%8.0f ns ", ns);
+		}
+		else
+		{
+			printf("%11s ", "too slow");
+		}
+		TIME(fnmatch(c->pattern, subject, FNM_CASEFOLD) == 0, fn);
+		printf("%8.0f ns", ns);
+
+		if (table != matched || (recursive != 0) != matched || fn != matched)
+		{
+			printf("   MATCHERS DISAGREE");
+			mismatches++;
+		}
+		printf("\n");
+		pattern_free(compiled);
+	}
+	return mismatches != 0;
+}
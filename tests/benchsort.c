@@ -0,0 +1,173 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * Microbenchmark of dirlist_sort() against qsort() with the comparators
+ * directory listings were sorted with before it
+ *
+ * */
+
+/* Usage: benchsort [entries], 100000 if not given. Each listing is
+ * sorted every way dirlist_sort() can, the best of RUNS times, the order
+ * it gives checked against the reference comparator */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "directory.h"
+
+#define RUNS 5
+
+static const directory_entry *ref_entries;
+static int ref_key;
+
+static double _now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The reference order of two entries, ties broken by position so that
+   qsort() gives the stable order dirlist_sort() promises */
+static int _ref_compare(const void *pa, const void *pb)
+{
+	uint32_t a = *(const uint32_t *)pa, b = *(const uint32_t *)pb;
+	const directory_entry *ea = &ref_entries[a], *eb = &ref_entries[b];
+	int r;
+
+	if (ref_key == TNFS_DIRSORT_SIZE)
+		r = ea->size < eb->size ? -1 : ea->size > eb->size;
+	else if (ref_key == TNFS_DIRSORT_MODIFIED)
+		r = ea->mtime < eb->mtime ? -1 : ea->mtime > eb->mtime;
+	else if (ref_key == TNFS_DIRSORT_CASE)
+		r = strcmp(ea->entrypath, eb->entrypath);
+	else
+		r = strcasecmp(ea->entrypath, eb->entrypath);
+
+	return r ? r : (a > b) - (a < b);
+}
+
+static void _random_name(char *name, int len)
+{
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 _-.";
+	int i;
+
+	for (i = 0; i < len; i++)
+		name[i] = chars[rand() % (sizeof(chars) - 1)];
+	name[len] = '\0';
+}
+
+/* Fills a listing with count entries named as kind says */
+static dir_listing *_make_listing(const char *kind, uint32_t count)
+{
+	dir_listing *listing = dirlist_new("bench");
+	directory_entry *entry;
+	char name[64];
+	uint32_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (strcmp(kind, "random") == 0)
+			_random_name(name, 4 + rand() % 28);
+		// names that differ only well past the collation prefix
+		else if (strcmp(kind, "shared prefix") == 0)
+			snprintf(name, sizeof(name), "Atari Game Collection %06u Disk %c.ATR",
+					 (unsigned)rand() % 1000000, 'A' + rand() % 4);
+		else
+			snprintf(name, sizeof(name), "file%07u.xex", i);
+
+		if ((entry = dirlist_add(listing, name)) == NULL)
+		{
+			fprintf(stderr, "out of memory at %u entries\n", i);
+			exit(1);
+		}
+		entry->size = rand() % 200000;
+		entry->mtime = 1500000000 + rand() % 100000000;
+	}
+	return listing;
+}
+
+static void _bench(const char *kind, dir_listing *listing, const char *what, int key)
+{
+	uint32_t *order, *ref, i, count = listing->count;
+	double start, best = 0, refbest = 0, t;
+	int run;
+
+	ref_entries = listing->entries;
+	ref_key = key;
+	ref = malloc(count * sizeof(uint32_t));
+	for (run = 0; run < RUNS; run++)
+	{
+		start = _now();
+		order = dirlist_sort(listing, key);
+		t = _now() - start;
+		if (order == NULL)
+		{
+			fprintf(stderr, "dirlist_sort failed\n");
+			exit(1);
+		}
+		if (run == 0 || t < best)
+			best = t;
+		if (run < RUNS - 1)
+			free(order);
+
+		for (i = 0; i < count; i++)
+			ref[i] = i;
+		start = _now();
+		qsort(ref, count, sizeof(uint32_t), _ref_compare);
+		t = _now() - start;
+		if (run == 0 || t < refbest)
+			refbest = t;
+	}
+
+	printf("%-14s %-15s %9.2f ms %9.2f ms %6.2fx   %s\n", kind, what, best * 1e3,
+		   refbest * 1e3, refbest / best,
+		   memcmp(order, ref, count * sizeof(uint32_t)) == 0 ? "same order" : "DIFFERENT ORDER");
+	free(order);
+	free(ref);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *kinds[] = {"random", "shared prefix", "presorted"};
+	uint32_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+	dir_listing *listing;
+	int k;
+
+	srand(1);
+	printf("%u entries, best of %d\n", count, RUNS);
+	printf("%-14s %-15s %12s %12s %7s\n", "names", "sorted by", "dirlist_sort", "qsort", "");
+	for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++)
+	{
+		listing = _make_listing(kinds[k], count);
+		_bench(kinds[k], listing, "name", 0);
+		_bench(kinds[k], listing, "name with case", TNFS_DIRSORT_CASE);
+		_bench(kinds[k], listing, "modified", TNFS_DIRSORT_MODIFIED);
+		_bench(kinds[k], listing, "size", TNFS_DIRSORT_SIZE);
+		dirlist_release(listing);
+	}
+	return 0;
+}
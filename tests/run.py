@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""Runs the tnfsd tests.
+
+usage: run.py [-v] [test ...]
+
+Each test_*.py runs against a tnfsd of its own, serving a share made
+afresh in a temporary directory. A test module may define:
+
+    ARGS       extra tnfsd options, with {tmp} standing for its temporary
+               directory
+    SLOWFS     milliseconds the slowfs.so shim makes paths with "slow" in
+               them take to look at, if the test needs a slow filesystem
+    NO_OPENAT2 set to have the noopenat2.so shim make openat2() look
+               missing, as on kernels before 5.6
+    setup(share)
+               to add what it needs to the share
+    run(t)     the test itself, checking what it gets with t.check(), or
+               passing over what tnfsd wasn't built with by t.skip()
+
+TNFSD names the server to test, ../bin/tnfsd by default."""
+
+import glob
+import importlib
+import os
+import random
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+import traceback
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+TNFSD = os.environ.get("TNFSD", os.path.join(HERE, "..", "bin", "tnfsd"))
+SLOWFS = os.path.join(HERE, "slowfs.so")
+NO_OPENAT2 = os.path.join(HERE, "noopenat2.so")
+
+
+class Test:
+    def __init__(self, name, port, share, tmp, verbose):
+        self.name = name
+        self.port = port
+        self.share = share
+        self.tmp = tmp
+        self.verbose = verbose
+        self.failed = 0
+        self.passed = 0
+        self.skipped = 0
+
+    def path(self, rel):
+        return os.path.join(self.share, rel)
+
+    def check(self, what, got, expected):
+        if got == expected:
+            self.passed += 1
+            if self.verbose:
+                print("  ok   %s" % what)
+        else:
+            self.failed += 1
+            print("  FAIL %s: got %.200r, expected %.200r" % (what, got, expected))
+
+    def skip(self, what, why):
+        """For checks of what this tnfsd wasn't built with"""
+        self.skipped += 1
+        if self.verbose:
+            print("  skip %s: %s" % (what, why))
+
+
+def common_share(share):
+    """What every test can count on finding"""
+    rnd = random.Random(1)
+    with open(os.path.join(share, "readme.txt"), "w") as f:
+        f.write("hello\n")
+    with open(os.path.join(share, "big.bin"), "wb") as f:
+        f.write(bytes(rnd.randrange(256) for i in range(64 * 1024)))
+
+
+def free_port():
+    """One free for both UDP and TCP"""
+    while True:
+        port = random.randrange(20000, 60000)
+        u = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        t = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        try:
+            u.bind(("127.0.0.1", port))
+            t.bind(("127.0.0.1", port))
+            return port
+        except OSError:
+            pass
+        finally:
+            u.close()
+            t.close()
+
+
+def start(port, share, tmp, module, log):
+    env = dict(os.environ)
+    preload = []
+    slowfs = getattr(module, "SLOWFS", None)
+    if slowfs is not None:
+        preload.append(SLOWFS)
+        env["SLOWFS_MS"] = str(slowfs)
+    if getattr(module, "NO_OPENAT2", False):
+        preload.append(NO_OPENAT2)
+    if preload:
+        env["LD_PRELOAD"] = " ".join(preload)
+    args = [a.format(tmp=tmp) for a in getattr(module, "ARGS", [])]
+    server = subprocess.Popen([TNFSD, "-p", str(port)] + args + [share],
+        stdout=log, stderr=subprocess.STDOUT, env=env)
+
+    # ready once it takes connections
+    for i in range(100):
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=1).close()
+            return server
+        except OSError:
+            if server.poll() is not None:
+                break
+            time.sleep(0.05)
+    server.kill()
+    raise RuntimeError("tnfsd didn't start")
+
+
+def run_test(path, verbose):
+    name = os.path.splitext(os.path.basename(path))[0]
+    module = importlib.import_module(name)
+    tmp = tempfile.mkdtemp(prefix="tnfsd-" + name + "-")
+    share = os.path.join(tmp, "share")
+    os.mkdir(share)
+    port = free_port()
+    t = Test(name, port, share, tmp, verbose)
+
+    print(name)
+    common_share(share)
+    if hasattr(module, "setup"):
+        module.setup(share)
+    with open(os.path.join(tmp, "tnfsd.log"), "w") as log:
+        server = start(port, share, tmp, module, log)
+        try:
+            module.run(t)
+        except Exception:
+            t.failed += 1
+            print("  FAIL %s raised:" % name)
+            traceback.print_exc(file=sys.stdout)
+        finally:
+            server.terminate()
+            server.wait()
+
+    if t.failed:
+        print("  %d of %d checks failed, server log in %s" %
+            (t.failed, t.failed + t.passed, os.path.join(tmp, "tnfsd.log")))
+    else:
+        print("  %d checks passed%s" % (t.passed,
+            ", %d skipped" % t.skipped if t.skipped else ""))
+        subprocess.run(["chmod", "-R", "u+w", tmp])
+        shutil.rmtree(tmp, ignore_errors=True)
+    return t.failed == 0
+
+
+def main():
+    verbose = "-v" in sys.argv[1:]
+    names = [a for a in sys.argv[1:] if a != "-v"]
+    sys.path.insert(0, HERE)
+    if names:
+        paths = [os.path.join(HERE, n if n.endswith(".py") else n + ".py") for n in names]
+    else:
+        paths = sorted(glob.glob(os.path.join(HERE, "test_*.py")))
+
+    if not os.access(TNFSD, os.X_OK):
+        print("no tnfsd at %s, build it first" % TNFSD)
+        return 1
+    failed = [p for p in paths if not run_test(p, verbose)]
+    if failed:
+        print("FAILED: " + " ".join(os.path.basename(p) for p in failed))
+        return 1
+    print("all passed")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
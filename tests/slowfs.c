@@ -0,0 +1,123 @@
+/* The MIT License
+ *
+ * Copyright (c) 2010 Dylan Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ *
+ * Test shim, loaded with LD_PRELOAD, that makes a filesystem slow
+ *
+ * */
+
+/* Looking at any path with "slow" in it takes SLOWFS_MS milliseconds,
+ * 1500 if that isn't set, as it might on a network share that has gone
+ * to sleep. Descriptors are slowed by the path they were opened with */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define NEXT(f) static __typeof__(f) *next; if (next == NULL) next = dlsym(RTLD_NEXT, #f)
+
+static void nap(const char *path)
+{
+	const char *ms;
+
+	if (path != NULL && strstr(path, "slow") != NULL)
+	{
+		ms = getenv("SLOWFS_MS");
+		usleep(1000 * (ms ? atoi(ms) : 1500));
+	}
+}
+
+static void napfd(int fd)
+{
+	char link[64], path[4096];
+	ssize_t n;
+
+	snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+	if ((n = readlink(link, path, sizeof(path) - 1)) > 0)
+	{
+		path[n] = 0;
+		nap(path);
+	}
+}
+
+int stat(const char *path, struct stat *st)
+{
+	NEXT(stat);
+	nap(path);
+	return next(path, st);
+}
+
+int lstat(const char *path, struct stat *st)
+{
+	NEXT(lstat);
+	nap(path);
+	return next(path, st);
+}
+
+int fstat(int fd, struct stat *st)
+{
+	NEXT(fstat);
+	napfd(fd);
+	return next(fd, st);
+}
+
+int fstatat(int dirfd, const char *path, struct stat *st, int flags)
+{
+	NEXT(fstatat);
+	if (*path == 0)
+		napfd(dirfd);
+	else
+		nap(path);
+	return next(dirfd, path, st, flags);
+}
+
+int open(const char *path, int flags, ...)
+{
+	va_list ap;
+	int mode;
+
+	NEXT(open);
+	va_start(ap, flags);
+	mode = va_arg(ap, int);
+	va_end(ap);
+	nap(path);
+	return next(path, flags, mode);
+}
+
+int openat(int dirfd, const char *path, int flags, ...)
+{
+	va_list ap;
+	int mode;
+
+	NEXT(openat);
+	va_start(ap, flags);
+	mode = va_arg(ap, int);
+	va_end(ap);
+	nap(path);
+	return next(dirfd, path, flags, mode);
+}
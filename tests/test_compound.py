@@ -0,0 +1,113 @@
+"""COMPOUND: several requests in one, chained by handle, over UDP and TCP"""
+
+import os
+import struct
+
+import tnfs
+
+CHAIN = 0x01
+ALWAYS = 0x02
+
+
+def setup(share):
+    os.mkdir(os.path.join(share, "ctest"))
+    with open(os.path.join(share, "ctest", "cfg.bin"), "wb") as f:
+        f.write(bytes(range(150)) * 2)
+    with open(os.path.join(share, "ctest", "big.bin"), "wb") as f:
+        f.write(bytes(range(256)) * 64)
+    for i in range(1, 6):
+        with open(os.path.join(share, "ctest", "f%d.txt" % i), "w") as f:
+            f.write("%d\n" % i)
+
+
+def part(cmd, args, flags=0):
+    return bytes([cmd, flags]) + struct.pack("<H", len(args)) + args
+
+
+def compound(c, *parts):
+    """(status, [(index, status, data)]), checking the reply is all parts"""
+    st, d = c.req(tnfs.COMPOUND, bytes([len(parts)]) + b"".join(parts))
+    if st != 0:
+        return st, None
+    out = []
+    p = 1
+    for i in range(d[0]):
+        index, status, length = struct.unpack("<BBH", d[p:p + 4])
+        out.append((index, status, d[p + 4:p + 4 + length]))
+        p += 4 + length
+    if p != len(d):
+        return "reply %d bytes, parts %d" % (len(d), p), None
+    return st, out
+
+
+def statuses(result):
+    return [(x[0], x[1]) for x in result[1]] if result[1] else result[0]
+
+
+def openargs(path):
+    return struct.pack("<HH", tnfs.O_RDONLY, 0) + path + b"\0"
+
+
+def readargs(size):
+    return b"\0" + struct.pack("<H", size)
+
+
+def check(t, c, how):
+    with open(t.path("ctest/cfg.bin"), "rb") as f:
+        cfg = f.read()
+
+    r = compound(c, part(tnfs.OPEN, openargs(b"ctest/cfg.bin")),
+        part(tnfs.READ, readargs(512), CHAIN), part(tnfs.CLOSE, b"\0", CHAIN | ALWAYS))
+    t.check(how + " open, read, close", statuses(r), [(0, 0), (1, 0), (2, 0)])
+    t.check(how + " data", r[1][1][2][2:], cfg)
+
+    opened = [c.open(b"ctest/cfg.bin") for i in range(16)]
+    t.check(how + " handles closed", [o[0] for o in opened], [0] * 16)
+    for o in opened:
+        c.close_file(o[1])
+
+    r = compound(c, part(tnfs.OPEN, openargs(b"ctest/nope")),
+        part(tnfs.READ, readargs(512), CHAIN), part(tnfs.CLOSE, b"\0", CHAIN | ALWAYS))
+    t.check(how + " failure stops all but ALWAYS", statuses(r), [(0, 0x02), (2, tnfs.EBADF)])
+
+    r = compound(c, part(tnfs.OPEN, openargs(b"ctest/cfg.bin")),
+        part(tnfs.READ, readargs(512), CHAIN), part(tnfs.READ, readargs(512), CHAIN),
+        part(tnfs.CLOSE, b"\0", CHAIN | ALWAYS))
+    t.check(how + " EOF then close", statuses(r), [(0, 0), (1, 0), (2, tnfs.EOF), (3, 0)])
+
+    r = compound(c, *[part(tnfs.STAT, b"ctest/f%d.txt\0" % i) for i in range(1, 6)])
+    t.check(how + " STATs", [(x[1], struct.unpack("<I", x[2][6:10])[0]) for x in r[1]],
+        [(0, 2)] * 5)
+
+    r = compound(c, part(tnfs.OPENDIRX, b"\0\0\0\0\0ctest\0"),
+        part(tnfs.READDIRX, b"\0\0", CHAIN), part(tnfs.CLOSEDIR, b"\0", CHAIN | ALWAYS))
+    t.check(how + " listing", statuses(r), [(0, 0), (1, 0), (2, 0)])
+
+    t.check(how + " no COMPOUND inside", compound(c, part(tnfs.COMPOUND, b"\0"))[0], tnfs.EINVAL)
+    t.check(how + " no UMOUNT inside", compound(c, part(tnfs.UMOUNT, b""))[0], tnfs.EINVAL)
+    t.check(how + " bad length", c.req(tnfs.COMPOUND, bytes([1, tnfs.STAT, 0, 9, 0]) + b"x")[0],
+        tnfs.EINVAL)
+    t.check(how + " empty", c.req(tnfs.COMPOUND, b"")[0], tnfs.EINVAL)
+    t.check(how + " no parts", c.req(tnfs.COMPOUND, b"\0")[0], tnfs.EINVAL)
+
+    st1, d1 = c.req(tnfs.COMPOUND, bytes([1]) + part(tnfs.STAT, b"ctest/f1.txt\0"))
+    st2, d2 = c.req(tnfs.COMPOUND, bytes([1]) + part(tnfs.STAT, b"ctest/f2.txt\0"), seq=c.seq)
+    t.check(how + " retransmit answered alike", (st2, d2), (st1, d1))
+    t.check(how + " plain request after", c.stat(b"ctest/f1.txt")[0], 0)
+
+
+def run(t):
+    c = tnfs.Client(t.port)
+    c.mount()
+    check(t, c, "udp")
+
+    # a READ as large as the reply has room for
+    r = compound(c, part(tnfs.OPEN, openargs(b"ctest/big.bin")),
+        part(tnfs.READ, readargs(4096), CHAIN), part(tnfs.CLOSE, b"\0", CHAIN | ALWAYS))
+    n = struct.unpack("<H", r[1][1][2][:2])[0]
+    with open(t.path("ctest/big.bin"), "rb") as f:
+        t.check("udp READ cut to fit", (n > 0, r[1][1][2][2:]), (True, f.read(n)))
+
+    c = tnfs.Client(t.port, tcp=True)
+    c.mount(msgsz=4096)
+    check(t, c, "tcp")
@@ -0,0 +1,114 @@
+"""COPYFILE, run as a job and followed with JOBSTATUS: what it copies,
+what it refuses, and who gets to see how it went"""
+
+import os
+
+import tnfs
+
+COPY_EXCL = 0x01
+JOBS_MAX = 16
+
+
+def setup(share):
+    d = os.path.join(share, "cp")
+    os.makedirs(os.path.join(d, "dir"))
+    with open(os.path.join(d, "small.txt"), "wb") as f:
+        f.write(b"small\n")
+    with open(os.path.join(d, "old.txt"), "wb") as f:
+        f.write(b"an older and longer file\n")
+    os.symlink("small.txt", os.path.join(d, "alias.txt"))
+    os.link(os.path.join(d, "small.txt"), os.path.join(d, "hard.txt"))
+    os.symlink("/etc/hostname", os.path.join(d, "out.txt"))
+    os.symlink("/tmp", os.path.join(d, "outdir"))
+
+
+def copy(c, src, dst, flags=0):
+    """(status, job handle)"""
+    st, d = c.req(tnfs.COPYFILE, bytes([flags]) + src + b"\0" + dst + b"\0")
+    return st, (d[0] if st == 0 else None)
+
+
+def copied(c, src, dst, flags=0):
+    """The status of starting the copy, and how the job went"""
+    st, h = copy(c, src, dst, flags)
+    if st != 0:
+        return st
+    return c.jobwait(h)[:2]
+
+
+def content(t, rel):
+    with open(t.path(rel), "rb") as f:
+        return f.read()
+
+
+def run(t):
+    c = tnfs.Client(t.port)
+    c.mount()
+
+    st, h = copy(c, b"big.bin", b"cp/big.copy")
+    t.check("copy", st, 0)
+    t.check("copied", c.jobwait(h), (0, 0, 65536, 65536, b""))
+    t.check("same bytes", content(t, "cp/big.copy"), content(t, "big.bin"))
+    t.check("told once", c.req(tnfs.JOBSTATUS, bytes([h]))[0], tnfs.EBADF)
+
+    # over what's there, unless it's exclusive
+    t.check("exclusive onto a file", copied(c, b"cp/small.txt", b"cp/old.txt", COPY_EXCL),
+        tnfs.EEXIST)
+    t.check("left alone", content(t, "cp/old.txt"), b"an older and longer file\n")
+    t.check("onto a file", copied(c, b"cp/small.txt", b"cp/old.txt"), (0, 0))
+    t.check("replaced, not overwritten", content(t, "cp/old.txt"), b"small\n")
+    t.check("exclusive to a new name", copied(c, b"cp/small.txt", b"cp/new.txt", COPY_EXCL),
+        (0, 0))
+    t.check("through a link", copied(c, b"cp/alias.txt", b"cp/via.txt"), (0, 0))
+    t.check("a link copied as its file", os.path.islink(t.path("cp/via.txt")), False)
+
+    # onto itself, by any name
+    for dst in (b"cp/small.txt", b"cp/alias.txt", b"cp/hard.txt", b"cp/./small.txt"):
+        t.check("onto itself as %s" % dst.decode(), copied(c, b"cp/small.txt", dst),
+            tnfs.EINVAL)
+    t.check("still there", content(t, "cp/small.txt"), b"small\n")
+
+    # only files
+    t.check("a directory", copied(c, b"cp/dir", b"cp/d2"), tnfs.EISDIR)
+    t.check("onto a directory", copied(c, b"cp/small.txt", b"cp/dir"), tnfs.EISDIR)
+    t.check("the root", copied(c, b"/", b"cp/r"), tnfs.EISDIR)
+    t.check("missing", copied(c, b"cp/nope", b"cp/n2"), tnfs.ENOENT)
+    t.check("into what's missing", copied(c, b"cp/small.txt", b"cp/nope/x"), tnfs.ENOENT)
+    t.check("nothing made", os.path.exists(t.path("cp/d2")), False)
+
+    # and only below the root
+    t.check("from above the root", copied(c, b"../etc/hostname", b"cp/h"), tnfs.EINVAL)
+    t.check("to above the root", copied(c, b"cp/small.txt", b"../escaped"), tnfs.EINVAL)
+    t.check("from a link out", copied(c, b"cp/out.txt", b"cp/h"), tnfs.EACCES)
+    t.check("into a link out", copied(c, b"cp/small.txt", b"cp/outdir/escaped"),
+        tnfs.EACCES)
+    t.check("nothing escaped", (os.path.exists(t.path("cp/h")),
+        os.path.exists("/tmp/escaped"), os.path.exists(os.path.join(t.tmp, "escaped"))),
+        (False, False, False))
+
+    # only the session that started a job can follow it
+    other = tnfs.Client(t.port, src="127.0.0.2")
+    other.mount()
+    same_ip = tnfs.Client(t.port)
+    same_ip.mount()
+    st, h = copy(c, b"big.bin", b"cp/watched.bin")
+    t.check("another client", other.req(tnfs.JOBSTATUS, bytes([h]))[0], tnfs.EBADF)
+    t.check("another session", same_ip.req(tnfs.JOBSTATUS, bytes([h]))[0], tnfs.EBADF)
+    t.check("no such job", c.req(tnfs.JOBSTATUS, bytes([JOBS_MAX]))[0], tnfs.EBADF)
+    t.check("the owner still told", c.jobwait(h)[:2], (0, 0))
+
+    # a job's slot is kept until its outcome is asked for
+    handles = []
+    for i in range(JOBS_MAX):
+        st, h = copy(c, b"cp/small.txt", b"cp/many%d.txt" % i)
+        if st != 0:
+            break
+        handles.append(h)
+    t.check("every slot", len(handles), JOBS_MAX)
+    t.check("slots exhausted", copy(c, b"cp/small.txt", b"cp/more.txt")[0], tnfs.EAGAIN)
+    t.check("for everyone", copy(other, b"cp/small.txt", b"cp/more.txt")[0], tnfs.EAGAIN)
+    t.check("onto a file", copy(c, b"cp/small.txt", b"cp/big.copy")[0], tnfs.EAGAIN)
+    t.check("nothing started", (os.path.exists(t.path("cp/more.txt")),
+        content(t, "cp/big.copy") == content(t, "big.bin")), (False, True))
+    t.check("all done", [c.jobwait(h)[:2] for h in handles], [(0, 0)] * JOBS_MAX)
+    t.check("a slot again", copied(c, b"cp/small.txt", b"cp/more.txt"), (0, 0))
@@ -0,0 +1,55 @@
+"""SIZE and FREE: the size of the filesystem the share is on and the
+space free on it to anyone, in kilobytes, kept for DEVCACHE_TTL seconds"""
+
+import os
+import struct
+import time
+
+import tnfs
+
+DEVCACHE_TTL = 2
+GROWTH = 32 * 1024 * 1024
+
+
+def kb(c, cmd):
+    st, d = c.req(cmd)
+    return struct.unpack("<I", d[:4])[0] if st == 0 else ("status", st)
+
+
+def statvfs(path):
+    """(size, free) in kilobytes, as tnfsd works them out"""
+    v = os.statvfs(path)
+    return (min(v.f_blocks * v.f_frsize // 1024, 0xffffffff),
+        min(v.f_bavail * v.f_frsize // 1024, 0xffffffff))
+
+
+def setup(share):
+    os.mkdir(os.path.join(share, "sub"))
+
+
+def run(t):
+    c = tnfs.Client(t.port)
+    c.mount()
+    sub = tnfs.Client(t.port)
+    sub.mount(b"/sub")
+
+    size, free = statvfs(t.share)
+    t.check("SIZE", kb(c, tnfs.SIZE), size)
+    # anything else on the machine may be writing too
+    t.check("FREE", abs(kb(c, tnfs.FREE) - free) < 4096, True)
+    t.check("SIZE below the root", kb(sub, tnfs.SIZE), size)
+    t.check("not before mounting", tnfs.Client(t.port).req(tnfs.SIZE)[0] != 0, True)
+
+    # start a second so the figures from here on are kept their full time
+    time.sleep(1 - time.time() % 1 + 0.05)
+    before = kb(c, tnfs.FREE)
+    with open(t.path("grown.bin"), "wb") as f:
+        f.write(b"\xaa" * GROWTH)
+        os.fsync(f.fileno())
+    t.check("kept", kb(c, tnfs.FREE), before)
+    t.check("shared with its other figure", kb(c, tnfs.SIZE), size)
+    time.sleep(DEVCACHE_TTL + 0.1)
+    after = kb(c, tnfs.FREE)
+    t.check("queried again once they're stale",
+        before - after > GROWTH // 1024 * 3 // 4, True)
+    t.check("and as statvfs() has it", abs(after - statvfs(t.share)[1]) < 4096, True)
@@ -0,0 +1,176 @@
+"""The directory index: listings come from it while it matches the disk,
+a damaged one is never used, and tnfsd-index replaces it under a running
+tnfsd"""
+
+import os
+import struct
+import subprocess
+import time
+
+import tnfs
+
+ARGS = ["-i", "{tmp}/index"]
+TNFSD_INDEX = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+    "..", "bin", "tnfsd-index")
+
+# dirindex_header: magic, version, byteorder, dircount, entrycount,
+# dirtab, enttab, strtab, size
+HEADER = struct.Struct("=8sIIIIQQQQ")
+
+
+def index(share):
+    return os.path.join(os.path.dirname(share), "index")
+
+
+def build(share):
+    return subprocess.run([TNFSD_INDEX, share, index(share)],
+        capture_output=True, text=True)
+
+
+def sneak(dirpath, name, data=b""):
+    """Add a file without the directory's modification time showing it,
+    so only a listing read from the disk has it"""
+    st = os.stat(dirpath)
+    with open(os.path.join(dirpath, name), "wb") as f:
+        f.write(data)
+    os.utime(dirpath, ns=(st.st_atime_ns, st.st_mtime_ns))
+
+
+def setup(share):
+    for d in ("ix/hidden", "ix/sized", "ix/later"):
+        os.makedirs(os.path.join(share, d))
+    for name in ("a", "b"):
+        with open(os.path.join(share, "ix/hidden", name), "wb") as f:
+            f.write(b"x")
+    with open(os.path.join(share, "ix/sized/f"), "wb") as f:
+        f.write(b"short")
+    with open(os.path.join(share, "ix/later/one"), "wb") as f:
+        f.write(b"1")
+    if build(share).returncode != 0:
+        return
+    sneak(os.path.join(share, "ix/hidden"), "sneaked")
+    # rewritten in place after indexing, which the directory doesn't show
+    with open(os.path.join(share, "ix/sized/f"), "wb") as f:
+        f.write(b"a good deal longer")
+
+
+def log(t):
+    with open(os.path.join(t.tmp, "tnfsd.log")) as f:
+        return f.read()
+
+
+def replace(t, c, data):
+    """Rename a new index over the old one and wait for tnfsd to look at it"""
+    new = os.path.join(t.tmp, "index.new")
+    with open(new, "wb") as f:
+        f.write(data)
+    os.rename(new, index(t.share))
+    look(c)
+
+
+def look(c):
+    """Give tnfsd the chance to pick up a new index: it looks at most
+    once a second, between requests"""
+    time.sleep(1.1)
+    c.stat(b"readme.txt")
+
+
+def damaged(good):
+    h = list(HEADER.unpack_from(good))
+    dirtab, strtab = h[5], h[7]
+    out = []
+
+    out.append(("truncated inside the header", good[:HEADER.size - 8]))
+    out.append(("truncated inside the tables", good[:strtab - 4]))
+    bad = bytearray(good)
+    bad[0:8] = b"NOTANIDX"
+    out.append(("wrong magic", bytes(bad)))
+    bad = bytearray(good)
+    struct.pack_into("=I", bad, 8, h[1] + 1)
+    out.append(("another version", bytes(bad)))
+    bad = bytearray(good)
+    struct.pack_into("=Q", bad, HEADER.size - 8, h[8] + 4)
+    out.append(("size past the end of the file", bytes(bad)))
+    bad = bytearray(good)
+    struct.pack_into("=Q", bad, 24, len(good))
+    out.append(("directory table past the end", bytes(bad)))
+    bad = bytearray(good)
+    struct.pack_into("=I", bad, 16, 0x10000000)
+    out.append(("more directories than fit", bytes(bad)))
+    bad = bytearray(good)
+    struct.pack_into("=I", bad, dirtab, 0xFFFFFF00)
+    out.append(("path offset past the strings", bytes(bad)))
+    bad = bytearray(good)
+    struct.pack_into("=I", bad, dirtab + 8, 0xFFFFFFFF)
+    out.append(("entries past the entry table", bytes(bad)))
+    bad = bytearray(good)
+    bad[-1] = ord("x")
+    out.append(("strings not terminated", bytes(bad)))
+    return out
+
+
+def wait(get, want, timeout=3):
+    """What get() returns once it's want, or when it gives up; changes
+    made here reach tnfsd by way of inotify, a moment later"""
+    end = time.time() + timeout
+    got = get()
+    while got != want and time.time() < end:
+        time.sleep(0.05)
+        got = get()
+    return got
+
+
+def run(t):
+    c = tnfs.Client(t.port)
+    c.mount()
+
+    t.check("index mapped", "dirindex: mapped" in log(t), True)
+
+    t.check("listed from the index", sorted(c.listdir(b"ix/hidden")), ["a", "b"])
+    st, h, n = c.opendirx(b"ix/sized")
+    t.check("entries checked on first use", [e[1] for e in c.readdirx_all(h)], [18])
+    c.closedir(h)
+
+    # damaged indexes are refused, and the one mapped is kept
+    with open(index(t.share), "rb") as f:
+        good = f.read()
+    for what, data in damaged(good):
+        before = log(t).count("dirindex: %s is" % index(t.share))
+        replace(t, c, data)
+        t.check("refused: " + what,
+            log(t).count("dirindex: %s is" % index(t.share)) > before, True)
+    t.check("old index kept", sorted(c.listdir(b"ix/hidden")), ["a", "b"])
+
+    # tnfsd-index writes a new one beside it and renames it into place
+    with open(os.path.join(t.tmp, "index.tmp"), "wb") as f:
+        f.write(b"left over from a build that died")
+    old = os.stat(index(t.share)).st_ino
+    r = build(t.share)
+    t.check("tnfsd-index", (r.returncode, r.stdout.startswith("Indexed ")), (0, True))
+    t.check("no temporary file left", os.path.exists(os.path.join(t.tmp, "index.tmp")), False)
+    t.check("renamed into place", os.stat(index(t.share)).st_ino != old, True)
+    sneak(t.path("ix/later"), "two")
+    mapped = log(t).count("dirindex: mapped")
+    look(c)
+    t.check("new index mapped", log(t).count("dirindex: mapped"), mapped + 1)
+    t.check("listed from the new index", c.listdir(b"ix/later"), ["one"])
+
+    # once used, a directory is stale as soon as anything in it changes
+    with open(t.path("ix/later/three"), "wb") as f:
+        f.write(b"3")
+    t.check("stale after a create",
+        wait(lambda: sorted(c.listdir(b"ix/later")), ["one", "three", "two"]),
+        ["one", "three", "two"])
+    os.unlink(t.path("ix/hidden/a"))
+    t.check("stale after a remove",
+        wait(lambda: sorted(c.listdir(b"ix/hidden")), ["b", "sneaked"]), ["b", "sneaked"])
+    with open(t.path("ix/sized/f"), "ab") as f:
+        f.write(b"!")
+
+    def sizes():
+        st, h, n = c.opendirx(b"ix/sized")
+        out = [e[1] for e in c.readdirx_all(h)]
+        c.closedir(h)
+        return out
+    t.check("stale after a write in place", wait(sizes, [19]), [19])
+
@@ -0,0 +1,115 @@
+"""gzip compressed files served decompressed: foo.atr.gz is listed,
+stat()ed and read as foo.atr, at the size in its trailer, and seeks
+anywhere in it"""
+
+import gzip
+import os
+import random
+import struct
+import zlib
+
+import tnfs
+
+rnd = random.Random(39)
+# an Atari disk image: a header, then sectors that deflate unevenly
+IMAGE = b"\x96\x02\x80\x16\x80\x00" + b"\0" * 10 + b"".join(
+    bytes(rnd.randrange(256) for i in range(128)) if rnd.random() < 0.3 else b"\0" * 128
+    for s in range(720))
+SMALL = b"tiny\n"
+
+
+def gzipped(data, extra=b"", name=b"", comment=b"", hcrc=False):
+    """A gzip file with whichever optional header fields are asked for"""
+    flags = (0x04 if extra else 0) | (0x08 if name else 0) | \
+        (0x10 if comment else 0) | (0x02 if hcrc else 0)
+    header = struct.pack("<BBBBIBB", 0x1f, 0x8b, 8, flags, 0, 0, 3)
+    if extra:
+        header += struct.pack("<H", len(extra)) + extra
+    if name:
+        header += name + b"\0"
+    if comment:
+        header += comment + b"\0"
+    if hcrc:
+        header += struct.pack("<H", zlib.crc32(header) & 0xffff)
+    z = zlib.compressobj(9, zlib.DEFLATED, -15)
+    return header + z.compress(data) + z.flush() + \
+        struct.pack("<II", zlib.crc32(data), len(data) & 0xffffffff)
+
+
+def setup(share):
+    d = os.path.join(share, "gz")
+    os.mkdir(d)
+    with open(os.path.join(d, "disk.atr.gz"), "wb") as f:
+        f.write(gzip.compress(IMAGE))
+    with open(os.path.join(d, "fields.atr.gz"), "wb") as f:
+        f.write(gzipped(IMAGE, extra=b"XY\x02\x00hi", name=b"fields.atr",
+            comment=b"a comment", hcrc=True))
+    with open(os.path.join(d, "small.txt.gz"), "wb") as f:
+        f.write(gzip.compress(SMALL))
+    # the plain file wins over its compressed copy
+    with open(os.path.join(d, "both.txt"), "wb") as f:
+        f.write(b"plain\n")
+    with open(os.path.join(d, "both.txt.gz"), "wb") as f:
+        f.write(gzip.compress(b"compressed\n"))
+    with open(os.path.join(d, "fake.txt.gz"), "wb") as f:
+        f.write(b"not gzipped at all\n")
+
+
+def whole(c, path):
+    st, fd = c.open(path)
+    if st != 0:
+        return st
+    data = c.readall(fd)
+    c.close_file(fd)
+    return data
+
+
+def run(t):
+    c = tnfs.Client(t.port)
+    c.mount()
+
+    if c.stat(b"gz/disk.atr")[0] == tnfs.ENOENT:
+        t.skip("gzip compressed files", "not built with GZ=yes")
+        return
+
+    st, h, n = c.opendirx(b"gz")
+    t.check("listed by their plain names",
+        sorted((e[3], e[1]) for e in c.readdirx_all(h)),
+        [("both.txt", 6), ("both.txt.gz", os.path.getsize(t.path("gz/both.txt.gz"))),
+         ("disk.atr", len(IMAGE)), ("fake.txt.gz", 19), ("fields.atr", len(IMAGE)),
+         ("small.txt", len(SMALL))])
+    c.closedir(h)
+
+    for name in (b"gz/disk.atr", b"gz/fields.atr"):
+        what = name.decode()
+        t.check("stat " + what, c.stat(name), (0, len(IMAGE)))
+        t.check("read " + what, whole(c, name), IMAGE)
+
+        st, fd = c.open(name)
+        offsets = [len(IMAGE) - 64, 16, len(IMAGE) // 2, 0, len(IMAGE) - 1]
+        offsets += [rnd.randrange(len(IMAGE)) for i in range(30)]
+        got = []
+        for o in offsets:
+            c.lseek(fd, o)
+            got.append(c.read(fd, 200))
+        t.check("random reads of " + what, got, [IMAGE[o:o + 200] for o in offsets])
+        t.check("end of " + what, c.lseek(fd, 0, 2), len(IMAGE))
+        t.check("read at the end of " + what, c.read(fd), tnfs.EOF)
+        c.lseek(fd, len(IMAGE) + 500)
+        t.check("read past the end of " + what, c.read(fd), tnfs.EOF)
+        c.close_file(fd)
+
+    t.check("small one", whole(c, b"gz/small.txt"), SMALL)
+    t.check("plain file first", whole(c, b"gz/both.txt"), b"plain\n")
+    t.check("compressed file by its own name",
+        whole(c, b"gz/small.txt.gz"), open(t.path("gz/small.txt.gz"), "rb").read())
+    t.check("not really gzipped", c.open(b"gz/fake.txt")[0], tnfs.EIO)
+
+    # read-only
+    for flags in (tnfs.O_WRONLY, tnfs.O_RDWR, tnfs.O_RDONLY | tnfs.O_TRUNC):
+        t.check("open with flags %#x" % flags, c.open(b"gz/disk.atr", flags)[0], tnfs.EROFS)
+    t.check("create over it",
+        c.open(b"gz/disk.atr", tnfs.O_WRONLY | tnfs.O_CREAT)[0], tnfs.EROFS)
+    t.check("create it exclusively",
+        c.open(b"gz/disk.atr", tnfs.O_WRONLY | tnfs.O_CREAT | tnfs.O_EXCL)[0], tnfs.EEXIST)
+    t.check("nothing made", os.path.exists(t.path("gz/disk.atr")), False)
@@ -0,0 +1,93 @@
+"""HASH: small files checksummed at once, large ones and large overlays
+by a job whose JOBSTATUS carries the checksum, and kept while unchanged"""
+
+import os
+import struct
+
+import tnfs
+
+ARGS = ["-o", "{tmp}/ovl"]
+
+HASH_INLINE = 256 * 1024
+
+
+def crc32c(data):
+    table = []
+    for i in range(256):
+        c = i
+        for k in range(8):
+            c = (c >> 1) ^ 0x82F63B78 if c & 1 else c >> 1
+        table.append(c)
+    crc = 0xFFFFFFFF
+    for b in data:
+        crc = table[(crc ^ b) & 0xFF] ^ (crc >> 8)
+    return crc ^ 0xFFFFFFFF
+
+
+def setup(share):
+    os.mkdir(os.path.join(os.path.dirname(share), "ovl"))
+    with open(os.path.join(share, "large.bin"), "wb") as f:
+        f.write(os.urandom(HASH_INLINE * 3 + 123))
+    with open(os.path.join(share, "image.atr"), "wb") as f:
+        f.write(os.urandom(HASH_INLINE * 2))
+    os.mkdir(os.path.join(share, "dir"))
+
+
+def hashed(path, data):
+    st = os.stat(path)
+    return (0, bytes([1]) + struct.pack("<III", crc32c(data), len(data), int(st.st_mtime)))
+
+
+def run(t):
+    c = tnfs.Client(t.port)
+    c.mount()
+    t.check("known value", crc32c(b"123456789"), 0xE3069283)
+
+    with open(t.path("readme.txt"), "rb") as f:
+        small = f.read()
+    t.check("small file at once", c.req(tnfs.HASH, b"readme.txt\0"), hashed(t.path("readme.txt"), small))
+    t.check("directory", c.req(tnfs.HASH, b"dir\0")[0], tnfs.EISDIR)
+    t.check("missing", c.req(tnfs.HASH, b"nope\0")[0], tnfs.ENOENT)
+
+    # a large one is a job, which tells the checksum when it's done
+    with open(t.path("large.bin"), "rb") as f:
+        large = f.read()
+    expected = hashed(t.path("large.bin"), large)
+    st, d = c.req(tnfs.HASH, b"large.bin\0")
+    t.check("large file is a job", (st, len(d)), (tnfs.EAGAIN, 1))
+    st, result, done, total, found = c.jobwait(d[0])
+    t.check("job done", (st, result, done, total), (0, 0, len(large), len(large)))
+    t.check("job's checksum", (0, found), expected)
+    t.check("then kept", c.req(tnfs.HASH, b"large.bin\0"), expected)
+
+    with open(t.path("large.bin"), "ab") as f:
+        f.write(b"more")
+    large += b"more"
+    st, d = c.req(tnfs.HASH, b"large.bin\0")
+    t.check("changed, a job again", st, tnfs.EAGAIN)
+    t.check("new checksum", (0, c.jobwait(d[0])[4]), hashed(t.path("large.bin"), large))
+
+    # a client's own large overlay is checksummed a piece at a time
+    with open(t.path("image.atr"), "rb") as f:
+        image = bytearray(f.read())
+    st, fd = c.open(b"image.atr", tnfs.O_RDWR)
+    c.lseek(fd, 1000)
+    c.write(fd, b"CHANGED")
+    c.close_file(fd)
+    image[1000:1007] = b"CHANGED"
+    st, d = c.req(tnfs.HASH, b"image.atr\0")
+    t.check("large overlay is a job", (st, len(d)), (tnfs.EAGAIN, 1))
+    other = tnfs.Client(t.port, src="127.0.0.2")
+    other.mount()
+    t.check("others served meanwhile", other.stat(b"readme.txt"), (0, 6))
+    st, result, done, total, found = c.jobwait(d[0])
+    t.check("overlay job done", (st, result, done), (0, 0, len(image)))
+    t.check("overlay's checksum", struct.unpack("<I", found[1:5])[0], crc32c(bytes(image)))
+    st, d = c.req(tnfs.HASH, b"image.atr\0")
+    t.check("overlay's not kept for everyone", (st, c.jobwait(d[0])[4]), (tnfs.EAGAIN, found))
+
+    # another client sees the shared file's checksum
+    st, d = other.req(tnfs.HASH, b"image.atr\0")
+    with open(t.path("image.atr"), "rb") as f:
+        shared = f.read()
+    t.check("shared file's checksum", (0, other.jobwait(d[0])[4]), hashed(t.path("image.atr"), shared))
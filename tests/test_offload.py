@@ -0,0 +1,119 @@
+"""STAT, OPEN and OPENDIRX run off the main loop unless the caches answer
+them: retransmits of one are absorbed, other sessions go on over UDP or
+TCP, and what its own session sends meanwhile waits its turn and runs in
+order once it's done"""
+
+import os
+import threading
+import time
+
+import tnfs
+
+SLOWFS = 500
+
+
+def setup(share):
+    os.mkdir(os.path.join(share, "slow"))
+    for i in range(1, 6):
+        with open(os.path.join(share, "slow", "f%d" % i), "w") as f:
+            f.write("x" * i)
+    os.mkdir(os.path.join(share, "slowdir"))
+    for name in ("a", "b", "c"):
+        open(os.path.join(share, "slowdir", name), "w").close()
+
+
+def replies(c, until):
+    out = []
+    while time.time() < until:
+        r = c.recv(timeout=max(0.01, until - time.time()))
+        if r is not None:
+            r.when = time.time()
+            out.append(r)
+    return out
+
+
+def run(t):
+    a = tnfs.Client(t.port, timeout=10)
+    b = tnfs.Client(t.port, timeout=10)
+    a.mount()
+    b.mount()
+
+    # even the first, while a cached one is answered at once
+    seq = a.next_seq()
+    a.send(seq, tnfs.STAT, b"slow/f1\0")
+    time.sleep(0.05)
+    t.check("another session meanwhile", b.stat(b"readme.txt"), (0, 6))
+    t.check("before the slow one", a.recv(timeout=0.01), None)
+    r = a.recv(timeout=5)
+    t.check("slow STAT", (r.seqno, r.status), (seq, 0))
+    start = time.time()
+    t.check("cached STAT", a.stat(b"slow/f1"), (0, 1))
+    t.check("answered from the cache", time.time() - start < 0.25, True)
+
+    # retransmitted while it runs, with another client asking meanwhile
+    seq = a.next_seq()
+    start = time.time()
+
+    def retransmit():
+        for i in range(3):
+            a.send(seq, tnfs.STAT, b"slow/f2\0")
+            time.sleep(0.1)
+    th = threading.Thread(target=retransmit)
+    th.start()
+    time.sleep(0.1)
+    bseq = b.next_seq()
+    b.send(bseq, tnfs.STAT, b"big.bin\0")
+    time.sleep(0.05)
+    b.send(b.next_seq(), tnfs.STAT, b"readme.txt\0")
+    got = []
+    tb = threading.Thread(target=lambda: got.extend(replies(b, start + 1.5)))
+    tb.start()
+    ra = replies(a, start + 1.5)
+    th.join()
+    tb.join()
+    t.check("slow one answered once", [(r.seqno, r.status) for r in ra], [(seq, 0)])
+    t.check("the others answered", [(r.seqno, r.status) for r in got],
+        [(bseq, 0), ((bseq + 1) & 0xFF, 0)])
+    t.check("the others not held up", bool(ra and got) and got[-1].when < ra[0].when, True)
+
+    a.send(seq, tnfs.STAT, b"slow/f2\0")
+    r = a.recv(timeout=2)
+    t.check("retransmit once done gets the reply", (r.seqno, r.status), (seq, 0))
+
+    # its own session's next request waits for it
+    seq = a.next_seq()
+    a.send(seq, tnfs.STAT, b"slow/f5\0")
+    time.sleep(0.1)
+    nseq = a.next_seq()
+    a.send(nseq, tnfs.STAT, b"readme.txt\0")
+    ra = replies(a, time.time() + 1.5)
+    t.check("same session in order", [(r.seqno, r.status) for r in ra], [(seq, 0), (nseq, 0)])
+
+    # TCP while one runs: requests, a new connection, one that goes away
+    tc = tnfs.Client(t.port, tcp=True, timeout=10)
+    tc.mount()
+    gone = tnfs.Client(t.port, tcp=True)
+    gone.mount()
+    seq = a.next_seq()
+    a.send(seq, tnfs.STAT, b"slow/f3\0")
+    time.sleep(0.2)
+    tc.send(tc.next_seq(), tnfs.STAT, b"big.bin\0")
+    gone.send(gone.next_seq(), tnfs.STAT, b"big.bin\0")
+    gone.close()
+    late = tnfs.Client(t.port, tcp=True, timeout=10)
+    st, d = late.mount()
+    t.check("TCP connection accepted meanwhile", st, 0)
+    r = tc.recv(timeout=5)
+    t.check("TCP request answered", r.status, 0)
+    t.check("while the slow one runs", a.recv(timeout=0.05), None)
+    r = a.recv(timeout=5)
+    t.check("slow one done", (r.seqno, r.status), (seq, 0))
+    t.check("TCP still fine", tc.stat(b"readme.txt"), (0, 6))
+    t.check("new connection works", late.stat(b"readme.txt"), (0, 6))
+
+    # a slow listing
+    st, h, count = a.opendirx(b"slowdir")
+    t.check("slow OPENDIRX", (st, count), (0, 3))
+    t.check("READDIRX", sorted(e[3] for e in a.readdirx_all(h)), ["a", "b", "c"])
+    a.closedir(h)
+    t.check("slow OPEN", a.open(b"slow/f4")[0], 0)
@@ -0,0 +1,65 @@
+"""Copy-on-write overlays: writes land in an image per client and file,
+whatever name the file is opened by, and every handle sees it grow"""
+
+import os
+
+import tnfs
+
+ARGS = ["-o", "{tmp}/ovl"]
+
+
+def setup(share):
+    os.mkdir(os.path.join(os.path.dirname(share), "ovl"))
+    os.mkdir(os.path.join(share, "ovtest"))
+    with open(os.path.join(share, "ovtest", "img.atr"), "wb") as f:
+        f.write(b"." * 1000)
+    os.symlink("img.atr", os.path.join(share, "ovtest", "alias.atr"))
+    os.symlink("ovtest", os.path.join(share, "ovlink"))
+
+
+def run(t):
+    c = tnfs.Client(t.port)
+    c.mount()
+
+    # one image, by whichever name it's written
+    st, fd = c.open(b"ovtest/alias.atr", tnfs.O_RDWR)
+    t.check("open through a link", st, 0)
+    c.write(fd, b"VIA-ALIAS")
+    c.close_file(fd)
+    st, fd = c.open(b"ovlink/img.atr", tnfs.O_RDWR)
+    t.check("open through a directory link", st, 0)
+    c.lseek(fd, 9)
+    c.write(fd, b"+LINK")
+    c.close_file(fd)
+    st, fd = c.open(b"ovtest/img.atr")
+    t.check("one overlay", c.read(fd, 14), b"VIA-ALIAS+LINK")
+    c.close_file(fd)
+    ovl = os.path.join(t.tmp, "ovl")
+    t.check("overlay files", sorted(os.path.relpath(os.path.join(d, f), ovl)
+        for d, _, files in os.walk(ovl) for f in files),
+        ["127.0.0.1/data/ovtest/img.atr", "127.0.0.1/map/ovtest/img.atr"])
+    with open(t.path("ovtest/img.atr"), "rb") as f:
+        t.check("shared file untouched", f.read(), b"." * 1000)
+
+    # growth through one handle, seen through another
+    st, w = c.open(b"ovtest/img.atr", tnfs.O_RDWR)
+    st, r = c.open(b"ovtest/img.atr")
+    t.check("end before", c.lseek(r, 0, 2), 1000)
+    c.lseek(w, 0, 2)
+    c.write(w, b"GROWN")
+    t.check("end after growth", c.lseek(r, 0, 2), 1005)
+    c.lseek(r, 1000)
+    t.check("read past the old end", c.read(r, 100), b"GROWN")
+    st, tr = c.open(b"ovtest/img.atr", tnfs.O_RDWR | tnfs.O_TRUNC)
+    c.close_file(tr)
+    t.check("end after truncating", c.lseek(r, 0, 2), 0)
+    c.lseek(r, 0)
+    t.check("nothing to read", c.read(r, 100), tnfs.EOF)
+    with open(t.path("ovtest/img.atr"), "rb") as f:
+        t.check("shared file still untouched", len(f.read()), 1000)
+
+    # another client sees the shared file
+    o = tnfs.Client(t.port, src="127.0.0.2")
+    o.mount()
+    st, fd = o.open(b"ovtest/img.atr")
+    t.check("other client", o.read(fd, 5), b".....")
@@ -0,0 +1,85 @@
+"""Paths resolve beneath the root over STAT and OPEN alike, with openat2()
+and RESOLVE_BENEATH. test_resolve_fallback runs the same without it"""
+
+import os
+
+import tnfs
+
+
+def setup(share):
+    tmp = os.path.dirname(share)
+    for d in ("outside", "share2"):
+        os.mkdir(os.path.join(tmp, d))
+        with open(os.path.join(tmp, d, "secret.txt"), "w") as f:
+            f.write("secret\n")
+    base = os.path.join(share, "rs")
+    os.makedirs(os.path.join(base, "in", "sub"))
+    with open(os.path.join(base, "in", "file.txt"), "w") as f:
+        f.write("inside\n")
+    links = {
+        "rel": "in/file.txt",
+        "dir_in": "in",
+        "abs_in": os.path.join(base, "in", "file.txt"),
+        "abs_out": os.path.join(tmp, "outside", "secret.txt"),
+        "rel_out": "../../outside/secret.txt",
+        "dir_out": os.path.join(tmp, "outside"),
+        "prefix": "../../share2/secret.txt",
+        "dangling": "in/nothing",
+        "dangling_out": os.path.join(tmp, "outside", "made.txt"),
+        "dangling_rel_out": "../../outside/made2.txt",
+    }
+    for name, target in links.items():
+        os.symlink(target, os.path.join(base, name))
+
+
+def stat_and_open(c, path):
+    """What STAT and OPEN make of a path: the size or status of each, and
+    what was read"""
+    st, size = c.stat(path)
+    ost, fd = c.open(path)
+    if ost != 0:
+        return st if st else size, ost
+    data = c.read(fd, 100)
+    c.close_file(fd)
+    return st if st else size, data
+
+
+def resolve_all(t, beneath):
+    c = tnfs.Client(t.port)
+    c.mount()
+    inside = (7, b"inside\n")
+    refused = (tnfs.EACCES, tnfs.EACCES)
+
+    # within the root
+    for path in (b"rs/in/file.txt", b"/rs/in/file.txt", b"rs//in/./file.txt",
+                 b"rs/rel", b"rs/dir_in/file.txt"):
+        t.check(path.decode(), stat_and_open(c, path), inside)
+    t.check("dangling", stat_and_open(c, b"rs/dangling"), (tnfs.ENOENT, tnfs.ENOENT))
+
+    # an absolute symlink is refused by RESOLVE_BENEATH, wherever it
+    # points; resolving the path finds it inside
+    t.check("absolute symlink inside", stat_and_open(c, b"rs/abs_in"),
+        refused if beneath else inside)
+
+    # never out of it, however it's asked for
+    for path in (b"rs/abs_out", b"rs/rel_out", b"rs/dir_out/secret.txt", b"rs/prefix",
+                 b"rs/dangling_out", b"rs/dangling_rel_out"):
+        t.check(path.decode(), stat_and_open(c, path), refused)
+    for path in (b"../readme.txt", b"rs/../readme.txt", b"rs/in/../../readme.txt",
+                 b"rs/dir_in/../rel", b"..", b"rs/.."):
+        t.check(path.decode(), stat_and_open(c, path), (tnfs.EINVAL, tnfs.EINVAL))
+
+    # nor created out of it
+    create = tnfs.O_WRONLY | tnfs.O_CREAT
+    st, fd = c.open(b"rs/dangling", create)
+    t.check("create through a dangling symlink", st, 0)
+    c.close_file(fd)
+    t.check("created inside", os.path.isfile(t.path("rs/in/nothing")), True)
+    for path in (b"rs/dangling_out", b"rs/dangling_rel_out", b"rs/dir_out/new.txt"):
+        t.check("create " + path.decode(), c.open(path, create)[0], tnfs.EACCES)
+    t.check("nothing made outside", sorted(os.listdir(os.path.join(t.tmp, "outside"))),
+        ["secret.txt"])
+
+
+def run(t):
+    resolve_all(t, True)
@@ -0,0 +1,18 @@
+"""Paths resolve beneath the root as in test_resolve, on a kernel without
+openat2(), where they're checked with realpath() instead"""
+
+import os
+
+import test_resolve
+
+NO_OPENAT2 = True
+
+
+def setup(share):
+    test_resolve.setup(share)
+
+
+def run(t):
+    test_resolve.resolve_all(t, False)
+    with open(os.path.join(t.tmp, "tnfsd.log")) as f:
+        t.check("without openat2()", "openat2() is not available" in f.read(), True)
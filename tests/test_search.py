@@ -0,0 +1,131 @@
+"""SEARCH: names matching a glob anywhere below a directory, from the
+index tnfsd builds with -s and keeps up to date as the tree changes"""
+
+import os
+import struct
+import time
+
+import tnfs
+
+ARGS = ["-s"]
+DIROPT_DIR_PATTERN = 0x08
+MANY = 300
+
+
+def setup(share):
+    for d in ("sr/games/arcade", "sr/games/puzzle", "sr/games/.hidden",
+            "sr/docs", "sr/many", "sr/games/arcade/pac"):
+        os.makedirs(os.path.join(share, d))
+    for f in ("games/arcade/pacman.atr", "games/arcade/galaxian.atr",
+            "games/arcade/pac/pacman.xex", "games/puzzle/tetris.xex",
+            "games/.hidden/secret.atr", "docs/README.TXT", "docs/pacman.txt"):
+        with open(os.path.join(share, "sr", f), "wb") as fh:
+            fh.write(b"x" * 10)
+    for i in range(MANY):
+        open(os.path.join(share, "sr", "many", "f%03d.dat" % i), "wb").close()
+
+
+def search(c, path, pattern, diropt=0, sortopt=0, maxresults=0):
+    """(status, count) and the paths found, in order"""
+    st, d = c.req(tnfs.SEARCH, bytes([diropt, sortopt]) +
+        struct.pack("<H", maxresults) + pattern + b"\0" + path + b"\0")
+    if st != 0:
+        return (st, None), None
+    h, count = d[0], struct.unpack("<H", d[1:3])[0]
+    names = [e[3] for e in c.readdirx_all(h)]
+    c.closedir(h)
+    return (st, count), names
+
+
+def found(c, path, pattern, **kw):
+    return sorted(search(c, path, pattern, **kw)[1] or [])
+
+
+def wait(get, want, timeout=3):
+    """What get() returns once it's want, or when it gives up; changes
+    made here reach the index by way of inotify, a moment later"""
+    end = time.time() + timeout
+    got = get()
+    while got != want and time.time() < end:
+        time.sleep(0.05)
+        got = get()
+    return got
+
+
+def run(t):
+    c = tnfs.Client(t.port)
+    c.mount()
+
+    # the index is built on a thread of its own after tnfsd starts
+    end = time.time() + 10
+    while search(c, b"sr", b"*.atr")[0][0] == tnfs.EAGAIN and time.time() < end:
+        time.sleep(0.05)
+
+    # with a run of three literal characters to look up, and without
+    t.check("trigram", found(c, b"sr", b"*pacman*"),
+        ["docs/pacman.txt", "games/arcade/pac/pacman.xex", "games/arcade/pacman.atr"])
+    t.check("case folded", found(c, b"sr", b"*readme*"), ["docs/README.TXT"])
+    t.check("no trigram", found(c, b"sr", b"*.x?x"),
+        ["games/arcade/pac/pacman.xex", "games/puzzle/tetris.xex"])
+    t.check("wildcards between every pair", found(c, b"sr", b"t*t*s*"), ["games/puzzle/tetris.xex"])
+    t.check("nothing literal", len(found(c, b"sr", b"*")), 6 + MANY)
+    t.check("no match", search(c, b"sr", b"*nothing*"), ((0, 0), []))
+    t.check("hidden skipped", "games/.hidden/secret.atr" in found(c, b"sr", b"*.atr"), False)
+    t.check("hidden asked for", "games/.hidden/secret.atr" in found(c, b"sr", b"*.atr", diropt=0x02),
+        True)
+    t.check("files only", found(c, b"sr", b"pac*"),
+        ["docs/pacman.txt", "games/arcade/pac/pacman.xex", "games/arcade/pacman.atr"])
+    t.check("directories by pattern", found(c, b"sr", b"pac*", diropt=DIROPT_DIR_PATTERN),
+        ["docs/pacman.txt", "games/arcade/pac", "games/arcade/pac/pacman.xex",
+         "games/arcade/pacman.atr"])
+
+    # relative to where it starts, and only below it
+    t.check("start below the root", found(c, b"sr/games/arcade", b"*pacman*"),
+        ["pac/pacman.xex", "pacman.atr"])
+    t.check("start with slashes", found(c, b"/sr//games/arcade/", b"*pacman*"),
+        ["pac/pacman.xex", "pacman.atr"])
+    m = tnfs.Client(t.port)
+    m.mount(b"/sr/games")
+    t.check("below a mount point", found(m, b"", b"*pacman*"),
+        ["arcade/pac/pacman.xex", "arcade/pacman.atr"])
+    t.check("a file to start from", search(c, b"sr/docs/README.TXT", b"*")[0][0] != 0, True)
+    t.check("nowhere to start from", search(c, b"sr/nope", b"*")[0][0], tnfs.ENOENT)
+
+    # more than a READDIRX page at a time, and no more than asked for
+    (st, count), names = search(c, b"sr/many", b"f*.dat")
+    t.check("paged", (st, count, names), (0, MANY, ["f%03d.dat" % i for i in range(MANY)]))
+    (st, count), names = search(c, b"sr/many", b"f*.dat", maxresults=50)
+    t.check("maxresults", (count, len(names), len(set(names))), (50, 50, 50))
+    (st, count), names = search(c, b"sr/many", b"f*.dat", sortopt=0x04)
+    t.check("sorted descending", names, ["f%03d.dat" % i for i in reversed(range(MANY))])
+
+    # kept up to date as the tree changes, where it can be watched
+    with open(os.path.join(t.tmp, "tnfsd.log")) as f:
+        if "refreshing every" in f.read():
+            t.skip("changes", "rebuilt every SEARCH_REFRESH seconds without inotify")
+            return
+    with open(t.path("sr/docs/pacman2.txt"), "wb") as f:
+        f.write(b"new")
+    t.check("created", wait(lambda: found(c, b"sr/docs", b"*pacman*"),
+        ["pacman.txt", "pacman2.txt"]), ["pacman.txt", "pacman2.txt"])
+    os.unlink(t.path("sr/docs/pacman.txt"))
+    t.check("removed", wait(lambda: found(c, b"sr/docs", b"*pacman*"), ["pacman2.txt"]),
+        ["pacman2.txt"])
+    os.rename(t.path("sr/docs/pacman2.txt"), t.path("sr/games/puzzle/mspacman.atr"))
+    t.check("renamed", wait(lambda: found(c, b"sr", b"*pacman*"),
+        ["games/arcade/pac/pacman.xex", "games/arcade/pacman.atr", "games/puzzle/mspacman.atr"]),
+        ["games/arcade/pac/pacman.xex", "games/arcade/pacman.atr", "games/puzzle/mspacman.atr"])
+    os.makedirs(t.path("sr/new/deeper"))
+    with open(t.path("sr/new/deeper/pacman.bas"), "wb") as f:
+        f.write(b"10 GOTO 10\n")
+    t.check("a new directory and what's in it",
+        wait(lambda: found(c, b"sr/new", b"*pacman*"), ["deeper/pacman.bas"]), ["deeper/pacman.bas"])
+    with open(t.path("sr/new/deeper/pacman.lst"), "wb") as f:
+        f.write(b"")
+    t.check("and changes in that", wait(lambda: found(c, b"sr/new", b"*pacman*"),
+        ["deeper/pacman.bas", "deeper/pacman.lst"]), ["deeper/pacman.bas", "deeper/pacman.lst"])
+    os.rename(t.path("sr/new"), t.path("sr/moved"))
+    t.check("a directory renamed", wait(lambda: (found(c, b"sr", b"*pacman.l*")),
+        ["moved/deeper/pacman.lst"]), ["moved/deeper/pacman.lst"])
+    t.check("searched from its new name", wait(lambda: found(c, b"sr/moved", b"*.lst"),
+        ["deeper/pacman.lst"]), ["deeper/pacman.lst"])
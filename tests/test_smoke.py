@@ -0,0 +1,47 @@
+"""Mounting, listing, STAT and READ, over UDP and TCP"""
+
+import os
+
+import tnfs
+
+
+def setup(share):
+    for d in ("Alpha", "beta", "games"):
+        os.mkdir(os.path.join(share, d))
+    with open(os.path.join(share, ".hidden"), "w") as f:
+        f.write("h")
+    for i in (1, 2, 10, 11, 20):
+        with open(os.path.join(share, "games", "Game_%d.atr" % i), "w") as f:
+            f.write("x" * i)
+
+
+def check(t, c, how):
+    st, d = c.mount()
+    t.check(how + " mount", st, 0)
+
+    t.check(how + " default listing", c.listdir(b"/"),
+        ["Alpha", "beta", "games", "big.bin", "readme.txt"])
+    t.check(how + " not folders first", c.listdir(b"/", diropt=0x01),
+        ["Alpha", "beta", "big.bin", "games", "readme.txt"])
+    t.check(how + " hidden shown", ".hidden" in c.listdir(b"/", diropt=0x02), True)
+    t.check(how + " descending", c.listdir(b"/", sortopt=0x04),
+        ["games", "beta", "Alpha", "readme.txt", "big.bin"])
+    t.check(how + " pattern", c.listdir(b"/games", pattern=b"*_1?.atr"),
+        ["Game_10.atr", "Game_11.atr"])
+    t.check(how + " size sort", c.listdir(b"/games", sortopt=0x10),
+        ["Game_1.atr", "Game_2.atr", "Game_10.atr", "Game_11.atr", "Game_20.atr"])
+
+    t.check(how + " stat", c.stat(b"/readme.txt"), (0, 6))
+    t.check(how + " stat missing", c.stat(b"/nope")[0], 0x02)
+
+    st, fd = c.open(b"/big.bin")
+    t.check(how + " open", st, 0)
+    with open(t.path("big.bin"), "rb") as f:
+        t.check(how + " read", c.readall(fd), f.read())
+    t.check(how + " close", c.close_file(fd), 0)
+    t.check(how + " umount", c.umount(), 0)
+
+
+def run(t):
+    check(t, tnfs.Client(t.port), "udp")
+    check(t, tnfs.Client(t.port, tcp=True), "tcp")
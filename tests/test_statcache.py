@@ -0,0 +1,90 @@
+"""The statcache: what STAT finds, including that a file isn't there, is
+reused until the server or anything else changes it, or for STATCACHE_TTL
+seconds at most"""
+
+import gzip
+import os
+import time
+
+import tnfs
+
+SLOWFS = 500
+TTL = 2     # STATCACHE_TTL
+
+
+def setup(share):
+    os.mkdir(os.path.join(share, "sc"))
+    with open(os.path.join(share, "sc", "gone.txt"), "w") as f:
+        f.write("x")
+    with open(os.path.join(share, "sc", "linked.txt"), "w") as f:
+        f.write("12345")
+    # changed through a link in a directory nobody watches
+    other = os.path.join(os.path.dirname(share), "other")
+    os.mkdir(other)
+    os.link(os.path.join(share, "sc", "linked.txt"), os.path.join(other, "linked.txt"))
+    with gzip.open(os.path.join(share, "sc", "present.atr.gz"), "wb") as f:
+        f.write(b"a" * 100)
+    os.mkdir(os.path.join(share, "slowsc"))
+    with open(os.path.join(share, "slowsc", "f.txt"), "w") as f:
+        f.write("1")
+    with open(os.path.join(share, "slowsc", "f.new"), "w") as f:
+        f.write("0123456789")
+
+
+def run(t):
+    c = tnfs.Client(t.port, timeout=5)
+    c.mount()
+    create = tnfs.O_WRONLY | tnfs.O_CREAT
+
+    # a miss, then the server creates the file
+    t.check("missing", c.stat(b"sc/a.txt"), (tnfs.ENOENT, None))
+    st, fd = c.open(b"sc/a.txt", create)
+    c.write(fd, b"abc")
+    c.close_file(fd)
+    t.check("created by the server", c.stat(b"sc/a.txt"), (0, 3))
+
+    # a miss, then something else creates it, and removes another
+    start = time.time()
+    t.check("missing too", c.stat(b"sc/b.txt"), (tnfs.ENOENT, None))
+    t.check("there", c.stat(b"sc/gone.txt"), (0, 1))
+    with open(t.path("sc/b.txt"), "w") as f:
+        f.write("abcd")
+    os.unlink(t.path("sc/gone.txt"))
+    time.sleep(0.2)
+    t.check("created outside it", c.stat(b"sc/b.txt"), (0, 4))
+    t.check("removed outside it", c.stat(b"sc/gone.txt"), (tnfs.ENOENT, None))
+    t.check("well before the TTL", time.time() - start < TTL, True)
+
+    # a change nothing reports lasts until the TTL
+    t.check("before a silent change", c.stat(b"sc/linked.txt"), (0, 5))
+    with open(os.path.join(t.tmp, "other", "linked.txt"), "a") as f:
+        f.write("678")
+    t.check("silent change unseen", c.stat(b"sc/linked.txt"), (0, 5))
+    time.sleep(TTL + 0.5)
+    t.check("seen after the TTL", c.stat(b"sc/linked.txt"), (0, 8))
+
+    # replaced while its stat() ran: the generation keeps the old result
+    # from being stored
+    seq = c.next_seq()
+    c.send(seq, tnfs.STAT, b"slowsc/f.txt\0")
+    time.sleep(0.2)
+    os.rename(t.path("slowsc/f.new"), t.path("slowsc/f.txt"))
+    r = c.recv(timeout=5)
+    t.check("answered as it was", (r.seqno, r.status), (seq, 0))
+    t.check("not kept", c.stat(b"slowsc/f.txt"), (0, 10))
+
+    # a compressed image is served under another name, which a change
+    # to it drops as well
+    if c.stat(b"sc/present.atr")[0] != 0:
+        t.skip("compressed names", "built without GZ")
+        return
+    t.check("missing image", c.stat(b"sc/new.atr"), (tnfs.ENOENT, None))
+    with gzip.open(t.path("sc/new.atr.gz"), "wb") as f:
+        f.write(b"b" * 200)
+    time.sleep(0.2)
+    t.check("compressed outside it", c.stat(b"sc/new.atr"), (0, 200))
+    t.check("missing image too", c.stat(b"sc/srv.atr"), (tnfs.ENOENT, None))
+    st, fd = c.open(b"sc/srv.atr.gz", create)
+    c.write(fd, gzip.compress(b"c" * 300))
+    c.close_file(fd)
+    t.check("compressed by the server", c.stat(b"sc/srv.atr"), (0, 300))
@@ -0,0 +1,60 @@
+"""Message sizes negotiated at MOUNT over TCP, and how a WRITE that
+arrives in pieces is put back together"""
+
+import os
+import struct
+import time
+
+import tnfs
+
+
+def write_in_pieces(c, fd, data, pieces):
+    msg = c.packet(c.next_seq(), tnfs.WRITE, bytes([fd]) + struct.pack("<H", len(data)) + data)
+    step = len(msg) // pieces + 1
+    for i in range(0, len(msg), step):
+        c.s.sendall(msg[i:i + step])
+        time.sleep(0.02)
+    r = c.recv()
+    return r.status, struct.unpack("<H", r.data[:2])[0] if r.status == 0 else None
+
+
+def run(t):
+    os.mkdir(t.path("wt"))
+    with open(t.path("big.bin"), "rb") as f:
+        big = f.read()
+
+    u = tnfs.Client(t.port)
+    t.check("UDP stays at 532", u.mount(msgsz=65535), (0, b"\x02\x01\xe8\x03\x14\x02"))
+    old = tnfs.Client(t.port, tcp=True)
+    t.check("TCP without asking", old.mount(), (0, b"\x02\x01\xe8\x03"))
+    c = tnfs.Client(t.port, tcp=True)
+    t.check("TCP granted", c.mount(msgsz=65535), (0, b"\x02\x01\xe8\x03\xff\xff"))
+
+    st, fd = c.open(b"big.bin")
+    data = c.read(fd, 60000)
+    t.check("large READ", data, big[:60000])
+    c.close_file(fd)
+
+    st, fd = c.open(b"wt/out.bin", tnfs.O_WRONLY | tnfs.O_CREAT)
+    t.check("large WRITE in pieces", write_in_pieces(c, fd, big[:50000], 7), (0, 50000))
+    c.close_file(fd)
+    with open(t.path("wt/out.bin"), "rb") as f:
+        t.check("written", f.read(), big[:50000])
+
+    # a WRITE saying it's longer than what was sent, without having
+    # negotiated, or longer than was negotiated, is taken as it came and
+    # the request after it still runs
+    for how, client in (("not negotiated", old), ("negotiated", c)):
+        st, fd = client.open(b"wt/short.bin", tnfs.O_WRONLY | tnfs.O_CREAT)
+        claim = 200 if client is old else 65535
+        client.send(client.next_seq(), tnfs.WRITE, bytes([fd]) + struct.pack("<H", claim) + b"x" * 10)
+        time.sleep(0.2)
+        client.send(client.next_seq(), tnfs.STAT, b"readme.txt\0")
+        got = []
+        while len(got) < 2:
+            r = client.recv(timeout=2)
+            if r is None:
+                break
+            got.append(r.cmd)
+        t.check("short WRITE then STAT, " + how, got, [tnfs.WRITE, tnfs.STAT])
+        client.close_file(fd)
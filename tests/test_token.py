@@ -0,0 +1,124 @@
+"""OPENDIRX tokens: a client that hands back the token of the view it
+has is told nothing changed without a handle being opened, any change to
+what READDIRX would return changes the token, and a request without
+TNFS_DIROPT_TOKEN gets the same reply it always did"""
+
+import os
+import struct
+import time
+
+import tnfs
+
+DIROPT_TOKEN = 0x10
+DIRSORT_DESCENDING = 0x04
+DIRSORT_SIZE = 0x10
+UNCHANGED = 0xFF
+MAX_DHND_PER_CONN = 8
+
+
+def setup(share):
+    d = os.path.join(share, "tok")
+    os.makedirs(os.path.join(d, "sub"))
+    for name, size in (("a.atr", 100), ("b.atr", 300), ("c.xex", 200)):
+        with open(os.path.join(d, name), "wb") as f:
+            f.write(b"." * size)
+
+
+def opendirx(c, path, token=0, pattern=b"", diropt=0, sortopt=0, maxresults=0):
+    """(status, handle, count, token) with TNFS_DIROPT_TOKEN"""
+    st, d = c.req(tnfs.OPENDIRX, bytes([diropt | DIROPT_TOKEN, sortopt]) +
+        struct.pack("<HI", maxresults, token) + pattern + b"\0" + path + b"\0")
+    if st != 0:
+        return st, None, None, None
+    return (st, d[0]) + struct.unpack("<HI", d[1:7])
+
+
+def token(c, path, **kw):
+    """The token of a view, leaving no handle open"""
+    st, h, n, tok = opendirx(c, path, **kw)
+    c.closedir(h)
+    return tok
+
+
+def wait_change(c, path, old, **kw):
+    """The token once it's no longer old; changes made here reach tnfsd a
+    moment later"""
+    end = time.time() + 3
+    tok = token(c, path, **kw)
+    while tok == old and time.time() < end:
+        time.sleep(0.05)
+        tok = token(c, path, **kw)
+    return tok
+
+
+def run(t):
+    c = tnfs.Client(t.port)
+    c.mount()
+
+    st, h, n, tok = opendirx(c, b"tok")
+    t.check("open with a token", (st, n), (0, 4))
+    t.check("token not zero", tok != 0, True)
+    entries = c.readdirx_all(h)
+    c.closedir(h)
+
+    # the same view again, as often as there are handles and then some
+    for i in range(MAX_DHND_PER_CONN * 3):
+        st, h, n, again = opendirx(c, b"tok", token=tok)
+        if (st, h, n, again) != (0, UNCHANGED, 4, tok):
+            break
+    t.check("unchanged", (st, h, n, again), (0, UNCHANGED, 4, tok))
+    st, h, n, again = opendirx(c, b"tok")
+    t.check("token 0 always gets a handle", (st, h != UNCHANGED), (0, True))
+    c.closedir(h)
+    handles = [c.opendirx(b"tok")[1] for i in range(MAX_DHND_PER_CONN)]
+    t.check("no handle kept for unchanged views", sorted(handles), list(range(MAX_DHND_PER_CONN)))
+    for h in handles:
+        c.closedir(h)
+    st, h, n, other = opendirx(c, b"tok", token=tok ^ 1)
+    t.check("a stale token gets a handle", (st, h != UNCHANGED, other), (0, True, tok))
+    t.check("and the same entries", c.readdirx_all(h), entries)
+    c.closedir(h)
+
+    # the view is part of the token
+    views = {
+        "descending": dict(sortopt=DIRSORT_DESCENDING),
+        "by size": dict(sortopt=DIRSORT_SIZE),
+        "pattern": dict(pattern=b"*.atr"),
+        "maxresults": dict(maxresults=2),
+        "files mixed in": dict(diropt=0x01),
+    }
+    for what, kw in views.items():
+        t.check("token of the view %s" % what, token(c, b"tok", **kw) != tok, True)
+    t.check("tokens of different views differ",
+        len(set(token(c, b"tok", **kw) for kw in views.values())), len(views))
+
+    # and so is everything READDIRX returns
+    with open(t.path("tok/b.atr"), "ab") as f:
+        f.write(b"+")
+    new = wait_change(c, b"tok", tok)
+    t.check("size changes the token", new != tok, True)
+    st = os.stat(t.path("tok/a.atr"))
+    os.utime(t.path("tok/a.atr"), (st.st_atime, st.st_mtime - 1000))
+    t.check("mtime changes the token", wait_change(c, b"tok", new) != new, True)
+    new = token(c, b"tok")
+    pat = token(c, b"tok", pattern=b"*.xex")
+    os.rename(t.path("tok/a.atr"), t.path("tok/d.atr"))
+    t.check("rename changes the token", wait_change(c, b"tok", new) != new, True)
+    t.check("but not of a view it isn't in", token(c, b"tok", pattern=b"*.xex"), pat)
+
+    # without TNFS_DIROPT_TOKEN, what the reply always was
+    st, d = c.req(tnfs.OPENDIRX, b"\0\0\0\0" + b"\0" + b"tok" + b"\0")
+    t.check("plain reply", (st, len(d), d[1:3]), (0, 3, struct.pack("<H", 4)))
+    plain = d[0]
+    st, h, n, tok = opendirx(c, b"tok")
+    pages = []
+    for handle in (plain, h):
+        st, page = c.req(tnfs.READDIRX, bytes([handle, 0]))
+        pages.append((st, page))
+        c.closedir(handle)
+    t.check("same pages either way", pages[0], pages[1])
+    st, d = c.req(tnfs.OPENDIRX, b"\0\0\0\0" + b"*.atr\0" + b"tok\0")
+    t.check("pattern where a token would be", (st, len(d), d[1:3]), (0, 3, struct.pack("<H", 3)))
+    c.closedir(d[0])
+    t.check("token too short", c.req(tnfs.OPENDIRX, bytes([DIROPT_TOKEN, 0, 0, 0, 0, 0]) + b"\0")[0],
+        tnfs.EINVAL)
@@ -0,0 +1,84 @@
+"""RMTREE and COPYTREE, run as jobs and followed with JOBSTATUS"""
+
+import os
+import subprocess
+
+import tnfs
+
+
+def setup(share):
+    tree = os.path.join(share, "tt", "tree")
+    for d in ("a/b/c", "ro", "empty"):
+        os.makedirs(os.path.join(tree, d))
+    with open(os.path.join(tree, "a", "f1"), "wb") as f:
+        f.write(os.urandom(5000))
+    with open(os.path.join(tree, "a", "b", "big"), "wb") as f:
+        f.write(os.urandom(300000))
+    with open(os.path.join(tree, "ro", "r.txt"), "w") as f:
+        f.write("ro\n")
+    os.chmod(os.path.join(tree, "ro"), 0o555)
+    os.symlink("/etc", os.path.join(tree, "out"))
+    os.symlink("a/f1", os.path.join(tree, "rel"))
+    os.makedirs(os.path.join(share, "mr", "sub", "inner"))
+
+
+def copytree(c, src, dst, flags=0):
+    st, d = c.req(tnfs.COPYTREE, bytes([flags]) + src + b"\0" + dst + b"\0")
+    return st, (d[0] if st == 0 else None)
+
+
+def rmtree(c, path):
+    st, d = c.req(tnfs.RMTREE, path + b"\0")
+    return st, (d[0] if st == 0 else None)
+
+
+def same(a, b):
+    return subprocess.run(["diff", "-r", "--no-dereference", a, b],
+        capture_output=True).returncode == 0
+
+
+def run(t):
+    c = tnfs.Client(t.port)
+    c.mount()
+    other = tnfs.Client(t.port, src="127.0.0.2")
+    other.mount()
+
+    st, h = copytree(c, b"tt/tree", b"tt/copy")
+    t.check("COPYTREE", st, 0)
+    t.check("copied", c.jobwait(h)[:2], (0, 0))
+    t.check("same tree", same(t.path("tt/tree"), t.path("tt/copy")), True)
+    t.check("symlink copied as a link", os.readlink(t.path("tt/copy/out")), "/etc")
+    t.check("exists", copytree(c, b"tt/tree", b"tt/copy")[0], 0x0B)
+    t.check("into itself", copytree(c, b"tt/tree", b"tt/tree/a/inner")[0], tnfs.EINVAL)
+    t.check("missing", copytree(c, b"tt/nope", b"tt/x")[0], 0x02)
+    t.check("outside the root", copytree(c, b"../etc", b"tt/x")[0], tnfs.EINVAL)
+    t.check("the root", copytree(c, b"/", b"tt/x")[0], tnfs.EINVAL)
+    t.check("RMTREE of the root", rmtree(c, b"/")[0], tnfs.EINVAL)
+
+    os.symlink(t.path("tt/copy"), t.path("tt/lnk"))
+    st, h = rmtree(c, b"tt/lnk")
+    c.jobwait(h)
+    t.check("RMTREE of a link removes the link",
+        (os.path.lexists(t.path("tt/lnk")), os.path.isdir(t.path("tt/copy"))), (False, True))
+
+    st, h = rmtree(c, b"tt/copy")
+    t.check("RMTREE", st, 0)
+    t.check("another session can't follow it", other.req(tnfs.JOBSTATUS, bytes([h]))[0], tnfs.EBADF)
+    t.check("removed", c.jobwait(h)[:2], (0, 0))
+    t.check("gone", os.path.exists(t.path("tt/copy")), False)
+
+    st, h = copytree(c, b"tt/tree", b"tt/moved", 0x01)
+    t.check("move", c.jobwait(h)[:2], (0, 0))
+    t.check("moved", (os.path.exists(t.path("tt/tree")), os.path.isdir(t.path("tt/moved/a/b/c"))),
+        (False, True))
+
+    # nor the directory a session is mounted at, however it's named
+    m = tnfs.Client(t.port)
+    m.mount(b"/mr/sub")
+    for path in (b"/", b"", b"//", b"/."):
+        t.check("RMTREE of the mount point as %r" % path, rmtree(m, path)[0], tnfs.EINVAL)
+        t.check("COPYTREE of the mount point as %r" % path,
+            copytree(m, path, b"/moved", 0x01)[0], tnfs.EINVAL)
+    t.check("mount point kept", os.path.isdir(t.path("mr/sub/inner")), True)
+    st, h = copytree(m, b"/inner", b"/inner2")
+    t.check("copy below it", (st, m.jobwait(h)[:2]), (0, (0, 0)))
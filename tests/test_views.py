@@ -0,0 +1,213 @@
+"""Cached directory listings shared between handles: every sort order,
+folders first or not and maxresults is a view of the one listing, a
+change to the directory is seen by handles opened after it, and the
+READDIRX pages kept for a view are what encoding it afresh would give"""
+
+import os
+import time
+
+import tnfs
+
+ARGS = ["-s"]
+DIROPT_NO_FOLDERSFIRST = 0x01
+DIRSORT_CASE = 0x02
+DIRSORT_DESCENDING = 0x04
+DIRSORT_MODIFIED = 0x08
+DIRSORT_SIZE = 0x10
+PAGED = 300
+
+FILES = ["Alpha.atr", "beta.xex", "Gamma.bas", "delta.atr", "epsilon.car",
+    "Zeta.atr", "eta.cas", "THETA.xex", "iota.atr", "kappa.com"]
+DIRS = ["games", "Demos"]
+
+VIEWS = {
+    "by name": 0,
+    "descending": DIRSORT_DESCENDING,
+    "case sensitive": DIRSORT_CASE,
+    "case sensitive descending": DIRSORT_CASE | DIRSORT_DESCENDING,
+    "by modification time": DIRSORT_MODIFIED,
+    "newest first": DIRSORT_MODIFIED | DIRSORT_DESCENDING,
+}
+
+
+def setup(share):
+    d = os.path.join(share, "vw")
+    os.mkdir(d)
+    # every size and time different, so no order leans on how ties fall
+    for i, name in enumerate(FILES):
+        with open(os.path.join(d, name), "wb") as f:
+            f.write(b"." * ((i * 7) % len(FILES) * 100 + 1))
+        os.utime(os.path.join(d, name),
+            (1500000000, 1500000000 + (i * 3) % len(FILES) * 60))
+    for i, name in enumerate(DIRS):
+        os.mkdir(os.path.join(d, name))
+        os.utime(os.path.join(d, name), (1500000000, 1400000000 + i))
+    open(os.path.join(d, ".hidden"), "w").close()
+
+    # a flat directory of names of every length, over several pages
+    d = os.path.join(share, "pg")
+    os.mkdir(d)
+    for i in range(PAGED):
+        with open(os.path.join(d, "%03d%s" % (i, "n" * (i % 40))), "wb") as f:
+            f.write(b"x" * i)
+
+
+def model(t, sortopt=0):
+    """The names READDIRX should give with folders first, in order"""
+    dirs, files = [], []
+    for name in os.listdir(t.path("vw")):
+        if name.startswith("."):
+            continue
+        st = os.stat(t.path("vw/" + name))
+        isdir = os.path.isdir(t.path("vw/" + name))
+        if sortopt & DIRSORT_SIZE:
+            key = 0 if isdir else st.st_size
+        elif sortopt & DIRSORT_MODIFIED:
+            key = int(st.st_mtime)
+        elif sortopt & DIRSORT_CASE:
+            key = name.encode()
+        else:
+            key = name.lower()
+        (dirs if isdir else files).append((key, name))
+    rev = bool(sortopt & DIRSORT_DESCENDING)
+    return ([n for k, n in sorted(dirs, reverse=rev)] +
+        [n for k, n in sorted(files, reverse=rev)])
+
+
+def readdirx(c, h, count=0):
+    """(status, raw reply) of one READDIRX"""
+    return c.req(tnfs.READDIRX, bytes([h, count]))
+
+
+def names(page):
+    """The names in a READDIRX reply"""
+    out, p = [], 4
+    for i in range(page[0]):
+        end = page.index(b"\0", p + 13)
+        out.append(page[p + 13:end].decode())
+        p = end + 1
+    return out
+
+
+def pages(c, h, count=0):
+    """Every READDIRX reply for a handle, raw, and the handle closed"""
+    out = []
+    while True:
+        st, d = readdirx(c, h, count)
+        if st != 0:
+            break
+        out.append(d)
+        if d[1] & 1:
+            break
+    c.closedir(h)
+    return out
+
+
+def listed(c, path, **kw):
+    """The names of a view, leaving no handle open"""
+    st, h, n = c.opendirx(path, **kw)
+    got = [e[3] for e in c.readdirx_all(h)]
+    c.closedir(h)
+    return got
+
+
+def searched(c, path, count=0):
+    """The raw READDIRX replies for every name below path"""
+    end = time.time() + 10
+    st, d = c.req(tnfs.SEARCH, b"\0\0\0\0*\0" + path + b"\0")
+    # the index is built on a thread of its own after tnfsd starts
+    while st == tnfs.EAGAIN and time.time() < end:
+        time.sleep(0.05)
+        st, d = c.req(tnfs.SEARCH, b"\0\0\0\0*\0" + path + b"\0")
+    return pages(c, d[0], count) if st == 0 else ("status", st)
+
+
+def wait(get, want, timeout=3):
+    """What get() returns once it's want, or when it gives up"""
+    end = time.time() + timeout
+    got = get()
+    while got != want and time.time() < end:
+        time.sleep(0.05)
+        got = get()
+    return got
+
+
+def run(t):
+    c = tnfs.Client(t.port)
+    c.mount()
+
+    # all open on the one listing at once, read a few entries at a time in turn
+    reading = {}
+    for what, sortopt in VIEWS.items():
+        st, h, n = c.opendirx(b"vw", sortopt=sortopt)
+        reading[what] = (h, [])
+    while reading:
+        for what, (h, got) in list(reading.items()):
+            st, d = readdirx(c, h, 3)
+            if st != 0:
+                c.closedir(h)
+                del reading[what]
+                t.check("view " + what, got, model(t, VIEWS[what]))
+                continue
+            got += names(d)
+
+    # by size, where the directories tie
+    got = listed(c, b"vw", sortopt=DIRSORT_SIZE)
+    t.check("view by size", (sorted(got[:2]), got[2:]),
+        (sorted(DIRS), model(t, DIRSORT_SIZE)[2:]))
+    got = listed(c, b"vw", sortopt=DIRSORT_SIZE | DIRSORT_DESCENDING)
+    t.check("view largest first", (sorted(got[:2]), got[2:]),
+        (sorted(DIRS), model(t, DIRSORT_SIZE | DIRSORT_DESCENDING)[2:]))
+
+    t.check("view with folders mixed in", listed(c, b"vw", diropt=DIROPT_NO_FOLDERSFIRST),
+        sorted(DIRS + FILES, key=str.lower))
+    t.check("view with folders mixed in, descending",
+        listed(c, b"vw", diropt=DIROPT_NO_FOLDERSFIRST, sortopt=DIRSORT_DESCENDING),
+        sorted(DIRS + FILES, key=str.lower, reverse=True))
+
+    # maxresults takes the first so many as listed, then sorts those
+    full = model(t)
+    for most in (1, 5, 12, 100):
+        st, h, n = c.opendirx(b"vw", maxresults=most)
+        got = [e[3] for e in c.readdirx_all(h)]
+        c.closedir(h)
+        t.check("view of at most %d" % most,
+            (n, len(got), len(set(got)), got == [x for x in full if x in got]),
+            (min(most, len(full)),) * 3 + (True,))
+
+    # a change is seen by the handles opened after it, while one already
+    # open reads on through what it had
+    st, before, n = c.opendirx(b"vw", sortopt=DIRSORT_DESCENDING)
+    first = names(readdirx(c, before, 2)[1])
+    with open(t.path("vw/zzz.new"), "wb") as f:
+        f.write(b"new")
+    os.unlink(t.path("vw/Alpha.atr"))
+    want = model(t, DIRSORT_DESCENDING)
+    t.check("changed listing", wait(lambda: listed(c, b"vw", sortopt=DIRSORT_DESCENDING), want),
+        want)
+    t.check("has the change", ("zzz.new" in want, "Alpha.atr" in want), (True, False))
+    t.check("other views changed too", wait(lambda: listed(c, b"vw"), model(t)), model(t))
+    rest = [e[3] for e in c.readdirx_all(before)]
+    c.closedir(before)
+    t.check("open handle reads on", first + rest,
+        sorted(DIRS, key=str.lower, reverse=True) + sorted(FILES, key=str.lower, reverse=True))
+
+    # pages served from the listing are what they'd be encoded afresh: a
+    # second handle on the view is given the first one's pages, and SEARCH,
+    # whose results are never shared, encodes the same entries anew
+    tc = tnfs.Client(t.port, tcp=True)
+    tc.mount(msgsz=4096)
+    for what, cl, count in (("as many as fit", c, 0), ("7 at a time", c, 7),
+            ("over TCP", tc, 0)):
+        st, h, n = cl.opendirx(b"pg")
+        made = pages(cl, h, count)
+        st, h, n = cl.opendirx(b"pg")
+        served = pages(cl, h, count)
+        t.check("pages %s: several" % what, len(made) > 2, True)
+        t.check("pages %s: all there" % what, sum(p[0] for p in made), PAGED)
+        t.check("pages %s: shared" % what, served, made)
+        t.check("pages %s: as encoded afresh" % what, searched(cl, b"pg", count), made)
+    st, h, n = c.opendirx(b"pg")
+    small = pages(c, h)
+    st, h, n = tc.opendirx(b"pg")
+    t.check("larger pages for larger messages", len(pages(tc, h)) < len(small), True)
@@ -0,0 +1,129 @@
+"""WATCH: held until the directory changes or the wait runs out, over
+UDP and TCP"""
+
+import os
+import threading
+import time
+
+import tnfs
+
+
+def setup(share):
+    os.mkdir(os.path.join(share, "wt"))
+
+
+def watched(c, path=b"wt"):
+    """A handle on path, read to the end so the listing is current"""
+    st, h, count = c.opendirx(path)
+    c.readdirx_all(h)
+    return h
+
+
+def check(t, c, how):
+    def touch(name):
+        with open(t.path("wt/" + name), "w") as f:
+            f.write("x")
+
+    h = watched(c)
+    c.s.settimeout(10)
+    start = time.time()
+    t.check(how + " times out", c.req(tnfs.WATCH, bytes([h, 2])), (0, b"\x00"))
+    t.check(how + " after the time asked for", 1.5 < time.time() - start < 3.5, True)
+
+    threading.Timer(0.5, touch, ("a",)).start()
+    start = time.time()
+    t.check(how + " change wakes it", c.req(tnfs.WATCH, bytes([h, 10])), (0, b"\x01"))
+    t.check(how + " promptly", 0.4 < time.time() - start < 1.5, True)
+
+    # the handle's listing is from before "a"
+    t.check(how + " stale listing answered at once", c.req(tnfs.WATCH, bytes([h, 10])), (0, b"\x01"))
+    c.closedir(h)
+
+    if not c.tcp:
+        # retransmits are absorbed, answered once, then from the last reply
+        h = watched(c)
+        seq = c.next_seq()
+        for i in range(3):
+            c.send(seq, tnfs.WATCH, bytes([h, 10]))
+            time.sleep(0.2)
+        t.check(how + " no early reply", c.recv(timeout=0.3), None)
+        touch("b")
+        r = c.recv(timeout=2)
+        t.check(how + " one reply", (r.seqno, r.cmd, r.status, r.data), (seq, tnfs.WATCH, 0, b"\x01"))
+        t.check(how + " only one", c.recv(timeout=0.3), None)
+        c.send(seq, tnfs.WATCH, bytes([h, 10]))
+        r = c.recv(timeout=2)
+        t.check(how + " retransmit after", (r.seqno, r.data), (seq, b"\x01"))
+        c.s.settimeout(3)
+        c.closedir(h)
+
+    # another request lets a held WATCH go without a reply
+    h = watched(c)
+    c.send(c.next_seq(), tnfs.WATCH, bytes([h, 10]))
+    time.sleep(0.1)
+    t.check(how + " STAT while held", c.stat(b"wt/a")[0], 0)
+    touch("c")
+    t.check(how + " dropped WATCH silent", c.recv(timeout=0.5), None)
+    c.s.settimeout(3)
+    c.closedir(h)
+
+    h = watched(c)
+    t.check(how + " bad handle", c.req(tnfs.WATCH, bytes([h + 1]))[0], tnfs.EBADF)
+    t.check(how + " not in COMPOUND", c.req(tnfs.COMPOUND, bytes([1, tnfs.WATCH, 0, 1, 0, h]))[0],
+        tnfs.EINVAL)
+    c.closedir(h)
+
+    # a plain OPENDIR handle, woken by the directory going
+    os.mkdir(t.path("wt/sub"))
+    st, d = c.req(tnfs.OPENDIR, b"wt/sub\0")
+    threading.Timer(0.3, os.rmdir, (t.path("wt/sub"),)).start()
+    c.s.settimeout(5)
+    t.check(how + " directory removed", c.req(tnfs.WATCH, bytes([d[0], 5])), (0, b"\x01"))
+    c.s.settimeout(3)
+    c.closedir(d[0])
+
+    # one change wakes every watcher
+    results = []
+
+    def watcher(w):
+        w.mount()
+        hh = watched(w)
+        w.s.settimeout(10)
+        results.append(w.req(tnfs.WATCH, bytes([hh, 8])))
+
+    clients = [tnfs.Client(t.port, tcp=c.tcp) for i in range(20)]
+    threads = [threading.Thread(target=watcher, args=(w,)) for w in clients]
+    for th in threads:
+        th.start()
+    time.sleep(1)
+    touch("d")
+    for th in threads:
+        th.join()
+    t.check(how + " all woken", results.count((0, b"\x01")), 20)
+    for w in clients:
+        w.close()
+
+    if c.tcp:
+        # a connection that goes away while its WATCH is held
+        w = tnfs.Client(t.port, tcp=True)
+        w.mount()
+        hh = watched(w)
+        w.send(w.next_seq(), tnfs.WATCH, bytes([hh, 5]))
+        time.sleep(0.1)
+        w.close()
+        time.sleep(0.1)
+        touch("e")
+        time.sleep(0.2)
+        t.check(how + " server still there", c.stat(b"wt/a")[0], 0)
+
+    for name in os.listdir(t.path("wt")):
+        os.unlink(t.path("wt/" + name))
+
+
+def run(t):
+    c = tnfs.Client(t.port)
+    c.mount()
+    check(t, c, "udp")
+    c = tnfs.Client(t.port, tcp=True)
+    c.mount()
+    check(t, c, "tcp")
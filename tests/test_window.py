@@ -0,0 +1,126 @@
+"""WINDOW: several requests in flight over UDP, run in seqno order
+whatever order they arrive in, with retransmits answered again and a
+client that loses its place resynchronized"""
+
+import os
+import random
+import struct
+import time
+
+import tnfs
+
+
+def readreq(fd, size=512):
+    return bytes([fd]) + struct.pack("<H", size)
+
+
+def run(t):
+    with open(t.path("big.bin"), "rb") as f:
+        big = f.read()
+    c = tnfs.Client(t.port)
+    c.mount()
+
+    for want, granted in ((16, 16), (5, 4), (100, 16), (0, 1), (8, 8)):
+        st, d = c.req(tnfs.WINDOW, bytes([want]))
+        t.check("window of %d" % want, (st, d[0]), (0, granted))
+    c.send(c.seq, tnfs.WINDOW, bytes([8]))
+    t.check("WINDOW retransmit", c.recv().data, bytes([8]))
+
+    st, fd = c.open(b"big.bin")
+    t.check("open", st, 0)
+
+    # a burst of reads, each answered
+    seqs = [c.next_seq() for i in range(8)]
+    for s in seqs:
+        c.send(s, tnfs.READ, readreq(fd))
+    got = {}
+    for s in seqs:
+        r = c.recv()
+        got[r.seqno] = r.data[2:]
+    t.check("burst", b"".join(got.get(s, b"") for s in seqs), big[:8 * 512])
+
+    # the first of four comes last: nothing runs until it's there
+    seqs = [c.next_seq() for i in range(4)]
+    for s in seqs[1:]:
+        c.send(s, tnfs.READ, readreq(fd))
+    t.check("held until the gap is filled", c.recv(timeout=0.3), None)
+    c.s.settimeout(3)
+    c.send(seqs[0], tnfs.READ, readreq(fd))
+    got = {}
+    for s in seqs:
+        r = c.recv()
+        got[r.seqno] = r
+    t.check("run in seqno order", b"".join(got[s].data[2:] for s in seqs),
+        big[8 * 512:12 * 512])
+    c.send(seqs[1], tnfs.READ, readreq(fd))
+    t.check("retransmit answered alike", c.recv().raw, got[seqs[1]].raw)
+
+    # the rest, with requests and replies lost along the way
+    rnd = random.Random(3)
+    c.lseek(fd, 0)
+    total = len(big) // 512
+    base = c.seq
+    out = {}
+    outstanding = {}
+    nxt = 0
+    c.s.settimeout(0.05)
+    while len(out) < total:
+        while nxt < total and nxt - min(list(outstanding) + [nxt]) < 8:
+            outstanding[nxt] = (base + 1 + nxt) & 0xFF
+            if rnd.random() >= 0.15:
+                c.send(outstanding[nxt], tnfs.READ, readreq(fd))
+            nxt += 1
+        r = c.recv()
+        if r is None:
+            for i, s in outstanding.items():
+                c.send(s, tnfs.READ, readreq(fd))
+            continue
+        if rnd.random() < 0.15:
+            continue
+        for i, s in list(outstanding.items()):
+            if s == r.seqno:
+                out[i] = r.data[2:]
+                del outstanding[i]
+    c.seq = (base + total) & 0xFF
+    while c.recv(timeout=0.1) is not None:
+        pass
+    t.check("lossy read", b"".join(out[i] for i in range(total)), big)
+    c.s.settimeout(3)
+
+    # a client that jumps well past the window starts again from there
+    c.seq = (c.seq + 100) & 0xFF
+    t.check("resync after a jump", c.stat(b"big.bin")[0], 0)
+    t.check("next after resync", c.stat(b"big.bin")[0], 0)
+
+    # a WATCH is held while later requests run
+    os.mkdir(t.path("wt"))
+    st, dh, count = c.opendirx(b"wt")
+    wseq = c.next_seq()
+    c.send(wseq, tnfs.WATCH, bytes([dh, 5]))
+    t.check("STAT while WATCH held", c.stat(b"big.bin")[0], 0)
+    c.send(wseq, tnfs.WATCH, bytes([dh, 5]))
+    time.sleep(0.1)
+    open(t.path("wt/x"), "w").close()
+    r = c.recv()
+    t.check("WATCH wakes", (r.seqno, r.status, r.data[:1]), (wseq, 0, b"\x01"))
+    t.check("WATCH retransmit absorbed", c.recv(timeout=0.3), None)
+    c.s.settimeout(3)
+
+    # back to one at a time
+    st, d = c.req(tnfs.WINDOW, bytes([1]))
+    t.check("window off", (st, d[0]), (0, 1))
+    c.send(c.seq, tnfs.WINDOW, bytes([1]))
+    t.check("retransmit once off", c.recv().data, bytes([1]))
+    t.check("stop and wait", c.stat(b"big.bin")[0], 0)
+
+    # UMOUNT with a request still waiting for an earlier one
+    c.req(tnfs.WINDOW, bytes([4]))
+    c.send((c.seq + 2) & 0xFF, tnfs.STAT, b"big.bin\0")
+    t.check("umount", c.umount(), 0)
+
+    # TCP keeps its own order and is only granted 1
+    c = tnfs.Client(t.port, tcp=True)
+    c.mount()
+    st, d = c.req(tnfs.WINDOW, bytes([8]))
+    t.check("TCP window", (st, d[0]), (0, 1))
+    t.check("TCP stat", c.stat(b"big.bin")[0], 0)
@@ -0,0 +1,207 @@
+"""ZIP archives as read-only directories: stored and deflated members
+read and seek as plain files, ZIP64 archives too, and damaged archives
+are refused without taking anything else with them"""
+
+import io
+import os
+import random
+import struct
+import zipfile
+import zlib
+
+import tnfs
+
+rnd = random.Random(38)
+STORED = bytes(rnd.randrange(256) for i in range(40000))
+# repetitive enough to deflate, varied enough that seeks land mid-block
+DEFLATED = b"".join(b"line %d of %d\n" % (i, rnd.randrange(1000))
+    for i in range(9000))
+
+
+def zip64(members):
+    """An archive with every size and offset in ZIP64 extra fields and a
+    ZIP64 end of central directory, as if it were too big for the rest"""
+    out = io.BytesIO()
+    central = b""
+    for name, data, method in members:
+        comp = data
+        if method == 8:
+            z = zlib.compressobj(9, zlib.DEFLATED, -15)
+            comp = z.compress(data) + z.flush()
+        crc = zlib.crc32(data)
+        offset = out.tell()
+        out.write(struct.pack("<IHHHHHIIIHH", 0x04034b50, 45, 0, method,
+            0, 0x21, crc, 0xffffffff, 0xffffffff, len(name), 20))
+        out.write(name + struct.pack("<HHQQ", 1, 16, len(data), len(comp)))
+        out.write(comp)
+        central += struct.pack("<IHHHHHHIIIHHHHHII", 0x02014b50, 45, 45, 0,
+            method, 0, 0x21, crc, 0xffffffff, 0xffffffff, len(name), 28,
+            0, 0, 0, 0, 0xffffffff)
+        central += name + struct.pack("<HHQQQ", 1, 24, len(data), len(comp), offset)
+    cdoffset = out.tell()
+    out.write(central)
+    eocd64 = out.tell()
+    out.write(struct.pack("<IQHHIIQQQQ", 0x06064b50, 44, 45, 45, 0, 0,
+        len(members), len(members), len(central), cdoffset))
+    out.write(struct.pack("<IIQI", 0x07064b50, 0, eocd64, 1))
+    out.write(struct.pack("<IHHHHIIH", 0x06054b50, 0, 0, 0xffff, 0xffff,
+        0xffffffff, 0xffffffff, 0))
+    return out.getvalue()
+
+
+def plain():
+    out = io.BytesIO()
+    with zipfile.ZipFile(out, "w") as z:
+        z.writestr(zipfile.ZipInfo("s.bin"), STORED, zipfile.ZIP_STORED)
+        z.writestr(zipfile.ZipInfo("d.txt"), DEFLATED, zipfile.ZIP_DEFLATED)
+        z.writestr(zipfile.ZipInfo("dir/"), b"")
+        z.writestr(zipfile.ZipInfo("dir/sub/x.txt"), b"x\n", zipfile.ZIP_DEFLATED)
+    return out.getvalue()
+
+
+def eocd(data):
+    return data.rindex(struct.pack("<I", 0x06054b50))
+
+
+def damaged():
+    """(name, archive, what it's wrong with)"""
+    good = plain()
+    end = eocd(good)
+    count, cdsize, cdoffset = struct.unpack("<HII", good[end + 10:end + 20])
+    out = []
+
+    out.append(("noend", good[:end + 10], "end record cut short"))
+    out.append(("text", b"not an archive\n" * 10, "no end record at all"))
+    out.append(("tiny", b"PK", "shorter than an end record"))
+    bad = bytearray(good)
+    struct.pack_into("<I", bad, end + 16, len(good))
+    out.append(("cdpast", bytes(bad), "central directory past the end"))
+    bad = bytearray(good)
+    struct.pack_into("<I", bad, end + 12, cdsize + 100)
+    out.append(("cdlong", bytes(bad), "central directory overruns the end record"))
+    bad = bytearray(good)
+    second = good.index(struct.pack("<I", 0x02014b50), cdoffset + 4)
+    bad[second:second + 4] = b"XXXX"
+    out.append(("badsig", bytes(bad), "a central entry without its signature"))
+    bad = bytearray(good)
+    struct.pack_into("<H", bad, end + 10, count + 1)
+    struct.pack_into("<H", bad, end + 8, count + 1)
+    out.append(("count", bytes(bad), "more entries counted than there are"))
+    bad = bytearray(good)
+    struct.pack_into("<H", bad, cdoffset + 28, 0xfff0)
+    out.append(("namelen", bytes(bad), "a name running off the central directory"))
+    z = bytearray(zip64([(b"a", b"a", 0)]))
+    loc = z.rindex(struct.pack("<I", 0x07064b50))
+    struct.pack_into("<Q", z, loc + 8, len(z) + 1000)
+    out.append(("z64loc", bytes(z), "ZIP64 locator past the end"))
+    z = bytearray(zip64([(b"a", b"a", 0)]))
+    z64 = z.rindex(struct.pack("<I", 0x06064b50))
+    z[z64:z64 + 4] = b"XXXX"
+    out.append(("z64sig", bytes(z), "ZIP64 end record without its signature"))
+    return out
+
+
+def setup(share):
+    os.makedirs(os.path.join(share, "zz", "bad"))
+    with open(os.path.join(share, "zz", "plain.zip"), "wb") as f:
+        f.write(plain())
+    with open(os.path.join(share, "zz", "big64.zip"), "wb") as f:
+        f.write(zip64([(b"s.bin", STORED, 0), (b"d.txt", DEFLATED, 8),
+            (b"in/deep.bin", STORED[:100], 8)]))
+    for name, data, what in damaged():
+        with open(os.path.join(share, "zz", "bad", name + ".zip"), "wb") as f:
+            f.write(data)
+
+    # members whose data isn't where the archive says
+    good = plain()
+    cdoffset = struct.unpack("<I", good[eocd(good) + 16:eocd(good) + 20])[0]
+    bad = bytearray(good)
+    struct.pack_into("<I", bad, cdoffset + 42, len(good) - 10)
+    with open(os.path.join(share, "zz", "bad", "local.zip"), "wb") as f:
+        f.write(bytes(bad))
+    bad = bytearray(good)
+    struct.pack_into("<II", bad, cdoffset + 20, len(good), len(good))
+    with open(os.path.join(share, "zz", "bad", "short.zip"), "wb") as f:
+        f.write(bytes(bad))
+
+
+def whole(c, path):
+    st, fd = c.open(path)
+    if st != 0:
+        return st
+    data = c.readall(fd)
+    c.close_file(fd)
+    return data
+
+
+def seeks(t, c, path, data, what):
+    st, fd = c.open(path)
+    if st != 0:
+        t.check("open " + what, st, 0)
+        return
+    rnd = random.Random(path)
+    offsets = [len(data) - 100, 5, len(data) // 2, 0, len(data) - 1]
+    offsets += [rnd.randrange(len(data)) for i in range(20)]
+    got = []
+    for o in offsets:
+        c.lseek(fd, o)
+        got.append(c.read(fd, 300))
+    t.check("seeks in " + what, got, [data[o:o + 300] for o in offsets])
+    t.check("end of " + what, c.lseek(fd, 0, 2), len(data))
+    t.check("read at the end of " + what, c.read(fd), tnfs.EOF)
+    c.lseek(fd, len(data) + 1000)
+    t.check("read past the end of " + what, c.read(fd), tnfs.EOF)
+    c.close_file(fd)
+
+
+def run(t):
+    c = tnfs.Client(t.port)
+    c.mount()
+
+    if c.stat(b"zz/plain.zip/s.bin")[0] in (tnfs.ENOENT, tnfs.ENOTDIR):
+        t.skip("ZIP archives", "not built with ZIP=yes")
+        return
+
+    for arc in (b"zz/plain.zip", b"zz/big64.zip"):
+        what = arc.decode()
+        t.check("stat stored in " + what, c.stat(arc + b"/s.bin"), (0, len(STORED)))
+        t.check("stat deflated in " + what, c.stat(arc + b"/d.txt"), (0, len(DEFLATED)))
+        t.check("read stored in " + what, whole(c, arc + b"/s.bin"), STORED)
+        t.check("read deflated in " + what, whole(c, arc + b"/d.txt"), DEFLATED)
+        seeks(t, c, arc + b"/s.bin", STORED, "stored in " + what)
+        seeks(t, c, arc + b"/d.txt", DEFLATED, "deflated in " + what)
+
+    t.check("list", sorted(c.listdir(b"zz/plain.zip")), ["d.txt", "dir", "s.bin"])
+    t.check("list a directory entry", c.listdir(b"zz/plain.zip/dir"), ["sub"])
+    t.check("list an implied directory", c.listdir(b"zz/plain.zip/dir/sub"), ["x.txt"])
+    t.check("list ZIP64", sorted(c.listdir(b"zz/big64.zip")), ["d.txt", "in", "s.bin"])
+    t.check("read below ZIP64", whole(c, b"zz/big64.zip/in/deep.bin"), STORED[:100])
+    st, h, n = c.opendirx(b"zz/plain.zip")
+    t.check("sizes listed", sorted((e[3], e[1]) for e in c.readdirx_all(h)),
+        [("d.txt", len(DEFLATED)), ("dir", 0), ("s.bin", len(STORED))])
+    c.closedir(h)
+    t.check("open a directory", c.open(b"zz/plain.zip/dir")[0], tnfs.EISDIR)
+    t.check("open what isn't there", c.open(b"zz/plain.zip/nope")[0], tnfs.ENOENT)
+
+    # read-only, however it's asked
+    for flags in (tnfs.O_WRONLY, tnfs.O_RDWR, tnfs.O_RDONLY | tnfs.O_TRUNC,
+            tnfs.O_WRONLY | tnfs.O_APPEND):
+        t.check("open a member with flags %#x" % flags,
+            c.open(b"zz/plain.zip/s.bin", flags)[0], tnfs.EROFS)
+    t.check("create a member",
+        c.open(b"zz/plain.zip/new.bin", tnfs.O_WRONLY | tnfs.O_CREAT)[0], tnfs.EROFS)
+    t.check("create in a directory in it",
+        c.open(b"zz/plain.zip/dir/new.bin", tnfs.O_WRONLY | tnfs.O_CREAT)[0], tnfs.EROFS)
+    t.check("archive untouched", open(t.path("zz/plain.zip"), "rb").read(), plain())
+
+    # damaged ones are refused, whichever way they're come at
+    for name, data, what in damaged():
+        arc = b"zz/bad/" + name.encode() + b".zip"
+        t.check("list: " + what, c.listdir(arc), tnfs.EIO)
+        t.check("stat: " + what, c.stat(arc + b"/s.bin")[0], tnfs.EIO)
+        t.check("open: " + what, c.open(arc + b"/s.bin")[0], tnfs.EIO)
+        t.check("still a file: " + what, c.stat(arc), (0, len(data)))
+    t.check("local header not found", c.open(b"zz/bad/local.zip/s.bin")[0], tnfs.EIO)
+    t.check("data past the end", c.open(b"zz/bad/short.zip/s.bin")[0], tnfs.EIO)
+    t.check("the rest of it", whole(c, b"zz/bad/short.zip/d.txt"), DEFLATED)
+    t.check("still serving", whole(c, b"zz/plain.zip/s.bin"), STORED)
@@ -0,0 +1,203 @@
+"""A small TNFS client for the tests, over UDP or TCP.
+
+Requests go out as they are given; nothing is retried, so a test can
+drop, repeat or reorder them on purpose with send() and recv()."""
+
+import socket
+import struct
+import time
+
+UMOUNT = 0x01
+COMPOUND = 0x02
+WINDOW = 0x03
+OPENDIR = 0x10
+CLOSEDIR = 0x12
+OPENDIRX = 0x17
+READDIRX = 0x18
+SEARCH = 0x19
+RMTREE = 0x1A
+COPYTREE = 0x1B
+WATCH = 0x1C
+READ = 0x21
+WRITE = 0x22
+CLOSE = 0x23
+STAT = 0x24
+LSEEK = 0x25
+OPEN = 0x29
+HASH = 0x2A
+COPYFILE = 0x2B
+JOBSTATUS = 0x2C
+SIZE = 0x30
+FREE = 0x31
+
+O_RDONLY = 0x01
+O_WRONLY = 0x02
+O_RDWR = 0x03
+O_APPEND = 0x08
+O_CREAT = 0x100
+O_TRUNC = 0x200
+O_EXCL = 0x400
+
+ENOENT = 0x02
+EIO = 0x03
+EBADF = 0x06
+EACCES = 0x09
+EAGAIN = 0x07
+EEXIST = 0x0B
+ENOTDIR = 0x0C
+EISDIR = 0x0D
+EINVAL = 0x0E
+EROFS = 0x14
+ENOSYS = 0x16
+EOF = 0x21
+
+
+class Reply:
+    def __init__(self, raw):
+        self.raw = raw
+        self.sid, self.seqno, self.cmd, self.status = struct.unpack("<HBBB", raw[:5])
+        self.data = raw[5:]
+
+
+class Client:
+    def __init__(self, port, tcp=False, src=None, timeout=3):
+        self.tcp = tcp
+        if tcp:
+            self.s = socket.create_connection(("127.0.0.1", port),
+                source_address=(src, 0) if src else None)
+        else:
+            self.s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+            if src:
+                self.s.bind((src, 0))
+            self.s.connect(("127.0.0.1", port))
+        self.s.settimeout(timeout)
+        self.sid = 0
+        self.seq = 0
+
+    def close(self):
+        self.s.close()
+
+    def next_seq(self):
+        self.seq = (self.seq + 1) & 0xFF
+        return self.seq
+
+    def packet(self, seq, cmd, data=b""):
+        return struct.pack("<HBB", self.sid, seq, cmd) + data
+
+    def send(self, seq, cmd, data=b""):
+        self.s.sendall(self.packet(seq, cmd, data))
+
+    def recv(self, timeout=None):
+        """The next reply, or None if none comes in time. Over TCP one
+        recv() is taken as one reply, as the server sends them whole"""
+        if timeout is not None:
+            self.s.settimeout(timeout)
+        try:
+            return Reply(self.s.recv(70000))
+        except socket.timeout:
+            return None
+
+    def req(self, cmd, data=b"", seq=None):
+        """Send a request and wait for its reply: (status, data)"""
+        if seq is None:
+            seq = self.next_seq()
+        self.send(seq, cmd, data)
+        r = Reply(self.s.recv(70000))
+        return r.status, r.data
+
+    def mount(self, root=b"", msgsz=None):
+        data = b"\x02\x01" + root + b"\x00\x00\x00"
+        if msgsz is not None:
+            data += struct.pack("<H", msgsz)
+        self.s.sendall(struct.pack("<HBB", 0, 0, 0) + data)
+        r = Reply(self.s.recv(70000))
+        if r.status == 0:
+            self.sid = r.sid
+        return r.status, r.data
+
+    def umount(self):
+        return self.req(UMOUNT)[0]
+
+    def stat(self, path):
+        """(status, size)"""
+        st, d = self.req(STAT, path + b"\0")
+        return st, (struct.unpack("<I", d[6:10])[0] if st == 0 else None)
+
+    def open(self, path, flags=O_RDONLY, mode=0o644):
+        """(status, handle)"""
+        st, d = self.req(OPEN, struct.pack("<HH", flags, mode) + path + b"\0")
+        return st, (d[0] if st == 0 else None)
+
+    def read(self, fd, size=512):
+        """The bytes read, or the status if it failed"""
+        st, d = self.req(READ, bytes([fd]) + struct.pack("<H", size))
+        return d[2:] if st == 0 else st
+
+    def readall(self, fd, size=512):
+        out = b""
+        while True:
+            d = self.read(fd, size)
+            if isinstance(d, int):
+                return out
+            out += d
+
+    def write(self, fd, data):
+        return self.req(WRITE, bytes([fd]) + struct.pack("<H", len(data)) + data)[0]
+
+    def lseek(self, fd, offset, whence=0):
+        """The new position, or the status if it failed"""
+        st, d = self.req(LSEEK, bytes([fd, whence]) + struct.pack("<i", offset))
+        return struct.unpack("<I", d[:4])[0] if st == 0 else st
+
+    def close_file(self, fd):
+        return self.req(CLOSE, bytes([fd]))[0]
+
+    def opendirx(self, path, pattern=b"", diropt=0, sortopt=0, maxresults=0):
+        """(status, handle, count)"""
+        st, d = self.req(OPENDIRX, bytes([diropt, sortopt]) +
+            struct.pack("<H", maxresults) + pattern + b"\0" + path + b"\0")
+        if st != 0:
+            return st, None, None
+        return st, d[0], struct.unpack("<H", d[1:3])[0]
+
+    def readdirx_all(self, handle):
+        """Every entry left, as (flags, size, mtime, name)"""
+        out = []
+        while True:
+            st, d = self.req(READDIRX, bytes([handle, 0]))
+            if st != 0:
+                return out
+            count, dirstatus = d[0], d[1]
+            p = 4
+            for i in range(count):
+                flags, size, mtime, ctime = struct.unpack("<BIII", d[p:p + 13])
+                p += 13
+                end = d.index(b"\0", p)
+                out.append((flags, size, mtime, d[p:end].decode()))
+                p = end + 1
+            if dirstatus & 1:
+                return out
+
+    def closedir(self, handle):
+        return self.req(CLOSEDIR, bytes([handle]))[0]
+
+    def listdir(self, path, **kw):
+        st, h, count = self.opendirx(path, **kw)
+        if st != 0:
+            return st
+        names = [e[3] for e in self.readdirx_all(h)]
+        self.closedir(h)
+        return names
+
+    def jobwait(self, handle):
+        """Poll JOBSTATUS until the job is done: (status, result, done,
+        total, what the job found)"""
+        while True:
+            st, d = self.req(JOBSTATUS, bytes([handle]))
+            if st != 0:
+                return st, None, None, None, None
+            state, result = d[0], d[1]
+            done, total = struct.unpack("<II", d[2:10])
+            if state == 1:
+                return st, result, done, total, d[10:]
+            time.sleep(0.01)